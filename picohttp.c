@@ -20,14 +20,29 @@
 */
 
 #include "picohttp.h"
-#include "picohttp_debug.h"
+#include "picohttp_trace.h"
+#include "picohttp_probes.h"
+#include "picohttp_stackmeter.h"
 
 #include <alloca.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#if defined(PICOHTTP_CONFIG_USE_SNPRINTF)
+#include <stdio.h>
+#endif
+#if !PICOHTTP_NO_BODYTOFD
+#include <errno.h>
+#include <unistd.h>
+#endif
 
 #include "picohttp_base64.h"
+#if !PICOHTTP_NO_DIGEST_AUTH
+#include "picohttp_digest.h"
+#endif
+#if !PICOHTTP_NO_AUTHCACHE
+#include "picohttp_authcache.h"
+#endif
 
 static char const PICOHTTP_STR_CRLF[] = "\r\n";
 static char const PICOHTTP_STR_CLSP[] = ": ";
@@ -60,6 +75,9 @@ static char const PICOHTTP_STR_CLOSE[] = "close";
 
 static char const PICOHTTP_STR_DATE[] = "Date";
 static char const PICOHTTP_STR_EXPECT[] = "Expect";
+static char const PICOHTTP_STR_100_CONTINUE[] = "100-continue";
+static char const PICOHTTP_STR_HTTP_1_1_100_CONTINUE[] =
+	"HTTP/1.1 100 Continue\r\n\r\n";
 
 static char const PICOHTTP_STR_BOUNDARY[] = " boundary=";
 static char const PICOHTTP_STR_NAME__[] = " name=\"";
@@ -74,12 +92,52 @@ static char const PICOHTTP_STR_REALM__[] = "realm=\"";
 static char const PICOHTTP_STR_USERNAME__[] = "username=\"";
 static char const PICOHTTP_STR_QOP_[] = "qop=";
 static char const PICOHTTP_STR_NC_[] = "nc=";
+#if !PICOHTTP_NO_DIGEST_AUTH
+static char const PICOHTTP_STR_NONCE_[] = "nonce=";
+static char const PICOHTTP_STR_CNONCE_[] = "cnonce=";
+static char const PICOHTTP_STR_URI_[] = "uri=";
+static char const PICOHTTP_STR_RESPONSE_[] = "response=";
+static char const PICOHTTP_STR_ALGORITHM_[] = "algorithm=";
+static char const PICOHTTP_STR_USERHASH_[] = "userhash=";
+static char const PICOHTTP_STR_AUTH[] = "auth";
+static char const PICOHTTP_STR_MD5[] = "MD5";
+static char const PICOHTTP_STR_SHA_256[] = "SHA-256";
+static char const PICOHTTP_STR__SESS[] = "-sess";
+static char const PICOHTTP_STR_TRUE[] = "true";
+static char const PICOHTTP_STR_DIGEST_CHALLENGE_QOP[] =
+	"\", qop=\"auth\", algorithm=";
+static char const PICOHTTP_STR_DIGEST_CHALLENGE_NONCE[] = ", nonce=\"";
+static char const PICOHTTP_STR_DIGEST_CHALLENGE_STALE[] = ", stale=true";
+#endif
+
+static char const PICOHTTP_STR_RANGE[] = "Range";
+static char const PICOHTTP_STR_IF_RANGE[] = "If-Range";
+static char const PICOHTTP_STR__RANGE[] = "-Range";
+static char const PICOHTTP_STR__RANGES[] = "-Ranges";
+static char const PICOHTTP_STR_BYTES[] = "bytes";
+static char const PICOHTTP_STR_ETAG[] = "ETag";
+
+#define PICOHTTP_BYTERANGES_BOUNDARY "picoweb-byteranges-6c697468"
+static char const PICOHTTP_STR_BYTERANGES_BOUNDARY[] =
+	PICOHTTP_BYTERANGES_BOUNDARY;
+static char const PICOHTTP_STR_MULTIPART_BYTERANGES[] =
+	"multipart/byteranges; boundary=" PICOHTTP_BYTERANGES_BOUNDARY;
+
+/* "bytes " first '-' last '/' length */
+#define PICOHTTP_CONTENTRANGE_MAX_LEN (6 + 3*20 + 2)
+
+/* Whether the value of a header is wanted by the header callback;
+ * those of other headers are skipped without being copied */
+typedef bool (*picohttpHeaderWantedCallback)(
+	void * const data,
+	char const *headername );
 
 /* compilation unit local function forward declarations */
 static int picohttpProcessHeaders (
 	struct picohttpRequest * const req,
 	size_t const hvbuflen,
 	char * const headervalue,
+	picohttpHeaderWantedCallback headerwantedcallback,
 	picohttpHeaderFieldCallback headerfieldcallback,
 	void * const data,
 	int ch );
@@ -128,6 +186,8 @@ static char const *picohttpStatusString(int code)
 	switch(code) {
 	case 200:
 		return "OK";
+	case 206:
+		return "Partial Content";
 	case 400:
 		return "Bad Request";
 	case 401:
@@ -136,14 +196,26 @@ static char const *picohttpStatusString(int code)
 		return "Forbidden";
 	case 404:
 		return "Not Found";
+	case 408:
+		return "Request Timeout";
+	case 413:
+		return "Payload Too Large";
 	case 414:
 		return "Request URI Too Long";
+	case 415:
+		return "Unsupported Media Type";
+	case 416:
+		return "Range Not Satisfiable";
+	case 417:
+		return "Expectation Failed";
 	case 422:
 		return "Unprocessable Entity";
 	case 500:
 		return "Internal Server Error";
 	case 501:
 		return "Not Implemented";
+	case 503:
+		return "Service Unavailable";
 	case 505:
 		return "HTTP Version Not Supported";
 	}
@@ -158,12 +230,81 @@ void picohttpStatusResponse(
 	picohttpResponseWrite(req, strlen(c), c);
 }
 
+#define picohttpAPPEND_STATIC_STR(c,x) \
+	(memcpy(c, x, sizeof(x)-1), c += sizeof(x)-1)
+
+#if !PICOHTTP_NO_DIGEST_AUTH
+/* Digest challenges, one line per algorithm; the SHA-256 one first as
+ * clients are to use the first challenge they support (RFC-7616 3.7) */
+static size_t picohttpDigestChallenges(
+	char *c,
+	char const * const realm,
+	char const * const nonce,
+	bool stale )
+{
+	char * const start = c;
+	for(int i = 0; i < 2; i++) {
+		if( i ) {
+			*c++ = '\n';
+		}
+		picohttpAPPEND_STATIC_STR(c, PICOHTTP_STR_DIGEST_);
+		picohttpAPPEND_STATIC_STR(c, PICOHTTP_STR_REALM__);
+		size_t const realm_len = strlen(realm);
+		memcpy(c, realm, realm_len);
+		c += realm_len;
+		picohttpAPPEND_STATIC_STR(c, PICOHTTP_STR_DIGEST_CHALLENGE_QOP);
+		if( !i ) {
+			picohttpAPPEND_STATIC_STR(c, PICOHTTP_STR_SHA_256);
+		} else {
+			picohttpAPPEND_STATIC_STR(c, PICOHTTP_STR_MD5);
+		}
+		picohttpAPPEND_STATIC_STR(c, PICOHTTP_STR_DIGEST_CHALLENGE_NONCE);
+		memcpy(c, nonce, PICOHTTP_DIGEST_NONCE_LEN);
+		c += PICOHTTP_DIGEST_NONCE_LEN;
+		*c++ = '"';
+		if( stale ) {
+			picohttpAPPEND_STATIC_STR(c, PICOHTTP_STR_DIGEST_CHALLENGE_STALE);
+		}
+	}
+	*c = 0;
+	return c - start;
+}
+#endif
+
 void picohttpAuthRequired(
 	struct picohttpRequest *req,
 	char const * const realm )
 {
-	/* FIXME: Fits only for Basic Auth!
-	 *        Adjust this for Digest Auth header */
+#if !PICOHTTP_NO_DIGEST_AUTH
+	if( req->query.auth && req->query.auth->nonces ) {
+		char nonce[PICOHTTP_DIGEST_NONCE_LEN+1];
+		picohttpDigestNonceIssue(req->query.auth->nonces, nonce);
+
+		size_t const www_authenticate_maxlen = 2 * (1 + /* '\n' */
+			sizeof(PICOHTTP_STR_DIGEST_)-1 +
+			sizeof(PICOHTTP_STR_REALM__)-1 +
+			strlen(realm) +
+			sizeof(PICOHTTP_STR_DIGEST_CHALLENGE_QOP)-1 +
+			sizeof(PICOHTTP_STR_SHA_256)-1 +
+			sizeof(PICOHTTP_STR_DIGEST_CHALLENGE_NONCE)-1 +
+			PICOHTTP_DIGEST_NONCE_LEN +
+			1 + /* closing '"' */
+			sizeof(PICOHTTP_STR_DIGEST_CHALLENGE_STALE)-1 );
+#ifdef PICOWEB_CONFIG_USE_C99VARARRAY
+		char www_authenticate[www_authenticate_maxlen+1];
+#else
+		char *www_authenticate = alloca(www_authenticate_maxlen+1);
+#endif
+		picohttpDigestChallenges(www_authenticate,
+			realm, nonce, req->query.auth->stale);
+
+		req->response.www_authenticate = www_authenticate;
+
+		picohttpStatusResponse(req, PICOHTTP_STATUS_401_UNAUTHORIZED);
+		return;
+	}
+#endif
+
 	size_t const www_authenticate_maxlen = 1 + /* terminating 0 */
 		sizeof(PICOHTTP_STR_BASIC_)-1 +
 		sizeof(PICOHTTP_STR_REALM__)-1 +
@@ -177,10 +318,8 @@ void picohttpAuthRequired(
 	memset(www_authenticate, 0, www_authenticate_maxlen);
 
 	char *c = www_authenticate;
-	memcpy(c, PICOHTTP_STR_BASIC_, sizeof(PICOHTTP_STR_BASIC_)-1);
-	c += sizeof(PICOHTTP_STR_BASIC_)-1;
-	memcpy(c, PICOHTTP_STR_REALM__, sizeof(PICOHTTP_STR_REALM__)-1);
-	c += sizeof(PICOHTTP_STR_REALM__)-1;
+	picohttpAPPEND_STATIC_STR(c, PICOHTTP_STR_BASIC_);
+	picohttpAPPEND_STATIC_STR(c, PICOHTTP_STR_REALM__);
 	for(size_t i=0; realm[i]; i++) {
 		*c++ = realm[i];
 	}
@@ -268,203 +407,328 @@ static int picohttpIoB10ToU8 (
 	return ch;
 }
 
-static int picohttpIoB10ToU64 (
-	uint64_t *i,
-	struct picohttpIoOps const * const ioops,
-	int ch )
+/* Value of a hex digit, negative if ch is none */
+static int picohttpHexDigit(int ch)
 {
-	if( 0 > ch )
-		ch = picohttpIoGetch(ioops);
-
-	while( '0' <= ch && '9' >= ch ) {
-		*i *= 10;
-		*i += (ch & 0x0f);
-		ch = picohttpIoGetch(ioops);
-	}
-
-	return ch;
+	if( '0' <= ch && '9' >= ch )
+		return ch & 0x0f;
+	ch |= 0x20;
+	if( 'a' <= ch && 'f' >= ch )
+		return (ch & 0x0f) + 9;
+	return -1;
 }
 
+/* Decodes the two hex digits following a '%'; an I/O error is passed
+ * on, malformed escapes give -PICOHTTP_STATUS_400_BAD_REQUEST. */
 static int picohttpIoGetPercentCh(
 	struct picohttpIoOps const * const ioops )
 {
-	char ch=0;
+	int hi, lo;
 	int chr;
 	if( 0 > (chr = picohttpIoGetch(ioops)))
 		return chr;
-
-	chr |= 0x20;
-	if( '0' <= chr && '9' >= chr ) {
-		ch = ((chr)&0x0f)<<4;
-	} else
-	if( 'a' <= chr && 'f' >= chr ) {
-		ch = (((chr)&0x0f) + 9)<<4;
-	}
+	if( 0 > (hi = picohttpHexDigit(chr)) )
+		return -PICOHTTP_STATUS_400_BAD_REQUEST;
 
 	if( 0 > (chr = picohttpIoGetch(ioops)))
 		return chr;
+	if( 0 > (lo = picohttpHexDigit(chr)) )
+		return -PICOHTTP_STATUS_400_BAD_REQUEST;
 
-	chr |= 0x20;
-	if( '0' <= chr && '9' >= chr ) {
-		ch |= ((chr)&0x0f);
-	} else
-	if( 'a' <= chr && 'f' >= chr ) {
-		ch |= (((chr)&0x0f) + 9);
-	}
-
-	return ch;
+	return (hi << 4) | lo;
 }
 
-int picohttpGetch(struct picohttpRequest * const req)
+/* Reads the size line of the next chunk of a chunked transfer coded
+ * body. The last, zero sized, chunk is followed by the trailer, which
+ * the header processing code deals with just fine; once it has been
+ * read the body is treated like one of known length, so that all
+ * further reads report its end.
+ *
+ * A chunk that takes the body past the max_body of the route is
+ * refused with the same 413 picohttpHeadStatus gives a Content-Length
+ * over it, unless the handler has started its response already; the
+ * body is not read any further then.
+ *
+ * Returns the chunk size, 0 at the end of the body, or a negative
+ * value on error. */
+static int64_t picohttpChunkBegin(struct picohttpRequest * const req)
 {
 	int ch;
-	/* skipping over Chunked Transfer Boundaries
-	 * if Chunked Transfer Encoding is used */
-	if(req->query.transferencoding == PICOHTTP_CODING_CHUNKED ) {
-		if( !req->query.chunklength ) {
-			/* this is a new chunk;
-			 * read the length and skip to after <CR><LF> */
-			if( 0 > (ch = picohttpIoGetch(req->ioops)) ) {
-				return -1;
-			}
-			uint64_t len;
-			if( 0 > (ch = picohttpIoB10ToU64(
-					&len,
-					req->ioops,
-					ch))
-			) {
-				return ch;
-			}
-			if( 0 > (ch = picohttpIoSkipOverCRLF(req->ioops, ch)) ) {
-				return ch;
-			}
-			req->query.chunklength = len;
-			return ch;
+	uint64_t len = 0;
+	unsigned digits = 0;
+	for(;; digits++) {
+		if( 0 > (ch = picohttpIoGetch(req->ioops)) ) {
+			return -1;
+		}
+		int const c = ch | 0x20;
+		uint8_t d;
+		if( '0' <= c && '9' >= c ) {
+			d = c & 0x0f;
+		} else
+		if( 'a' <= c && 'f' >= c ) {
+			d = (c & 0x0f) + 9;
+		} else {
+			break;
+		}
+		if( len >> 59 ) {
+			return -1;
+		}
+		len = (len << 4) | d;
+	}
+	if( !digits ) {
+		return -1;
+	}
+	/* chunk extensions are ignored */
+	while( '\n' != ch ) {
+		if( 0 > (ch = picohttpIoGetch(req->ioops)) ) {
+			return -1;
 		}
+	}
 
-		if( req->query.chunklength <= req->received_octets ) {
-			/* If this happens the data is corrupted, or
-			 * the client is nonconforming, or an attack is
-			 * underway, or something entierely different,
-			 * or all of that.
-			 * Abort processing the query!
-			 */
+	if( req->route && req->route->max_body
+	 && req->received_octets + len > req->route->max_body ) {
+		if( !req->sent.header ) {
+			char const * const c = picohttpStatusString(
+				PICOHTTP_STATUS_413_PAYLOAD_TOO_LARGE);
+			/* whatever the handler writes after it is cut off */
+			req->response.contentlength = strlen(c);
+			picohttpStatusResponse(req,
+				PICOHTTP_STATUS_413_PAYLOAD_TOO_LARGE);
+		}
+		req->query.transferencoding = PICOHTTP_CODING_IDENTITY;
+		req->query.lengthknown = 0;
+		return -1;
+	}
+
+	if( !len ) {
+		char trailer[2] = {0,};
+		if( 0 > (ch = picohttpIoGetch(req->ioops)) ) {
+			return -1;
+		}
+		if( 0 > (ch = picohttpProcessHeaders(
+				req,
+				sizeof(trailer), trailer,
+				NULL, NULL, NULL,
+				ch))
+		) {
+			return -1;
+		}
+		if( '\r' == ch ) {
+			ch = picohttpIoGetch(req->ioops);
+		}
+		if( '\n' != ch ) {
 			return -1;
 		}
+		req->query.transferencoding = PICOHTTP_CODING_IDENTITY;
+		req->query.contentlength = req->received_octets;
+		req->query.lengthknown = 1;
 	}
+	req->query.chunklength = len;
+	return len;
+}
 
-	if( 0 <= (ch = picohttpIoGetch(req->ioops)) ) {
-		req->received_octets++;
-	} else {
-		return ch;
+/* skips over the <CR><LF> trailing the data of a chunk */
+static int picohttpChunkEnd(struct picohttpRequest * const req)
+{
+	int ch = picohttpIoGetch(req->ioops);
+	if( '\r' == ch ) {
+		ch = picohttpIoGetch(req->ioops);
 	}
+	return ('\n' == ch) ? 0 : -1;
+}
 
-	if(req->query.transferencoding == PICOHTTP_CODING_CHUNKED ) {
-		if( !req->query.chunklength <= req->received_octets ) {
-			/* end of chunk;
-			 * skip over <CR><LF>, make sure the trailing '0' is
-			 * there and read the headers, err, I mean footers
-			 * (whatever, the header processing code will do for 
-			 * chunk footers just fine).
-			 */
-			if( '0' != (ch = picohttpIoGetch(req->ioops)) ) {
-				return -1;
-			}
-			if( 0 > (ch = picohttpIoGetch(req->ioops)) ) {
-				return -1;
-			}
-			if( 0 > (ch = picohttpProcessHeaders(
-					req,
-					0, NULL,
-					NULL, NULL,
-					ch))
-			) {
-				return ch;
-			}
-			
-			req->received_octets =
-			req->query.chunklength = 0;
+/* The handler wants the body: a client waiting for the go ahead gets
+ * it now, unless it has been answered already; then it doesn't send the
+ * body, or it is not of interest anymore. */
+static void picohttpBodyContinue(struct picohttpRequest * const req)
+{
+	req->query.expect = 0;
+	if( !req->sent.header ) {
+		picohttpIoWrite(req->ioops,
+			sizeof(PICOHTTP_STR_HTTP_1_1_100_CONTINUE)-1,
+			PICOHTTP_STR_HTTP_1_1_100_CONTINUE);
+		picohttpIoFlush(req->ioops);
+	}
+}
+
+int picohttpIsInterimResponse(
+	size_t count,
+	void const *buf )
+{
+	char const * const c = buf;
+	/* "HTTP/1.1 1xx ...\r\n\r\n" */
+	return 16 <= count
+		&& !memcmp(c, PICOHTTP_STR_HTTP_, sizeof(PICOHTTP_STR_HTTP_)-1)
+		&& '1' == c[9]
+		&& !memcmp(c + count - 4, "\r\n\r\n", 4);
+}
+
+/* Octets of the body that may be read next; 0 at its end, negative on
+ * error. A request with neither a Content-Length nor chunked transfer
+ * coding has no body (RFC 7230, 3.3.3); whatever follows its head is
+ * the next request. */
+static int64_t picohttpBodyAvail(struct picohttpRequest * const req)
+{
+	if( req->query.expect ) {
+		picohttpBodyContinue(req);
+	}
+	if( PICOHTTP_CODING_CHUNKED == req->query.transferencoding ) {
+		return req->query.chunklength ?
+			(int64_t)req->query.chunklength : picohttpChunkBegin(req);
+	}
+	if( !req->query.lengthknown ) {
+		return 0;
+	}
+	return req->query.contentlength - req->received_octets;
+}
+
+static int picohttpBodyConsumed(
+	struct picohttpRequest * const req,
+	size_t len )
+{
+	req->received_octets += len;
+	if( PICOHTTP_CODING_CHUNKED == req->query.transferencoding ) {
+		req->query.chunklength -= len;
+		if( !req->query.chunklength ) {
+			return picohttpChunkEnd(req);
 		}
 	}
+	return 0;
+}
 
+int picohttpGetch(struct picohttpRequest * const req)
+{
+	int ch;
+	int64_t const avail = picohttpBodyAvail(req);
+	if( 0 >= avail ) {
+		return -1;
+	}
+	if( 0 > (ch = picohttpIoGetch(req->ioops)) ) {
+		return ch;
+	}
+	if( 0 > picohttpBodyConsumed(req, 1) ) {
+		return -1;
+	}
 	return ch;
 }
 
 int picohttpRead(struct picohttpRequest * const req, size_t len, char * const buf)
 {
-	/* skipping over Chunked Transfer Boundaries
-	 * if Chunked Transfer Encoding is used */
-	if(req->query.transferencoding == PICOHTTP_CODING_CHUNKED ) {
-		if( !req->query.chunklength ) {
-			int ch;
-			/* this is a new chunk;
-			 * read the length and skip to after <CR><LF> */
-			if( 0 > (ch = picohttpIoGetch(req->ioops)) ) {
-				return -1;
-			}
-			uint64_t len;
-			if( 0 > (ch = picohttpIoB10ToU64(
-					&len,
-					req->ioops,
-					ch))
-			) {
-				return ch;
-			}
-			if( 0 > (ch = picohttpIoSkipOverCRLF(req->ioops, ch)) ) {
-				return ch;
-			}
-			req->query.chunklength = len;
-			return ch;
+	int64_t const avail = picohttpBodyAvail(req);
+	if( 0 > avail ) {
+		return -1;
+	}
+	if( !avail ) {
+		return 0;
+	}
+	if( (uint64_t)avail < len ) {
+		len = avail;
+	}
+
+	int r = picohttpIoRead(req->ioops, len, buf);
+	if( 0 < r && 0 > picohttpBodyConsumed(req, r) ) {
+		return -1;
+	}
+	return r;
+}
+
+/* Reads off what the handler left of the body, in bulk, if the client
+ * is sending it and not too much of it remains */
+static void picohttpBodyDrain(struct picohttpRequest * const req)
+{
+	if( 1 == req->query.expect ) {
+		/* never told to go ahead */
+		return;
+	}
+	if( PICOHTTP_CODING_CHUNKED != req->query.transferencoding ) {
+		if( req->query.contentlength - req->received_octets
+		    > PICOHTTP_DRAIN_MAX ) {
+			return;
 		}
+	}
+	char scratch[128];
+	for(size_t left = PICOHTTP_DRAIN_MAX; left; ) {
+		int const r = picohttpRead(req,
+			(left < sizeof(scratch)) ? left : sizeof(scratch), scratch);
+		if( 0 >= r ) {
+			break;
+		}
+		left -= r;
+	}
+}
 
-		if( req->query.chunklength <= req->received_octets ) {
-			/* If this happens the data is corrupted, or
-			 * the client is nonconforming, or an attack is
-			 * underway, or something entierely different,
-			 * or all of that.
-			 * Abort processing the query!
-			 */
+#if !PICOHTTP_NO_BODYTOFD
+static int picohttpBodyToFdWrite(
+	int fd,
+	size_t len,
+	char const *buf )
+{
+	while( len ) {
+		ssize_t const w = write(fd, buf, len);
+		if( 0 > w ) {
+			if( EINTR == errno )
+				continue;
 			return -1;
 		}
+		buf += w;
+		len -= w;
 	}
+	return 0;
+}
 
-	if( req->received_octets + len > req->query.chunklength ) {
-		len = req->query.chunklength - req->received_octets;
+int64_t picohttpRequestBodyToFd(
+	struct picohttpRequest * const req,
+	int fd,
+	uint64_t maxlen )
+{
+	if( PICOHTTP_CODING_CHUNKED != req->query.transferencoding
+	 && maxlen && req->query.contentlength - req->received_octets > maxlen ) {
+		/* not even starting on it */
+		return -1;
 	}
 
-	int r = picohttpIoRead(req->ioops, len, buf);
-
-	if(req->query.transferencoding == PICOHTTP_CODING_CHUNKED ) {
-		if( !req->query.chunklength <= req->received_octets ) {
-			int ch;
-			/* end of chunk;
-			 * skip over <CR><LF>, make sure the trailing '0' is
-			 * there and read the headers, err, I mean footers
-			 * (whatever, the header processing code will do for 
-			 * chunk footers just fine).
-			 */
-			if( '0' != (ch = picohttpIoGetch(req->ioops)) ) {
+	uint64_t written = 0;
+	for(;;) {
+		int64_t avail = picohttpBodyAvail(req);
+		if( 0 > avail ) {
+			return -1;
+		}
+		if( !avail ) {
+			break;
+		}
+		if( maxlen ) {
+			if( written == maxlen ) {
 				return -1;
 			}
-			if( 0 > (ch = picohttpIoGetch(req->ioops)) ) {
-				return -1;
+			if( (uint64_t)avail > maxlen - written ) {
+				avail = maxlen - written;
 			}
-			if( 0 > (ch = picohttpProcessHeaders(
-					req,
-					0, NULL,
-					NULL, NULL,
-					ch))
-			) {
-				return ch;
+		}
+		/* what fits the int returned by the I/O operations */
+		size_t const len = (avail < (1 << 30)) ? (size_t)avail : (1 << 30);
+
+		int r;
+		if( req->ioops->splice ) {
+			r = picohttpIoSplice(req->ioops, len, fd);
+		} else {
+			char block[PICOHTTP_BODYTOFD_BLOCK];
+			r = picohttpIoRead(req->ioops,
+				(len < sizeof(block)) ? len : sizeof(block), block);
+			if( 0 < r && 0 > picohttpBodyToFdWrite(fd, r, block) ) {
+				return -1;
 			}
-			
-			req->received_octets =
-			req->query.chunklength = 0;
+		}
+		if( 0 >= r ) {
+			return -1;
+		}
+		written += r;
+		if( 0 > picohttpBodyConsumed(req, r) ) {
+			return -1;
 		}
 	}
-
-	return r;
+	return written;
 }
+#endif
 
 /* TODO:
  * It is possible to do in-place pattern matching on the route definition
@@ -506,6 +770,43 @@ static size_t picohttpMatchURL(
 	return j;
 }
 
+/* Removes dot segments (RFC 3986 5.2.4) from the decoded path and
+ * collapses repeated slashes, in place and in a single pass, so that
+ * routes and handlers only ever see the canonical form. ".." never
+ * leads above the root. URLs not starting with '/' are left alone. */
+void picohttpNormalizePath(char * const url)
+{
+	if( '/' != *url ) {
+		return;
+	}
+	char const *r = url;
+	char *w = url;
+	/* r is at a '/' at the start of each round */
+	while( *r ) {
+		while( '/' == r[1] ) {
+			r++;
+		}
+		if( '.' == r[1] && ('/' == r[2] || !r[2]) ) {
+			r += 2;
+		} else
+		if( '.' == r[1] && '.' == r[2] && ('/' == r[3] || !r[3]) ) {
+			/* drop the segment written last */
+			while( w > url && '/' != *--w );
+			r += 3;
+		} else {
+			do {
+				*w++ = *r++;
+			} while( *r && '/' != *r );
+			continue;
+		}
+		if( !*r ) {
+			/* "/a/." and "/a/.." end in a directory */
+			*w++ = '/';
+		}
+	}
+	*w = 0;
+}
+
 static int picohttpMatchRoute(
 	struct picohttpRequest * const req,
 	struct picohttpURLRoute const * const routes )
@@ -608,6 +909,9 @@ static int picohttpProcessURL (
 		}
 		if( '%' == ch ) {
 			ch = picohttpIoGetPercentCh(req->ioops);
+			if( -PICOHTTP_STATUS_400_BAD_REQUEST == ch ) {
+				return ch;
+			}
 			if( ch < 0 ) {
 				return -PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR;
 			}
@@ -625,6 +929,35 @@ static int picohttpProcessURL (
 	return ch;
 }
 
+/* Skips the rest of a query variable, up to the '&' or the white space
+ * after it, which is returned. Escapes are checked all the same: like
+ * in the variable names, malformed ones and %00 give
+ * -PICOHTTP_STATUS_400_BAD_REQUEST. */
+static int picohttpQuerySkip(
+	struct picohttpRequest * const req )
+{
+	for(;;) {
+		int ch = picohttpIoGetch(req->ioops);
+		if( '%' == ch ) {
+			ch = picohttpIoGetPercentCh(req->ioops);
+			if( -PICOHTTP_STATUS_400_BAD_REQUEST == ch || !ch ) {
+				return -PICOHTTP_STATUS_400_BAD_REQUEST;
+			}
+			if( ch < 0 ) {
+				return -PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR;
+			}
+			/* an escaped '&' or space doesn't end it */
+			continue;
+		}
+		if( ch < 0 ) {
+			return -PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR;
+		}
+		if( '&' == ch || picohttpIsLWS(ch) ) {
+			return ch;
+		}
+	}
+}
+
 static int picohttpProcessQuery (
 	struct picohttpRequest * const req,
 	int ch )
@@ -668,6 +1001,9 @@ static int picohttpProcessQuery (
 			}
 			if( '%' == ch ) {
 				ch = picohttpIoGetPercentCh(req->ioops);
+				if( -PICOHTTP_STATUS_400_BAD_REQUEST == ch ) {
+					return ch;
+				}
 				if( ch < 0 ) {
 					return -PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR;
 				}
@@ -679,13 +1015,9 @@ static int picohttpProcessQuery (
 			if( (size_t)(variter - var) >= var_max_length ) {
 /* variable name in request longer than longest
  * variable name accepted by route --> skip to next variable */
-				do {
-					ch = picohttpIoGetch(req->ioops);
-					if( ch < 0 ) {
-						return -PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR;
-					}
-				} while(!( '&' == ch ||
-				           picohttpIsLWS(ch) ));
+				if( 0 > (ch = picohttpQuerySkip(req)) ) {
+					return ch;
+				}
 				continue;
 			}
 			*variter = ch;
@@ -693,8 +1025,12 @@ static int picohttpProcessQuery (
 			ch = picohttpIoGetch(req->ioops);
 		}
 		if( '=' == ch ) {
-			debug_printf("set variable '%s'\r\n", var);
-		} else {
+			picohttpTrace(PICOHTTP_TRACE_CLASS_QUERY,
+				PICOHTTP_TRACE_QUERY_VAR, picohttpTracePack(var), 0);
+			/* values are not evaluated (yet); skip over it */
+			if( 0 > (ch = picohttpQuerySkip(req)) ) {
+				return ch;
+			}
 		}
 	}
 	if( 0 > (ch = picohttpIoSkipSpace(req->ioops, ch)) ) {
@@ -806,56 +1142,247 @@ static void picohttpProcessHeaderContentType(
 	}
 }
 
-static void picohttpProcessHeaderAuthorization(
+#if !PICOHTTP_NO_DIGEST_AUTH
+/* Copies a auth-param value, removing quoted-pair escapes.
+ * Returns false if it doesn't fit into dest. */
+static bool picohttpAuthParamCopy(
+	char * const dest,
+	size_t const dest_maxlen,
+	char const *value,
+	size_t len )
+{
+	size_t i = 0;
+	if( !dest ) {
+		return true;
+	}
+	for(char const * const end = value + len; value < end; value++) {
+		if( '\\' == *value && value+1 < end ) {
+			value++;
+		}
+		if( i >= dest_maxlen ) {
+			return false;
+		}
+		dest[i++] = *value;
+	}
+	if( i >= dest_maxlen ) {
+		return false;
+	}
+	dest[i] = 0;
+	return true;
+}
+
+static void picohttpProcessDigestAuthorization(
 	struct picohttpRequest * const req,
-	char const *authorization )
+	char const *a )
 {
-	if(!strncmp(authorization,
-	            PICOHTTP_STR_BASIC_,
-		    sizeof(PICOHTTP_STR_BASIC_)-1)) {
-		authorization += sizeof(PICOHTTP_STR_BASIC_)-1;
-		/* HTTP RFC-2617 Basic Auth */
+	struct picohttpAuthData * const auth = req->query.auth;
+	if( !auth
+	 || !auth->username
+	 || !auth->pwresponse ) {
+		return;
+	}
 
-		if( !req->query.auth
-		 || !req->query.auth->username 
-		 || !req->query.auth->pwresponse ) {
+	auth->username[0] = 0;
+	auth->pwresponse[0] = 0;
+	if( auth->realm )
+		auth->realm[0] = 0;
+	auth->uri[0] = 0;
+	auth->nonce[0] = 0;
+	auth->cnonce[0] = 0;
+	auth->algorithm = PICOHTTP_DIGEST_MD5;
+	auth->message_qop = 0;
+	auth->nonce_count = 0;
+
+	for(;;) {
+		while( ' ' == *a || '\t' == *a || ',' == *a )
+			a++;
+		if( !*a )
+			break;
+
+		/* auth-param = token "=" ( token / quoted-string ) */
+		char const * const name = a;
+		while( *a && '=' != *a && ' ' != *a && ',' != *a )
+			a++;
+		if( '=' != *a ) {
 			return;
 		}
-		size_t user_password_max_len = 
-			req->query.auth->username_maxlen +
-			req->query.auth->pwresponse_maxlen;
-
-#ifdef PICOWEB_CONFIG_USE_C99VARARRAY
-			
-		char user_password[user_password_max_len+1];
-#else
-		char *user_password = alloca(user_password_max_len+1);
-#endif
-		char const *a = authorization;
-		size_t i = 0;
-		while(*a && i < user_password_max_len) {
-			phb64enc_t e = {0,0,0,0};
-			for(size_t j=0; *a && j < 4; j++) {
-				e[j] = *a++;
+		size_t const name_len = ++a - name;
+
+		char const *value = a;
+		size_t value_len;
+		if( '"' == *a ) {
+			value = ++a;
+			while( *a && '"' != *a ) {
+				if( '\\' == *a && a[1] )
+					a++;
+				a++;
 			}
-			phb64raw_t r;
-			size_t l = phb64decode(e, r);
-			if( !l ) {
-				/* invalid chunk => abort the whole header */
+			if( '"' != *a ) {
 				return;
 			}
-			for(size_t j=0;
-			       j < l
-			    && i < user_password_max_len;
-			    j++, i++) {
-				user_password[i] = r[j];
+			value_len = a++ - value;
+		} else {
+			while( *a && ',' != *a && ' ' != *a && '\t' != *a )
+				a++;
+			value_len = a - value;
+		}
+
+#define picohttpAUTH_PARAM_IS(x) \
+	( sizeof(x)-1 == name_len && !strncmp(name, x, name_len) )
+#define picohttpAUTH_VALUE_IS(x) \
+	( sizeof(x)-1 == value_len && !strncmp(value, x, value_len) )
+
+		bool ok = true;
+		if( sizeof(PICOHTTP_STR_USERNAME__)-2 == name_len
+		 && !strncmp(name, PICOHTTP_STR_USERNAME__, name_len) ) {
+			ok = picohttpAuthParamCopy(auth->username,
+				auth->username_maxlen, value, value_len);
+		} else
+		if( sizeof(PICOHTTP_STR_REALM__)-2 == name_len
+		 && !strncmp(name, PICOHTTP_STR_REALM__, name_len) ) {
+			ok = picohttpAuthParamCopy(auth->realm,
+				auth->realm_maxlen, value, value_len);
+		} else
+		if( picohttpAUTH_PARAM_IS(PICOHTTP_STR_NONCE_) ) {
+			ok = picohttpAuthParamCopy(auth->nonce,
+				sizeof(auth->nonce), value, value_len);
+		} else
+		if( picohttpAUTH_PARAM_IS(PICOHTTP_STR_CNONCE_) ) {
+			ok = picohttpAuthParamCopy(auth->cnonce,
+				sizeof(auth->cnonce), value, value_len);
+		} else
+		if( picohttpAUTH_PARAM_IS(PICOHTTP_STR_URI_) ) {
+			ok = picohttpAuthParamCopy(auth->uri,
+				sizeof(auth->uri), value, value_len);
+		} else
+		if( picohttpAUTH_PARAM_IS(PICOHTTP_STR_RESPONSE_) ) {
+			ok = picohttpAuthParamCopy(auth->pwresponse,
+				auth->pwresponse_maxlen, value, value_len);
+		} else
+		if( picohttpAUTH_PARAM_IS(PICOHTTP_STR_QOP_) ) {
+			ok = picohttpAUTH_VALUE_IS(PICOHTTP_STR_AUTH);
+			auth->message_qop = PICOHTTP_QOP_AUTH;
+		} else
+		if( picohttpAUTH_PARAM_IS(PICOHTTP_STR_NC_) ) {
+			ok = (8 == value_len);
+			for(size_t i = 0; ok && i < value_len; i++) {
+				int const c = value[i] | 0x20;
+				auth->nonce_count <<= 4;
+				if( '0' <= c && '9' >= c ) {
+					auth->nonce_count |= c - '0';
+				} else
+				if( 'a' <= c && 'f' >= c ) {
+					auth->nonce_count |= c - 'a' + 10;
+				} else {
+					ok = false;
+				}
+			}
+		} else
+		if( picohttpAUTH_PARAM_IS(PICOHTTP_STR_ALGORITHM_) ) {
+			uint8_t alg = 0;
+			if( value_len >= sizeof(PICOHTTP_STR_MD5)-1
+			 && !strncmp(value, PICOHTTP_STR_MD5,
+			             sizeof(PICOHTTP_STR_MD5)-1) ) {
+				alg = PICOHTTP_DIGEST_MD5;
+				value += sizeof(PICOHTTP_STR_MD5)-1;
+				value_len -= sizeof(PICOHTTP_STR_MD5)-1;
+			} else
+			if( value_len >= sizeof(PICOHTTP_STR_SHA_256)-1
+			 && !strncmp(value, PICOHTTP_STR_SHA_256,
+			             sizeof(PICOHTTP_STR_SHA_256)-1) ) {
+				alg = PICOHTTP_DIGEST_SHA256;
+				value += sizeof(PICOHTTP_STR_SHA_256)-1;
+				value_len -= sizeof(PICOHTTP_STR_SHA_256)-1;
 			}
+			if( value_len && picohttpAUTH_VALUE_IS(PICOHTTP_STR__SESS) ) {
+				alg |= PICOHTTP_DIGEST_SESS;
+			} else
+			if( value_len ) {
+				alg = 0;
+			}
+			ok = !!alg;
+			auth->algorithm = alg;
+		} else
+		if( picohttpAUTH_PARAM_IS(PICOHTTP_STR_USERHASH_) ) {
+			ok = !picohttpAUTH_VALUE_IS(PICOHTTP_STR_TRUE);
+		}
+
+#undef picohttpAUTH_PARAM_IS
+#undef picohttpAUTH_VALUE_IS
+
+		if( !ok ) {
+#if PICOHTTP_TRACE
+			char param[9] = {0,};
+			memcpy(param, name, (name_len < 8) ? name_len : 8);
+			picohttpTrace(PICOHTTP_TRACE_CLASS_AUTH,
+				PICOHTTP_TRACE_AUTH_REJECT, picohttpTracePack(param), 0);
+#endif
+			return;
+		}
+	}
+
+	if( !auth->username[0]
+	 || !auth->nonce[0]
+	 || !auth->cnonce[0]
+	 || !auth->pwresponse[0]
+	 || !auth->nonce_count
+	 || PICOHTTP_QOP_AUTH != auth->message_qop ) {
+		return;
+	}
+
+	auth->scheme = PICOHTTP_AUTH_DIGEST;
+	picohttpTrace(PICOHTTP_TRACE_CLASS_AUTH, PICOHTTP_TRACE_AUTH_DIGEST,
+		picohttpTracePack(auth->username), auth->nonce_count);
+}
+#endif
+
+static void picohttpProcessHeaderAuthorization(
+	struct picohttpRequest * const req,
+	char const *authorization )
+{
+	if(!strncmp(authorization,
+	            PICOHTTP_STR_BASIC_,
+		    sizeof(PICOHTTP_STR_BASIC_)-1)) {
+		authorization += sizeof(PICOHTTP_STR_BASIC_)-1;
+		/* HTTP RFC-2617 Basic Auth */
+
+		if( !req->query.auth
+		 || !req->query.auth->username 
+		 || !req->query.auth->pwresponse ) {
+			return;
+		}
+#if !PICOHTTP_NO_AUTHCACHE
+		if( req->query.auth->cache ) {
+			picohttpAuthCacheMac(req->query.auth->cache,
+				authorization, req->query.auth->mac);
 		}
-		user_password[i] = 0;
+#endif
+		size_t const user_password_max_len = 
+			req->query.auth->username_maxlen +
+			req->query.auth->pwresponse_maxlen;
 
-		debug_printf(
-			"[picohttp] user_password='%s'\r\n",
-			user_password);
+		size_t const authorization_len = strlen(authorization);
+		if( authorization_len >
+		    PHB64_ENCODED_LEN(user_password_max_len + 1) ) {
+			/* can't fit into auth.username and auth.pwresponse */
+			return;
+		}
+		size_t const user_password_len =
+			PHB64_DECODED_MAX(authorization_len);
+
+#ifdef PICOWEB_CONFIG_USE_C99VARARRAY
+			
+		char user_password[user_password_len+1];
+#else
+		char *user_password = alloca(user_password_len+1);
+#endif
+		size_t const l = phb64_decode_buf(NULL,
+			authorization_len, authorization, user_password);
+		if( PHB64_ERROR == l ) {
+			/* invalid encoding => abort the whole header */
+			return;
+		}
+		user_password[l] = 0;
 
 		char *c;
 		for(c = user_password; *c && ':' != *c; c++);
@@ -881,18 +1408,236 @@ static void picohttpProcessHeaderAuthorization(
 				c,
 				req->query.auth->pwresponse_maxlen);
 		}
-		debug_printf(
-			"[picohttp] Basic Auth: username='%s', password='%s'\r\n",
-			req->query.auth->username,
-			req->query.auth->pwresponse);
+		req->query.auth->scheme = PICOHTTP_AUTH_BASIC;
+		uint8_t verified = 0;
+#if !PICOHTTP_NO_AUTHCACHE
+		if( req->query.auth->cache ) {
+			req->query.auth->verified = picohttpAuthCacheLookup(
+				req->query.auth->cache, req->query.auth->mac);
+		}
+		verified = req->query.auth->verified;
+#endif
+		picohttpTrace(PICOHTTP_TRACE_CLASS_AUTH, PICOHTTP_TRACE_AUTH_BASIC,
+			picohttpTracePack(req->query.auth->username), verified);
 		return;
 	}
 
+#if !PICOHTTP_NO_DIGEST_AUTH
 	if(!strncmp(authorization,
 	            PICOHTTP_STR_DIGEST_,
 		    sizeof(PICOHTTP_STR_DIGEST_)-1)) {
+		authorization += sizeof(PICOHTTP_STR_DIGEST_)-1;
+		/* HTTP RFC-7616 Digest Auth */
+		picohttpProcessDigestAuthorization(req, authorization);
+		return;
+	}
+#endif
+}
+
+static size_t picohttpScanSize(
+	char const **s )
+{
+	size_t v = 0;
+	for(; '0' <= **s && '9' >= **s; (*s)++) {
+		if( v > (PICOHTTP_RANGE_OPEN - 10) / 10 ) {
+			/* saturate; anything this large is beyond any entity */
+			v = PICOHTTP_RANGE_OPEN - 1;
+			continue;
+		}
+		v = v*10 + (**s & 0x0f);
+	}
+	return v;
+}
+
+static void picohttpProcessHeaderRange(
+	struct picohttpRequest * const req,
+	char const *range )
+{
+	/* RFC-7233 Range: bytes=first-last, first-, -suffix, ... */
+	req->query.range.count = 0;
+	if( strncmp(range, PICOHTTP_STR_BYTES, sizeof(PICOHTTP_STR_BYTES)-1)
+	 || '=' != range[sizeof(PICOHTTP_STR_BYTES)-1] ) {
+		return;
+	}
+	range += sizeof(PICOHTTP_STR_BYTES);
+
+	for(;;) {
+		struct picohttpByteRange r = {
+			.first = PICOHTTP_RANGE_OPEN,
+			.last  = PICOHTTP_RANGE_OPEN };
+
+		while( ' ' == *range || '\t' == *range )
+			range++;
+
+		if( '0' <= *range && '9' >= *range ) {
+			r.first = picohttpScanSize(&range);
+		}
+		if( '-' != *range ) {
+			goto invalid;
+		}
+		range++;
+		if( '0' <= *range && '9' >= *range ) {
+			r.last = picohttpScanSize(&range);
+		}
+
+		if( PICOHTTP_RANGE_OPEN == r.first ) {
+			if( PICOHTTP_RANGE_OPEN == r.last ) {
+				goto invalid;
+			}
+		} else
+		if( PICOHTTP_RANGE_OPEN != r.last && r.last < r.first ) {
+			goto invalid;
+		}
+
+		if( PICOHTTP_RANGES_MAX <= req->query.range.count ) {
+			/* more ranges than we care to track; serving the
+			 * whole entity is always a valid answer */
+			goto invalid;
+		}
+		req->query.range.ranges[req->query.range.count++] = r;
+
+		while( ' ' == *range || '\t' == *range )
+			range++;
+		if( !*range ) {
+			break;
+		}
+		if( ',' != *range ) {
+			goto invalid;
+		}
+		range++;
+	}
+	return;
+
+invalid:
+	/* a syntactically invalid Range header is to be ignored */
+	req->query.range.count = 0;
+}
+
+static void picohttpProcessHeaderIfRange(
+	struct picohttpRequest * const req,
+	char const *ifrange )
+{
+	if( strlen(ifrange) > PICOHTTP_IFRANGE_MAX_LEN ) {
+		/* can't be compared, so the range can't be honored */
+		req->query.range.conditional = 2;
 		return;
 	}
+	strcpy(req->query.range.ifrange, ifrange);
+	req->query.range.conditional = 1;
+}
+
+/* RFC 7231 5.1.1; HTTP/1.0 clients don't wait for 100 Continue */
+static void picohttpProcessHeaderExpect(
+	struct picohttpRequest * const req,
+	char const *headervalue )
+{
+	size_t i;
+	for(i = 0; i < sizeof(PICOHTTP_STR_100_CONTINUE)-1; i++) {
+		/* case insensitive; the other characters are unaffected */
+		if( (headervalue[i] | 0x20) != PICOHTTP_STR_100_CONTINUE[i] ) {
+			break;
+		}
+	}
+	if( sizeof(PICOHTTP_STR_100_CONTINUE)-1 != i || headervalue[i] ) {
+		req->query.expect = 2;
+		return;
+	}
+	if( 1 == req->httpversion.major && 1 <= req->httpversion.minor ) {
+		req->query.expect = 1;
+	}
+}
+
+/* header names are case insensitive; the other characters of tokens
+ * are unaffected by folding */
+static bool picohttpHeaderNameEq(
+	char const *a,
+	char const *b )
+{
+	for(; *a && (*a | 0x20) == (*b | 0x20); a++, b++);
+	return !*a && !*b;
+}
+
+/* Index of headername in the route's headers list, -1 if not in it */
+static int picohttpRouteHeader(
+	struct picohttpURLRoute const * const route,
+	char const *headername )
+{
+	if( !route || !route->headers ) {
+		return -1;
+	}
+	for(int i = 0; route->headers[i]; i++) {
+		if( picohttpHeaderNameEq(route->headers[i], headername) ) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool picohttpRequestHeaderWanted(
+	void * const data,
+	char const *headername )
+{
+	struct picohttpRequest * const req = data;
+	/* the ones picohttpProcessHeaderField makes use of itself, matched
+	 * the same way */
+	return !strncmp(headername,
+	                PICOHTTP_STR_CONTENT,
+	                sizeof(PICOHTTP_STR_CONTENT)-1)
+	    || !strncmp(headername,
+	                PICOHTTP_STR_TRANSFER,
+	                sizeof(PICOHTTP_STR_TRANSFER)-1)
+	    || !strncmp(headername,
+	                PICOHTTP_STR_AUTHORIZATION,
+	                sizeof(PICOHTTP_STR_AUTHORIZATION)-1)
+	    || !strncmp(headername,
+	                PICOHTTP_STR_RANGE,
+	                sizeof(PICOHTTP_STR_RANGE)-1)
+	    || !strncmp(headername,
+	                PICOHTTP_STR_IF_RANGE,
+	                sizeof(PICOHTTP_STR_IF_RANGE)-1)
+	    || !strncmp(headername,
+	                PICOHTTP_STR_EXPECT,
+	                sizeof(PICOHTTP_STR_EXPECT)-1)
+	    || 0 <= picohttpRouteHeader(req->route, headername);
+}
+
+/* Keeps the value of a header the route declared */
+static void picohttpRequestHeaderKeep(
+	struct picohttpRequest * const req,
+	char const *headername,
+	char const *headervalue )
+{
+	int const name = picohttpRouteHeader(req->route, headername);
+	if( 0 > name || PICOHTTP_ROUTE_HEADERS_MAX <= req->headers.count ) {
+		return;
+	}
+	for(uint8_t i = 0; i < req->headers.count; i++) {
+		if( name == req->headers.index[i].name ) {
+			return;
+		}
+	}
+	size_t const len = strlen(headervalue) + 1;
+	if( req->headers.size - req->headers.len < len ) {
+		return;
+	}
+	memcpy(req->headers.store + req->headers.len, headervalue, len);
+	req->headers.index[req->headers.count].name = name;
+	req->headers.index[req->headers.count].offset = req->headers.len;
+	req->headers.count++;
+	req->headers.len += len;
+}
+
+char const *picohttpRequestHeader(
+	struct picohttpRequest const * const req,
+	char const *name )
+{
+	for(uint8_t i = 0; i < req->headers.count; i++) {
+		if( picohttpHeaderNameEq(
+			req->route->headers[req->headers.index[i].name], name) ) {
+			return req->headers.store + req->headers.index[i].offset;
+		}
+	}
+	return NULL;
 }
 
 static void picohttpProcessHeaderField(
@@ -901,7 +1646,9 @@ static void picohttpProcessHeaderField(
 	char const *headervalue)
 {
 	struct picohttpRequest * const req = data;
-	debug_printf("[picohttp] %s: %s\r\n", headername, headervalue);
+	picohttpTrace(PICOHTTP_TRACE_CLASS_HEADER, PICOHTTP_TRACE_HEADER,
+		picohttpTracePack(headername), strlen(headervalue));
+	picohttpRequestHeaderKeep(req, headername, headervalue);
 	if(!strncmp(headername,
 		    PICOHTTP_STR_CONTENT,
 		    sizeof(PICOHTTP_STR_CONTENT)-1)) {
@@ -910,6 +1657,7 @@ static void picohttpProcessHeaderField(
 		if(!strncmp(headername,
 			    PICOHTTP_STR__LENGTH, sizeof(PICOHTTP_STR__LENGTH)-1)) {
 			req->query.contentlength = atol(headervalue);
+			req->query.lengthknown = 1;
 			return;
 		}
 
@@ -946,28 +1694,86 @@ static void picohttpProcessHeaderField(
 		picohttpProcessHeaderAuthorization(req, headervalue);
 		return;
 	}
+
+	if(!strncmp(headername,
+	            PICOHTTP_STR_RANGE,
+		    sizeof(PICOHTTP_STR_RANGE)-1)) {
+		picohttpProcessHeaderRange(req, headervalue);
+		return;
+	}
+
+	if(!strncmp(headername,
+	            PICOHTTP_STR_IF_RANGE,
+		    sizeof(PICOHTTP_STR_IF_RANGE)-1)) {
+		picohttpProcessHeaderIfRange(req, headervalue);
+		return;
+	}
+
+	if(!strncmp(headername,
+	            PICOHTTP_STR_EXPECT,
+		    sizeof(PICOHTTP_STR_EXPECT)-1)) {
+		picohttpProcessHeaderExpect(req, headervalue);
+		return;
+	}
+}
+
+/* Checks on the complete request head, before the handler is called
+ * and, with Expect: 100-continue, before the client sends the body */
+static int picohttpHeadStatus(
+	struct picohttpRequest * const req )
+{
+	if( 2 == req->query.expect ) {
+		return PICOHTTP_STATUS_417_EXPECTATION_FAILED;
+	}
+	struct picohttpURLRoute const * const route = req->route;
+	bool const body = req->query.contentlength
+		|| PICOHTTP_CODING_CHUNKED == req->query.transferencoding;
+	if( !route || !body ) {
+		return PICOHTTP_STATUS_200_OK;
+	}
+	if( route->max_body && req->query.contentlength > route->max_body ) {
+		return PICOHTTP_STATUS_413_PAYLOAD_TOO_LARGE;
+	}
+	if( route->content_types ) {
+		int const type = req->query.contenttype;
+		int const *t;
+		for(t = route->content_types; *t; t++) {
+			if( type == *t || (!(*t & 0x0fff) && (type & 0xf000) == *t) ) {
+				break;
+			}
+		}
+		if( !*t ) {
+			return PICOHTTP_STATUS_415_UNSUPPORTED_MEDIA_TYPE;
+		}
+	}
+	return PICOHTTP_STATUS_200_OK;
+}
+
+/* The statuses of picohttpHeadStatus; the head is complete then and
+ * the body may follow */
+static bool picohttpHeadRejected(int status)
+{
+	return PICOHTTP_STATUS_413_PAYLOAD_TOO_LARGE == status
+		|| PICOHTTP_STATUS_415_UNSUPPORTED_MEDIA_TYPE == status
+		|| PICOHTTP_STATUS_417_EXPECTATION_FAILED == status;
 }
 
 static int picohttpProcessHeaders (
 	struct picohttpRequest * const req,
 	size_t const headervalue_maxlen,
 	char * const headervalue,
+	picohttpHeaderWantedCallback headerwantedcallback,
 	picohttpHeaderFieldCallback headerfieldcallback,
 	void * const cb_data,
 	int ch )
 {
-#define PICOHTTP_HEADERNAME_MAX_LEN 32
 	char headername[PICOHTTP_HEADERNAME_MAX_LEN+1] = {0,};
 
-#if 0
-#define PICOHTTP_HEADERVALUE_MAX_LEN 224
-	char headervalue[PICOHTTP_HEADERVALUE_MAX_LEN+1] = {0,};
-#endif
-
-	char *hn = headername;
-	char *hv = headervalue;
+	size_t hn = 0;
+	size_t hv = 0;
+	/* the value of the current header goes to the callback */
+	bool wanted = false;
 
-	/* TODO: Add Header handling here */
 	while( !picohttpIsCRLF(ch) ) {
 		/* Beginning of new header line */
 		if( 0 < ch && !picohttpIsCRLF(ch) ){
@@ -981,40 +1787,34 @@ static int picohttpProcessHeaders (
 				/* read until EOL */
 				for(;
 				    0 < ch && !picohttpIsCRLF(ch);
-				    hv = (size_t)(hv - headervalue) <
-				         (headervalue_maxlen-1) ?
-					     hv+1 : 0 ) {
+				    ch = picohttpIoGetch(req->ioops) ) {
 					/* add to header field content */
-
-					if(hv)
-						*hv = ch;
-
-					ch = picohttpIoGetch(req->ioops);
+					if( wanted && hv < headervalue_maxlen-1 )
+						headervalue[hv++] = ch;
 				}
 			} else {
-				if( *headername && *headervalue && headerfieldcallback )
+				if( wanted && hv ) {
+					headervalue[hv] = 0;
 					headerfieldcallback(
 						cb_data,
 						headername,
 						headervalue );
+				}
 				/* new header field */
-				memset(headername, 0, PICOHTTP_HEADERNAME_MAX_LEN+1);
-				hn = headername;
-
-				memset(headervalue, 0, headervalue_maxlen);
-				hv = headervalue;
+				hn = 0;
+				hv = 0;
 				/* read until ':' or EOL */
 				for(;
 				    0 < ch && ':' != ch && !picohttpIsCRLF(ch);
-				    hn = (hn - headername) <
-				          PICOHTTP_HEADERNAME_MAX_LEN ?
-					      hn+1 : 0 ) {
+				    ch = picohttpIoGetch(req->ioops) ) {
 					/* add to header name */
-					if(hn)
-						*hn = ch;
-
-					ch = picohttpIoGetch(req->ioops);
+					if( hn < PICOHTTP_HEADERNAME_MAX_LEN )
+						headername[hn++] = ch;
 				}
+				headername[hn] = 0;
+				wanted = hn && headerfieldcallback
+					&& (!headerwantedcallback
+					    || headerwantedcallback(cb_data, headername));
 			}
 		} 
 		if( 0 > ch  ) {
@@ -1031,11 +1831,13 @@ static int picohttpProcessHeaders (
 			return -PICOHTTP_STATUS_400_BAD_REQUEST;
 		}
 	}
-	if( *headername && *headervalue && headerfieldcallback)
+	if( wanted && hv ) {
+		headervalue[hv] = 0;
 		headerfieldcallback(
 			cb_data,
 			headername,
 			headervalue );
+	}
 
 	return ch;
 }
@@ -1053,24 +1855,34 @@ static int picohttp_wrap_request_prochdrs (
 	struct picohttpRequest * const req,
 	int ch )
 {
-#if PICOHTTP_NO_DIGEST_AUTH
-	size_t const headervalue_maxlen = 256;
-#else
-	size_t const headervalue_maxlen = 768;
-#endif
+	size_t const headervalue_maxlen = PICOHTTP_HEADERVALUE_MAX_LEN+1;
+	/* values are terminated as they are handed on; no need to clear
+	 * it here */
 	char headervalue[headervalue_maxlen];
 
-	memset(headervalue, 0, headervalue_maxlen);
-
 	return picohttpProcessHeaders(
 		req,
 		headervalue_maxlen,
 		headervalue,
+		picohttpRequestHeaderWanted,
 		picohttpProcessHeaderField,
 		req,
 		ch );
 }
 
+/* Size of the store for route declared header values; only needed if
+ * a route declares any */
+static size_t picohttpRoutesHeadersLength(
+	struct picohttpURLRoute const * const routes )
+{
+	for(size_t i = 0; routes[i].urlhead; i++) {
+		if( routes[i].headers ) {
+			return PICOHTTP_ROUTE_HEADERS_LEN;
+		}
+	}
+	return 0;
+}
+
 size_t picohttpRoutesMaxUrlLength(
 	struct picohttpURLRoute const * const routes )
 {
@@ -1086,6 +1898,52 @@ size_t picohttpRoutesMaxUrlLength(
 	return url_max_length;
 }
 
+static void picohttpRequestInit (
+	struct picohttpRequest * const req,
+	struct picohttpIoOps const * const ioops,
+	char * const url,
+	struct picohttpAuthData * const authdata,
+	void *userdata)
+{
+	memset(req, 0, sizeof(*req));
+
+	req->url = url;
+	req->urltail = 0;
+	req->ioops = ioops;
+	req->method = 0;
+	req->httpversion.major = 1;
+	req->httpversion.minor = 0;
+	req->sent.header = 0;
+	req->sent.octets = 0;
+	req->received_octets = 0;
+	req->userdata = userdata;
+	req->query.auth = authdata;
+	if( authdata ) {
+		authdata->scheme = 0;
+#if !PICOHTTP_NO_AUTHCACHE
+		authdata->verified = 0;
+#endif
+#if !PICOHTTP_NO_DIGEST_AUTH
+		authdata->stale = 0;
+#endif
+	}
+}
+
+/* Request head processed; over to the route's handler */
+static void picohttpCallHandler(
+	struct picohttpRequest * const req )
+{
+	struct picohttpURLRoute const * const route = req->route;
+	picohttpStackPhase(PICOHTTP_STACK_HANDLER);
+	picohttpProbe3(headers__done, req, route->urlhead,
+		req->query.contentlength);
+	picohttpProbe3(handler__entry, req, route->urlhead,
+		req->query.contentlength);
+	route->handler(req);
+	picohttpProbe5(handler__exit, req, route->urlhead, req->status,
+		req->received_octets, req->sent.octets);
+}
+
 void picohttpProcessRequest (
 	struct picohttpIoOps const * const ioops,
 	struct picohttpURLRoute const * const routes,
@@ -1095,27 +1953,22 @@ void picohttpProcessRequest (
 
 	int ch;
 	struct picohttpRequest request;
-	memset(&request, 0, sizeof(request));
 
 	size_t const url_max_length = picohttpRoutesMaxUrlLength(routes);
+	/* the header store follows the URL */
+	size_t const headers_len = picohttpRoutesHeadersLength(routes);
 #ifdef PICOWEB_CONFIG_USE_C99VARARRAY
-	char url[url_max_length+1];
+	char url[url_max_length+1+headers_len];
 #else
-	char *url = alloca(url_max_length+1);
+	char *url = alloca(url_max_length+1+headers_len);
 #endif
 	memset(url, 0, url_max_length+1);
 
-	request.url = url;
-	request.urltail = 0;
-	request.ioops = ioops;
-	request.method = 0;
-	request.httpversion.major = 1;
-	request.httpversion.minor = 0;
-	request.sent.header = 0;
-	request.sent.octets = 0;
-	request.received_octets = 0;
-	request.userdata = userdata;
-	request.query.auth = authdata;
+	picohttpStackBegin();
+	picohttpRequestInit(&request, ioops, url, authdata, userdata);
+	request.headers.store = url + url_max_length+1;
+	request.headers.size = headers_len;
+	picohttpProbe1(request__start, &request);
 
 	request.method = picohttpProcessRequestMethod(ioops);
 	if( !request.method ) {
@@ -1126,6 +1979,7 @@ void picohttpProcessRequest (
 		ch = -PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR;
 		goto http_error;
 	}
+	picohttpProbe2(method__parsed, &request, request.method);
 
 	if( 0 > (ch = picohttpIoSkipSpace(ioops, -1)) ) {
 		ch = -PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR;
@@ -1134,6 +1988,7 @@ void picohttpProcessRequest (
 
 	if( 0 > (ch = picohttpProcessURL(&request, url_max_length, ch)) )
 		goto http_error;
+	picohttpNormalizePath(url);
 
 	if( !picohttpMatchRoute(&request, routes) || !request.route ) {
 		ch = -PICOHTTP_STATUS_404_NOT_FOUND;
@@ -1143,6 +1998,7 @@ void picohttpProcessRequest (
 		ch = -PICOHTTP_STATUS_405_METHOD_NOT_ALLOWED;
 		goto http_error;
 	}
+	picohttpProbe3(route__matched, &request, request.route->urlhead, url);
 
 	if( 0 > (ch = picohttpProcessQuery(&request, ch)) )
 		goto http_error;
@@ -1168,16 +2024,436 @@ void picohttpProcessRequest (
 		}
 	}
 
+	if( PICOHTTP_STATUS_200_OK != (ch = picohttpHeadStatus(&request)) ) {
+		ch = -ch;
+		goto http_error;
+	}
+
 	request.status = PICOHTTP_STATUS_200_OK;
-	request.route->handler(&request);
+	picohttpTrace(PICOHTTP_TRACE_CLASS_REQUEST, PICOHTTP_TRACE_ROUTE,
+		request.method, request.route - routes);
+	picohttpCallHandler(&request);
 
 	picohttpIoFlush(request.ioops);
+	picohttpBodyDrain(&request);
+	picohttpStackEnd(request.route);
 	return;
 
 http_error:
+	picohttpStackPhase(PICOHTTP_STACK_HANDLER);
 
 	picohttpStatusResponse(&request, -ch);
 	picohttpIoFlush(request.ioops);
+	if( picohttpHeadRejected(-ch) ) {
+		picohttpBodyDrain(&request);
+	}
+	picohttpStackEnd(request.route);
+}
+
+/* Push parser states; the request line first, then the header lines */
+#define PICOHTTP_PARSER_METHOD      0
+#define PICOHTTP_PARSER_URL_SP      1
+#define PICOHTTP_PARSER_URL         2
+#define PICOHTTP_PARSER_URL_PCT1    3
+#define PICOHTTP_PARSER_URL_PCT2    4
+#define PICOHTTP_PARSER_QUERY       5
+#define PICOHTTP_PARSER_VERSION_SP  6
+#define PICOHTTP_PARSER_VERSION     7
+#define PICOHTTP_PARSER_MAJOR       8
+#define PICOHTTP_PARSER_MINOR       9
+#define PICOHTTP_PARSER_REQLINE_EOL 10
+#define PICOHTTP_PARSER_REQLINE_CR  11
+#define PICOHTTP_PARSER_LINE        12
+#define PICOHTTP_PARSER_NAME        13
+#define PICOHTTP_PARSER_VALUE_SP    14
+#define PICOHTTP_PARSER_VALUE       15
+#define PICOHTTP_PARSER_HEADER_CR   16
+#define PICOHTTP_PARSER_END_CR      17
+#define PICOHTTP_PARSER_DONE        18
+
+void picohttpParserInit(
+	struct picohttpParser * const p,
+	struct picohttpURLRoute const * const routes,
+	char * const url,
+	struct picohttpAuthData * const authdata,
+	void *userdata )
+{
+	picohttpRequestInit(&p->request, NULL, url, authdata, userdata);
+	p->routes = routes;
+	p->url_max_length = picohttpRoutesMaxUrlLength(routes);
+	memset(url, 0, p->url_max_length+1);
+	p->len = 0;
+	p->state = PICOHTTP_PARSER_METHOD;
+	p->pct = 0;
+	p->skip = 0;
+	memset(p->headername, 0, sizeof(p->headername));
+	memset(p->headervalue, 0, sizeof(p->headervalue));
+	p->request.headers.store = p->headerstore;
+	p->request.headers.size = sizeof(p->headerstore);
+	picohttpProbe1(request__start, &p->request);
+}
+
+static int picohttpParserMethod(char const * const m)
+{
+	if( !strcmp(m, "GET") )
+		return PICOHTTP_METHOD_GET;
+	if( !strcmp(m, "HEAD") )
+		return PICOHTTP_METHOD_HEAD;
+	if( !strcmp(m, "POST") )
+		return PICOHTTP_METHOD_POST;
+	return 0;
+}
+
+/* URL complete; does the routing just like picohttpProcessRequest */
+static int picohttpParserRoute(
+	struct picohttpParser * const p )
+{
+	struct picohttpRequest * const req = &p->request;
+	picohttpNormalizePath(req->url);
+	if( !picohttpMatchRoute(req, p->routes) || !req->route ) {
+		return PICOHTTP_STATUS_404_NOT_FOUND;
+	}
+	if( !(req->route->allowed_methods & req->method) ) {
+		return PICOHTTP_STATUS_405_METHOD_NOT_ALLOWED;
+	}
+	picohttpProbe3(route__matched, req, req->route->urlhead, req->url);
+	return 0;
+}
+
+static void picohttpParserHeaderDone(
+	struct picohttpParser * const p )
+{
+	if( *p->headername && *p->headervalue ) {
+		picohttpProcessHeaderField(
+			&p->request,
+			p->headername,
+			p->headervalue );
+	}
+	/* both are kept terminated as they are filled */
+	p->headername[0] = 0;
+	p->headervalue[0] = 0;
+	p->skip = 0;
+}
+
+/* Feeds a single octet; returns 0 to go on or the final status */
+static int picohttpParserStep(
+	struct picohttpParser * const p,
+	int ch )
+{
+	struct picohttpRequest * const req = &p->request;
+
+	switch( p->state ) {
+	case PICOHTTP_PARSER_METHOD:
+		/* collected in headername, which is unused until the headers */
+		if( ' ' == ch || '\t' == ch ) {
+			req->method = picohttpParserMethod(p->headername);
+			if( !req->method ) {
+				return PICOHTTP_STATUS_501_NOT_IMPLEMENTED;
+			}
+			picohttpProbe2(method__parsed, req, req->method);
+			memset(p->headername, 0, sizeof(p->headername));
+			p->len = 0;
+			p->state = PICOHTTP_PARSER_URL_SP;
+			return 0;
+		}
+		if( 4 <= p->len || picohttpIsCRLF(ch) ) {
+			return PICOHTTP_STATUS_501_NOT_IMPLEMENTED;
+		}
+		p->headername[p->len++] = ch;
+		return 0;
+
+	case PICOHTTP_PARSER_URL_SP:
+		if( ' ' == ch || '\t' == ch ) {
+			return 0;
+		}
+		p->state = PICOHTTP_PARSER_URL;
+		/* fall through */
+	case PICOHTTP_PARSER_URL:
+		if( '?' == ch || picohttpIsLWS(ch) ) {
+			int const e = picohttpParserRoute(p);
+			if( e ) {
+				return e;
+			}
+			p->len = 0;
+			p->state = ( '?' == ch ) ?
+				PICOHTTP_PARSER_QUERY :
+				PICOHTTP_PARSER_VERSION_SP;
+			return ( '?' == ch ) ? 0 : picohttpParserStep(p, ch);
+		}
+		if( '%' == ch ) {
+			p->state = PICOHTTP_PARSER_URL_PCT1;
+			return 0;
+		}
+		break;
+
+	case PICOHTTP_PARSER_URL_PCT1:
+		if( 0 > picohttpHexDigit(ch) ) {
+			return PICOHTTP_STATUS_400_BAD_REQUEST;
+		}
+		p->pct = picohttpHexDigit(ch) << 4;
+		p->state = PICOHTTP_PARSER_URL_PCT2;
+		return 0;
+
+	case PICOHTTP_PARSER_URL_PCT2:
+		if( 0 > picohttpHexDigit(ch) ) {
+			return PICOHTTP_STATUS_400_BAD_REQUEST;
+		}
+		ch = p->pct | picohttpHexDigit(ch);
+		p->state = PICOHTTP_PARSER_URL;
+		break;
+
+	case PICOHTTP_PARSER_QUERY:
+		/* query variables are not evaluated (yet), but their escapes
+		 * are checked as picohttpProcessQuery does; len counts the hex
+		 * digits still to come */
+		if( p->len ) {
+			if( 0 > picohttpHexDigit(ch) ) {
+				return PICOHTTP_STATUS_400_BAD_REQUEST;
+			}
+			p->pct = (p->pct << 4) | picohttpHexDigit(ch);
+			if( !--p->len && !p->pct ) {
+				return PICOHTTP_STATUS_400_BAD_REQUEST;
+			}
+			return 0;
+		}
+		if( '%' == ch ) {
+			p->pct = 0;
+			p->len = 2;
+			return 0;
+		}
+		if( !ch ) {
+			return PICOHTTP_STATUS_400_BAD_REQUEST;
+		}
+		if( picohttpIsLWS(ch) ) {
+			p->state = PICOHTTP_PARSER_VERSION_SP;
+			return picohttpParserStep(p, ch);
+		}
+		return 0;
+
+	case PICOHTTP_PARSER_VERSION_SP:
+		if( ' ' == ch || '\t' == ch ) {
+			return 0;
+		}
+		if( picohttpIsCRLF(ch) ) {
+			/* HTTP/0.9 style request line without version */
+			p->state = PICOHTTP_PARSER_REQLINE_EOL;
+			return picohttpParserStep(p, ch);
+		}
+		p->len = 0;
+		req->httpversion.major = 0;
+		req->httpversion.minor = 0;
+		p->state = PICOHTTP_PARSER_VERSION;
+		/* fall through */
+	case PICOHTTP_PARSER_VERSION:
+		if( PICOHTTP_STR_HTTP_[p->len] != (char)ch ) {
+			return PICOHTTP_STATUS_400_BAD_REQUEST;
+		}
+		if( sizeof(PICOHTTP_STR_HTTP_)-1 == ++p->len ) {
+			p->state = PICOHTTP_PARSER_MAJOR;
+		}
+		return 0;
+
+	case PICOHTTP_PARSER_MAJOR:
+		if( '0' <= ch && '9' >= ch ) {
+			req->httpversion.major *= 10;
+			req->httpversion.major += (ch & 0x0f);
+			return 0;
+		}
+		if( '.' != ch ) {
+			return PICOHTTP_STATUS_400_BAD_REQUEST;
+		}
+		p->state = PICOHTTP_PARSER_MINOR;
+		return 0;
+
+	case PICOHTTP_PARSER_MINOR:
+		if( '0' <= ch && '9' >= ch ) {
+			req->httpversion.minor *= 10;
+			req->httpversion.minor += (ch & 0x0f);
+			return 0;
+		}
+		if( req->httpversion.major > 1 ||
+		    req->httpversion.minor > 1 ) {
+			return PICOHTTP_STATUS_505_HTTP_VERSION_NOT_SUPPORTED;
+		}
+		p->state = PICOHTTP_PARSER_REQLINE_EOL;
+		/* fall through */
+	case PICOHTTP_PARSER_REQLINE_EOL:
+		/* like picohttpIoSkipOverCRLF anything up to EOL is ignored */
+		if( '\r' == ch ) {
+			p->state = PICOHTTP_PARSER_REQLINE_CR;
+		} else
+		if( '\n' == ch ) {
+			p->state = PICOHTTP_PARSER_LINE;
+		}
+		return 0;
+
+	case PICOHTTP_PARSER_REQLINE_CR:
+	case PICOHTTP_PARSER_HEADER_CR:
+		if( '\n' != ch ) {
+			return PICOHTTP_STATUS_400_BAD_REQUEST;
+		}
+		p->state = PICOHTTP_PARSER_LINE;
+		return 0;
+
+	case PICOHTTP_PARSER_LINE:
+		if( ' ' == ch || '\t' == ch ) {
+			/* continuation of the previous header line */
+			p->len = strlen(p->headervalue);
+			p->state = PICOHTTP_PARSER_VALUE_SP;
+			return 0;
+		}
+		picohttpParserHeaderDone(p);
+		if( '\r' == ch ) {
+			p->state = PICOHTTP_PARSER_END_CR;
+			return 0;
+		}
+		if( '\n' == ch ) {
+			p->state = PICOHTTP_PARSER_DONE;
+			return picohttpHeadStatus(req);
+		}
+		if( !ch ) {
+			return PICOHTTP_STATUS_400_BAD_REQUEST;
+		}
+		p->len = 0;
+		p->state = PICOHTTP_PARSER_NAME;
+		/* fall through */
+	case PICOHTTP_PARSER_NAME:
+		if( ':' == ch ) {
+			p->skip = !picohttpRequestHeaderWanted(req, p->headername);
+			p->len = 0;
+			p->state = PICOHTTP_PARSER_VALUE_SP;
+			return 0;
+		}
+		if( picohttpIsCRLF(ch) ) {
+			/* header line without value */
+			p->state = PICOHTTP_PARSER_VALUE;
+			return picohttpParserStep(p, ch);
+		}
+		if( PICOHTTP_HEADERNAME_MAX_LEN > p->len ) {
+			p->headername[p->len++] = ch;
+			p->headername[p->len] = 0;
+		}
+		return 0;
+
+	case PICOHTTP_PARSER_VALUE_SP:
+		if( ' ' == ch || '\t' == ch ) {
+			return 0;
+		}
+		p->state = PICOHTTP_PARSER_VALUE;
+		/* fall through */
+	case PICOHTTP_PARSER_VALUE:
+		if( '\r' == ch ) {
+			p->state = PICOHTTP_PARSER_HEADER_CR;
+			return 0;
+		}
+		if( '\n' == ch ) {
+			p->state = PICOHTTP_PARSER_LINE;
+			return 0;
+		}
+		if( !ch ) {
+			return PICOHTTP_STATUS_400_BAD_REQUEST;
+		}
+		if( !p->skip && PICOHTTP_HEADERVALUE_MAX_LEN > p->len ) {
+			p->headervalue[p->len++] = ch;
+			p->headervalue[p->len] = 0;
+		}
+		return 0;
+
+	case PICOHTTP_PARSER_END_CR:
+		if( '\n' != ch ) {
+			return PICOHTTP_STATUS_400_BAD_REQUEST;
+		}
+		p->state = PICOHTTP_PARSER_DONE;
+		return picohttpHeadStatus(req);
+
+	default:
+		return req->status;
+	}
+
+	/* URL character, possibly percent decoded */
+	if( !ch ) {
+		return PICOHTTP_STATUS_400_BAD_REQUEST;
+	}
+	if( p->len >= p->url_max_length ) {
+		return PICOHTTP_STATUS_414_REQUEST_URI_TOO_LONG;
+	}
+	req->url[p->len++] = ch;
+	return 0;
+}
+
+size_t picohttpParserFeed(
+	struct picohttpParser * const p,
+	void const *buf,
+	size_t len )
+{
+	uint8_t const * const octets = buf;
+	size_t i;
+	for(i = 0; i < len && !p->request.status; i++) {
+		int const status = picohttpParserStep(p, octets[i]);
+		if( status ) {
+			if( PICOHTTP_STATUS_200_OK != status ) {
+				p->state = PICOHTTP_PARSER_DONE;
+			}
+			p->request.status = status;
+		}
+	}
+	return i;
+}
+
+void picohttpParserDispatch(
+	struct picohttpParser * const p,
+	struct picohttpIoOps const * const ioops )
+{
+	struct picohttpRequest * const req = &p->request;
+	req->ioops = ioops;
+	picohttpStackBegin();
+
+	if( PICOHTTP_STATUS_200_OK == req->status ) {
+		picohttpTrace(PICOHTTP_TRACE_CLASS_REQUEST, PICOHTTP_TRACE_ROUTE,
+			req->method, req->route - p->routes);
+		picohttpCallHandler(req);
+		picohttpIoFlush(req->ioops);
+		picohttpBodyDrain(req);
+	} else {
+		picohttpStackPhase(PICOHTTP_STACK_HANDLER);
+		picohttpStatusResponse(req, req->status ?
+			req->status : PICOHTTP_STATUS_400_BAD_REQUEST);
+		picohttpIoFlush(req->ioops);
+		if( picohttpHeadRejected(req->status) ) {
+			picohttpBodyDrain(req);
+		}
+	}
+	picohttpStackEnd(req->route);
+}
+
+/* Formats the value of a Content-Range header; a first offset of
+ * PICOHTTP_RANGE_OPEN gives the "unsatisfied" form. With dest == NULL
+ * only the length is determined. */
+static size_t picohttpFormatContentRange(
+	char *dest,
+	size_t first,
+	size_t last,
+	size_t entitylength )
+{
+	size_t p = 0;
+	if( dest ) {
+		memcpy(dest, PICOHTTP_STR_BYTES, sizeof(PICOHTTP_STR_BYTES)-1);
+		dest[sizeof(PICOHTTP_STR_BYTES)-1] = ' ';
+	}
+	p += sizeof(PICOHTTP_STR_BYTES);
+	if( PICOHTTP_RANGE_OPEN == first ) {
+		if( dest ) dest[p] = '*';
+		p++;
+	} else {
+		p += picohttp_fmt_uint(dest ? dest+p : 0, first);
+		if( dest ) dest[p] = '-';
+		p++;
+		p += picohttp_fmt_uint(dest ? dest+p : 0, last);
+	}
+	if( dest ) dest[p] = '/';
+	p++;
+	p += picohttp_fmt_uint(dest ? dest+p : 0, entitylength);
+	return p;
 }
 
 int picohttpResponseSendHeaders (
@@ -1193,10 +2469,16 @@ int picohttpResponseSendHeaders (
 	if(req->sent.header)
 		return 0;
 
+	picohttpTrace(PICOHTTP_TRACE_CLASS_REQUEST, PICOHTTP_TRACE_RESPONSE,
+		req->status, req->response.contentlength);
+	picohttpProbe4(response__header, req, picohttpProbeUrlhead(req),
+		req->status, req->response.contentlength);
+
 	if(!req->response.contenttype) {
 		req->response.contenttype = "text/plain";
 	}
 
+	size_t p;
 #if defined(PICOHTTP_CONFIG_USE_SNPRINTF)
 	snprintf(tmp, sizeof(tmp)-1, "%s%d.%d %d ",
 	         PICOHTTP_STR_HTTP_,
@@ -1207,7 +2489,7 @@ int picohttpResponseSendHeaders (
 	if( 0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_HTTP_)) )
 		return e;
 
-	size_t p = 0;
+	p = 0;
 	p += picohttp_fmt_uint(tmp+p, req->httpversion.major);
 	tmp[p] = '.'; p++;
 	p += picohttp_fmt_uint(tmp+p, req->httpversion.minor);
@@ -1272,15 +2554,58 @@ int picohttpResponseSendHeaders (
 			return e;
 	}
 
-	/* WWW-Authenticate header */
-	if( req->response.www_authenticate ){
-		if( 0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_WWW_AUTHENTICATE)) ||
+	/* ETag header */
+	if( req->response.etag ) {
+		if( 0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_ETAG)) ||
 		    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CLSP)) ||
 		    0 > (e = picohttpIoWrite(
-				req->ioops, strlen(req->response.www_authenticate),
-				req->response.www_authenticate))  ||
+				req->ioops, strlen(req->response.etag),
+				req->response.etag)) ||
+		    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CRLF)) )
+			return e;
+	}
+
+	/* Accept-Ranges header */
+	if( req->response.range.enabled ) {
+		if( 0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_ACCEPT)) ||
+		    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR__RANGES)) ||
+		    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CLSP)) ||
+		    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_BYTES)) ||
+		    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CRLF)) )
+			return e;
+	}
+
+	/* Content-Range header; multipart/byteranges carry it per part */
+	if( ( PICOHTTP_STATUS_206_PARTIAL_CONTENT == req->status
+	   && 1 == req->response.range.count )
+	 || PICOHTTP_STATUS_416_RANGE_NOT_SATISFIABLE == req->status ) {
+		char contentrange[PICOHTTP_CONTENTRANGE_MAX_LEN];
+		size_t const crlen = (1 == req->response.range.count) ?
+			picohttpFormatContentRange(contentrange,
+				req->response.range.ranges[0].first,
+				req->response.range.ranges[0].last,
+				req->response.range.entitylength) :
+			picohttpFormatContentRange(contentrange,
+				PICOHTTP_RANGE_OPEN, 0,
+				req->response.range.entitylength);
+		if( 0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CONTENT)) ||
+		    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR__RANGE)) ||
+		    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CLSP)) ||
+		    0 > (e = picohttpIoWrite(req->ioops, crlen, contentrange)) ||
+		    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CRLF)) )
+			return e;
+	}
+
+	/* WWW-Authenticate header; one per '\n' separated challenge */
+	for(c = req->response.www_authenticate; c && *c; ) {
+		char const * const eol = strchr(c, '\n');
+		size_t const len = eol ? (size_t)(eol - c) : strlen(c);
+		if( 0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_WWW_AUTHENTICATE)) ||
+		    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CLSP)) ||
+		    0 > (e = picohttpIoWrite(req->ioops, len, c))  ||
 		    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CRLF)) )
 			return e;
+		c += eol ? len + 1 : len;
 	}
 
 	if( 0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CRLF)) )
@@ -1291,6 +2616,268 @@ int picohttpResponseSendHeaders (
 #undef picohttpIO_WRITE_STATIC_STR
 }
 
+/* multipart/byteranges part delimiter and headers:
+ *   <CR><LF>--boundary<CR><LF>
+ *   Content-Type: ...<CR><LF>
+ *   Content-Range: bytes first-last/length<CR><LF>
+ *   <CR><LF>
+ * the final delimiter being <CR><LF>--boundary--<CR><LF>
+ */
+static size_t picohttpRangePartHeaderLength(
+	struct picohttpRequest * const req,
+	struct picohttpByteRange const * const r )
+{
+	return 2 + 2 + sizeof(PICOHTTP_STR_BYTERANGES_BOUNDARY)-1 + 2 +
+		sizeof(PICOHTTP_STR_CONTENT)-1 +
+		sizeof(PICOHTTP_STR__TYPE)-1 +
+		sizeof(PICOHTTP_STR_CLSP)-1 +
+		strlen(req->response.range.contenttype) + 2 +
+		sizeof(PICOHTTP_STR_CONTENT)-1 +
+		sizeof(PICOHTTP_STR__RANGE)-1 +
+		sizeof(PICOHTTP_STR_CLSP)-1 +
+		picohttpFormatContentRange(NULL,
+			r->first, r->last,
+			req->response.range.entitylength) + 2 +
+		2;
+}
+
+static int picohttpRangeWritePartHeader(
+	struct picohttpRequest * const req,
+	struct picohttpByteRange const * const r )
+{
+#define picohttpIO_WRITE_STATIC_STR(x) \
+	(picohttpIoWrite(req->ioops, sizeof(x)-1, x))
+
+	char contentrange[PICOHTTP_CONTENTRANGE_MAX_LEN];
+	size_t const crlen = picohttpFormatContentRange(contentrange,
+		r->first, r->last,
+		req->response.range.entitylength);
+	int e;
+
+	if( 0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CRLF)) ||
+	    0 > (e = picohttpIoWrite(req->ioops, 2, "--")) ||
+	    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_BYTERANGES_BOUNDARY)) ||
+	    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CRLF)) ||
+	    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CONTENT)) ||
+	    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR__TYPE)) ||
+	    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CLSP)) ||
+	    0 > (e = picohttpIoWrite(
+			req->ioops, strlen(req->response.range.contenttype),
+			req->response.range.contenttype)) ||
+	    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CRLF)) ||
+	    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CONTENT)) ||
+	    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR__RANGE)) ||
+	    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CLSP)) ||
+	    0 > (e = picohttpIoWrite(req->ioops, crlen, contentrange)) ||
+	    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CRLF)) ||
+	    0 > (e = picohttpIO_WRITE_STATIC_STR(PICOHTTP_STR_CRLF)) )
+		return e;
+
+	req->sent.octets += picohttpRangePartHeaderLength(req, r);
+	return 0;
+
+#undef picohttpIO_WRITE_STATIC_STR
+}
+
+static int picohttpRangeWriteClosingDelimiter(
+	struct picohttpRequest * const req )
+{
+	int e;
+	if( 0 > (e = picohttpIoWrite(req->ioops, 4, "\r\n--")) ||
+	    0 > (e = picohttpIoWrite(req->ioops,
+			sizeof(PICOHTTP_STR_BYTERANGES_BOUNDARY)-1,
+			PICOHTTP_STR_BYTERANGES_BOUNDARY)) ||
+	    0 > (e = picohttpIoWrite(req->ioops, 4, "--\r\n")) )
+		return e;
+
+	req->sent.octets += 4 + sizeof(PICOHTTP_STR_BYTERANGES_BOUNDARY)-1 + 4;
+	return 0;
+}
+
+int picohttpResponseRanges (
+	struct picohttpRequest * const req,
+	size_t entitylength,
+	char const *validator )
+{
+	struct picohttpByteRange * const rs = req->response.range.ranges;
+	size_t n = 0;
+
+	req->response.range.enabled = 1;
+	req->response.range.entitylength = entitylength;
+	req->response.range.offset = 0;
+	req->response.range.count = 0;
+	req->response.range.current = 0;
+	req->response.range.partheader = 0;
+
+	/* RFC-7233 defines Range for GET only */
+	if( PICOHTTP_METHOD_GET != req->method
+	 || !req->query.range.count
+	 || req->sent.header ) {
+		return 0;
+	}
+
+	/* If-Range compares strongly (RFC-7233 3.2): weak entity tags
+	 * never match, not even themselves */
+	if( req->query.range.conditional
+	 && ( 1 != req->query.range.conditional
+	   || !validator
+	   || !strncmp(validator, "W/", 2)
+	   || strcmp(validator, req->query.range.ifrange) ) ) {
+		/* entity changed since the client got its part; send all */
+		return 0;
+	}
+
+	for(size_t i = 0; i < req->query.range.count; i++) {
+		struct picohttpByteRange r = req->query.range.ranges[i];
+
+		if( PICOHTTP_RANGE_OPEN == r.first ) {
+			/* suffix range */
+			if( !r.last || !entitylength ) {
+				continue;
+			}
+			r.first = (r.last < entitylength) ?
+				entitylength - r.last : 0;
+			r.last = entitylength - 1;
+		} else {
+			if( r.first >= entitylength ) {
+				continue;
+			}
+			if( r.last >= entitylength ) {
+				r.last = entitylength - 1;
+			}
+		}
+
+		/* keep ranges sorted and coalesce overlapping or adjacent
+		 * ones, so that the entity can be streamed front to back */
+		size_t j = n;
+		while( j && rs[j-1].first > r.first ) {
+			rs[j] = rs[j-1];
+			j--;
+		}
+		rs[j] = r;
+		n++;
+	}
+	for(size_t i = 1; i < n; ) {
+		if( rs[i].first <= rs[i-1].last + 1 ) {
+			if( rs[i].last > rs[i-1].last ) {
+				rs[i-1].last = rs[i].last;
+			}
+			memmove(rs+i, rs+i+1, (n-i-1) * sizeof(*rs));
+			n--;
+		} else {
+			i++;
+		}
+	}
+
+	if( !n ) {
+		req->response.contentlength = 0;
+		picohttpStatusResponse(req,
+			PICOHTTP_STATUS_416_RANGE_NOT_SATISFIABLE);
+		return -PICOHTTP_STATUS_416_RANGE_NOT_SATISFIABLE;
+	}
+
+	req->status = PICOHTTP_STATUS_206_PARTIAL_CONTENT;
+	req->response.range.count = n;
+
+	if( 1 == n ) {
+		req->response.contentlength = rs[0].last - rs[0].first + 1;
+		return n;
+	}
+
+	if(!req->response.contenttype) {
+		req->response.contenttype = "text/plain";
+	}
+	req->response.range.contenttype = req->response.contenttype;
+	req->response.contenttype = PICOHTTP_STR_MULTIPART_BYTERANGES;
+
+	size_t contentlength = 4 + sizeof(PICOHTTP_STR_BYTERANGES_BOUNDARY)-1 + 4;
+	for(size_t i = 0; i < n; i++) {
+		contentlength += picohttpRangePartHeaderLength(req, rs + i)
+			+ rs[i].last - rs[i].first + 1;
+	}
+	req->response.contentlength = contentlength;
+
+	return n;
+}
+
+size_t picohttpResponseNextOffset (
+	struct picohttpRequest * const req )
+{
+	if( !req->response.range.count ) {
+		return req->sent.octets;
+	}
+	if( req->response.range.current >= req->response.range.count ) {
+		return req->response.range.entitylength;
+	}
+
+	struct picohttpByteRange const * const r =
+		req->response.range.ranges + req->response.range.current;
+	if( req->response.range.offset < r->first ) {
+		req->response.range.offset = r->first;
+	}
+	return req->response.range.offset;
+}
+
+/* Writes the parts of the entity data in buf that fall into the selected
+ * ranges. Returns the number of entity octets consumed. */
+static int picohttpResponseWriteRanges (
+	struct picohttpRequest * const req,
+	size_t len,
+	void const *buf )
+{
+	char const *b = buf;
+	size_t const consumed = len;
+	size_t offset = req->response.range.offset;
+	int e;
+
+	while( len && req->response.range.current < req->response.range.count ) {
+		struct picohttpByteRange const * const r =
+			req->response.range.ranges + req->response.range.current;
+
+		if( offset < r->first ) {
+			size_t const skip = r->first - offset;
+			if( skip >= len ) {
+				break;
+			}
+			b += skip;
+			len -= skip;
+			offset = r->first;
+		}
+
+		if( 1 < req->response.range.count
+		 && !req->response.range.partheader ) {
+			if( 0 > (e = picohttpRangeWritePartHeader(req, r)) )
+				return e;
+			req->response.range.partheader = 1;
+		}
+
+		size_t n = r->last - offset + 1;
+		if( n > len ) {
+			n = len;
+		}
+		if( 0 > (e = picohttpIoWrite(req->ioops, n, b)) )
+			return e;
+		req->sent.octets += n;
+		offset += n;
+		b += n;
+		len -= n;
+
+		if( offset > r->last ) {
+			req->response.range.current++;
+			req->response.range.partheader = 0;
+			if( 1 < req->response.range.count
+			 && req->response.range.current == req->response.range.count ) {
+				if( 0 > (e = picohttpRangeWriteClosingDelimiter(req)) )
+					return e;
+			}
+		}
+	}
+
+	/* whatever is left lies before the next or after the last range */
+	req->response.range.offset = offset + len;
+	return consumed;
+}
+
 int picohttpResponseWrite (
 	struct picohttpRequest * const req,
 	size_t len,
@@ -1301,6 +2888,9 @@ int picohttpResponseWrite (
 	if( !req->sent.header )
 		picohttpResponseSendHeaders(req);
 
+	if( req->response.range.count )
+		return picohttpResponseWriteRanges(req, len, buf);
+
 	if( req->response.contentlength > 0 ) {
 		if(req->sent.octets >= req->response.contentlength)
 			return -1;
@@ -1513,6 +3103,53 @@ struct picohttpMultipart picohttpMultipartStart(
 	return mp;
 }
 
+/* Part headers are read by the header parser, straight off the
+ * connection; counted here so that they are accounted for as body. */
+struct picohttpMultipartHeadIo {
+	struct picohttpIoOps ioops;
+	struct picohttpIoOps const *inner;
+	size_t octets;
+};
+
+static int picohttpMultipartHeadGetch(void *data)
+{
+	struct picohttpMultipartHeadIo * const io = data;
+	int const ch = picohttpIoGetch(io->inner);
+	if( 0 <= ch ) {
+		io->octets++;
+	}
+	return ch;
+}
+
+static int picohttpMultipartHeaders(
+	struct picohttpMultipart * const mp,
+	size_t headervalue_maxlen,
+	char * const headervalue,
+	int ch )
+{
+	struct picohttpRequest * const req = mp->req;
+	struct picohttpMultipartHeadIo io = {
+		.ioops = {
+			.getch = picohttpMultipartHeadGetch,
+			.data = &io
+		},
+		.inner = req->ioops,
+		.octets = 0
+	};
+	req->ioops = &io.ioops;
+	ch = picohttpProcessHeaders(
+		req,
+		headervalue_maxlen,
+		headervalue,
+		NULL,
+		picohttpMultipartHeaderField,
+		mp,
+		ch);
+	req->ioops = io.inner;
+	req->received_octets += io.octets;
+	return ch;
+}
+
 int picohttpMultipartNext(
 	struct picohttpMultipart * const mp)
 {
@@ -1536,17 +3173,15 @@ int picohttpMultipartNext(
 					return ch;
 
 				memset(headervalbuf, 0, sizeof(headervalbuf));
-				if( 0 > (ch = picohttpProcessHeaders(
-						mp->req,
+				if( 0 > (ch = picohttpMultipartHeaders(
+						mp,
 						sizeof(headervalbuf),
 						headervalbuf,
-						picohttpMultipartHeaderField,
-						mp,
 						ch)) )
 					return ch;
 
 				if( '\r' == ch ) {	
-					if( 0 > (ch = picohttpIoGetch(mp->req->ioops)) )
+					if( 0 > (ch = picohttpGetch(mp->req)) )
 						return ch;
 					if( '\n' != ch ) {
 						return -1;
@@ -1556,6 +3191,9 @@ int picohttpMultipartNext(
 				mp->in_boundary = 
 				mp->replayhead = 0;
 
+				picohttpProbe3(multipart__part, mp->req,
+					picohttpProbeUrlhead(mp->req),
+					mp->req->received_octets);
 				return 0;
 			}
 		}
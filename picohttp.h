@@ -30,6 +30,54 @@
 #define PICOHTTP_MULTIPARTBOUNDARY_MAX_LEN 74
 #define PICOHTTP_DISPOSITION_NAME_MAX 48
 
+/* number of byte ranges accepted in a single Range header;
+ * set to 1 to disable multipart/byteranges responses */
+#ifndef PICOHTTP_RANGES_MAX
+#define PICOHTTP_RANGES_MAX 4
+#endif
+/* If-Range carries either an entity tag or a HTTP-date */
+#define PICOHTTP_IFRANGE_MAX_LEN 40
+
+/* a body left unread by the handler or rejected is read off the
+ * connection if no more than this remains, so that the client sees the
+ * response rather than a reset */
+#ifndef PICOHTTP_DRAIN_MAX
+#define PICOHTTP_DRAIN_MAX 65536
+#endif
+
+/* picohttpRequestBodyToFd writes to a POSIX file descriptor; the
+ * block is what it copies at a time where the transport can't splice */
+#ifndef PICOHTTP_NO_BODYTOFD
+#if defined(__unix__) || defined(__APPLE__)
+#define PICOHTTP_NO_BODYTOFD 0
+#else
+#define PICOHTTP_NO_BODYTOFD 1
+#endif
+#endif
+#ifndef PICOHTTP_BODYTOFD_BLOCK
+#define PICOHTTP_BODYTOFD_BLOCK 512
+#endif
+
+/* room for the values of the request headers a route declares, see
+ * picohttpRequestHeader */
+#ifndef PICOHTTP_ROUTE_HEADERS_MAX
+#define PICOHTTP_ROUTE_HEADERS_MAX 4
+#endif
+#ifndef PICOHTTP_ROUTE_HEADERS_LEN
+#define PICOHTTP_ROUTE_HEADERS_LEN 256
+#endif
+
+#define PICOHTTP_HEADERNAME_MAX_LEN 32
+/* longer header values get truncated; Digest authorization pushes
+ * quite some data */
+#ifndef PICOHTTP_HEADERVALUE_MAX_LEN
+#if PICOHTTP_NO_DIGEST_AUTH
+#define PICOHTTP_HEADERVALUE_MAX_LEN 255
+#else
+#define PICOHTTP_HEADERVALUE_MAX_LEN 767
+#endif
+#endif
+
 #define PICOHTTP_METHOD_GET  1
 #define PICOHTTP_METHOD_HEAD 2
 #define PICOHTTP_METHOD_POST 4
@@ -59,14 +107,21 @@
 #define PICOHTTP_CODING_CHUNKED  8
 
 #define PICOHTTP_STATUS_200_OK 200
+#define PICOHTTP_STATUS_206_PARTIAL_CONTENT 206
 #define PICOHTTP_STATUS_400_BAD_REQUEST 400
 #define PICOHTTP_STATUS_401_UNAUTHORIZED 401
 #define PICOHTTP_STATUS_403_FORBIDDEN 402
 #define PICOHTTP_STATUS_404_NOT_FOUND 404
 #define PICOHTTP_STATUS_405_METHOD_NOT_ALLOWED 405
+#define PICOHTTP_STATUS_408_REQUEST_TIMEOUT 408
+#define PICOHTTP_STATUS_413_PAYLOAD_TOO_LARGE 413
 #define PICOHTTP_STATUS_414_REQUEST_URI_TOO_LONG 414
+#define PICOHTTP_STATUS_415_UNSUPPORTED_MEDIA_TYPE 415
+#define PICOHTTP_STATUS_416_RANGE_NOT_SATISFIABLE 416
+#define PICOHTTP_STATUS_417_EXPECTATION_FAILED 417
 #define PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR 500
 #define PICOHTTP_STATUS_501_NOT_IMPLEMENTED 501
+#define PICOHTTP_STATUS_503_SERVICE_UNAVAILABLE 503
 #define PICOHTTP_STATUS_505_HTTP_VERSION_NOT_SUPPORTED 505
 
 struct picohttpIoOps {
@@ -76,6 +131,13 @@ struct picohttpIoOps {
 	int (*putch)(int, void*);
 	int (*flush)(void*);
 	void *data;
+	/* optional; moves up to count octets of input to the file
+	 * descriptor without passing them through user space, returns the
+	 * number moved, negative on error */
+	int (*splice)(size_t /*count*/, int /*fd*/, void*);
+	/* set by wrappers like picohttpIoStats to the operations they
+	 * wrap, so that a wrapper can still be found under others */
+	struct picohttpIoOps const *inner;
 };
 
 #define picohttpIoWrite(ioops,size,buf) (ioops->write(size, buf, ioops->data))
@@ -83,6 +145,7 @@ struct picohttpIoOps {
 #define picohttpIoGetch(ioops)          (ioops->getch(ioops->data))
 #define picohttpIoPutch(ioops,c)        (ioops->putch(c, ioops->data))
 #define picohttpIoFlush(ioops)          (ioops->flush(ioops->data))
+#define picohttpIoSplice(ioops,size,fd) (ioops->splice(size, fd, ioops->data))
 
 enum picohttpVarType {
 	PICOHTTP_TYPE_UNDEFINED = 0,
@@ -119,6 +182,18 @@ struct picohttpURLRoute {
 	picohttpHandler handler;
 	unsigned int max_urltail_len;
 	int allowed_methods;
+	/* request bodies larger than this are refused with 413 before the
+	 * handler runs; chunked ones when the handler reads the chunk that
+	 * takes them past it. 0: no limit */
+	size_t max_body;
+	/* PICOHTTP_CONTENTTYPE_* of acceptable bodies, 0 terminated; a major
+	 * type admits all of its subtypes. Others are refused with 415.
+	 * NULL: any */
+	int const *content_types;
+	/* names of the request headers the handler reads through
+	 * picohttpRequestHeader, NULL terminated. Headers neither the
+	 * route nor the library has use for are skipped unread. */
+	char const * const *headers;
 };
 
 #define PICOHTTP_EPOCH_YEAR 1970
@@ -132,6 +207,30 @@ struct picohttpDateTime {
 	unsigned int s:5; /* seconds / 2 */
 };
 
+#define PICOHTTP_AUTH_BASIC  1
+#define PICOHTTP_AUTH_DIGEST 2
+
+#define PICOHTTP_DIGEST_MD5    1
+#define PICOHTTP_DIGEST_SHA256 2
+#define PICOHTTP_DIGEST_SESS   0x80
+
+#define PICOHTTP_QOP_AUTH 1
+
+/* server nonces are 16 random octets in hex */
+#define PICOHTTP_DIGEST_NONCE_LEN 32
+#define PICOHTTP_DIGEST_CNONCE_MAX_LEN 64
+/* the digest-uri goes into HA2 as the client sent it; longer ones
+ * fail verification */
+#ifndef PICOHTTP_DIGEST_URI_MAX_LEN
+#define PICOHTTP_DIGEST_URI_MAX_LEN 255
+#endif
+
+struct picohttpDigestNonceCache;
+struct picohttpAuthCache;
+
+/* truncated HMAC-SHA256 identifying cached credentials */
+#define PICOHTTP_AUTHCACHE_MAC_LEN 16
+
 struct picohttpAuthData {
 	size_t const username_maxlen;
 	char  * const username;
@@ -143,13 +242,42 @@ struct picohttpAuthData {
 	size_t const pwresponse_maxlen;
 	char * const pwresponse;
 
-#if 0
-	size_t const uri_maxlen;
-	char * const uri;
-#endif
-
 	unsigned int message_qop;
 	uint32_t nonce_count;
+
+	/* scheme of the credentials found in the request, 0 if none */
+	uint8_t scheme;
+
+#if !PICOHTTP_NO_AUTHCACHE
+	/* optional; if set Basic credentials verified before by the
+	 * application (see picohttpAuthVerified) are flagged verified */
+	struct picohttpAuthCache *cache;
+	uint8_t verified;
+	uint8_t mac[PICOHTTP_AUTHCACHE_MAC_LEN];
+#endif
+
+#if !PICOHTTP_NO_DIGEST_AUTH
+	/* setting this enables Digest authentication challenges */
+	struct picohttpDigestNonceCache *nonces;
+
+	uint8_t algorithm;
+	uint8_t stale;
+	char nonce[PICOHTTP_DIGEST_NONCE_LEN+1];
+	char cnonce[PICOHTTP_DIGEST_CNONCE_MAX_LEN+1];
+	/* verified against the requested URL, and hashed into HA2 */
+	char uri[PICOHTTP_DIGEST_URI_MAX_LEN+1];
+#endif
+};
+
+/* A byte range as found in a Range header. Suffix ranges ("-500")
+ * are marked by first == PICOHTTP_RANGE_OPEN, open ended ranges
+ * ("9500-") by last == PICOHTTP_RANGE_OPEN. Once resolved against
+ * the entity length both bounds are inclusive entity offsets. */
+#define PICOHTTP_RANGE_OPEN ((size_t)-1)
+
+struct picohttpByteRange {
+	size_t first;
+	size_t last;
 };
 
 struct picohttpRequest {
@@ -167,27 +295,63 @@ struct picohttpRequest {
 	struct {
 		int contenttype;
 		size_t contentlength;
+		/* the body is framed by a Content-Length, or it was chunked
+		 * and has been read up to its end; contentlength is the length
+		 * of it then. Requests with neither have no body. */
+		uint8_t lengthknown;
 		uint8_t contentencoding;
 		uint8_t transferencoding;
 		char multipartboundary[PICOHTTP_MULTIPARTBOUNDARY_MAX_LEN+1];
 		size_t chunklength;
+		/* 1: the client waits for 100 Continue before sending the
+		 * body, 2: it expects something we can't meet */
+		uint8_t expect;
 		struct picohttpAuthData *auth;
+		struct {
+			uint8_t count;
+			struct picohttpByteRange ranges[PICOHTTP_RANGES_MAX];
+			/* 0: unconditional, 1: If-Range given, 2: unusable */
+			uint8_t conditional;
+			char ifrange[PICOHTTP_IFRANGE_MAX_LEN+1];
+		} range;
 	} query;
 	struct {
 		char const *contenttype;
 		char const *disposition;
 		char const *www_authenticate;
+		char const *etag;
 		struct picohttpDateTime lastmodified;
 		int max_age;
 		size_t contentlength;
 		uint8_t contentencoding;
 		uint8_t transferencoding;
+		struct {
+			size_t entitylength;
+			size_t offset; /* entity offset of next written octet */
+			uint8_t enabled;
+			uint8_t count;
+			uint8_t current;
+			uint8_t partheader;
+			char const *contenttype; /* of the parts in multipart */
+			struct picohttpByteRange ranges[PICOHTTP_RANGES_MAX];
+		} range;
 	} response;
 	size_t received_octets;
 	struct {
 		size_t octets;
 		uint8_t header;
 	} sent;
+	/* values of the route's headers, NUL terminated in store */
+	struct {
+		char *store;
+		uint16_t size;
+		uint16_t len;
+		uint8_t count;
+		struct {
+			uint8_t name;    /* index in route->headers */
+			uint16_t offset;
+		} index[PICOHTTP_ROUTE_HEADERS_MAX];
+	} headers;
 	void *userdata;
 };
 
@@ -204,6 +368,20 @@ struct picohttpMultipart {
 	int mismatch;
 };
 
+/* Push parser state for a request head; see picohttpParserFeed */
+struct picohttpParser {
+	struct picohttpRequest request;
+	struct picohttpURLRoute const *routes;
+	size_t url_max_length;
+	size_t len;    /* of the token being parsed */
+	uint8_t state;
+	uint8_t pct;   /* percent escape decoded so far */
+	uint8_t skip;  /* the value of the current header is of no use */
+	char headername[PICOHTTP_HEADERNAME_MAX_LEN+1];
+	char headervalue[PICOHTTP_HEADERVALUE_MAX_LEN+1];
+	char headerstore[PICOHTTP_ROUTE_HEADERS_LEN];
+};
+
 typedef void (*picohttpHeaderFieldCallback)(
 	void * const data,
 	char const *headername,
@@ -212,12 +390,49 @@ typedef void (*picohttpHeaderFieldCallback)(
 size_t picohttpRoutesMaxUrlLength(
 	struct picohttpURLRoute const * const routes );
 
+/* Brings a decoded path into the canonical form routes and handlers
+ * see: dot segments removed, repeated slashes collapsed; in place. */
+void picohttpNormalizePath(char * const url);
+
 void picohttpProcessRequest(
 	struct picohttpIoOps const * const ioops,
 	struct picohttpURLRoute const * const routes,
 	struct picohttpAuthData * const authdata,
 	void *userdata );
 
+/* Non-blocking alternative to picohttpProcessRequest for event driven
+ * hosts: the request head is pushed into the parser as it arrives and
+ * the handler runs only once all of it is there.
+ *
+ * url must hold picohttpRoutesMaxUrlLength(routes)+1 chars and, like
+ * authdata, stay valid until the request has been dispatched. */
+void picohttpParserInit(
+	struct picohttpParser * const p,
+	struct picohttpURLRoute const * const routes,
+	char * const url,
+	struct picohttpAuthData * const authdata,
+	void *userdata );
+
+/* Parses up to len octets of buf, resuming wherever the previous call
+ * stopped, even in the middle of a token. Returns the number of octets
+ * consumed; parsing stops right after the request head, so any octets
+ * left over in buf are the start of the request body.
+ *
+ * p->request.status stays 0 while more input is needed; it becomes
+ * PICOHTTP_STATUS_200_OK once the head is complete or holds the error
+ * status the request is to be answered with. */
+size_t picohttpParserFeed(
+	struct picohttpParser * const p,
+	void const *buf,
+	size_t len );
+
+/* Answers a request whose head picohttpParserFeed completed: runs the
+ * route handler, or sends the error status. The body, if any, is read
+ * through ioops, starting with the octets picohttpParserFeed left. */
+void picohttpParserDispatch(
+	struct picohttpParser * const p,
+	struct picohttpIoOps const * const ioops );
+
 void picohttpStatusResponse(
 	struct picohttpRequest *req, int status );
 
@@ -234,8 +449,73 @@ int picohttpResponseWrite (
 	size_t len,
 	void const *buf );
 
+/* Selects the part of an entity of entitylength octets to be sent in
+ * reply to a Range request. validator is the entity tag (as sent in
+ * response.etag) or the Last-Modified date the If-Range header is
+ * compared against; may be
+ * NULL, in which case conditional range requests get the full entity.
+ * The comparison is a strong one: a weak (W/) validator or If-Range
+ * gets the full entity as well.
+ *
+ * Must be called before the first picohttpResponseWrite. Afterwards the
+ * handler writes the entity through picohttpResponseWrite as if it sent
+ * the whole of it; octets outside the selected ranges are dropped.
+ *
+ * Returns the number of ranges being sent (0 for a full 200 response).
+ * If the requested ranges can not be satisfied a 416 response is sent
+ * and -PICOHTTP_STATUS_416_RANGE_NOT_SATISFIABLE is returned; the handler
+ * should return then. */
+int picohttpResponseRanges (
+	struct picohttpRequest * const req,
+	size_t entitylength,
+	char const *validator );
+
+/* Entity offset the next picohttpResponseWrite is expected to start at.
+ * Octets the selected ranges don't cover are skipped, so handlers with
+ * seekable data sources (files) seek there instead of reading and
+ * writing data that gets dropped anyway. Returns the entity length
+ * once all ranges have been sent. */
+size_t picohttpResponseNextOffset (
+	struct picohttpRequest * const req );
+
 int picohttpGetch(struct picohttpRequest * const req);
 
+/* Value of a request header the route declared in its headers list;
+ * NULL if the request had none, or it didn't fit in with the others.
+ * Of repeated headers the first is kept. */
+char const *picohttpRequestHeader(
+	struct picohttpRequest const * const req,
+	char const *name );
+
+/* Reads up to len octets of the request body; returns the number read,
+ * 0 at the end of the body, negative on error. */
+int picohttpRead(
+	struct picohttpRequest * const req,
+	size_t len,
+	char * const buf );
+
+#if !PICOHTTP_NO_BODYTOFD
+/* Writes the request body, as received (identity or chunked, e.g.
+ * application/octet-stream), to fd. Spliced if the transport supports
+ * that, copied in blocks otherwise. Bodies longer than maxlen (0 for no
+ * limit) are not taken.
+ *
+ * Returns the number of octets written, or -1 if the body was too long
+ * or could not be read or written; fd is left at an undefined offset
+ * then. */
+int64_t picohttpRequestBodyToFd(
+	struct picohttpRequest * const req,
+	int fd,
+	uint64_t maxlen );
+#endif
+
+/* Whether buf is an interim (1xx) response the library wrote; those go
+ * out in a single write, ahead of the actual response. For picohttpIoOps
+ * wrappers looking at the response head. */
+int picohttpIsInterimResponse(
+	size_t count,
+	void const *buf );
+
 struct picohttpMultipart picohttpMultipartStart(
 	struct picohttpRequest * const req);
 
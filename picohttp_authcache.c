@@ -0,0 +1,171 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "picohttp_authcache.h"
+
+#include "picohttp_sha256.h"
+
+#include <string.h>
+
+#if !PICOHTTP_NO_AUTHCACHE
+
+static void picohttpAuthCacheLock(
+	struct picohttpAuthCache * const cache )
+{
+	if( cache->lock )
+		cache->lock(cache->data);
+}
+
+static void picohttpAuthCacheUnlock(
+	struct picohttpAuthCache * const cache )
+{
+	if( cache->unlock )
+		cache->unlock(cache->data);
+}
+
+void picohttpAuthCacheInit(
+	struct picohttpAuthCache * const cache )
+{
+	picohttpAuthCacheLock(cache);
+	cache->random(sizeof(cache->key), cache->key, cache->data);
+	memset(cache->entries, 0, sizeof(cache->entries));
+	picohttpAuthCacheUnlock(cache);
+}
+
+void picohttpAuthCacheMac(
+	struct picohttpAuthCache * const cache,
+	char const *authorization,
+	uint8_t mac[PICOHTTP_AUTHCACHE_MAC_LEN] )
+{
+	/* HMAC-SHA256 (RFC-2104); the key is exactly one hash output
+	 * long and thus shorter than the block size */
+	uint8_t pad[64];
+	uint8_t digest[PHSHA256_DIGEST_LEN];
+	struct phsha256ctx ctx;
+
+	memset(pad, 0x36, sizeof(pad));
+	for(size_t i = 0; i < sizeof(cache->key); i++)
+		pad[i] ^= cache->key[i];
+	phsha256init(&ctx);
+	phsha256update(&ctx, sizeof(pad), pad);
+	phsha256update(&ctx, strlen(authorization), authorization);
+	phsha256final(&ctx, digest);
+
+	memset(pad, 0x5c, sizeof(pad));
+	for(size_t i = 0; i < sizeof(cache->key); i++)
+		pad[i] ^= cache->key[i];
+	phsha256init(&ctx);
+	phsha256update(&ctx, sizeof(pad), pad);
+	phsha256update(&ctx, sizeof(digest), digest);
+	phsha256final(&ctx, digest);
+
+	memcpy(mac, digest, PICOHTTP_AUTHCACHE_MAC_LEN);
+}
+
+static size_t picohttpAuthCacheSlot(
+	uint8_t const mac[PICOHTTP_AUTHCACHE_MAC_LEN] )
+{
+	/* the MAC is uniformly distributed, any of its bits will do */
+	uint32_t const h =  (uint32_t)mac[0]
+	                 | ((uint32_t)mac[1] << 8)
+	                 | ((uint32_t)mac[2] << 16)
+	                 | ((uint32_t)mac[3] << 24);
+	return h % PICOHTTP_AUTHCACHE_ENTRIES;
+}
+
+static int picohttpAuthCacheMacEqual(
+	uint8_t const *a,
+	uint8_t const *b )
+{
+	/* constant time; doesn't leak how many leading octets matched */
+	uint8_t diff = 0;
+	for(size_t i = 0; i < PICOHTTP_AUTHCACHE_MAC_LEN; i++)
+		diff |= a[i] ^ b[i];
+	return !diff;
+}
+
+int picohttpAuthCacheLookup(
+	struct picohttpAuthCache * const cache,
+	uint8_t const mac[PICOHTTP_AUTHCACHE_MAC_LEN] )
+{
+	int found = 0;
+	size_t const slot = picohttpAuthCacheSlot(mac);
+
+	picohttpAuthCacheLock(cache);
+	uint32_t const now = cache->now(cache->data);
+	for(size_t i = 0; i < PICOHTTP_AUTHCACHE_WAYS; i++) {
+		struct picohttpAuthCacheEntry * const e = cache->entries +
+			(slot + i) % PICOHTTP_AUTHCACHE_ENTRIES;
+		if( !e->verified ) {
+			continue;
+		}
+		if( now - e->verified >= cache->ttl ) {
+			e->verified = 0;
+			continue;
+		}
+		found |= picohttpAuthCacheMacEqual(e->mac, mac);
+	}
+	picohttpAuthCacheUnlock(cache);
+
+	return found;
+}
+
+void picohttpAuthVerified(
+	struct picohttpRequest * const req )
+{
+	struct picohttpAuthData * const auth = req->query.auth;
+	if( !auth
+	 || !auth->cache
+	 || PICOHTTP_AUTH_BASIC != auth->scheme
+	 || auth->verified ) {
+		return;
+	}
+	struct picohttpAuthCache * const cache = auth->cache;
+	size_t const slot = picohttpAuthCacheSlot(auth->mac);
+
+	picohttpAuthCacheLock(cache);
+	uint32_t now = cache->now(cache->data);
+	if( !now ) {
+		/* 0 marks unused entries */
+		now = 1;
+	}
+
+	/* replace a free or expired slot, or else the oldest one */
+	struct picohttpAuthCacheEntry *victim = NULL;
+	for(size_t i = 0; i < PICOHTTP_AUTHCACHE_WAYS; i++) {
+		struct picohttpAuthCacheEntry * const e = cache->entries +
+			(slot + i) % PICOHTTP_AUTHCACHE_ENTRIES;
+		if( !e->verified || now - e->verified >= cache->ttl ) {
+			victim = e;
+			break;
+		}
+		if( !victim || now - e->verified > now - victim->verified ) {
+			victim = e;
+		}
+	}
+	memcpy(victim->mac, auth->mac, PICOHTTP_AUTHCACHE_MAC_LEN);
+	victim->verified = now;
+
+	picohttpAuthCacheUnlock(cache);
+	auth->verified = 1;
+}
+
+#endif/*!PICOHTTP_NO_AUTHCACHE*/
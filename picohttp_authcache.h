@@ -0,0 +1,87 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_AUTHCACHE_H
+#define PICOHTTP_AUTHCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "picohttp.h"
+
+/* Cache of recently verified Basic auth credentials, so that
+ * applications using expensive password checks (KDFs) run them once
+ * per client session instead of once per request.
+ *
+ * Entries are identified by a HMAC-SHA256 of the raw Authorization
+ * header value under a random per-cache key; neither user names nor
+ * passwords are kept. */
+
+#ifndef PICOHTTP_AUTHCACHE_ENTRIES
+#define PICOHTTP_AUTHCACHE_ENTRIES 32
+#endif
+/* number of consecutive slots an entry may be placed in */
+#define PICOHTTP_AUTHCACHE_WAYS 4
+
+struct picohttpAuthCacheEntry {
+	uint8_t mac[PICOHTTP_AUTHCACHE_MAC_LEN];
+	uint32_t verified; /* 0: unused */
+};
+
+struct picohttpAuthCache {
+	struct picohttpAuthCacheEntry entries[PICOHTTP_AUTHCACHE_ENTRIES];
+	uint8_t key[32];
+	uint32_t ttl; /* seconds */
+
+	uint32_t (*now)(void*);                   /* seconds, monotonic */
+	void (*random)(size_t, uint8_t*, void*);  /* must be unpredictable */
+	void (*lock)(void*);                      /* optional */
+	void (*unlock)(void*);                    /* optional */
+	void *data;
+};
+
+/* Generates a fresh key and drops all entries; call after setting up
+ * the callbacks, and whenever cached credentials must be revoked
+ * (password changes, user removal). */
+void picohttpAuthCacheInit(
+	struct picohttpAuthCache * const cache );
+
+/* Looks up the MAC of the credentials the request carried.
+ * Returns 1 on a live entry. Used by the header parser, which sets
+ * picohttpAuthData.verified from it. */
+int picohttpAuthCacheLookup(
+	struct picohttpAuthCache * const cache,
+	uint8_t const mac[PICOHTTP_AUTHCACHE_MAC_LEN] );
+
+/* Computes the cache MAC of a raw Authorization header value. */
+void picohttpAuthCacheMac(
+	struct picohttpAuthCache * const cache,
+	char const *authorization,
+	uint8_t mac[PICOHTTP_AUTHCACHE_MAC_LEN] );
+
+/* To be called by the application after it verified the credentials of
+ * the request itself; following requests carrying the same credentials
+ * get picohttpAuthData.verified set until the entry's TTL runs out. */
+void picohttpAuthVerified(
+	struct picohttpRequest * const req );
+
+#endif/*PICOHTTP_AUTHCACHE_H*/
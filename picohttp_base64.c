@@ -21,45 +21,72 @@
 
 #include "picohttp_base64.h"
 
+#include <string.h>
+
+#if !defined(PHB64_NO_SIMD)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PHB64_USE_AVX2 1
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define PHB64_USE_SSSE3 1
+#endif
+#endif
+
+static char const phb64_enctab[64] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#define PHB64_DEC_INVALID 0xff
+#define PHB64_DEC_PAD     0xfe
+#define PHB64_DEC_SPACE   0xfd
+
+static uint8_t const phb64_dectab[256] = {
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xfd,0xfd,0xff,0xff,0xfd,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xfd,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0x3e,0xff,0xff,0xff,0x3f,
+	0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x3b,0x3c,0x3d,0xff,0xff,0xff,0xfe,0xff,0xff,
+	0xff,0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,
+	0x0f,0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,0x18,0x19,0xff,0xff,0xff,0xff,0xff,
+	0xff,0x1a,0x1b,0x1c,0x1d,0x1e,0x1f,0x20,0x21,0x22,0x23,0x24,0x25,0x26,0x27,0x28,
+	0x29,0x2a,0x2b,0x2c,0x2d,0x2e,0x2f,0x30,0x31,0x32,0x33,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff
+};
+
+/* phb64state_t layout */
+#define PHB64_STATE_VALUE(s)  ((s) & 0x00ffffff)
+#define PHB64_STATE_COUNT(s)  (((s) >> 24) & 0x03)
+#define PHB64_STATE_PAD(s)    (((s) >> 26) & 0x03)
+#define PHB64_STATE_ENDED     ((phb64state_t)1 << 28)
+#define PHB64_STATE_PACK(value, count, pad) \
+	( ((phb64state_t)(value) & 0x00ffffff) \
+	| ((phb64state_t)(count) << 24) \
+	| ((phb64state_t)(pad) << 26) )
+
 void phb64encode(
 	phb64raw_t const raw,
 	size_t count,
 	phb64enc_t enc)
 {
-	enc[1] = 0;
-	enc[3] = 0xff;
-	enc[2] = (count > 1) ? 0 : 0xff;
-
-	switch(count) {
-	default:
+	if( !count || 3 < count ) {
 		return;
-	case 3:
-		enc[3] = ((raw[2] & 0x3f));
-		enc[2] = ((raw[2] & 0xc0) >> 6);
-	case 2:
-		enc[2] |= ((raw[1] & 0x0f) << 2);
-		enc[1]  = ((raw[1] & 0xf0) >> 4);
-	case 1:
-		enc[1] |= ((raw[0] & 0x03) << 4);
-		enc[0]  = ((raw[0] & 0xfc) >> 2);
 	}
+	uint32_t const v =
+		  ((uint32_t)raw[0] << 16)
+		| ((count > 1) ? (uint32_t)raw[1] << 8 : 0)
+		| ((count > 2) ? (uint32_t)raw[2] : 0);
 
-	for(int i = 0; i < 4; i++) {
-		if( 26 > enc[i] ) {
-			enc[i] = enc[i] + 'A';
-		} else
-		if( 52 > enc[i] ) {
-			enc[i] = (enc[i]-26) + 'a';
-		} else
-		if( 62 > enc[i] ) {
-			enc[i] = (enc[i]-52) + '0';
-		} else
-		switch( enc[i] ) {
-		case 62: enc[i] = '+'; break;
-		case 63: enc[i] = '/'; break;
-		default: enc[i] = '=';
-		}
-	}
+	enc[0] = phb64_enctab[(v >> 18) & 0x3f];
+	enc[1] = phb64_enctab[(v >> 12) & 0x3f];
+	enc[2] = (count > 1) ? phb64_enctab[(v >> 6) & 0x3f] : '=';
+	enc[3] = (count > 2) ? phb64_enctab[v & 0x3f] : '=';
 }
 
 size_t phb64decode(
@@ -67,31 +94,376 @@ size_t phb64decode(
 	phb64raw_t raw)
 {
 	size_t count = 3;
-	phb64enc_t v;
+	uint32_t v = 0;
 	for(int i = 0; i < 4; i++) {
-		if( 'A' <= enc[i] && 'Z' >= enc[i] ) {
-			v[i] = enc[i] - 'A';
-		} else
-		if( 'a' <= enc[i] && 'z' >= enc[i] ) {
-			v[i] = enc[i] - 'a' + 26;
-		} else
-		if( '0' <= enc[i] && '9' >= enc[i] ) {
-			v[i] = enc[i] - '0' + 52;
+		uint8_t const d = phb64_dectab[(uint8_t)enc[i]];
+		v <<= 6;
+		if( 0x40 > d ) {
+			v |= d;
 		} else
-		switch(enc[i]) {
-		case '+': v[i] = 62; break;
-		case '/': v[i] = 63; break;
-		case 0: /* slightly deviating from the RFC, but reasonable */
-		case '=': v[i] = 0;  count--; break;
-		default:
-			  return 0;
+		/* NUL slightly deviating from the RFC, but reasonable */
+		if( PHB64_DEC_PAD == d || !enc[i] ) {
+			count--;
+		} else {
+			return 0;
 		}
 	}
 
-	raw[0] = ((v[0] & 0x3f) << 2) | ((v[1] & 0x30) >> 4);
-	raw[1] = ((v[1] & 0x0f) << 4) | ((v[2] & 0x3c) >> 2);
-	raw[2] = ((v[2] & 0x03) << 6) | ( v[3] & 0x3f );
+	raw[0] = (uint8_t)(v >> 16);
+	raw[1] = (uint8_t)(v >> 8);
+	raw[2] = (uint8_t)(v);
 
 	return count;
 }
 
+#if PHB64_USE_SSSE3
+/* 12 octets -> 16 characters; reads 16 octets from raw.
+ * W. Mula, D. Lemire: "Faster Base64 Encoding and Decoding
+ * Using AVX2 Instructions", ACM TOW 2018 */
+static inline __m128i phb64_enc_sextets_ssse3(__m128i in)
+{
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	__m128i const t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	__m128i const t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	__m128i const t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	__m128i const t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t1, t3);
+}
+
+static inline __m128i phb64_enc_ascii_ssse3(__m128i const sextets)
+{
+	__m128i r = _mm_subs_epu8(sextets, _mm_set1_epi8(51));
+	__m128i const less = _mm_cmpgt_epi8(_mm_set1_epi8(26), sextets);
+	r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+	r = _mm_shuffle_epi8(_mm_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+		'/' - 63, 'A', 0, 0), r);
+	return _mm_add_epi8(r, sextets);
+}
+
+/* 16 characters -> 12 octets, 16 octets get stored; returns 0 if the
+ * block contains anything but base64 alphabet characters */
+static inline int phb64_dec_block_ssse3(
+	char const *enc,
+	uint8_t *raw )
+{
+	__m128i const in = _mm_loadu_si128((__m128i const*)enc);
+	__m128i const hi_nibbles = _mm_and_si128(
+		_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+	__m128i const lo_nibbles = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+	__m128i const lo = _mm_shuffle_epi8(_mm_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a), lo_nibbles);
+	__m128i const hi = _mm_shuffle_epi8(_mm_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10), hi_nibbles);
+	if( 0xffff != _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_and_si128(lo, hi), _mm_setzero_si128())) ) {
+		return 0;
+	}
+
+	__m128i const eq_2f = _mm_cmpeq_epi8(in, _mm_set1_epi8(0x2f));
+	__m128i const roll = _mm_shuffle_epi8(_mm_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0),
+		_mm_add_epi8(eq_2f, hi_nibbles));
+	__m128i const sextets = _mm_add_epi8(in, roll);
+
+	__m128i const ab_bc = _mm_maddubs_epi16(sextets,
+		_mm_set1_epi32(0x01400140));
+	__m128i const abc = _mm_madd_epi16(ab_bc, _mm_set1_epi32(0x00011000));
+	__m128i const out = _mm_shuffle_epi8(abc, _mm_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	_mm_storeu_si128((__m128i*)raw, out);
+	return 1;
+}
+#endif/*PHB64_USE_SSSE3*/
+
+#if PHB64_USE_AVX2
+/* AVX2 variants of the above; pshufb works per 128 bit lane, so each
+ * lane is handled exactly like the SSSE3 code does */
+static inline void phb64_enc_block_avx2(
+	uint8_t const *raw,
+	char *enc )
+{
+	__m256i in = _mm256_inserti128_si256(
+		_mm256_castsi128_si256(_mm_loadu_si128((__m128i const*)raw)),
+		_mm_loadu_si128((__m128i const*)(raw + 12)), 1);
+	in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	__m256i const t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+	__m256i const t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+	__m256i const t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+	__m256i const t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+	__m256i const sextets = _mm256_or_si256(t1, t3);
+
+	__m256i r = _mm256_subs_epu8(sextets, _mm256_set1_epi8(51));
+	__m256i const less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), sextets);
+	r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+	r = _mm256_shuffle_epi8(_mm256_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+		'/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+		'/' - 63, 'A', 0, 0), r);
+	_mm256_storeu_si256((__m256i*)enc, _mm256_add_epi8(r, sextets));
+}
+
+static inline int phb64_dec_block_avx2(
+	char const *enc,
+	uint8_t *raw )
+{
+	__m256i const in = _mm256_loadu_si256((__m256i const*)enc);
+	__m256i const hi_nibbles = _mm256_and_si256(
+		_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0f));
+	__m256i const lo_nibbles = _mm256_and_si256(in, _mm256_set1_epi8(0x0f));
+	__m256i const lo = _mm256_shuffle_epi8(_mm256_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a), lo_nibbles);
+	__m256i const hi = _mm256_shuffle_epi8(_mm256_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10), hi_nibbles);
+	if( !_mm256_testz_si256(lo, hi) ) {
+		return 0;
+	}
+
+	__m256i const eq_2f = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(0x2f));
+	__m256i const roll = _mm256_shuffle_epi8(_mm256_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0),
+		_mm256_add_epi8(eq_2f, hi_nibbles));
+	__m256i const sextets = _mm256_add_epi8(in, roll);
+
+	__m256i const ab_bc = _mm256_maddubs_epi16(sextets,
+		_mm256_set1_epi32(0x01400140));
+	__m256i abc = _mm256_madd_epi16(ab_bc, _mm256_set1_epi32(0x00011000));
+	abc = _mm256_shuffle_epi8(abc, _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	abc = _mm256_permutevar8x32_epi32(abc,
+		_mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+	_mm256_storeu_si256((__m256i*)raw, abc);
+	return 1;
+}
+#endif/*PHB64_USE_AVX2*/
+
+/* bulk encoding of whole quanta; returns the number of octets consumed */
+static size_t phb64_encode_quanta(
+	size_t len,
+	uint8_t const *raw,
+	char *enc )
+{
+	size_t i = 0;
+	char *e = enc;
+#if PHB64_USE_AVX2
+	for(; len - i >= 28; i += 24, e += 32) {
+		phb64_enc_block_avx2(raw + i, e);
+	}
+#endif
+#if PHB64_USE_SSSE3
+	for(; len - i >= 16; i += 12, e += 16) {
+		__m128i const in = _mm_loadu_si128((__m128i const*)(raw + i));
+		_mm_storeu_si128((__m128i*)e,
+			phb64_enc_ascii_ssse3(phb64_enc_sextets_ssse3(in)));
+	}
+#endif
+	for(; len - i >= 3; i += 3, e += 4) {
+		uint32_t const v =
+			  ((uint32_t)raw[i] << 16)
+			| ((uint32_t)raw[i+1] << 8)
+			|  (uint32_t)raw[i+2];
+		e[0] = phb64_enctab[(v >> 18) & 0x3f];
+		e[1] = phb64_enctab[(v >> 12) & 0x3f];
+		e[2] = phb64_enctab[(v >> 6) & 0x3f];
+		e[3] = phb64_enctab[v & 0x3f];
+	}
+	return i;
+}
+
+size_t phb64_encode_buf(
+	phb64state_t *state,
+	size_t len,
+	void const *raw_,
+	char *enc)
+{
+	uint8_t const *raw = raw_;
+	char *e = enc;
+	uint32_t value = 0;
+	unsigned count = 0;
+
+	if( state ) {
+		value = PHB64_STATE_VALUE(*state);
+		count = PHB64_STATE_COUNT(*state);
+	}
+
+	/* complete a quantum left over from the previous call */
+	if( count ) {
+		uint8_t q[3];
+		for(unsigned i = 0; i < count; i++) {
+			q[i] = (uint8_t)(value >> (8 * (count - 1 - i)));
+		}
+		while( count < 3 && len ) {
+			q[count++] = *raw++;
+			len--;
+		}
+		if( 3 > count ) {
+			*state = PHB64_STATE_PACK(
+				(count > 1) ? (q[0] << 8) | q[1] : q[0], count, 0);
+			return 0;
+		}
+		e += 4 * (phb64_encode_quanta(3, q, e) / 3);
+		count = 0;
+	}
+
+	size_t const done = phb64_encode_quanta(len, raw, e);
+	e += 4 * (done / 3);
+	raw += done;
+	len -= done;
+
+	if( state ) {
+		*state = PHB64_STATE_PACK(
+			(len > 1) ? (raw[0] << 8) | raw[1] : (len ? raw[0] : 0),
+			len, 0);
+	} else
+	if( len ) {
+		phb64encode(raw, len, e);
+		e += 4;
+	}
+
+	return e - enc;
+}
+
+size_t phb64_encode_final(
+	phb64state_t *state,
+	char *enc)
+{
+	unsigned const count = PHB64_STATE_COUNT(*state);
+	uint32_t const value = PHB64_STATE_VALUE(*state);
+	*state = PHB64_STATE_INIT;
+	if( !count ) {
+		return 0;
+	}
+	phb64raw_t const q = {
+		(uint8_t)(value >> (8 * (count - 1))),
+		(uint8_t)value,
+		0 };
+	phb64encode(q, count, enc);
+	return 4;
+}
+
+size_t phb64_decode_buf(
+	phb64state_t *state,
+	size_t len,
+	char const *enc,
+	void *raw_)
+{
+	uint8_t * const raw = raw_;
+	uint8_t *r = raw;
+	uint32_t value = 0;
+	unsigned count = 0;
+	unsigned pad = 0;
+	int ended = 0;
+
+	if( state ) {
+		value = PHB64_STATE_VALUE(*state);
+		count = PHB64_STATE_COUNT(*state);
+		pad   = PHB64_STATE_PAD(*state);
+		ended = !!(*state & PHB64_STATE_ENDED);
+	}
+
+	for(size_t i = 0; i < len; ) {
+		if( !count && !ended ) {
+			/* at a quantum boundary; try the bulk decoders,
+			 * they bail out on whitespace and padding */
+#if PHB64_USE_AVX2
+			while( len - i >= 48 && phb64_dec_block_avx2(enc + i, r) ) {
+				i += 32;
+				r += 24;
+			}
+#endif
+#if PHB64_USE_SSSE3
+			while( len - i >= 24 && phb64_dec_block_ssse3(enc + i, r) ) {
+				i += 16;
+				r += 12;
+			}
+#endif
+			if( i >= len ) {
+				break;
+			}
+		}
+
+		uint8_t const d = phb64_dectab[(uint8_t)enc[i++]];
+		if( PHB64_DEC_SPACE == d ) {
+			continue;
+		}
+		if( PHB64_DEC_INVALID == d ) {
+			return PHB64_ERROR;
+		}
+		if( PHB64_DEC_PAD == d ) {
+			if( ended || 2 > count ) {
+				return PHB64_ERROR;
+			}
+			pad++;
+			value <<= 6;
+		} else {
+			if( ended || pad ) {
+				return PHB64_ERROR;
+			}
+			value = (value << 6) | d;
+		}
+
+		if( 4 == ++count ) {
+			r[0] = (uint8_t)(value >> 16);
+			if( 2 > pad ) r[1] = (uint8_t)(value >> 8);
+			if( 1 > pad ) r[2] = (uint8_t)(value);
+			r += 3 - pad;
+			ended = !!pad;
+			value = count = pad = 0;
+		}
+	}
+
+	if( state ) {
+		*state = PHB64_STATE_PACK(value, count, pad)
+			| (ended ? PHB64_STATE_ENDED : 0);
+		return r - raw;
+	}
+
+	phb64state_t s = PHB64_STATE_PACK(value, count, pad);
+	size_t const tail = phb64_decode_final(&s, r);
+	if( PHB64_ERROR == tail ) {
+		return PHB64_ERROR;
+	}
+	return (r - raw) + tail;
+}
+
+size_t phb64_decode_final(
+	phb64state_t *state,
+	void *raw_)
+{
+	uint8_t * const raw = raw_;
+	unsigned const count = PHB64_STATE_COUNT(*state);
+	unsigned const pad = PHB64_STATE_PAD(*state);
+	uint32_t const value = PHB64_STATE_VALUE(*state) << (6 * (4 - count));
+	*state = PHB64_STATE_INIT;
+
+	/* missing padding is tolerated, a lone sextet isn't */
+	switch( count - pad ) {
+	case 0:
+		return 0;
+	case 2:
+		raw[0] = (uint8_t)(value >> 16);
+		return 1;
+	case 3:
+		raw[0] = (uint8_t)(value >> 16);
+		raw[1] = (uint8_t)(value >> 8);
+		return 2;
+	}
+	return PHB64_ERROR;
+}
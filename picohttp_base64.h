@@ -28,7 +28,18 @@
 
 typedef uint8_t phb64raw_t[3];
 typedef char phb64enc_t[4];
+
+/* Streaming state of the buffer codec; carries the octets (encoder) or
+ * sextets (decoder) of an incomplete quantum between calls.
+ * Initialize with PHB64_STATE_INIT. */
 typedef uint32_t phb64state_t;
+#define PHB64_STATE_INIT 0
+
+/* upper bounds of the output of the buffer codec */
+#define PHB64_ENCODED_LEN(n) ((((n) + 2) / 3) * 4)
+#define PHB64_DECODED_MAX(n) ((((n) + 3) / 4) * 3)
+
+#define PHB64_ERROR ((size_t)-1)
 
 void phb64encode(
 	phb64raw_t const raw,
@@ -39,4 +50,39 @@ size_t phb64decode(
 	phb64enc_t const enc,
 	phb64raw_t raw);
 
+/* Encodes len octets from raw to enc, returning the number of characters
+ * written. With state == NULL raw is the complete input and the output
+ * gets padded; enc must hold PHB64_ENCODED_LEN(len) characters.
+ * Otherwise up to 2 trailing octets are kept in *state for the next call
+ * or phb64_encode_final; enc must hold PHB64_ENCODED_LEN(len+2). */
+size_t phb64_encode_buf(
+	phb64state_t *state,
+	size_t len,
+	void const *raw,
+	char *enc);
+
+/* Flushes the octets kept in *state as a padded final quantum; enc must
+ * hold 4 characters. Returns the number of characters written. */
+size_t phb64_encode_final(
+	phb64state_t *state,
+	char *enc);
+
+/* Decodes len characters from enc to raw, returning the number of
+ * octets written or PHB64_ERROR on invalid input. Whitespace is skipped.
+ * raw must hold PHB64_DECODED_MAX(len) octets (PHB64_DECODED_MAX(len+3)
+ * when streaming). With state == NULL enc is the complete input, missing
+ * padding is tolerated. Otherwise an incomplete quantum is kept in
+ * *state for the next call; phb64_decode_final flushes it. */
+size_t phb64_decode_buf(
+	phb64state_t *state,
+	size_t len,
+	char const *enc,
+	void *raw);
+
+/* Completes a streamed decode; raw must hold 2 octets. Returns the
+ * number of octets written or PHB64_ERROR. */
+size_t phb64_decode_final(
+	phb64state_t *state,
+	void *raw);
+
 #endif/*PICOHTTP_BASE64_H*/
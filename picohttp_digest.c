@@ -0,0 +1,351 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* HTTP Digest authentication, RFC-7616 with qop=auth */
+
+#include "picohttp_digest.h"
+#include "picohttp_trace.h"
+
+#include "picohttp_md5.h"
+#include "picohttp_sha256.h"
+
+#include <string.h>
+#include <stdbool.h>
+
+#if !PICOHTTP_NO_DIGEST_AUTH
+
+union phdigestctx {
+	struct phmd5ctx md5;
+	struct phsha256ctx sha256;
+};
+
+/* hex digest of the largest hash + terminating 0 */
+#define PHDIGEST_HEX_MAX (2*PHSHA256_DIGEST_LEN + 1)
+
+static char const phdigest_hexdigits[] = "0123456789abcdef";
+
+static void phdigestinit(
+	uint8_t algorithm,
+	union phdigestctx *ctx )
+{
+	if( PICOHTTP_DIGEST_SHA256 == (algorithm & ~PICOHTTP_DIGEST_SESS) )
+		phsha256init(&ctx->sha256);
+	else
+		phmd5init(&ctx->md5);
+}
+
+static void phdigestupdate(
+	uint8_t algorithm,
+	union phdigestctx *ctx,
+	size_t len,
+	void const *data )
+{
+	if( PICOHTTP_DIGEST_SHA256 == (algorithm & ~PICOHTTP_DIGEST_SESS) )
+		phsha256update(&ctx->sha256, len, data);
+	else
+		phmd5update(&ctx->md5, len, data);
+}
+
+#define phdigestupdatestr(a,c,s) (phdigestupdate(a, c, strlen(s), s))
+#define phdigestupdatecolon(a,c) (phdigestupdate(a, c, 1, ":"))
+
+static void phdigestfinalhex(
+	uint8_t algorithm,
+	union phdigestctx *ctx,
+	char hex[PHDIGEST_HEX_MAX] )
+{
+	uint8_t digest[PHSHA256_DIGEST_LEN];
+	size_t len;
+	if( PICOHTTP_DIGEST_SHA256 == (algorithm & ~PICOHTTP_DIGEST_SESS) ) {
+		phsha256final(&ctx->sha256, digest);
+		len = PHSHA256_DIGEST_LEN;
+	} else {
+		phmd5final(&ctx->md5, digest);
+		len = PHMD5_DIGEST_LEN;
+	}
+	for(size_t i = 0; i < len; i++) {
+		hex[2*i]   = phdigest_hexdigits[digest[i] >> 4];
+		hex[2*i+1] = phdigest_hexdigits[digest[i] & 0x0f];
+	}
+	hex[2*len] = 0;
+}
+
+static void picohttpDigestLock(
+	struct picohttpDigestNonceCache * const cache )
+{
+	if( cache->lock )
+		cache->lock(cache->data);
+}
+
+static void picohttpDigestUnlock(
+	struct picohttpDigestNonceCache * const cache )
+{
+	if( cache->unlock )
+		cache->unlock(cache->data);
+}
+
+void picohttpDigestNonceIssue(
+	struct picohttpDigestNonceCache * const cache,
+	char nonce[PICOHTTP_DIGEST_NONCE_LEN+1] )
+{
+	uint8_t raw[PICOHTTP_DIGEST_NONCE_LEN/2];
+	cache->random(sizeof(raw), raw, cache->data);
+	for(size_t i = 0; i < sizeof(raw); i++) {
+		nonce[2*i]   = phdigest_hexdigits[raw[i] >> 4];
+		nonce[2*i+1] = phdigest_hexdigits[raw[i] & 0x0f];
+	}
+	nonce[PICOHTTP_DIGEST_NONCE_LEN] = 0;
+
+	picohttpDigestLock(cache);
+	uint32_t const now = cache->now(cache->data);
+
+	/* take a free slot, or else the one issued longest ago */
+	struct picohttpDigestNonce *slot = cache->nonces;
+	for(size_t i = 0; i < PICOHTTP_DIGEST_NONCES; i++) {
+		struct picohttpDigestNonce * const n = cache->nonces + i;
+		if( !n->value[0] ) {
+			slot = n;
+			break;
+		}
+		if( now - n->issued > now - slot->issued ) {
+			slot = n;
+		}
+	}
+	memcpy(slot->value, nonce, PICOHTTP_DIGEST_NONCE_LEN+1);
+	slot->issued = now;
+	slot->nc_max = 0;
+	slot->nc_seen = 0;
+
+	picohttpDigestUnlock(cache);
+}
+
+int picohttpDigestNonceUse(
+	struct picohttpDigestNonceCache * const cache,
+	char const *nonce,
+	uint32_t nc )
+{
+	int ret = -1;
+
+	if( !nc ) {
+		return 0;
+	}
+
+	picohttpDigestLock(cache);
+	uint32_t const now = cache->now(cache->data);
+
+	for(size_t i = 0; i < PICOHTTP_DIGEST_NONCES; i++) {
+		struct picohttpDigestNonce * const n = cache->nonces + i;
+		if( !n->value[0]
+		 || strncmp(n->value, nonce, PICOHTTP_DIGEST_NONCE_LEN+1) ) {
+			continue;
+		}
+
+		if( now - n->issued > cache->lifetime ) {
+			n->value[0] = 0;
+			break;
+		}
+
+		/* Requests on parallel connections may arrive slightly out
+		 * of order, hence a sliding window instead of requiring
+		 * strictly increasing nonce-counts. */
+		ret = 0;
+		if( nc > n->nc_max ) {
+			uint32_t const shift = nc - n->nc_max;
+			n->nc_seen = (shift >= 32) ? 0 : (n->nc_seen << shift);
+			if( n->nc_max && shift <= 32 ) {
+				n->nc_seen |= (uint32_t)1 << (shift - 1);
+			}
+			n->nc_max = nc;
+			ret = 1;
+		} else
+		if( nc < n->nc_max && n->nc_max - nc <= 32 ) {
+			uint32_t const bit = (uint32_t)1 << (n->nc_max - nc - 1);
+			if( !(n->nc_seen & bit) ) {
+				n->nc_seen |= bit;
+				ret = 1;
+			}
+		}
+		break;
+	}
+
+	picohttpDigestUnlock(cache);
+	return ret;
+}
+
+/* Compares the digest-uri directive with the request path, decoded
+ * and normalized like the latter. */
+static bool picohttpDigestUriMatches(
+	char const *uri,
+	char const *url )
+{
+	char const *scheme = strstr(uri, "://");
+	if( scheme ) {
+		uri = strchr(scheme + 3, '/');
+		if( !uri ) {
+			return false;
+		}
+	}
+
+	/* decoding never makes it longer */
+	char path[PICOHTTP_DIGEST_URI_MAX_LEN+1];
+	size_t len = 0;
+	while( *uri && '?' != *uri ) {
+		int ch = *uri++;
+		if( '%' == ch ) {
+			int v = 0;
+			for(int i = 0; i < 2; i++, uri++) {
+				int const c = *uri | 0x20;
+				if( '0' <= c && '9' >= c ) {
+					v = (v << 4) | (c - '0');
+				} else
+				if( 'a' <= c && 'f' >= c ) {
+					v = (v << 4) | (c - 'a' + 10);
+				} else {
+					return false;
+				}
+			}
+			ch = v;
+		}
+		if( !ch ) {
+			return false;
+		}
+		path[len++] = ch;
+	}
+	path[len] = 0;
+	picohttpNormalizePath(path);
+	return !strcmp(path, url);
+}
+
+static char const *picohttpDigestMethodString(int method)
+{
+	switch(method) {
+	case PICOHTTP_METHOD_GET:
+		return "GET";
+	case PICOHTTP_METHOD_HEAD:
+		return "HEAD";
+	case PICOHTTP_METHOD_POST:
+		return "POST";
+	}
+	return "";
+}
+
+int picohttpAuthDigestVerify(
+	struct picohttpRequest * const req,
+	char const *realm,
+	char const *password )
+{
+	struct picohttpAuthData * const auth = req->query.auth;
+	if( !auth
+	 || !auth->nonces
+	 || PICOHTTP_AUTH_DIGEST != auth->scheme
+	 || PICOHTTP_QOP_AUTH != auth->message_qop ) {
+		return 0;
+	}
+
+	if( !picohttpDigestUriMatches(auth->uri, req->url) ) {
+		picohttpTrace(PICOHTTP_TRACE_CLASS_AUTH,
+			PICOHTTP_TRACE_AUTH_URI_MISMATCH, 0, 0);
+		return 0;
+	}
+
+	/* RFC 7616, 3.4: the realm of the challenge; if the application
+	 * doesn't keep the client's, a different one fails on HA1 */
+	if( auth->realm && strcmp(auth->realm, realm) ) {
+		picohttpTrace(PICOHTTP_TRACE_CLASS_AUTH,
+			PICOHTTP_TRACE_AUTH_REJECT, picohttpTracePack("realm"), 0);
+		return 0;
+	}
+
+	uint8_t const a = auth->algorithm;
+	union phdigestctx ctx;
+	char ha1[PHDIGEST_HEX_MAX];
+	char ha2[PHDIGEST_HEX_MAX];
+	char response[PHDIGEST_HEX_MAX];
+
+	/* HA1 = H(username:realm:password) */
+	phdigestinit(a, &ctx);
+	phdigestupdatestr(a, &ctx, auth->username);
+	phdigestupdatecolon(a, &ctx);
+	phdigestupdatestr(a, &ctx, realm);
+	phdigestupdatecolon(a, &ctx);
+	phdigestupdatestr(a, &ctx, password);
+	phdigestfinalhex(a, &ctx, ha1);
+
+	if( a & PICOHTTP_DIGEST_SESS ) {
+		/* HA1 = H(H(username:realm:password):nonce:cnonce) */
+		phdigestinit(a, &ctx);
+		phdigestupdatestr(a, &ctx, ha1);
+		phdigestupdatecolon(a, &ctx);
+		phdigestupdatestr(a, &ctx, auth->nonce);
+		phdigestupdatecolon(a, &ctx);
+		phdigestupdatestr(a, &ctx, auth->cnonce);
+		phdigestfinalhex(a, &ctx, ha1);
+	}
+
+	/* HA2 = H(method:digest-uri) */
+	phdigestinit(a, &ctx);
+	phdigestupdatestr(a, &ctx, picohttpDigestMethodString(req->method));
+	phdigestupdatecolon(a, &ctx);
+	phdigestupdatestr(a, &ctx, auth->uri);
+	phdigestfinalhex(a, &ctx, ha2);
+
+	/* response = H(HA1:nonce:nc:cnonce:qop:HA2) */
+	char nc[9];
+	for(int i = 0; i < 8; i++) {
+		nc[i] = phdigest_hexdigits[(auth->nonce_count >> (28 - 4*i)) & 0x0f];
+	}
+	nc[8] = 0;
+
+	phdigestinit(a, &ctx);
+	phdigestupdatestr(a, &ctx, ha1);
+	phdigestupdatecolon(a, &ctx);
+	phdigestupdatestr(a, &ctx, auth->nonce);
+	phdigestupdatecolon(a, &ctx);
+	phdigestupdate(a, &ctx, 8, nc);
+	phdigestupdatecolon(a, &ctx);
+	phdigestupdatestr(a, &ctx, auth->cnonce);
+	phdigestupdatecolon(a, &ctx);
+	phdigestupdate(a, &ctx, 4, "auth");
+	phdigestupdatecolon(a, &ctx);
+	phdigestupdatestr(a, &ctx, ha2);
+	phdigestfinalhex(a, &ctx, response);
+
+	/* constant time compare */
+	size_t const len = strlen(response);
+	uint8_t diff = (strlen(auth->pwresponse) != len);
+	for(size_t i = 0; i < len && auth->pwresponse[i]; i++) {
+		diff |= (uint8_t)(response[i] ^ auth->pwresponse[i]);
+	}
+	if( diff ) {
+		return 0;
+	}
+
+	switch( picohttpDigestNonceUse(auth->nonces, auth->nonce, auth->nonce_count) ) {
+	case 1:
+		return 1;
+	case -1:
+		auth->stale = 1;
+		break;
+	}
+	return 0;
+}
+
+#endif/*!PICOHTTP_NO_DIGEST_AUTH*/
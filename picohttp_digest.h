@@ -0,0 +1,80 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_DIGEST_H
+#define PICOHTTP_DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "picohttp.h"
+
+/* Number of outstanding server nonces. Each nonce may be used for
+ * any number of requests (with increasing nonce-count) until it
+ * expires or its slot gets reused for a new challenge. */
+#ifndef PICOHTTP_DIGEST_NONCES
+#define PICOHTTP_DIGEST_NONCES 16
+#endif
+
+struct picohttpDigestNonce {
+	char value[PICOHTTP_DIGEST_NONCE_LEN+1];
+	uint32_t issued;
+	uint32_t nc_max;
+	uint32_t nc_seen; /* bit n set: nc_max-1-n has been used */
+};
+
+struct picohttpDigestNonceCache {
+	struct picohttpDigestNonce nonces[PICOHTTP_DIGEST_NONCES];
+	uint32_t lifetime; /* seconds */
+
+	uint32_t (*now)(void*);                   /* seconds, monotonic */
+	void (*random)(size_t, uint8_t*, void*);  /* must be unpredictable */
+	void (*lock)(void*);                      /* optional */
+	void (*unlock)(void*);                    /* optional */
+	void *data;
+};
+
+/* Creates a fresh nonce in the cache, evicting the oldest one if
+ * needed, and copies it to nonce. */
+void picohttpDigestNonceIssue(
+	struct picohttpDigestNonceCache * const cache,
+	char nonce[PICOHTTP_DIGEST_NONCE_LEN+1] );
+
+/* Records the use of nonce with nonce-count nc.
+ * Returns 1 if the nonce is valid and nc hasn't been seen before,
+ * 0 on a replayed nc and -1 if the nonce is unknown or expired. */
+int picohttpDigestNonceUse(
+	struct picohttpDigestNonceCache * const cache,
+	char const *nonce,
+	uint32_t nc );
+
+/* Verifies the Digest credentials of a request against password, for
+ * the realm given to picohttpAuthRequired; credentials for any other
+ * realm are rejected. Returns 1 if the credentials are valid. On a
+ * correct response with a stale nonce auth->stale is set, so that the
+ * following picohttpAuthRequired tells the client to just retry. */
+int picohttpAuthDigestVerify(
+	struct picohttpRequest * const req,
+	char const *realm,
+	char const *password );
+
+#endif/*PICOHTTP_DIGEST_H*/
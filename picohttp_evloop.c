@@ -0,0 +1,586 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#define _GNU_SOURCE
+
+#include "picohttp_evloop.h"
+#include "picohttp_timer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define PICOHTTP_EVLOOP_EVENTS 64
+
+/* A parser along with the buffers it points into */
+struct picohttpEvLoopParser {
+	struct picohttpParser parser;
+	struct picohttpAuthData auth;
+	char username[PICOHTTP_EVLOOP_USERNAME_LEN+1];
+	char realm[PICOHTTP_EVLOOP_REALM_LEN+1];
+	char pwresponse[PICOHTTP_EVLOOP_PWRESPONSE_LEN+1];
+	char url[];
+};
+
+struct picohttpEvLoopConn {
+	struct picohttpEvLoopConn *prev;
+	struct picohttpEvLoopConn *next;
+	struct picohttpEvLoop *loop;
+	int fd;
+	/* allocated once data arrives */
+	struct picohttpEvLoopParser *parser;
+	uint64_t accepted;
+	struct picohttpTimer timer;
+};
+
+/* A connection with a complete head, handed from the loop to the
+ * workers along with the octets received past the head */
+struct picohttpEvLoopReady {
+	struct picohttpEvLoopReady *next;
+	int fd;
+	struct picohttpEvLoopParser *parser;
+	uint64_t accepted;
+	size_t len;
+	uint8_t body[];
+};
+
+struct picohttpEvLoopWorker {
+	struct picohttpEvLoop *loop;
+	pthread_t thread;
+	struct picohttpSockConn io;
+};
+
+struct picohttpEvLoop {
+	struct picohttpEvLoopConfig config;
+	int epfd;
+	/* eventfd the workers signal on closing a connection, as the loop
+	 * may be waiting for one to accept again */
+	int wakefd;
+	size_t url_max_length;
+	volatile int stop;
+	uint8_t paused;     /* not accepting for now */
+	struct picohttpEvLoopConn *conns;
+	/* connections, served and expired are updated by the workers as
+	 * well, atomically */
+	struct picohttpEvLoopStats stats;
+	uint8_t deadlines;
+	struct picohttpTimerWheel wheel;
+	/* receive buffer while parsing */
+	struct picohttpSockConn io;
+
+	unsigned nworkers;
+	struct picohttpEvLoopWorker *workers;
+	pthread_mutex_t ready_lock;
+	pthread_cond_t ready_cond;
+	struct picohttpEvLoopReady *ready;
+	struct picohttpEvLoopReady **ready_tail;
+};
+
+/* While connections can't be taken on, the level triggered listening
+ * socket would wake the loop over and over; so its events get masked
+ * until a connection closes or the wait times out. */
+static void picohttpEvLoopListen(
+	struct picohttpEvLoop * const loop,
+	uint8_t on )
+{
+	if( loop->paused != on ) {
+		return;
+	}
+	struct epoll_event ev = {
+		.events = on ? EPOLLIN : 0,
+		.data.ptr = NULL
+	};
+	epoll_ctl(loop->epfd, EPOLL_CTL_MOD, loop->config.listenfd, &ev);
+	loop->paused = !on;
+}
+
+static void picohttpEvLoopClose(
+	struct picohttpEvLoop * const loop,
+	struct picohttpEvLoopConn * const c )
+{
+	if( c->prev ) {
+		c->prev->next = c->next;
+	} else {
+		loop->conns = c->next;
+	}
+	if( c->next ) {
+		c->next->prev = c->prev;
+	}
+	if( c->parser ) {
+		free(c->parser);
+		loop->stats.parsing--;
+	}
+	picohttpTimerCancel(&loop->wheel, &c->timer);
+	__atomic_fetch_sub(&loop->stats.connections, 1, __ATOMIC_RELAXED);
+
+	/* closing the socket removes it from the epoll set */
+	close(c->fd);
+	free(c);
+
+	picohttpEvLoopListen(loop, 1);
+}
+
+static void picohttpEvLoopExpired(
+	struct picohttpTimer * const timer )
+{
+	struct picohttpEvLoopConn * const c = timer->data;
+	picohttpSockSendTimeout(c->fd);
+	picohttpSockLinger(c->fd, 0);
+	__atomic_fetch_add(&c->loop->stats.expired, 1, __ATOMIC_RELAXED);
+	picohttpEvLoopClose(c->loop, c);
+}
+
+/* The head has to be complete by the header deadline, with no wait for
+ * the next octets taking longer than the idle deadline. */
+static void picohttpEvLoopArm(
+	struct picohttpEvLoop * const loop,
+	struct picohttpEvLoopConn * const c,
+	uint64_t now )
+{
+	struct picohttpDeadlines const * const d = &loop->config.deadlines;
+	uint64_t expires = d->header_ms ? c->accepted + d->header_ms : 0;
+	if( d->idle_ms && (!expires || now + d->idle_ms < expires) ) {
+		expires = now + d->idle_ms;
+	}
+	if( expires ) {
+		picohttpTimerArm(&loop->wheel, &c->timer, expires);
+	}
+}
+
+static void picohttpEvLoopAccept(
+	struct picohttpEvLoop * const loop )
+{
+	for(;;) {
+		struct sockaddr_storage peer;
+		socklen_t peerlen = sizeof(peer);
+		int const fd = accept4(loop->config.listenfd,
+			(struct sockaddr*)&peer, &peerlen,
+			SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if( 0 > fd ) {
+			if( EINTR == errno
+			 || ECONNABORTED == errno ) {
+				continue;
+			}
+			if( EAGAIN != errno && EWOULDBLOCK != errno ) {
+				/* out of descriptors or memory; the remaining
+				 * connections wait in the backlog */
+				picohttpEvLoopListen(loop, 0);
+			}
+			return;
+		}
+		if( loop->config.ratelimit
+		 && picohttpRateLimitCheck(loop->config.ratelimit,
+				(struct sockaddr*)&peer, peerlen) ) {
+			picohttpRateLimitReject(loop->config.ratelimit, fd);
+			picohttpSockLinger(fd, 0);
+			close(fd);
+			continue;
+		}
+
+		struct picohttpEvLoopConn * const c = calloc(1, sizeof(*c));
+		if( !c ) {
+			close(fd);
+			picohttpEvLoopListen(loop, 0);
+			return;
+		}
+		c->fd = fd;
+		c->loop = loop;
+		picohttpTimerInit(&c->timer, picohttpEvLoopExpired, c);
+
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLRDHUP,
+			.data.ptr = c
+		};
+		if( epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) ) {
+			close(fd);
+			free(c);
+			continue;
+		}
+
+		c->next = loop->conns;
+		if( c->next ) {
+			c->next->prev = c;
+		}
+		loop->conns = c;
+		__atomic_fetch_add(&loop->stats.connections, 1, __ATOMIC_RELAXED);
+
+		if( loop->deadlines ) {
+			c->accepted = picohttpSockConnMsec();
+			picohttpEvLoopArm(loop, c, c->accepted);
+		}
+	}
+}
+
+/* Serves a connection handed over by the loop, with blocking I/O or,
+ * under deadlines, waits in poll; then closes it. */
+static void picohttpEvLoopServe(
+	struct picohttpEvLoopWorker * const w,
+	struct picohttpEvLoopReady * const r )
+{
+	struct picohttpEvLoop * const loop = w->loop;
+	struct picohttpIoOps ioops;
+
+	if( !loop->deadlines ) {
+		int const flags = fcntl(r->fd, F_GETFL);
+		if( 0 > flags
+		 || 0 > fcntl(r->fd, F_SETFL, flags & ~O_NONBLOCK) ) {
+			goto done;
+		}
+	}
+
+	picohttpSockConnInit(&w->io, r->fd, &ioops);
+	if( loop->deadlines ) {
+		picohttpSockConnDeadlines(&w->io,
+			&loop->config.deadlines, r->accepted, 1);
+	}
+	memcpy(w->io.recvbuf, r->body, r->len);
+	w->io.recvbuf_len = r->len;
+
+	picohttpParserDispatch(&r->parser->parser, &ioops);
+	__atomic_fetch_add(&loop->stats.served, 1, __ATOMIC_RELAXED);
+	if( w->io.expired ) {
+		__atomic_fetch_add(&loop->stats.expired, 1, __ATOMIC_RELAXED);
+		picohttpSockConnTimeout(&w->io);
+	}
+	picohttpSockLinger(r->fd, 0);
+
+done:
+	close(r->fd);
+	free(r->parser);
+	free(r);
+	__atomic_fetch_sub(&loop->stats.connections, 1, __ATOMIC_RELAXED);
+
+	uint64_t const one = 1;
+	ssize_t const wr = write(loop->wakefd, &one, sizeof(one));
+	(void)wr;
+}
+
+static void *picohttpEvLoopWorkerMain(void *arg)
+{
+	struct picohttpEvLoopWorker * const w = arg;
+	struct picohttpEvLoop * const loop = w->loop;
+
+	for(;;) {
+		pthread_mutex_lock(&loop->ready_lock);
+		while( !loop->ready && !loop->stop ) {
+			pthread_cond_wait(&loop->ready_cond, &loop->ready_lock);
+		}
+		struct picohttpEvLoopReady * const r = loop->stop ?
+			NULL : loop->ready;
+		if( r && !(loop->ready = r->next) ) {
+			loop->ready_tail = &loop->ready;
+		}
+		pthread_mutex_unlock(&loop->ready_lock);
+		if( !r ) {
+			break;
+		}
+		picohttpEvLoopServe(w, r);
+	}
+	return NULL;
+}
+
+/* The head is complete; received octets past consumed are body. The
+ * connection leaves the loop for a worker. */
+static void picohttpEvLoopDispatch(
+	struct picohttpEvLoop * const loop,
+	struct picohttpEvLoopConn * const c,
+	size_t consumed,
+	size_t received )
+{
+	struct picohttpEvLoopReady * const r =
+		malloc(sizeof(*r) + received - consumed);
+	if( !r ) {
+		picohttpEvLoopClose(loop, c);
+		return;
+	}
+	r->next = NULL;
+	r->fd = c->fd;
+	r->parser = c->parser;
+	r->accepted = c->accepted;
+	r->len = received - consumed;
+	memcpy(r->body, loop->io.recvbuf + consumed, r->len);
+
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	picohttpTimerCancel(&loop->wheel, &c->timer);
+	if( c->prev ) {
+		c->prev->next = c->next;
+	} else {
+		loop->conns = c->next;
+	}
+	if( c->next ) {
+		c->next->prev = c->prev;
+	}
+	loop->stats.parsing--;
+	free(c);
+
+	pthread_mutex_lock(&loop->ready_lock);
+	*loop->ready_tail = r;
+	loop->ready_tail = &r->next;
+	pthread_cond_signal(&loop->ready_cond);
+	pthread_mutex_unlock(&loop->ready_lock);
+}
+
+static void picohttpEvLoopReadable(
+	struct picohttpEvLoop * const loop,
+	struct picohttpEvLoopConn * const c )
+{
+	for(;;) {
+		ssize_t const r = recv(c->fd,
+			loop->io.recvbuf, sizeof(loop->io.recvbuf), 0);
+		if( 0 > r ) {
+			if( EINTR == errno ) {
+				continue;
+			}
+			if( EAGAIN == errno || EWOULDBLOCK == errno ) {
+				return;
+			}
+		}
+		if( 0 >= r ) {
+			/* peer went away before completing the head */
+			picohttpEvLoopClose(loop, c);
+			return;
+		}
+
+		if( !c->parser ) {
+			struct picohttpEvLoopParser * const p = malloc(sizeof(*p)
+				+ loop->url_max_length + 1);
+			if( !p ) {
+				picohttpEvLoopClose(loop, c);
+				return;
+			}
+			/* the buffer pointers of picohttpAuthData are const */
+			struct picohttpAuthData const auth = {
+				.username_maxlen = sizeof(p->username)-1,
+				.username = p->username,
+				.realm_maxlen = sizeof(p->realm)-1,
+				.realm = p->realm,
+				.pwresponse_maxlen = sizeof(p->pwresponse)-1,
+				.pwresponse = p->pwresponse,
+#if !PICOHTTP_NO_AUTHCACHE
+				.cache = loop->config.authcache,
+#endif
+#if !PICOHTTP_NO_DIGEST_AUTH
+				.nonces = loop->config.nonces,
+#endif
+			};
+			memcpy(&p->auth, &auth, sizeof(auth));
+			picohttpParserInit(&p->parser,
+				loop->config.routes,
+				p->url,
+				&p->auth,
+				loop->config.userdata );
+			c->parser = p;
+			loop->stats.parsing++;
+		}
+
+		size_t const consumed = picohttpParserFeed(&c->parser->parser,
+			loop->io.recvbuf, r);
+		if( c->parser->parser.request.status ) {
+			picohttpEvLoopDispatch(loop, c, consumed, r);
+			return;
+		}
+		if( loop->config.deadlines.idle_ms ) {
+			picohttpEvLoopArm(loop, c, picohttpSockConnMsec());
+		}
+	}
+}
+
+struct picohttpEvLoop *picohttpEvLoopCreate(
+	struct picohttpEvLoopConfig const * const config )
+{
+	struct picohttpEvLoop * const loop = calloc(1, sizeof(*loop));
+	if( !loop ) {
+		return NULL;
+	}
+	loop->config = *config;
+	loop->url_max_length = picohttpRoutesMaxUrlLength(config->routes);
+	loop->deadlines = config->deadlines.header_ms
+		|| config->deadlines.body_ms
+		|| config->deadlines.idle_ms;
+	picohttpTimerWheelInit(&loop->wheel, picohttpSockConnMsec());
+
+	loop->nworkers = config->workers;
+	if( !loop->nworkers ) {
+		long const ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		loop->nworkers = (0 < ncpu) ? ncpu : 1;
+	}
+	loop->workers = calloc(loop->nworkers, sizeof(*loop->workers));
+	if( !loop->workers ) {
+		free(loop);
+		return NULL;
+	}
+	for(unsigned i = 0; i < loop->nworkers; i++) {
+		loop->workers[i].loop = loop;
+	}
+
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	/* the wake eventfd is told apart by the loop as its connection */
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = loop
+	};
+	if( 0 > loop->epfd
+	 || 0 > loop->wakefd
+	 || epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) ) {
+		if( 0 <= loop->epfd ) {
+			close(loop->epfd);
+		}
+		if( 0 <= loop->wakefd ) {
+			close(loop->wakefd);
+		}
+		free(loop->workers);
+		free(loop);
+		return NULL;
+	}
+
+	pthread_mutex_init(&loop->ready_lock, NULL);
+	pthread_cond_init(&loop->ready_cond, NULL);
+	loop->ready_tail = &loop->ready;
+	return loop;
+}
+
+void picohttpEvLoopDestroy(
+	struct picohttpEvLoop * const loop )
+{
+	if( !loop ) {
+		return;
+	}
+	while( loop->conns ) {
+		picohttpEvLoopClose(loop, loop->conns);
+	}
+	while( loop->ready ) {
+		struct picohttpEvLoopReady * const r = loop->ready;
+		loop->ready = r->next;
+		close(r->fd);
+		free(r->parser);
+		free(r);
+	}
+	pthread_cond_destroy(&loop->ready_cond);
+	pthread_mutex_destroy(&loop->ready_lock);
+	close(loop->wakefd);
+	close(loop->epfd);
+	free(loop->workers);
+	free(loop);
+}
+
+void picohttpEvLoopStop(
+	struct picohttpEvLoop * const loop )
+{
+	loop->stop = 1;
+}
+
+void picohttpEvLoopStats(
+	struct picohttpEvLoop const * const loop,
+	struct picohttpEvLoopStats * const stats )
+{
+	stats->connections =
+		__atomic_load_n(&loop->stats.connections, __ATOMIC_RELAXED);
+	stats->parsing = loop->stats.parsing;
+	stats->served = __atomic_load_n(&loop->stats.served, __ATOMIC_RELAXED);
+	stats->expired = __atomic_load_n(&loop->stats.expired, __ATOMIC_RELAXED);
+}
+
+int picohttpEvLoopRun(
+	struct picohttpEvLoop * const loop )
+{
+	int const listenfd = loop->config.listenfd;
+
+	int const flags = fcntl(listenfd, F_GETFL);
+	if( 0 > flags
+	 || 0 > fcntl(listenfd, F_SETFL, flags | O_NONBLOCK) ) {
+		return -1;
+	}
+	/* the listening socket is told apart by a NULL connection */
+	struct epoll_event lev = {
+		.events = EPOLLIN,
+		.data.ptr = NULL
+	};
+	if( epoll_ctl(loop->epfd, EPOLL_CTL_ADD, listenfd, &lev) ) {
+		return -1;
+	}
+
+	int ret = 0;
+	unsigned started;
+	for(started = 0; started < loop->nworkers; started++) {
+		struct picohttpEvLoopWorker * const w = loop->workers + started;
+		if( pthread_create(&w->thread, NULL, picohttpEvLoopWorkerMain, w) ) {
+			loop->stop = 1;
+			ret = -1;
+			break;
+		}
+	}
+
+	while( !loop->stop ) {
+		struct epoll_event events[PICOHTTP_EVLOOP_EVENTS];
+		/* the timeout bounds how long a stop request goes unnoticed,
+		 * and is cut short by the next deadline */
+		picohttpTimerAdvance(&loop->wheel, picohttpSockConnMsec());
+		int const n = epoll_wait(loop->epfd,
+			events, PICOHTTP_EVLOOP_EVENTS,
+			(int)picohttpTimerIdle(&loop->wheel, 250));
+		if( 0 > n ) {
+			if( EINTR == errno ) {
+				continue;
+			}
+			ret = -1;
+			break;
+		}
+		if( !n ) {
+			picohttpEvLoopListen(loop, 1);
+		}
+		for(int i = 0; i < n; i++) {
+			struct picohttpEvLoopConn * const c = events[i].data.ptr;
+			if( !c ) {
+				picohttpEvLoopAccept(loop);
+			} else
+			if( (void*)loop == (void*)c ) {
+				/* a worker closed a connection */
+				uint64_t count;
+				ssize_t const r = read(loop->wakefd, &count, sizeof(count));
+				(void)r;
+				picohttpEvLoopListen(loop, 1);
+			} else {
+				picohttpEvLoopReadable(loop, c);
+			}
+		}
+	}
+
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, listenfd, NULL);
+
+	pthread_mutex_lock(&loop->ready_lock);
+	loop->stop = 1;
+	pthread_cond_broadcast(&loop->ready_cond);
+	pthread_mutex_unlock(&loop->ready_lock);
+
+	for(unsigned i = 0; i < started; i++) {
+		pthread_join(loop->workers[i].thread, NULL);
+	}
+	return ret;
+}
@@ -0,0 +1,109 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_EVLOOP_H
+#define PICOHTTP_EVLOOP_H
+
+/* Epoll based connection driver for Linux hosts.
+ *
+ * Request heads are pushed into a picohttpParser as they trickle in,
+ * on a single loop thread, so a connection costs no thread and, until
+ * its first octets arrive, not even parser state. Once a head is
+ * complete the connection is handed to a pool of worker threads, which
+ * read the body and run the handler with blocking I/O; a slow client
+ * or handler holds up one worker, never the loop.
+ *
+ * Every connection gets picohttpAuthData of its own, allocated along
+ * with its parser, as heads are parsed interleaved. The credential and
+ * nonce caches are shared by the workers and need their lock functions
+ * set.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "picohttp.h"
+#include "picohttp_sockio.h"
+#include "picohttp_ratelimit.h"
+
+/* credential buffers of the picohttpAuthData of each connection */
+#ifndef PICOHTTP_EVLOOP_USERNAME_LEN
+#define PICOHTTP_EVLOOP_USERNAME_LEN 63
+#endif
+#ifndef PICOHTTP_EVLOOP_REALM_LEN
+#define PICOHTTP_EVLOOP_REALM_LEN 63
+#endif
+#ifndef PICOHTTP_EVLOOP_PWRESPONSE_LEN
+#define PICOHTTP_EVLOOP_PWRESPONSE_LEN 127
+#endif
+
+struct picohttpEvLoopConfig {
+	int listenfd;
+	struct picohttpURLRoute const *routes;
+	void *userdata;
+	unsigned workers;     /* 0: one per online CPU */
+#if !PICOHTTP_NO_AUTHCACHE
+	struct picohttpAuthCache *authcache;      /* optional */
+#endif
+#if !PICOHTTP_NO_DIGEST_AUTH
+	struct picohttpDigestNonceCache *nonces;  /* optional */
+#endif
+	/* all 0 for none; while a head is parsed they are kept on a timer
+	 * wheel, a dispatched connection waits for the client in poll */
+	struct picohttpDeadlines deadlines;
+	/* optional; connections over the limit are answered 429 and
+	 * closed as they are accepted */
+	struct picohttpRateLimit *ratelimit;
+};
+
+struct picohttpEvLoopStats {
+	size_t connections;   /* currently open */
+	size_t parsing;       /* of those, with a request head underway */
+	uint64_t served;      /* requests handed to the workers and done */
+	uint64_t expired;     /* connections that ran past a deadline */
+};
+
+struct picohttpEvLoop;
+
+struct picohttpEvLoop *picohttpEvLoopCreate(
+	struct picohttpEvLoopConfig const * const config );
+
+/* Accepts and serves connections until picohttpEvLoopStop is called;
+ * the workers finish the requests they are on before it returns.
+ * Returns 0 on orderly shutdown, -1 on error. */
+int picohttpEvLoopRun(
+	struct picohttpEvLoop * const loop );
+
+/* May be called from any thread or a signal handler. */
+void picohttpEvLoopStop(
+	struct picohttpEvLoop * const loop );
+
+/* Closes all connections still open, those still waiting for a worker
+ * as well. */
+void picohttpEvLoopDestroy(
+	struct picohttpEvLoop * const loop );
+
+void picohttpEvLoopStats(
+	struct picohttpEvLoop const * const loop,
+	struct picohttpEvLoopStats * const stats );
+
+#endif/*PICOHTTP_EVLOOP_H*/
@@ -0,0 +1,1228 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#define _GNU_SOURCE
+
+#include "picohttp_green.h"
+#include "picohttp_sockio.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#include <ucontext.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#if !PICOHTTP_GREEN_NO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#define PICOHTTP_GREEN_EVENTS 64
+
+#if !PICOHTTP_GREEN_NO_URING
+/* receive side of a connection on io_uring: the provided buffers
+ * received into, queued by buffer id until consumed */
+#define PICOHTTP_GREEN_NOBUF 0xffff
+
+struct picohttpGreenUringConn {
+	int fd;
+	uint16_t rx_head;
+	uint16_t rx_tail;
+	size_t rx_pos;
+	uint8_t recv_armed;
+	uint8_t eof;
+	uint8_t starved;      /* recv ended for lack of buffers */
+	size_t sendbuf_len;
+	uint8_t sendbuf[PICOHTTP_SOCKIO_SENDBUF_LEN];
+};
+
+/* what a suspended green thread waits for */
+#define PICOHTTP_GREEN_WAIT_RECV 1
+#define PICOHTTP_GREEN_WAIT_IO   2
+
+/* user_data of SQEs: thread pointer plus tag, 0 is ignored */
+#define PICOHTTP_GREEN_TAG_RECV   1
+#define PICOHTTP_GREEN_TAG_IO     2
+#define PICOHTTP_GREEN_TAG_ACCEPT 3
+#endif
+
+struct picohttpGreenThread {
+	struct picohttpGreenThread *prev;
+	struct picohttpGreenThread *next;
+	struct picohttpGreen *green;
+	ucontext_t ctx;
+	void *stack;          /* mapping including the guard page */
+	size_t stack_len;
+	uint8_t done;
+	uint8_t cancel;       /* set on shutdown; waits fail */
+#if !PICOHTTP_GREEN_NO_URING
+	uint8_t waiting;
+	uint8_t closing;      /* done, waiting for recv to wind down */
+	int res;              /* result of the I/O waited for */
+#endif
+	struct picohttpIoOps ioops;
+	union {
+		struct picohttpSockConn sock;
+#if !PICOHTTP_GREEN_NO_URING
+		struct picohttpGreenUringConn uring;
+#endif
+	} conn;
+};
+
+#define picohttpGREEN_THREAD_OF(c) ((struct picohttpGreenThread*) \
+	((uint8_t*)(c) - offsetof(struct picohttpGreenThread, conn)))
+
+#if !PICOHTTP_GREEN_NO_URING
+struct picohttpGreenUring {
+	int fd;
+	unsigned sq_entries;
+	unsigned sq_tail;
+	unsigned to_submit;
+	unsigned *sq_khead;
+	unsigned *sq_ktail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_khead;
+	unsigned *cq_ktail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_map;
+	size_t sq_map_len;
+	void *cq_map;
+	size_t cq_map_len;
+	size_t sqes_map_len;
+
+	struct io_uring_buf_ring *br;
+	size_t br_map_len;
+	uint16_t br_tail;
+	uint8_t *bufs;
+	uint16_t buf_len[PICOHTTP_GREEN_URING_BUFS];
+	uint16_t buf_next[PICOHTTP_GREEN_URING_BUFS];
+	size_t held;          /* buffers queued at connections */
+	size_t starved;       /* connections waiting for buffers */
+
+	uint8_t recv_multishot;
+	uint8_t accept_armed;
+};
+#endif
+
+struct picohttpGreen {
+	struct picohttpGreenConfig config;
+	int epfd;
+	size_t pagesize;
+	volatile int stop;
+	uint8_t paused;       /* not accepting for now */
+	ucontext_t sched;
+	struct picohttpGreenThread *threads;
+	struct picohttpGreenStats stats;
+#if !PICOHTTP_GREEN_NO_URING
+	struct picohttpGreenUring *uring;
+#endif
+};
+
+/* makecontext passes int arguments only, hence the pointer halves */
+static void picohttpGreenMain(unsigned lo, unsigned hi)
+{
+	struct picohttpGreenThread * const t = (void*)
+		((uintptr_t)lo | (((uintptr_t)hi << 16) << 16));
+	struct picohttpGreen * const green = t->green;
+
+	if( green->config.handler ) {
+		green->config.handler(&t->ioops, green->config.userdata);
+	} else {
+		picohttpProcessRequest(&t->ioops,
+			green->config.routes, NULL, green->config.userdata);
+	}
+	picohttpIoFlush((&t->ioops));
+
+	t->done = 1;
+	/* returns to the scheduler through uc_link */
+}
+
+static void picohttpGreenYield(
+	struct picohttpGreenThread * const t )
+{
+	swapcontext(&t->ctx, &t->green->sched);
+}
+
+static void picohttpGreenListen(
+	struct picohttpGreen * const green,
+	uint8_t on );
+
+/* releases the thread's memory; the connection is closed already */
+static void picohttpGreenFree(
+	struct picohttpGreen * const green,
+	struct picohttpGreenThread * const t )
+{
+	if( t->prev ) {
+		t->prev->next = t->next;
+	} else {
+		green->threads = t->next;
+	}
+	if( t->next ) {
+		t->next->prev = t->prev;
+	}
+	green->stats.threads--;
+
+	munmap(t->stack, t->stack_len);
+	free(t);
+
+	picohttpGreenListen(green, 1);
+}
+
+static struct picohttpGreenThread *picohttpGreenThreadCreate(
+	struct picohttpGreen * const green )
+{
+	struct picohttpGreenThread * const t = calloc(1, sizeof(*t));
+	if( !t ) {
+		return NULL;
+	}
+	t->green = green;
+
+	/* the lowest page stays inaccessible to catch stack overflows */
+	size_t const stack_size = green->config.stack_size ?
+		green->config.stack_size : PICOHTTP_GREEN_STACK_SIZE;
+	t->stack_len = green->pagesize
+		+ (stack_size + green->pagesize - 1) / green->pagesize
+		  * green->pagesize;
+	t->stack = mmap(NULL, t->stack_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if( MAP_FAILED == t->stack ) {
+		free(t);
+		return NULL;
+	}
+	mprotect(t->stack, green->pagesize, PROT_NONE);
+
+	getcontext(&t->ctx);
+	t->ctx.uc_stack.ss_sp = (uint8_t*)t->stack + green->pagesize;
+	t->ctx.uc_stack.ss_size = t->stack_len - green->pagesize;
+	t->ctx.uc_link = &green->sched;
+	uintptr_t const p = (uintptr_t)t;
+	makecontext(&t->ctx, (void (*)(void))picohttpGreenMain, 2,
+		(unsigned)(p & 0xffffffffu),
+		(unsigned)((p >> 16) >> 16));
+
+	t->next = green->threads;
+	if( t->next ) {
+		t->next->prev = t;
+	}
+	green->threads = t;
+	green->stats.threads++;
+	return t;
+}
+
+/* epoll backend */
+
+/* picohttpSockConnWait hook: parks the green thread until epoll
+ * reports the socket ready */
+static int picohttpGreenEpollWait(
+	struct picohttpSockConn * const conn,
+	int writable )
+{
+	struct picohttpGreenThread * const t = conn->waitdata;
+	struct picohttpGreen * const green = t->green;
+
+	if( t->cancel ) {
+		return -1;
+	}
+	struct epoll_event ev = {
+		.events = writable ? EPOLLOUT : EPOLLIN,
+		.data.ptr = t
+	};
+	if( epoll_ctl(green->epfd, EPOLL_CTL_MOD, conn->fd, &ev) ) {
+		return -1;
+	}
+	picohttpGreenYield(t);
+
+	return t->cancel ? -1 : 0;
+}
+
+static void picohttpGreenEpollResume(
+	struct picohttpGreen * const green,
+	struct picohttpGreenThread * const t )
+{
+	green->stats.switches++;
+	swapcontext(&green->sched, &t->ctx);
+	if( t->done ) {
+		green->stats.served++;
+		shutdown(t->conn.sock.fd, SHUT_RDWR);
+		close(t->conn.sock.fd);
+		picohttpGreenFree(green, t);
+	}
+}
+
+static struct picohttpGreenThread *picohttpGreenEpollSpawn(
+	struct picohttpGreen * const green,
+	int fd )
+{
+	struct epoll_event ev = {
+		.events = 0,
+		.data.ptr = NULL
+	};
+	if( epoll_ctl(green->epfd, EPOLL_CTL_ADD, fd, &ev) ) {
+		return NULL;
+	}
+	struct picohttpGreenThread * const t = picohttpGreenThreadCreate(green);
+	if( !t ) {
+		epoll_ctl(green->epfd, EPOLL_CTL_DEL, fd, NULL);
+		return NULL;
+	}
+	picohttpSockConnInit(&t->conn.sock, fd, &t->ioops);
+	t->conn.sock.wait = picohttpGreenEpollWait;
+	t->conn.sock.waitdata = t;
+	return t;
+}
+
+static void picohttpGreenEpollAccept(
+	struct picohttpGreen * const green )
+{
+	for(;;) {
+		if( green->config.max_threads
+		 && green->stats.threads >= green->config.max_threads ) {
+			/* leave further connections in the backlog */
+			picohttpGreenListen(green, 0);
+			return;
+		}
+		int const fd = accept4(green->config.listenfd, NULL, NULL,
+			SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if( 0 > fd ) {
+			if( EINTR == errno
+			 || ECONNABORTED == errno ) {
+				continue;
+			}
+			if( EAGAIN != errno && EWOULDBLOCK != errno ) {
+				/* out of descriptors or memory */
+				picohttpGreenListen(green, 0);
+			}
+			return;
+		}
+
+		struct picohttpGreenThread * const t =
+			picohttpGreenEpollSpawn(green, fd);
+		if( !t ) {
+			close(fd);
+			picohttpGreenListen(green, 0);
+			return;
+		}
+		/* run right away; the request is likely there already */
+		picohttpGreenEpollResume(green, t);
+	}
+}
+
+static int picohttpGreenEpollRun(
+	struct picohttpGreen * const green )
+{
+	int const listenfd = green->config.listenfd;
+
+	int const flags = fcntl(listenfd, F_GETFL);
+	if( 0 > flags
+	 || 0 > fcntl(listenfd, F_SETFL, flags | O_NONBLOCK) ) {
+		return -1;
+	}
+	/* the listening socket is told apart by a NULL thread */
+	struct epoll_event lev = {
+		.events = EPOLLIN,
+		.data.ptr = NULL
+	};
+	if( epoll_ctl(green->epfd, EPOLL_CTL_ADD, listenfd, &lev) ) {
+		return -1;
+	}
+
+	int ret = 0;
+	while( !green->stop ) {
+		struct epoll_event events[PICOHTTP_GREEN_EVENTS];
+		/* the timeout bounds how long a stop request goes unnoticed */
+		int const n = epoll_wait(green->epfd,
+			events, PICOHTTP_GREEN_EVENTS, 250);
+		green->stats.waits++;
+		if( 0 > n ) {
+			if( EINTR == errno ) {
+				continue;
+			}
+			ret = -1;
+			break;
+		}
+		if( !n ) {
+			picohttpGreenListen(green, 1);
+		}
+		for(int i = 0; i < n; i++) {
+			struct picohttpGreenThread * const t = events[i].data.ptr;
+			if( !t ) {
+				picohttpGreenEpollAccept(green);
+			} else {
+				picohttpGreenEpollResume(green, t);
+			}
+		}
+	}
+
+	epoll_ctl(green->epfd, EPOLL_CTL_DEL, listenfd, NULL);
+
+	/* let the handlers still waiting return through failing I/O */
+	while( green->threads ) {
+		struct picohttpGreenThread * const t = green->threads;
+		t->cancel = 1;
+		picohttpGreenEpollResume(green, t);
+	}
+	return ret;
+}
+
+#if !PICOHTTP_GREEN_NO_URING
+/* io_uring backend */
+
+static int picohttpGreenUringEnter(
+	struct picohttpGreenUring * const r,
+	unsigned min_complete,
+	int wait )
+{
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 250000000 };
+	struct io_uring_getevents_arg arg = {
+		.sigmask = 0,
+		.sigmask_sz = 0,
+		.pad = 0,
+		.ts = (uintptr_t)&ts
+	};
+	int const ret = syscall(__NR_io_uring_enter, r->fd,
+		r->to_submit, min_complete,
+		wait ? (IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG) : 0,
+		wait ? &arg : NULL,
+		wait ? sizeof(arg) : 0);
+	if( 0 < ret ) {
+		r->to_submit -= ((unsigned)ret < r->to_submit) ?
+			(unsigned)ret : r->to_submit;
+	}
+	return ret;
+}
+
+/* Queues an SQE; submission happens in batches with the next wait,
+ * or right here if the submission queue is full. */
+static struct io_uring_sqe *picohttpGreenUringSqe(
+	struct picohttpGreen * const green )
+{
+	struct picohttpGreenUring * const r = green->uring;
+	unsigned head = __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE);
+	if( r->sq_tail - head >= r->sq_entries ) {
+		picohttpGreenUringEnter(r, 0, 0);
+		head = __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE);
+		if( r->sq_tail - head >= r->sq_entries ) {
+			return NULL;
+		}
+	}
+	unsigned const idx = r->sq_tail & *r->sq_mask;
+	struct io_uring_sqe * const sqe = r->sqes + idx;
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[idx] = idx;
+	r->sq_tail++;
+	r->to_submit++;
+	__atomic_store_n(r->sq_ktail, r->sq_tail, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+static void picohttpGreenUringBufRelease(
+	struct picohttpGreenUring * const r,
+	uint16_t bid )
+{
+	struct io_uring_buf * const b =
+		r->br->bufs + (r->br_tail & (PICOHTTP_GREEN_URING_BUFS-1));
+	b->addr = (uintptr_t)(r->bufs + (size_t)bid * PICOHTTP_GREEN_URING_BUF_LEN);
+	b->len = PICOHTTP_GREEN_URING_BUF_LEN;
+	b->bid = bid;
+	r->br_tail++;
+	__atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+}
+
+static void picohttpGreenUringArmRecv(
+	struct picohttpGreenThread * const t )
+{
+	struct picohttpGreenUring * const r = t->green->uring;
+	struct picohttpGreenUringConn * const conn = &t->conn.uring;
+	struct io_uring_sqe * const sqe = picohttpGreenUringSqe(t->green);
+	if( !sqe ) {
+		conn->eof = 1;
+		return;
+	}
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->fd;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	if( r->recv_multishot ) {
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->len = 0;
+	} else {
+		sqe->len = PICOHTTP_GREEN_URING_BUF_LEN;
+	}
+	sqe->user_data = (uintptr_t)t | PICOHTTP_GREEN_TAG_RECV;
+	conn->recv_armed = 1;
+}
+
+/* Waits for received data; returns < 0 at EOF or on error. */
+static int picohttpGreenUringFill(
+	struct picohttpGreenThread * const t )
+{
+	struct picohttpGreenUringConn * const conn = &t->conn.uring;
+	while( PICOHTTP_GREEN_NOBUF == conn->rx_head ) {
+		if( conn->eof || t->cancel ) {
+			return -1;
+		}
+		if( !conn->recv_armed && !conn->starved ) {
+			picohttpGreenUringArmRecv(t);
+		}
+		t->waiting = PICOHTTP_GREEN_WAIT_RECV;
+		picohttpGreenYield(t);
+	}
+	return 0;
+}
+
+/* Takes n octets off the head of the receive queue */
+static void picohttpGreenUringConsume(
+	struct picohttpGreenThread * const t,
+	size_t n )
+{
+	struct picohttpGreenUring * const r = t->green->uring;
+	struct picohttpGreenUringConn * const conn = &t->conn.uring;
+	uint16_t const bid = conn->rx_head;
+	conn->rx_pos += n;
+	if( conn->rx_pos >= r->buf_len[bid] ) {
+		conn->rx_head = r->buf_next[bid];
+		if( PICOHTTP_GREEN_NOBUF == conn->rx_head ) {
+			conn->rx_tail = PICOHTTP_GREEN_NOBUF;
+		}
+		conn->rx_pos = 0;
+		r->held--;
+		picohttpGreenUringBufRelease(r, bid);
+	}
+}
+
+/* Rearms the receives that ran out of buffers, as far as there are
+ * buffers for them again. */
+static void picohttpGreenUringUnstarve(
+	struct picohttpGreen * const green )
+{
+	struct picohttpGreenUring * const r = green->uring;
+	size_t avail = PICOHTTP_GREEN_URING_BUFS - r->held;
+	for(struct picohttpGreenThread *t = green->threads;
+	    t && r->starved && avail; t = t->next) {
+		if( t->conn.uring.starved ) {
+			t->conn.uring.starved = 0;
+			r->starved--;
+			avail--;
+			picohttpGreenUringArmRecv(t);
+		}
+	}
+}
+
+static int picohttpGreenUringGetch(void *data)
+{
+	struct picohttpGreenThread * const t = picohttpGREEN_THREAD_OF(data);
+	struct picohttpGreenUring * const r = t->green->uring;
+	struct picohttpGreenUringConn * const conn = &t->conn.uring;
+	if( 0 > picohttpGreenUringFill(t) ) {
+		return -1;
+	}
+	int const ch = r->bufs[(size_t)conn->rx_head * PICOHTTP_GREEN_URING_BUF_LEN
+		+ conn->rx_pos];
+	picohttpGreenUringConsume(t, 1);
+	return ch;
+}
+
+static int picohttpGreenUringRead(size_t count, void *buf, void *data)
+{
+	struct picohttpGreenThread * const t = picohttpGREEN_THREAD_OF(data);
+	struct picohttpGreenUring * const r = t->green->uring;
+	struct picohttpGreenUringConn * const conn = &t->conn.uring;
+	size_t rb = 0;
+	while( rb < count ) {
+		if( 0 > picohttpGreenUringFill(t) ) {
+			break;
+		}
+		size_t n = r->buf_len[conn->rx_head] - conn->rx_pos;
+		if( n > count - rb )
+			n = count - rb;
+		memcpy((uint8_t*)buf + rb,
+			r->bufs + (size_t)conn->rx_head * PICOHTTP_GREEN_URING_BUF_LEN
+			+ conn->rx_pos, n);
+		picohttpGreenUringConsume(t, n);
+		rb += n;
+	}
+	return (rb || !count) ? (int)rb : -1;
+}
+
+/* Submits an operation on behalf of the thread and waits for it */
+static int picohttpGreenUringIo(
+	struct picohttpGreenThread * const t,
+	uint8_t opcode,
+	int fd,
+	void const *buf,
+	size_t len,
+	uint64_t offset )
+{
+	if( t->cancel ) {
+		return -1;
+	}
+	struct io_uring_sqe * const sqe = picohttpGreenUringSqe(t->green);
+	if( !sqe ) {
+		return -1;
+	}
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	if( IORING_OP_SEND == opcode ) {
+		sqe->msg_flags = MSG_NOSIGNAL;
+	}
+	sqe->user_data = (uintptr_t)t | PICOHTTP_GREEN_TAG_IO;
+
+	t->waiting = PICOHTTP_GREEN_WAIT_IO;
+	picohttpGreenYield(t);
+	return t->res;
+}
+
+static int picohttpGreenUringSend(
+	struct picohttpGreenThread * const t,
+	size_t count,
+	void const *buf )
+{
+	size_t wb = 0;
+	while( wb < count ) {
+		int const w = picohttpGreenUringIo(t, IORING_OP_SEND,
+			t->conn.uring.fd, (uint8_t const*)buf + wb, count - wb, 0);
+		if( 0 >= w ) {
+			return -1;
+		}
+		wb += w;
+	}
+	return wb;
+}
+
+static int picohttpGreenUringFlush(void *data)
+{
+	struct picohttpGreenThread * const t = picohttpGREEN_THREAD_OF(data);
+	struct picohttpGreenUringConn * const conn = &t->conn.uring;
+	if( conn->sendbuf_len ) {
+		int const e = picohttpGreenUringSend(t,
+			conn->sendbuf_len, conn->sendbuf);
+		conn->sendbuf_len = 0;
+		if( 0 > e )
+			return e;
+	}
+	return 0;
+}
+
+static int picohttpGreenUringWrite(size_t count, void const *buf, void *data)
+{
+	struct picohttpGreenThread * const t = picohttpGREEN_THREAD_OF(data);
+	struct picohttpGreenUringConn * const conn = &t->conn.uring;
+	if( conn->sendbuf_len + count > sizeof(conn->sendbuf) ) {
+		int const e = picohttpGreenUringFlush(data);
+		if( 0 > e )
+			return e;
+		if( count >= sizeof(conn->sendbuf) ) {
+			return picohttpGreenUringSend(t, count, buf);
+		}
+	}
+	memcpy(conn->sendbuf + conn->sendbuf_len, buf, count);
+	conn->sendbuf_len += count;
+	return count;
+}
+
+static int picohttpGreenUringPutch(int ch, void *data)
+{
+	uint8_t const c = ch;
+	return picohttpGreenUringWrite(1, &c, data);
+}
+
+static void picohttpGreenUringArmAccept(
+	struct picohttpGreen * const green )
+{
+	struct picohttpGreenUring * const r = green->uring;
+	if( r->accept_armed || green->stop ) {
+		return;
+	}
+	struct io_uring_sqe * const sqe = picohttpGreenUringSqe(green);
+	if( !sqe ) {
+		return;
+	}
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = green->config.listenfd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = PICOHTTP_GREEN_TAG_ACCEPT;
+	r->accept_armed = 1;
+}
+
+static void picohttpGreenUringCancelAccept(
+	struct picohttpGreen * const green )
+{
+	struct picohttpGreenUring * const r = green->uring;
+	if( !r->accept_armed ) {
+		return;
+	}
+	struct io_uring_sqe * const sqe = picohttpGreenUringSqe(green);
+	if( !sqe ) {
+		return;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = PICOHTTP_GREEN_TAG_ACCEPT;
+	sqe->user_data = 0;
+}
+
+/* shutdown and close go into the ring without waiting for them */
+static void picohttpGreenUringCloseFd(
+	struct picohttpGreen * const green,
+	int fd,
+	uint8_t op )
+{
+	struct io_uring_sqe * const sqe = picohttpGreenUringSqe(green);
+	if( !sqe ) {
+		if( IORING_OP_SHUTDOWN == op ) {
+			shutdown(fd, SHUT_RDWR);
+		} else {
+			close(fd);
+		}
+		return;
+	}
+	sqe->opcode = op;
+	sqe->fd = fd;
+	if( IORING_OP_SHUTDOWN == op ) {
+		sqe->len = SHUT_RDWR;
+	}
+	sqe->user_data = 0;
+}
+
+static void picohttpGreenUringFinish(
+	struct picohttpGreen * const green,
+	struct picohttpGreenThread * const t )
+{
+	struct picohttpGreenUring * const r = green->uring;
+	struct picohttpGreenUringConn * const conn = &t->conn.uring;
+
+	while( PICOHTTP_GREEN_NOBUF != conn->rx_head ) {
+		uint16_t const bid = conn->rx_head;
+		conn->rx_head = r->buf_next[bid];
+		r->held--;
+		picohttpGreenUringBufRelease(r, bid);
+	}
+	conn->rx_tail = PICOHTTP_GREEN_NOBUF;
+	if( conn->starved ) {
+		conn->starved = 0;
+		r->starved--;
+	}
+
+	if( conn->recv_armed ) {
+		/* the recv still refers to t; a shutdown makes it end and
+		 * the close follows its last completion */
+		picohttpGreenUringCloseFd(green, conn->fd, IORING_OP_SHUTDOWN);
+		t->closing = 1;
+		return;
+	}
+	picohttpGreenUringCloseFd(green, conn->fd, IORING_OP_CLOSE);
+	picohttpGreenFree(green, t);
+}
+
+static void picohttpGreenUringResume(
+	struct picohttpGreen * const green,
+	struct picohttpGreenThread * const t )
+{
+	t->waiting = 0;
+	green->stats.switches++;
+	swapcontext(&green->sched, &t->ctx);
+	if( t->done ) {
+		green->stats.served++;
+		picohttpGreenUringFinish(green, t);
+	}
+}
+
+static void picohttpGreenUringSpawn(
+	struct picohttpGreen * const green,
+	int fd )
+{
+	struct picohttpGreenThread * const t = picohttpGreenThreadCreate(green);
+	if( !t ) {
+		close(fd);
+		return;
+	}
+	struct picohttpGreenUringConn * const conn = &t->conn.uring;
+	conn->fd = fd;
+	conn->rx_head = PICOHTTP_GREEN_NOBUF;
+	conn->rx_tail = PICOHTTP_GREEN_NOBUF;
+
+	t->ioops.read  = picohttpGreenUringRead;
+	t->ioops.write = picohttpGreenUringWrite;
+	t->ioops.getch = picohttpGreenUringGetch;
+	t->ioops.putch = picohttpGreenUringPutch;
+	t->ioops.flush = picohttpGreenUringFlush;
+	t->ioops.data  = conn;
+
+	if( green->config.max_threads
+	 && green->stats.threads >= green->config.max_threads ) {
+		/* connections accepted until the cancel takes effect are
+		 * served anyway */
+		picohttpGreenListen(green, 0);
+	}
+	picohttpGreenUringResume(green, t);
+}
+
+static void picohttpGreenUringRecvDone(
+	struct picohttpGreen * const green,
+	struct picohttpGreenThread * const t,
+	int res,
+	uint32_t flags )
+{
+	struct picohttpGreenUring * const r = green->uring;
+	struct picohttpGreenUringConn * const conn = &t->conn.uring;
+
+	if( flags & IORING_CQE_F_BUFFER ) {
+		uint16_t const bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		if( 0 < res && !t->closing ) {
+			r->buf_len[bid] = res;
+			r->buf_next[bid] = PICOHTTP_GREEN_NOBUF;
+			if( PICOHTTP_GREEN_NOBUF == conn->rx_tail ) {
+				conn->rx_head = bid;
+			} else {
+				r->buf_next[conn->rx_tail] = bid;
+			}
+			conn->rx_tail = bid;
+			r->held++;
+		} else {
+			picohttpGreenUringBufRelease(r, bid);
+		}
+	}
+	if( !(flags & IORING_CQE_F_MORE) ) {
+		conn->recv_armed = 0;
+	}
+	if( 0 == res ) {
+		conn->eof = 1;
+	} else
+	if( -ENOBUFS == res ) {
+		if( !conn->starved && !t->closing ) {
+			conn->starved = 1;
+			r->starved++;
+		}
+	} else
+	if( -EINVAL == res && r->recv_multishot ) {
+		/* kernel without multishot recv (pre 6.0) */
+		r->recv_multishot = 0;
+	} else
+	if( 0 > res ) {
+		conn->eof = 1;
+	}
+
+	if( t->closing ) {
+		if( !conn->recv_armed ) {
+			picohttpGreenUringCloseFd(green, conn->fd, IORING_OP_CLOSE);
+			picohttpGreenFree(green, t);
+		}
+		return;
+	}
+	if( PICOHTTP_GREEN_WAIT_RECV == t->waiting
+	 && ( PICOHTTP_GREEN_NOBUF != conn->rx_head
+	   || conn->eof
+	   || (!conn->recv_armed && !conn->starved) ) ) {
+		picohttpGreenUringResume(green, t);
+	}
+}
+
+static void picohttpGreenUringAcceptDone(
+	struct picohttpGreen * const green,
+	int res,
+	uint32_t flags )
+{
+	struct picohttpGreenUring * const r = green->uring;
+	if( !(flags & IORING_CQE_F_MORE) ) {
+		r->accept_armed = 0;
+		if( -ECANCELED != res && !green->paused ) {
+			if( 0 > res && -EINTR != res && -ECONNABORTED != res ) {
+				/* out of descriptors or memory; retried once a
+				 * connection finishes or the wait times out */
+				green->paused = 1;
+			} else {
+				picohttpGreenUringArmAccept(green);
+			}
+		}
+	}
+	if( 0 <= res ) {
+		if( green->stop ) {
+			close(res);
+		} else {
+			picohttpGreenUringSpawn(green, res);
+		}
+	}
+}
+
+/* Handles all completions there are; returns their number */
+static unsigned picohttpGreenUringReap(
+	struct picohttpGreen * const green )
+{
+	struct picohttpGreenUring * const r = green->uring;
+	unsigned n = 0;
+	unsigned head = *r->cq_khead;
+	for(;;) {
+		unsigned const tail = __atomic_load_n(r->cq_ktail, __ATOMIC_ACQUIRE);
+		if( head == tail ) {
+			break;
+		}
+		struct io_uring_cqe const * const cqe =
+			r->cqes + (head & *r->cq_mask);
+		uint64_t const ud = cqe->user_data;
+		int const res = cqe->res;
+		uint32_t const flags = cqe->flags;
+		__atomic_store_n(r->cq_khead, ++head, __ATOMIC_RELEASE);
+		n++;
+
+		struct picohttpGreenThread * const t = (void*)(uintptr_t)(ud & ~(uint64_t)3);
+		switch( ud & 3 ) {
+		case PICOHTTP_GREEN_TAG_ACCEPT:
+			picohttpGreenUringAcceptDone(green, res, flags);
+			break;
+		case PICOHTTP_GREEN_TAG_RECV:
+			picohttpGreenUringRecvDone(green, t, res, flags);
+			break;
+		case PICOHTTP_GREEN_TAG_IO:
+			t->res = res;
+			picohttpGreenUringResume(green, t);
+			break;
+		}
+		/* completions handled may have queued more of them */
+		head = *r->cq_khead;
+	}
+	return n;
+}
+
+static int picohttpGreenUringRun(
+	struct picohttpGreen * const green )
+{
+	struct picohttpGreenUring * const r = green->uring;
+	int ret = 0;
+
+	picohttpGreenUringArmAccept(green);
+	while( !green->stop ) {
+		int const e = picohttpGreenUringEnter(r, 1, 1);
+		green->stats.waits++;
+		if( 0 > e
+		 && EINTR != errno
+		 && ETIME != errno
+		 && EBUSY != errno
+		 && EAGAIN != errno ) {
+			ret = -1;
+			break;
+		}
+		if( !picohttpGreenUringReap(green) ) {
+			picohttpGreenListen(green, 1);
+		}
+		if( r->starved ) {
+			picohttpGreenUringUnstarve(green);
+		}
+	}
+
+	/* let the handlers still waiting return through failing I/O;
+	 * those waiting for a send get it failed by a shutdown, as the
+	 * kernel may still access their buffers */
+	picohttpGreenUringCancelAccept(green);
+	for(struct picohttpGreenThread *t = green->threads, *next; t; t = next) {
+		next = t->next;
+		if( t->closing ) {
+			continue;
+		}
+		t->cancel = 1;
+		if( PICOHTTP_GREEN_WAIT_IO == t->waiting ) {
+			picohttpGreenUringCloseFd(green,
+				t->conn.uring.fd, IORING_OP_SHUTDOWN);
+		} else {
+			picohttpGreenUringResume(green, t);
+		}
+	}
+	/* the last receives trickle in over several waits; give up only
+	 * after a couple of timeouts without any completion */
+	for(unsigned idle = 0; green->threads && idle < 4; ) {
+		picohttpGreenUringEnter(r, 1, 1);
+		green->stats.waits++;
+		idle = picohttpGreenUringReap(green) ? 0 : idle + 1;
+	}
+	picohttpGreenUringEnter(r, 0, 0);
+	return ret;
+}
+
+static void picohttpGreenUringDestroy(
+	struct picohttpGreenUring * const r )
+{
+	if( r->bufs ) {
+		munmap(r->bufs, (size_t)PICOHTTP_GREEN_URING_BUFS
+			* PICOHTTP_GREEN_URING_BUF_LEN);
+	}
+	if( r->br ) {
+		munmap(r->br, r->br_map_len);
+	}
+	if( r->sqes ) {
+		munmap(r->sqes, r->sqes_map_len);
+	}
+	if( r->cq_map && r->cq_map != r->sq_map ) {
+		munmap(r->cq_map, r->cq_map_len);
+	}
+	if( r->sq_map ) {
+		munmap(r->sq_map, r->sq_map_len);
+	}
+	if( 0 <= r->fd ) {
+		close(r->fd);
+	}
+	free(r);
+}
+
+/* Sets up the ring; NULL if the kernel lacks anything needed */
+static struct picohttpGreenUring *picohttpGreenUringCreate(void)
+{
+	struct picohttpGreenUring * const r = calloc(1, sizeof(*r));
+	if( !r ) {
+		return NULL;
+	}
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = 4 * PICOHTTP_GREEN_URING_ENTRIES;
+	r->fd = syscall(__NR_io_uring_setup, PICOHTTP_GREEN_URING_ENTRIES, &p);
+	if( 0 > r->fd ) {
+		free(r);
+		return NULL;
+	}
+	unsigned const feat_needed = IORING_FEAT_SINGLE_MMAP
+		| IORING_FEAT_NODROP
+		| IORING_FEAT_FAST_POLL
+		| IORING_FEAT_EXT_ARG;
+	if( feat_needed != (p.features & feat_needed) ) {
+		goto fail;
+	}
+
+	r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if( r->cq_map_len > r->sq_map_len ) {
+		r->sq_map_len = r->cq_map_len;
+	}
+	r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if( MAP_FAILED == r->sq_map ) {
+		r->sq_map = NULL;
+		goto fail;
+	}
+	r->cq_map = r->sq_map;
+	r->sqes_map_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if( MAP_FAILED == r->sqes ) {
+		r->sqes = NULL;
+		goto fail;
+	}
+
+	uint8_t * const sq = r->sq_map;
+	r->sq_khead = (unsigned*)(sq + p.sq_off.head);
+	r->sq_ktail = (unsigned*)(sq + p.sq_off.tail);
+	r->sq_mask  = (unsigned*)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned*)(sq + p.sq_off.array);
+	r->sq_entries = p.sq_entries;
+	r->sq_tail = *r->sq_ktail;
+	uint8_t * const cq = r->cq_map;
+	r->cq_khead = (unsigned*)(cq + p.cq_off.head);
+	r->cq_ktail = (unsigned*)(cq + p.cq_off.tail);
+	r->cq_mask  = (unsigned*)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+	/* provided buffer ring, kernel 5.19 and later */
+	r->br_map_len = PICOHTTP_GREEN_URING_BUFS * sizeof(struct io_uring_buf);
+	r->br = mmap(NULL, r->br_map_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if( MAP_FAILED == r->br ) {
+		r->br = NULL;
+		goto fail;
+	}
+	r->bufs = mmap(NULL,
+		(size_t)PICOHTTP_GREEN_URING_BUFS * PICOHTTP_GREEN_URING_BUF_LEN,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if( MAP_FAILED == r->bufs ) {
+		r->bufs = NULL;
+		goto fail;
+	}
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)r->br;
+	reg.ring_entries = PICOHTTP_GREEN_URING_BUFS;
+	reg.bgid = 0;
+	if( syscall(__NR_io_uring_register, r->fd,
+			IORING_REGISTER_PBUF_RING, &reg, 1) ) {
+		goto fail;
+	}
+	for(unsigned bid = 0; bid < PICOHTTP_GREEN_URING_BUFS; bid++) {
+		picohttpGreenUringBufRelease(r, bid);
+	}
+
+	r->recv_multishot = 1;
+	return r;
+
+fail:
+	picohttpGreenUringDestroy(r);
+	return NULL;
+}
+#endif/*!PICOHTTP_GREEN_NO_URING*/
+
+/* While connections can't be taken on, accepting gets paused until a
+ * connection finishes or the wait times out; for epoll the level
+ * triggered listening socket would wake the scheduler over and over. */
+static void picohttpGreenListen(
+	struct picohttpGreen * const green,
+	uint8_t on )
+{
+	if( green->paused != on ) {
+		return;
+	}
+	if( on && green->config.max_threads
+	 && green->stats.threads >= green->config.max_threads ) {
+		return;
+	}
+	green->paused = !on;
+#if !PICOHTTP_GREEN_NO_URING
+	if( green->uring ) {
+		if( on ) {
+			picohttpGreenUringArmAccept(green);
+		} else {
+			picohttpGreenUringCancelAccept(green);
+		}
+		return;
+	}
+#endif
+	struct epoll_event ev = {
+		.events = on ? EPOLLIN : 0,
+		.data.ptr = NULL
+	};
+	epoll_ctl(green->epfd, EPOLL_CTL_MOD, green->config.listenfd, &ev);
+}
+
+struct picohttpGreen *picohttpGreenCreate(
+	struct picohttpGreenConfig const * const config )
+{
+	struct picohttpGreen * const green = calloc(1, sizeof(*green));
+	if( !green ) {
+		return NULL;
+	}
+	green->config = *config;
+	green->pagesize = sysconf(_SC_PAGESIZE);
+	green->epfd = -1;
+
+#if !PICOHTTP_GREEN_NO_URING
+	if( PICOHTTP_GREEN_BACKEND_EPOLL != config->backend ) {
+		green->uring = picohttpGreenUringCreate();
+		if( green->uring ) {
+			green->stats.backend = PICOHTTP_GREEN_BACKEND_URING;
+			return green;
+		}
+	}
+#endif
+	if( PICOHTTP_GREEN_BACKEND_URING == config->backend ) {
+		free(green);
+		return NULL;
+	}
+
+	green->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if( 0 > green->epfd ) {
+		free(green);
+		return NULL;
+	}
+	green->stats.backend = PICOHTTP_GREEN_BACKEND_EPOLL;
+	return green;
+}
+
+void picohttpGreenDestroy(
+	struct picohttpGreen * const green )
+{
+	if( !green ) {
+		return;
+	}
+#if !PICOHTTP_GREEN_NO_URING
+	if( green->uring ) {
+		/* with the ring gone the kernel no longer refers to the
+		 * memory of the threads left */
+		picohttpGreenUringDestroy(green->uring);
+		while( green->threads ) {
+			close(green->threads->conn.uring.fd);
+			picohttpGreenFree(green, green->threads);
+		}
+		free(green);
+		return;
+	}
+#endif
+	while( green->threads ) {
+		close(green->threads->conn.sock.fd);
+		picohttpGreenFree(green, green->threads);
+	}
+	close(green->epfd);
+	free(green);
+}
+
+int picohttpGreenRun(
+	struct picohttpGreen * const green )
+{
+#if !PICOHTTP_GREEN_NO_URING
+	if( green->uring ) {
+		return picohttpGreenUringRun(green);
+	}
+#endif
+	return picohttpGreenEpollRun(green);
+}
+
+void picohttpGreenStop(
+	struct picohttpGreen * const green )
+{
+	green->stop = 1;
+}
+
+void picohttpGreenStats(
+	struct picohttpGreen const * const green,
+	struct picohttpGreenStats * const stats )
+{
+	*stats = green->stats;
+}
+
+int picohttpGreenFileRead(
+	struct picohttpIoOps const * const ioops,
+	int fd,
+	size_t len,
+	void *buf,
+	uint64_t offset )
+{
+#if !PICOHTTP_GREEN_NO_URING
+	struct picohttpGreenThread * const t = picohttpGREEN_THREAD_OF(ioops->data);
+	if( t->green->uring ) {
+		return picohttpGreenUringIo(t, IORING_OP_READ, fd, buf, len, offset);
+	}
+#else
+	(void)ioops;
+#endif
+	ssize_t r;
+	do {
+		r = pread(fd, buf, len, offset);
+	} while( 0 > r && EINTR == errno );
+	return r;
+}
@@ -0,0 +1,131 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_GREEN_H
+#define PICOHTTP_GREEN_H
+
+/* Green thread connection driver for Linux hosts.
+ *
+ * Every connection runs on a user space context with a small stack of
+ * its own, on top of non-blocking sockets. Whenever a read or write
+ * would block the context yields to an epoll scheduler, which resumes
+ * it once the socket is ready. Handlers written against the blocking
+ * picohttpIoOps keep working unchanged, without a thread per
+ * connection and without busy waiting.
+ *
+ * On Linux kernels with a recent enough io_uring (5.19+) the I/O goes
+ * through a ring instead: connections are accepted by a multishot
+ * accept, received into a shared ring of provided buffers, and sends,
+ * file reads and closes of all contexts get submitted in one batch
+ * per scheduler round, so a request takes hardly any syscalls of its
+ * own. Otherwise, or with PICOHTTP_GREEN_NO_URING, epoll is used.
+ *
+ * All contexts run on the thread calling picohttpGreenRun; a handler
+ * doing blocking I/O of its own stalls all of them. Files are best
+ * read through picohttpGreenFileRead.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "picohttp.h"
+
+/* Covers picohttpProcessRequest with room to spare for handlers;
+ * stacks are mapped lazily, so only the used part costs memory. */
+#ifndef PICOHTTP_GREEN_STACK_SIZE
+#define PICOHTTP_GREEN_STACK_SIZE (64*1024)
+#endif
+
+#ifndef PICOHTTP_GREEN_URING_ENTRIES
+#define PICOHTTP_GREEN_URING_ENTRIES 256
+#endif
+/* provided receive buffers shared by all connections */
+#ifndef PICOHTTP_GREEN_URING_BUFS
+#define PICOHTTP_GREEN_URING_BUFS 256
+#endif
+#ifndef PICOHTTP_GREEN_URING_BUF_LEN
+#define PICOHTTP_GREEN_URING_BUF_LEN 2048
+#endif
+
+#define PICOHTTP_GREEN_BACKEND_AUTO  0
+#define PICOHTTP_GREEN_BACKEND_EPOLL 1
+#define PICOHTTP_GREEN_BACKEND_URING 2
+
+/* Runs on a green thread for every connection; the default
+ * (handler == NULL) is picohttpProcessRequest with the configured
+ * routes and no authentication data. */
+typedef void (*picohttpGreenConnHandler)(
+	struct picohttpIoOps const * const ioops,
+	void *userdata );
+
+struct picohttpGreenConfig {
+	int listenfd;
+	size_t stack_size;    /* 0: PICOHTTP_GREEN_STACK_SIZE */
+	size_t max_threads;   /* 0: unlimited */
+	uint8_t backend;      /* PICOHTTP_GREEN_BACKEND_...; AUTO prefers
+	                       * io_uring, URING insists on it */
+	struct picohttpURLRoute const *routes;
+	picohttpGreenConnHandler handler;
+	void *userdata;
+};
+
+struct picohttpGreenStats {
+	size_t threads;       /* connections currently served */
+	uint64_t served;      /* connections served to completion */
+	uint64_t switches;    /* context switches into green threads */
+	uint64_t waits;       /* epoll_wait or io_uring_enter calls */
+	uint8_t backend;      /* the one in use */
+};
+
+struct picohttpGreen;
+
+struct picohttpGreen *picohttpGreenCreate(
+	struct picohttpGreenConfig const * const config );
+
+/* Accepts and serves connections until picohttpGreenStop is called.
+ * Connections still open then see their I/O fail, so that handlers
+ * return. Returns 0 on orderly shutdown, -1 on error. */
+int picohttpGreenRun(
+	struct picohttpGreen * const green );
+
+/* May be called from any thread or a signal handler. */
+void picohttpGreenStop(
+	struct picohttpGreen * const green );
+
+void picohttpGreenDestroy(
+	struct picohttpGreen * const green );
+
+void picohttpGreenStats(
+	struct picohttpGreen const * const green,
+	struct picohttpGreenStats * const stats );
+
+/* Reads from a file (or any fd) on behalf of the green thread serving
+ * ioops, without stalling the others when running on io_uring.
+ * Returns the number of octets read, 0 at EOF or < 0 on error. */
+int picohttpGreenFileRead(
+	struct picohttpIoOps const * const ioops,
+	int fd,
+	size_t len,
+	void *buf,
+	uint64_t offset );
+
+#endif/*PICOHTTP_GREEN_H*/
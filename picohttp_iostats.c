@@ -0,0 +1,213 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "picohttp_iostats.h"
+
+#include <string.h>
+
+/* Advances the phase once the empty line ending a message head went by.
+ * Header lines end in CRLF, or a bare LF which the parser tolerates. */
+static void picohttpIoStatsScan(
+	uint8_t * const phase,
+	uint8_t * const eol,
+	size_t len,
+	void const * const buf )
+{
+	unsigned char const *p = buf;
+	for(size_t i = 0; i < len; i++) {
+		if( '\n' == p[i] ) {
+			if( ++*eol == 2 ) {
+				++*phase;
+				return;
+			}
+		} else
+		if( '\r' != p[i] ) {
+			*eol = 0;
+		}
+	}
+}
+
+static inline void picohttpIoStatsCount(
+	struct picohttpIoStats * const stats,
+	uint8_t phase,
+	unsigned op,
+	int ret )
+{
+	stats->phase[phase].calls[op]++;
+	if( 0 < ret ) {
+		stats->phase[phase].bytes[op] += ret;
+	}
+}
+
+static int picohttpIoStatsRead(size_t count, void *buf, void *data)
+{
+	struct picohttpIoStats * const stats = data;
+	uint8_t const phase = stats->in;
+	int const ret = picohttpIoRead(stats->inner, count, buf);
+	picohttpIoStatsCount(stats, phase, PICOHTTP_IO_READ, ret);
+	if( PICOHTTP_IO_PHASE_REQUEST_HEAD == phase && 0 < ret ) {
+		picohttpIoStatsScan(&stats->in, &stats->in_eol, ret, buf);
+	}
+	return ret;
+}
+
+/* counted as reads, which they stand in for */
+static int picohttpIoStatsSplice(size_t count, int fd, void *data)
+{
+	struct picohttpIoStats * const stats = data;
+	int const ret = picohttpIoSplice(stats->inner, count, fd);
+	picohttpIoStatsCount(stats, stats->in, PICOHTTP_IO_READ, ret);
+	return ret;
+}
+
+static int picohttpIoStatsGetch(void *data)
+{
+	struct picohttpIoStats * const stats = data;
+	uint8_t const phase = stats->in;
+	int const ch = picohttpIoGetch(stats->inner);
+	stats->phase[phase].calls[PICOHTTP_IO_GETCH]++;
+	if( 0 <= ch ) {
+		stats->phase[phase].bytes[PICOHTTP_IO_GETCH]++;
+		if( PICOHTTP_IO_PHASE_REQUEST_HEAD == phase ) {
+			char const c = ch;
+			picohttpIoStatsScan(&stats->in, &stats->in_eol, 1, &c);
+		}
+	}
+	return ch;
+}
+
+static int picohttpIoStatsWrite(size_t count, void const *buf, void *data)
+{
+	struct picohttpIoStats * const stats = data;
+	uint8_t const phase = stats->out;
+	int const ret = picohttpIoWrite(stats->inner, count, buf);
+	picohttpIoStatsCount(stats, phase, PICOHTTP_IO_WRITE, ret);
+	if( PICOHTTP_IO_PHASE_RESPONSE_HEAD == phase && 0 < ret
+	 && !picohttpIsInterimResponse(count, buf) ) {
+		/* 100 Continue counts as response head, but doesn't end it */
+		picohttpIoStatsScan(&stats->out, &stats->out_eol, ret, buf);
+	}
+	return ret;
+}
+
+static int picohttpIoStatsPutch(int ch, void *data)
+{
+	struct picohttpIoStats * const stats = data;
+	uint8_t const phase = stats->out;
+	int const ret = picohttpIoPutch(stats->inner, ch);
+	stats->phase[phase].calls[PICOHTTP_IO_PUTCH]++;
+	if( 0 <= ret ) {
+		stats->phase[phase].bytes[PICOHTTP_IO_PUTCH]++;
+		if( PICOHTTP_IO_PHASE_RESPONSE_HEAD == phase ) {
+			char const c = ch;
+			picohttpIoStatsScan(&stats->out, &stats->out_eol, 1, &c);
+		}
+	}
+	return ret;
+}
+
+static int picohttpIoStatsFlush(void *data)
+{
+	struct picohttpIoStats * const stats = data;
+	stats->phase[stats->out].calls[PICOHTTP_IO_FLUSH]++;
+	return picohttpIoFlush(stats->inner);
+}
+
+void picohttpIoStatsBegin(
+	struct picohttpIoStats * const stats,
+	struct picohttpIoStatsTotals * const totals,
+	struct picohttpIoOps const * const ioops )
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->inner = ioops;
+	stats->totals = totals;
+	stats->in = PICOHTTP_IO_PHASE_REQUEST_HEAD;
+	stats->out = PICOHTTP_IO_PHASE_RESPONSE_HEAD;
+
+	stats->ioops.read  = picohttpIoStatsRead;
+	stats->ioops.write = picohttpIoStatsWrite;
+	stats->ioops.getch = picohttpIoStatsGetch;
+	stats->ioops.putch = picohttpIoStatsPutch;
+	stats->ioops.flush = picohttpIoStatsFlush;
+	stats->ioops.data  = stats;
+	stats->ioops.inner = ioops;
+	if( ioops->splice ) {
+		stats->ioops.splice = picohttpIoStatsSplice;
+	}
+}
+
+uint64_t picohttpIoStatsCalls(
+	struct picohttpIoStats const * const stats )
+{
+	uint64_t calls = 0;
+	for(unsigned p = 0; p < PICOHTTP_IO_PHASES; p++) {
+		for(unsigned op = 0; op < PICOHTTP_IO_OPS; op++) {
+			calls += stats->phase[p].calls[op];
+		}
+	}
+	return calls;
+}
+
+uint64_t picohttpIoStatsEnd(
+	struct picohttpIoStats * const stats )
+{
+	struct picohttpIoStatsTotals * const totals = stats->totals;
+	if( !totals ) {
+		return 0;
+	}
+
+	for(unsigned p = 0; p < PICOHTTP_IO_PHASES; p++) {
+		for(unsigned op = 0; op < PICOHTTP_IO_OPS; op++) {
+			if( stats->phase[p].calls[op] ) {
+				__atomic_fetch_add(&totals->phase[p].calls[op],
+					stats->phase[p].calls[op], __ATOMIC_RELAXED);
+				__atomic_fetch_add(&totals->phase[p].bytes[op],
+					stats->phase[p].bytes[op], __ATOMIC_RELAXED);
+			}
+		}
+	}
+	__atomic_fetch_add(&totals->requests, 1, __ATOMIC_RELAXED);
+
+	uint64_t const calls = picohttpIoStatsCalls(stats);
+	uint64_t max = __atomic_load_n(&totals->max_calls, __ATOMIC_RELAXED);
+	while( calls > max
+	    && !__atomic_compare_exchange_n(&totals->max_calls, &max, calls,
+	           1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+
+	uint64_t const budget = totals->budget;
+	if( !budget || calls <= budget ) {
+		return 0;
+	}
+	__atomic_fetch_add(&totals->over_budget, 1, __ATOMIC_RELAXED);
+	return calls - budget;
+}
+
+struct picohttpIoStats const *picohttpIoStatsOf(
+	struct picohttpRequest const * const req )
+{
+	/* other wrappers, like the metrics, may sit on top */
+	for(struct picohttpIoOps const *io = req->ioops; io; io = io->inner) {
+		if( picohttpIoStatsWrite == io->write ) {
+			return io->data;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,110 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_IOSTATS_H
+#define PICOHTTP_IOSTATS_H
+
+/* I/O call counting.
+ *
+ * A picohttpIoStats wraps a connection's picohttpIoOps and counts the
+ * calls made to each operation and the octets they moved, separately
+ * for the phases of the request. Phases are told apart by watching the
+ * data for the empty line ending a message head, so the library needs
+ * no hooks for this:
+ *
+ *   request head    input up to the end of the request header
+ *   request body    input after that
+ *   response head   output up to the end of the response header
+ *   response body   output after that
+ *
+ * Flushes are attributed to the current output phase. Calls to the
+ * wrapped operations are what's counted, and what the budget of
+ * picohttpIoStatsTotals limits. Only with unbuffered socket I/O are
+ * these system calls; over a picohttpSockConn, which buffers both
+ * ways, a getch is a system call only when the receive buffer ran
+ * empty, so the counts are an upper bound on the system calls. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "picohttp.h"
+
+#define PICOHTTP_IO_READ  0
+#define PICOHTTP_IO_WRITE 1
+#define PICOHTTP_IO_GETCH 2
+#define PICOHTTP_IO_PUTCH 3
+#define PICOHTTP_IO_FLUSH 4
+#define PICOHTTP_IO_OPS   5
+
+#define PICOHTTP_IO_PHASE_REQUEST_HEAD  0
+#define PICOHTTP_IO_PHASE_REQUEST_BODY  1
+#define PICOHTTP_IO_PHASE_RESPONSE_HEAD 2
+#define PICOHTTP_IO_PHASE_RESPONSE_BODY 3
+#define PICOHTTP_IO_PHASES              4
+
+struct picohttpIoCounters {
+	uint64_t calls[PICOHTTP_IO_OPS];
+	uint64_t bytes[PICOHTTP_IO_OPS];
+};
+
+/* Aggregate over many requests; may be shared by threads */
+struct picohttpIoStatsTotals {
+	uint64_t budget;      /* operation calls per request; 0: none */
+	uint64_t requests;
+	uint64_t over_budget; /* requests that made more calls than budget */
+	uint64_t max_calls;   /* most calls made by a single request */
+	struct picohttpIoCounters phase[PICOHTTP_IO_PHASES];
+};
+
+/* Per connection; lives on the caller's stack */
+struct picohttpIoStats {
+	struct picohttpIoOps ioops;   /* process the request with these */
+	struct picohttpIoOps const *inner;
+	struct picohttpIoStatsTotals *totals;
+	struct picohttpIoCounters phase[PICOHTTP_IO_PHASES];
+	uint8_t in;   /* current input and output phase */
+	uint8_t out;
+	uint8_t in_eol;  /* line ends in a row */
+	uint8_t out_eol;
+};
+
+/* Starts counting the calls made to ioops; totals may be NULL */
+void picohttpIoStatsBegin(
+	struct picohttpIoStats * const stats,
+	struct picohttpIoStatsTotals * const totals,
+	struct picohttpIoOps const * const ioops );
+
+/* Adds the request to the totals. Returns the number of calls it made
+ * beyond the totals' budget, 0 if within. */
+uint64_t picohttpIoStatsEnd(
+	struct picohttpIoStats * const stats );
+
+/* Counters of the request being processed, NULL if its ioops are not
+ * those of a picohttpIoStats, nor wrap them. */
+struct picohttpIoStats const *picohttpIoStatsOf(
+	struct picohttpRequest const * const req );
+
+/* Calls counted over all operations and phases */
+uint64_t picohttpIoStatsCalls(
+	struct picohttpIoStats const * const stats );
+
+#endif/*PICOHTTP_IOSTATS_H*/
@@ -0,0 +1,152 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* MD5 as specified in RFC-1321; only used for HTTP Digest authentication
+ * where RFC-7616 still requires it for compatibility. */
+
+#include "picohttp_md5.h"
+
+#include <string.h>
+
+#define ROL32(x,n) (((x) << (n)) | ((x) >> (32-(n))))
+
+static uint32_t const phmd5_K[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+	0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+	0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+	0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+	0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+	0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static uint8_t const phmd5_R[16] = {
+	7, 12, 17, 22,
+	5,  9, 14, 20,
+	4, 11, 16, 23,
+	6, 10, 15, 21
+};
+
+static void phmd5block(
+	struct phmd5ctx *ctx,
+	uint8_t const *block )
+{
+	uint32_t w[16];
+	for(int i = 0; i < 16; i++) {
+		w[i] =  (uint32_t)block[i*4]
+		     | ((uint32_t)block[i*4+1] << 8)
+		     | ((uint32_t)block[i*4+2] << 16)
+		     | ((uint32_t)block[i*4+3] << 24);
+	}
+
+	uint32_t a = ctx->h[0];
+	uint32_t b = ctx->h[1];
+	uint32_t c = ctx->h[2];
+	uint32_t d = ctx->h[3];
+
+	for(int i = 0; i < 64; i++) {
+		uint32_t f;
+		int g;
+		switch( i >> 4 ) {
+		case 0: f = (b & c) | (~b & d); g = i;            break;
+		case 1: f = (d & b) | (~d & c); g = (5*i + 1) & 15; break;
+		case 2: f = b ^ c ^ d;          g = (3*i + 5) & 15; break;
+		default:f = c ^ (b | ~d);       g = (7*i) & 15;     break;
+		}
+		uint32_t const t = d;
+		d = c;
+		c = b;
+		b = b + ROL32(a + f + phmd5_K[i] + w[g],
+		              phmd5_R[((i >> 4) << 2) | (i & 3)]);
+		a = t;
+	}
+
+	ctx->h[0] += a;
+	ctx->h[1] += b;
+	ctx->h[2] += c;
+	ctx->h[3] += d;
+}
+
+void phmd5init(
+	struct phmd5ctx *ctx )
+{
+	ctx->h[0] = 0x67452301;
+	ctx->h[1] = 0xefcdab89;
+	ctx->h[2] = 0x98badcfe;
+	ctx->h[3] = 0x10325476;
+	ctx->length = 0;
+}
+
+void phmd5update(
+	struct phmd5ctx *ctx,
+	size_t len,
+	void const *data )
+{
+	uint8_t const *d = data;
+	size_t fill = ctx->length & 63;
+	ctx->length += len;
+
+	while( len ) {
+		size_t n = 64 - fill;
+		if( n > len ) {
+			n = len;
+		}
+		memcpy(ctx->block + fill, d, n);
+		fill += n;
+		d += n;
+		len -= n;
+		if( 64 == fill ) {
+			phmd5block(ctx, ctx->block);
+			fill = 0;
+		}
+	}
+}
+
+void phmd5final(
+	struct phmd5ctx *ctx,
+	uint8_t digest[PHMD5_DIGEST_LEN] )
+{
+	uint64_t const bits = ctx->length << 3;
+	uint8_t pad[72] = { 0x80, };
+	size_t const fill = ctx->length & 63;
+	size_t const padlen = (fill < 56) ? 56 - fill : 120 - fill;
+
+	for(int i = 0; i < 8; i++) {
+		pad[padlen + i] = (uint8_t)(bits >> (8*i));
+	}
+	phmd5update(ctx, padlen + 8, pad);
+
+	for(int i = 0; i < 4; i++) {
+		digest[i*4]   = (uint8_t)(ctx->h[i]);
+		digest[i*4+1] = (uint8_t)(ctx->h[i] >> 8);
+		digest[i*4+2] = (uint8_t)(ctx->h[i] >> 16);
+		digest[i*4+3] = (uint8_t)(ctx->h[i] >> 24);
+	}
+}
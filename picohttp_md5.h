@@ -20,29 +20,30 @@
 */
 
 #pragma once
-#ifndef PICOHTTP_DEBUG_H
-#define PICOHTTP_DEBUG_H
-
-#if 0
-#include <util/debug_utils.h>
-#endif
-
-#ifndef debug_printf
-#ifdef HOST_DEBUG
-#include <stdio.h>
-#define debug_printf(...) do{fprintf(stderr, __VA_ARGS__);}while(0)
-#else
-#define debug_printf(...) do{}while(0)
-#endif
-#endif
-
-#ifndef debug_putc
-#ifdef HOST_DEBUG
-#include <stdio.h>
-#define debug_putc(x) do{fputc(x, stderr);}while(0)
-#else
-#define debug_putc(x) do{}while(0)
-#endif
-#endif
-
-#endif/*PICOHTTP_DEBUG_H*/
+#ifndef PICOHTTP_MD5_H
+#define PICOHTTP_MD5_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PHMD5_DIGEST_LEN 16
+
+struct phmd5ctx {
+	uint32_t h[4];
+	uint64_t length;
+	uint8_t block[64];
+};
+
+void phmd5init(
+	struct phmd5ctx *ctx );
+
+void phmd5update(
+	struct phmd5ctx *ctx,
+	size_t len,
+	void const *data );
+
+void phmd5final(
+	struct phmd5ctx *ctx,
+	uint8_t digest[PHMD5_DIGEST_LEN] );
+
+#endif/*PICOHTTP_MD5_H*/
@@ -0,0 +1,482 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "picohttp_metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define PICOHTTP_METRICS_CACHELINE 64
+
+/* status codes counted individually; everything else is "other" */
+static int const picohttpMetricsStatusCodes[] = {
+	200, 204, 206, 301, 302, 304,
+	400, 401, 402, 403, 404, 405, 408, 413, 414, 416, 429,
+	500, 501, 503, 505
+};
+#define PICOHTTP_METRICS_STATUSES \
+	(sizeof(picohttpMetricsStatusCodes)/sizeof(*picohttpMetricsStatusCodes) + 1)
+
+static char const * const picohttpMetricsTimeNames[PICOHTTP_METRICS_TIMES] = {
+	"picohttp_request_parse_seconds",
+	"picohttp_request_ttfb_seconds",
+	"picohttp_request_duration_seconds",
+};
+static char const * const picohttpMetricsTimeHelp[PICOHTTP_METRICS_TIMES] = {
+	"Time until the route handler was invoked.",
+	"Time until the first response octet was written.",
+	"Time until the request was answered.",
+};
+
+struct picohttpMetricsRoute {
+	uint64_t status[PICOHTTP_METRICS_STATUSES];
+	uint64_t sum[PICOHTTP_METRICS_TIMES];     /* nanoseconds */
+	uint64_t bucket[PICOHTTP_METRICS_TIMES][PICOHTTP_METRICS_BUCKETS];
+};
+
+struct picohttpMetrics {
+	struct picohttpURLRoute const *app_routes;
+	struct picohttpURLRoute *routes;
+	unsigned nroutes;       /* slot route nroutes: requests not routed */
+	unsigned nslots;
+	size_t slot_size;
+	unsigned char *slots;
+};
+
+static uint64_t picohttpMetricsNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned picohttpMetricsBucket(uint64_t ns)
+{
+	if( ns < 1000 ) {
+		return 0;
+	}
+	uint64_t const us = ns / 1000;
+	unsigned const e = 63 - __builtin_clzll(us);
+	unsigned const b = 1 + 2*e + (2*ns >= (uint64_t)3000 << e);
+	return (b < PICOHTTP_METRICS_BUCKETS - 1) ?
+		b : PICOHTTP_METRICS_BUCKETS - 1;
+}
+
+/* exclusive upper bound of bucket b in microseconds */
+static double picohttpMetricsBucketBound(unsigned b)
+{
+	if( !b ) {
+		return 1.;
+	}
+	double const p = (double)((uint64_t)1 << ((b - 1) / 2));
+	return (b & 1) ? 1.5 * p : 2. * p;
+}
+
+static unsigned picohttpMetricsStatusIndex(int status)
+{
+	unsigned i;
+	for(i = 0; i < PICOHTTP_METRICS_STATUSES - 1; i++) {
+		if( picohttpMetricsStatusCodes[i] == status )
+			break;
+	}
+	return i;
+}
+
+static struct picohttpMetricsRoute *picohttpMetricsSlotRoute(
+	struct picohttpMetrics const * const metrics,
+	unsigned slot,
+	unsigned route )
+{
+	return (struct picohttpMetricsRoute*)(metrics->slots
+		+ slot * metrics->slot_size) + route;
+}
+
+static inline void picohttpMetricsAdd(uint64_t *counter, uint64_t v)
+{
+	/* slots are meant to have a single writer, but nothing breaks if
+	 * threads share one */
+	__atomic_fetch_add(counter, v, __ATOMIC_RELAXED);
+}
+
+/* I/O wrappers */
+
+static int picohttpMetricsRead(size_t count, void *buf, void *data)
+{
+	struct picohttpMetricsConn * const conn = data;
+	return picohttpIoRead(conn->inner, count, buf);
+}
+
+static int picohttpMetricsSplice(size_t count, int fd, void *data)
+{
+	struct picohttpMetricsConn * const conn = data;
+	return picohttpIoSplice(conn->inner, count, fd);
+}
+
+static int picohttpMetricsGetch(void *data)
+{
+	struct picohttpMetricsConn * const conn = data;
+	return picohttpIoGetch(conn->inner);
+}
+
+static void picohttpMetricsOutput(
+	struct picohttpMetricsConn * const conn,
+	size_t count,
+	void const *buf )
+{
+	if( !conn->head_len && picohttpIsInterimResponse(count, buf) ) {
+		/* 100 Continue; the response is yet to come */
+		return;
+	}
+	if( !conn->t[PICOHTTP_METRICS_TTFB+1] ) {
+		conn->t[PICOHTTP_METRICS_TTFB+1] = picohttpMetricsNow();
+	}
+	if( conn->head_len < sizeof(conn->head) - 1 ) {
+		size_t n = sizeof(conn->head) - 1 - conn->head_len;
+		if( n > count )
+			n = count;
+		memcpy(conn->head + conn->head_len, buf, n);
+		conn->head_len += n;
+	}
+}
+
+static int picohttpMetricsWrite(size_t count, void const *buf, void *data)
+{
+	struct picohttpMetricsConn * const conn = data;
+	if( count ) {
+		picohttpMetricsOutput(conn, count, buf);
+	}
+	return picohttpIoWrite(conn->inner, count, buf);
+}
+
+static int picohttpMetricsPutch(int ch, void *data)
+{
+	struct picohttpMetricsConn * const conn = data;
+	char const c = ch;
+	picohttpMetricsOutput(conn, 1, &c);
+	return picohttpIoPutch(conn->inner, ch);
+}
+
+static int picohttpMetricsFlush(void *data)
+{
+	struct picohttpMetricsConn * const conn = data;
+	return picohttpIoFlush(conn->inner);
+}
+
+static struct picohttpMetricsConn *picohttpMetricsConnOf(
+	struct picohttpRequest const * const req )
+{
+	for(struct picohttpIoOps const *io = req->ioops; io; io = io->inner) {
+		if( picohttpMetricsWrite == io->write ) {
+			return io->data;
+		}
+	}
+	return NULL;
+}
+
+/* handler of all routes in the table handed out */
+static void picohttpMetricsTrampoline(struct picohttpRequest *req)
+{
+	struct picohttpMetricsConn * const conn = picohttpMetricsConnOf(req);
+	if( !conn ) {
+		/* not processed over a picohttpMetricsConn; there's no way
+		 * of telling the application's handler */
+		picohttpStatusResponse(req, PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR);
+		return;
+	}
+	struct picohttpMetrics * const metrics = conn->metrics;
+	conn->route = req->route - metrics->routes;
+	conn->t[PICOHTTP_METRICS_PARSE+1] = picohttpMetricsNow();
+	metrics->app_routes[conn->route].handler(req);
+}
+
+void picohttpMetricsConnBegin(
+	struct picohttpMetricsConn * const conn,
+	struct picohttpMetrics * const metrics,
+	unsigned slot,
+	struct picohttpIoOps const * const ioops )
+{
+	memset(conn, 0, sizeof(*conn));
+	conn->inner = ioops;
+	conn->metrics = metrics;
+	conn->slot = slot % metrics->nslots;
+	conn->route = metrics->nroutes;
+
+	conn->ioops.read  = picohttpMetricsRead;
+	conn->ioops.write = picohttpMetricsWrite;
+	conn->ioops.getch = picohttpMetricsGetch;
+	conn->ioops.putch = picohttpMetricsPutch;
+	conn->ioops.flush = picohttpMetricsFlush;
+	conn->ioops.data  = conn;
+	conn->ioops.inner = ioops;
+	if( ioops->splice ) {
+		conn->ioops.splice = picohttpMetricsSplice;
+	}
+
+	conn->t[0] = picohttpMetricsNow();
+}
+
+void picohttpMetricsConnEnd(
+	struct picohttpMetricsConn * const conn )
+{
+	uint64_t * const t = conn->t;
+	t[PICOHTTP_METRICS_TOTAL+1] = picohttpMetricsNow();
+	/* requests failing before routing are parsed once answered */
+	if( !t[PICOHTTP_METRICS_TTFB+1] ) {
+		t[PICOHTTP_METRICS_TTFB+1] = t[PICOHTTP_METRICS_TOTAL+1];
+	}
+	if( !t[PICOHTTP_METRICS_PARSE+1] ) {
+		t[PICOHTTP_METRICS_PARSE+1] = t[PICOHTTP_METRICS_TTFB+1];
+	}
+
+	/* "HTTP/1.1 200" */
+	int status = 0;
+	conn->head[conn->head_len] = 0;
+	char const * const sp = strchr(conn->head, ' ');
+	if( !strncmp(conn->head, "HTTP/", 5) && sp ) {
+		status = atoi(sp + 1);
+	}
+
+	struct picohttpMetricsRoute * const r = picohttpMetricsSlotRoute(
+		conn->metrics, conn->slot, conn->route);
+	picohttpMetricsAdd(&r->status[picohttpMetricsStatusIndex(status)], 1);
+	for(unsigned i = 0; i < PICOHTTP_METRICS_TIMES; i++) {
+		uint64_t const d = t[i+1] - t[0];
+		picohttpMetricsAdd(&r->sum[i], d);
+		picohttpMetricsAdd(&r->bucket[i][picohttpMetricsBucket(d)], 1);
+	}
+}
+
+struct picohttpMetrics *picohttpMetricsCreate(
+	struct picohttpURLRoute const * const routes,
+	unsigned slots )
+{
+	struct picohttpMetrics * const metrics = calloc(1, sizeof(*metrics));
+	if( !metrics ) {
+		return NULL;
+	}
+	metrics->app_routes = routes;
+	while( routes[metrics->nroutes].urlhead ) {
+		metrics->nroutes++;
+	}
+	metrics->nslots = slots ? slots : 1;
+
+	metrics->routes = calloc(metrics->nroutes + 1, sizeof(*metrics->routes));
+	if( !metrics->routes ) {
+		free(metrics);
+		return NULL;
+	}
+	for(unsigned i = 0; i < metrics->nroutes; i++) {
+		/* all of the route as the application set it up, only its
+		 * handler is taken over */
+		metrics->routes[i] = routes[i];
+		metrics->routes[i].handler = picohttpMetricsTrampoline;
+	}
+
+	/* a slot per thread; rounded up to whole cache lines, so that
+	 * threads recording into neighbouring slots don't share any */
+	size_t const size = (metrics->nroutes + 1)
+		* sizeof(struct picohttpMetricsRoute);
+	metrics->slot_size = (size + PICOHTTP_METRICS_CACHELINE - 1)
+		& ~(size_t)(PICOHTTP_METRICS_CACHELINE - 1);
+	void *slotmem;
+	if( posix_memalign(&slotmem, PICOHTTP_METRICS_CACHELINE,
+			metrics->nslots * metrics->slot_size) ) {
+		free(metrics->routes);
+		free(metrics);
+		return NULL;
+	}
+	metrics->slots = slotmem;
+	memset(metrics->slots, 0, metrics->nslots * metrics->slot_size);
+	return metrics;
+}
+
+void picohttpMetricsDestroy(
+	struct picohttpMetrics * const metrics )
+{
+	if( !metrics ) {
+		return;
+	}
+	free(metrics->slots);
+	free(metrics->routes);
+	free(metrics);
+}
+
+struct picohttpURLRoute const *picohttpMetricsRoutes(
+	struct picohttpMetrics const * const metrics )
+{
+	return metrics->routes;
+}
+
+/* exposition */
+
+/* sums up route's slots */
+static void picohttpMetricsMerge(
+	struct picohttpMetrics const * const metrics,
+	unsigned route,
+	struct picohttpMetricsRoute * const sum )
+{
+	uint64_t * const dst = (uint64_t*)sum;
+	size_t const n = sizeof(*sum) / sizeof(uint64_t);
+	memset(sum, 0, sizeof(*sum));
+	for(unsigned s = 0; s < metrics->nslots; s++) {
+		uint64_t * const src = (uint64_t*)
+			picohttpMetricsSlotRoute(metrics, s, route);
+		for(size_t i = 0; i < n; i++) {
+			dst[i] += __atomic_load_n(src + i, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/* route as label value; without the termination markers */
+static void picohttpMetricsLabel(
+	struct picohttpMetrics const * const metrics,
+	unsigned route,
+	char * const label,
+	size_t len )
+{
+	if( route >= metrics->nroutes ) {
+		snprintf(label, len, "unmatched");
+		return;
+	}
+	char const *s = metrics->app_routes[route].urlhead;
+	size_t j = 0;
+	for(; *s && j + 2 < len; s++) {
+		if( ('|' == *s || '\\' == *s) && !s[1] ) {
+			break;
+		}
+		if( '"' == *s || '\\' == *s ) {
+			label[j++] = '\\';
+		}
+		label[j++] = *s;
+	}
+	label[j] = 0;
+}
+
+static void picohttpMetricsPrint(
+	struct picohttpRequest * const req,
+	char const *fmt,
+	... )
+	__attribute__((format(printf, 2, 3)));
+
+static void picohttpMetricsPrint(
+	struct picohttpRequest * const req,
+	char const *fmt,
+	... )
+{
+	char line[256];
+	va_list ap;
+	va_start(ap, fmt);
+	int const n = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if( 0 < n ) {
+		picohttpResponseWrite(req,
+			((size_t)n < sizeof(line)) ? (size_t)n : sizeof(line)-1, line);
+	}
+}
+
+void picohttpMetricsHandler(
+	struct picohttpRequest *req )
+{
+	struct picohttpMetricsConn * const conn = picohttpMetricsConnOf(req);
+	if( !conn ) {
+		picohttpStatusResponse(req, PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR);
+		return;
+	}
+	struct picohttpMetrics const * const metrics = conn->metrics;
+	unsigned const nroutes = metrics->nroutes + 1;
+
+	struct picohttpMetricsRoute * const sums =
+		malloc(nroutes * sizeof(*sums));
+	if( !sums ) {
+		picohttpStatusResponse(req, PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR);
+		return;
+	}
+	uint64_t * const counts = calloc(nroutes, sizeof(*counts));
+	if( !counts ) {
+		free(sums);
+		picohttpStatusResponse(req, PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR);
+		return;
+	}
+	for(unsigned r = 0; r < nroutes; r++) {
+		picohttpMetricsMerge(metrics, r, sums + r);
+		for(unsigned i = 0; i < PICOHTTP_METRICS_STATUSES; i++) {
+			counts[r] += sums[r].status[i];
+		}
+	}
+
+	req->response.contenttype = "text/plain; version=0.0.4";
+
+	char label[128];
+	picohttpMetricsPrint(req,
+		"# HELP picohttp_requests_total Requests answered.\n"
+		"# TYPE picohttp_requests_total counter\n");
+	for(unsigned r = 0; r < nroutes; r++) {
+		picohttpMetricsLabel(metrics, r, label, sizeof(label));
+		for(unsigned i = 0; i < PICOHTTP_METRICS_STATUSES; i++) {
+			if( !sums[r].status[i] ) {
+				continue;
+			}
+			char code[8] = "other";
+			if( i < PICOHTTP_METRICS_STATUSES - 1 ) {
+				snprintf(code, sizeof(code), "%d",
+					picohttpMetricsStatusCodes[i]);
+			}
+			picohttpMetricsPrint(req,
+				"picohttp_requests_total{route=\"%s\",code=\"%s\"} %llu\n",
+				label, code, (unsigned long long)sums[r].status[i]);
+		}
+	}
+
+	for(unsigned t = 0; t < PICOHTTP_METRICS_TIMES; t++) {
+		char const * const name = picohttpMetricsTimeNames[t];
+		picohttpMetricsPrint(req, "# HELP %s %s\n# TYPE %s histogram\n",
+			name, picohttpMetricsTimeHelp[t], name);
+		for(unsigned r = 0; r < nroutes; r++) {
+			if( !counts[r] ) {
+				continue;
+			}
+			picohttpMetricsLabel(metrics, r, label, sizeof(label));
+			uint64_t cumulative = 0;
+			for(unsigned b = 0; b < PICOHTTP_METRICS_BUCKETS - 1; b++) {
+				cumulative += sums[r].bucket[t][b];
+				picohttpMetricsPrint(req,
+					"%s_bucket{route=\"%s\",le=\"%g\"} %llu\n",
+					name, label, picohttpMetricsBucketBound(b) * 1e-6,
+					(unsigned long long)cumulative);
+			}
+			picohttpMetricsPrint(req,
+				"%s_bucket{route=\"%s\",le=\"+Inf\"} %llu\n"
+				"%s_sum{route=\"%s\"} %.9f\n"
+				"%s_count{route=\"%s\"} %llu\n",
+				name, label, (unsigned long long)counts[r],
+				name, label, sums[r].sum[t] * 1e-9,
+				name, label, (unsigned long long)counts[r]);
+		}
+	}
+
+	free(counts);
+	free(sums);
+}
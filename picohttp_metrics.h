@@ -0,0 +1,105 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_METRICS_H
+#define PICOHTTP_METRICS_H
+
+/* Per route request metrics for POSIX hosts.
+ *
+ * Counts requests by route and status, and keeps log-linear latency
+ * histograms of the time until the route handler ran (parse), until
+ * the first response octet was written (time to first byte) and until
+ * the request was done (total).
+ *
+ * Nothing in the request processing needs to know about this: the
+ * metrics hand out a copy of the route table whose handlers note the
+ * end of parsing before they call the actual handler, and a connection
+ * is measured by running it over the picohttpIoOps a
+ * picohttpMetricsConn wraps around its own.
+ *
+ * Recording goes to one of several slots, each on cache lines of its
+ * own; with a slot per thread the threads serving requests don't
+ * contend. Slots are merged when the metrics are read. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "picohttp.h"
+
+/* histogram buckets: below 1us, then two per power of two up to
+ * 2^26 us (about 67 s), and the overflow bucket */
+#define PICOHTTP_METRICS_BUCKETS 56
+
+#define PICOHTTP_METRICS_PARSE 0
+#define PICOHTTP_METRICS_TTFB  1
+#define PICOHTTP_METRICS_TOTAL 2
+#define PICOHTTP_METRICS_TIMES 3
+
+struct picohttpMetrics;
+
+/* Set up for routes; the application's route table must stay valid.
+ * Requests are recorded in one of slots slots, see
+ * picohttpMetricsConnBegin. */
+struct picohttpMetrics *picohttpMetricsCreate(
+	struct picohttpURLRoute const * const routes,
+	unsigned slots );
+
+void picohttpMetricsDestroy(
+	struct picohttpMetrics * const metrics );
+
+/* The route table to process requests with instead of the one the
+ * metrics were created for. */
+struct picohttpURLRoute const *picohttpMetricsRoutes(
+	struct picohttpMetrics const * const metrics );
+
+/* State of a connection being measured; lives on the caller's stack */
+struct picohttpMetricsConn {
+	struct picohttpIoOps ioops;      /* process the request with these */
+	struct picohttpIoOps const *inner;
+	struct picohttpMetrics *metrics;
+	unsigned slot;
+	unsigned route;
+	uint64_t t[PICOHTTP_METRICS_TIMES+1]; /* start, then marks */
+	char head[16];                   /* of the response; for the status */
+	uint8_t head_len;
+};
+
+/* Starts measuring a connection served over ioops, recording into
+ * slot (taken modulo the number of slots). */
+void picohttpMetricsConnBegin(
+	struct picohttpMetricsConn * const conn,
+	struct picohttpMetrics * const metrics,
+	unsigned slot,
+	struct picohttpIoOps const * const ioops );
+
+/* Records the request once it has been answered */
+void picohttpMetricsConnEnd(
+	struct picohttpMetricsConn * const conn );
+
+/* Route handler serving the metrics in the Prometheus text exposition
+ * format; only works for requests measured by the metrics, so add it
+ * to the route table the metrics are created for, e.g.
+ *   { "/metrics|", 0, picohttpMetricsHandler, 0, PICOHTTP_METHOD_GET } */
+void picohttpMetricsHandler(
+	struct picohttpRequest *req );
+
+#endif/*PICOHTTP_METRICS_H*/
@@ -0,0 +1,73 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_PROBES_H
+#define PICOHTTP_PROBES_H
+
+/* USDT (SystemTap SDT) probes in the request pipeline, for perf,
+ * bpftrace and the like; provider "picohttp":
+ *
+ *   request__start   (request)
+ *   method__parsed   (request, method)
+ *   route__matched   (request, urlhead, url)
+ *   headers__done    (request, urlhead, content length)
+ *   handler__entry   (request, urlhead, content length)
+ *   handler__exit    (request, urlhead, status, octets received, sent)
+ *   response__header (request, urlhead, status, content length)
+ *   multipart__part  (request, urlhead, octets received)
+ *
+ * urlhead is that of the matched route, NULL before routing. A probe
+ * is a single nop until a tracer attaches to it.
+ *
+ * Probes are built in where <sys/sdt.h> is available; define
+ * PICOHTTP_USDT to 0 or 1 to override. */
+
+#ifndef PICOHTTP_USDT
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define PICOHTTP_USDT 1
+#endif
+#endif
+#endif
+#ifndef PICOHTTP_USDT
+#define PICOHTTP_USDT 0
+#endif
+
+#if PICOHTTP_USDT
+#include <sys/sdt.h>
+#define picohttpProbe1(n,a)         DTRACE_PROBE1(picohttp, n, a)
+#define picohttpProbe2(n,a,b)       DTRACE_PROBE2(picohttp, n, a, b)
+#define picohttpProbe3(n,a,b,c)     DTRACE_PROBE3(picohttp, n, a, b, c)
+#define picohttpProbe4(n,a,b,c,d)   DTRACE_PROBE4(picohttp, n, a, b, c, d)
+#define picohttpProbe5(n,a,b,c,d,e) DTRACE_PROBE5(picohttp, n, a, b, c, d, e)
+#else
+#define picohttpProbe1(n,a)         do{}while(0)
+#define picohttpProbe2(n,a,b)       do{}while(0)
+#define picohttpProbe3(n,a,b,c)     do{}while(0)
+#define picohttpProbe4(n,a,b,c,d)   do{}while(0)
+#define picohttpProbe5(n,a,b,c,d,e) do{}while(0)
+#endif
+
+#define picohttpProbeUrlhead(req) \
+	((req)->route ? (req)->route->urlhead : (char const*)0)
+
+#endif/*PICOHTTP_PROBES_H*/
@@ -0,0 +1,269 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "picohttp_ratelimit.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <netinet/in.h>
+
+/* slots looked at for a peer before evicting */
+#define PICOHTTP_RATELIMIT_PROBES 8
+
+/* bucket state in one word, for compare-and-swap: the time of the last
+ * update in ms above tokens in 1/256 */
+#define PICOHTTP_RATELIMIT_TOKEN_BITS 24
+#define PICOHTTP_RATELIMIT_TOKEN_MASK \
+	(((uint64_t)1 << PICOHTTP_RATELIMIT_TOKEN_BITS) - 1)
+#define PICOHTTP_RATELIMIT_TOKEN 256
+
+struct picohttpRateLimitSlot {
+	uint64_t key;   /* 0 while unused */
+	uint64_t state;
+};
+
+struct picohttpRateLimit {
+	size_t mask;
+	uint64_t rate;  /* 1/256 tokens a second */
+	uint64_t burst; /* 1/256 tokens */
+	uint64_t epoch; /* ms, so that no state is 0 */
+	uint64_t allowed;
+	uint64_t limited;
+	uint64_t evicted;
+	size_t reject_len;
+	char reject[128];
+	struct picohttpRateLimitSlot *slots;
+};
+
+static uint64_t picohttpRateLimitMsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* splitmix64 finalizer */
+static uint64_t picohttpRateLimitMix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+/* The bucket key of a peer; 0 for peers that are not limited. IPv6
+ * addresses carrying an IPv4 one, as dual stack sockets report IPv4
+ * peers, get the key of that. */
+static uint64_t picohttpRateLimitKey(
+	struct sockaddr const * const addr,
+	socklen_t addrlen )
+{
+	uint64_t raw;
+	if( AF_INET == addr->sa_family
+	 && addrlen >= (socklen_t)sizeof(struct sockaddr_in) ) {
+		struct sockaddr_in const * const in = (void const*)addr;
+		raw = ((uint64_t)1 << 32) | in->sin_addr.s_addr;
+	} else if( AF_INET6 == addr->sa_family
+	 && addrlen >= (socklen_t)sizeof(struct sockaddr_in6) ) {
+		struct sockaddr_in6 const * const in6 = (void const*)addr;
+		if( IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)
+		 || IN6_IS_ADDR_V4COMPAT(&in6->sin6_addr) ) {
+			uint32_t s_addr;
+			memcpy(&s_addr, in6->sin6_addr.s6_addr + 12, sizeof(s_addr));
+			raw = ((uint64_t)1 << 32) | s_addr;
+		} else {
+			memcpy(&raw, in6->sin6_addr.s6_addr, sizeof(raw));
+			raw ^= (uint64_t)2 << 32;
+		}
+	} else {
+		/* local peers (AF_UNIX) and the like */
+		return 0;
+	}
+	uint64_t const key = picohttpRateLimitMix(raw);
+	return key ? key : 1;
+}
+
+struct picohttpRateLimit *picohttpRateLimitCreate(
+	size_t slots,
+	unsigned rate,
+	unsigned burst )
+{
+	struct picohttpRateLimit * const rl = calloc(1, sizeof(*rl));
+	if( !rl ) {
+		return NULL;
+	}
+	size_t n = 16;
+	while( n < slots ) {
+		n <<= 1;
+	}
+	rl->slots = calloc(n, sizeof(*rl->slots));
+	if( !rl->slots ) {
+		free(rl);
+		return NULL;
+	}
+	rl->mask = n - 1;
+	if( 65535 < rate ) {
+		rate = 65535;
+	}
+	if( 65535 < burst ) {
+		burst = 65535;
+	}
+	rl->rate = (uint64_t)rate * PICOHTTP_RATELIMIT_TOKEN;
+	rl->burst = (uint64_t)(burst ? burst : 1) * PICOHTTP_RATELIMIT_TOKEN;
+	rl->epoch = picohttpRateLimitMsec() - 1;
+	rl->reject_len = snprintf(rl->reject, sizeof(rl->reject),
+		"HTTP/1.1 429 Too Many Requests\r\n"
+		"Retry-After: %u\r\n"
+		"Connection: close\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n",
+		rate ? (burst + rate - 1) / rate : 60 );
+	return rl;
+}
+
+void picohttpRateLimitDestroy(
+	struct picohttpRateLimit * const rl )
+{
+	if( !rl ) {
+		return;
+	}
+	free(rl->slots);
+	free(rl);
+}
+
+/* The slot holding key, or one to put it into */
+static struct picohttpRateLimitSlot *picohttpRateLimitFind(
+	struct picohttpRateLimit * const rl,
+	uint64_t key,
+	uint64_t fresh )
+{
+	struct picohttpRateLimitSlot *oldest = NULL;
+	uint64_t oldest_state = UINT64_MAX;
+
+	for(size_t i = 0; i < PICOHTTP_RATELIMIT_PROBES; i++) {
+		struct picohttpRateLimitSlot * const s =
+			rl->slots + ((key + i) & rl->mask);
+		uint64_t k = __atomic_load_n(&s->key, __ATOMIC_ACQUIRE);
+		if( key == k ) {
+			return s;
+		}
+		if( !k ) {
+			/* claim it; state first, it's read once the key is seen */
+			if( __atomic_compare_exchange_n(&s->key, &k, key,
+					false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+				__atomic_store_n(&s->state, fresh, __ATOMIC_RELEASE);
+				return s;
+			}
+			if( key == k ) {
+				return s;
+			}
+		}
+		uint64_t const state = __atomic_load_n(&s->state, __ATOMIC_RELAXED);
+		if( state < oldest_state ) {
+			oldest = s;
+			oldest_state = state;
+		}
+	}
+
+	/* the state is ordered by time first */
+	uint64_t k = __atomic_load_n(&oldest->key, __ATOMIC_ACQUIRE);
+	if( __atomic_compare_exchange_n(&oldest->key, &k, key,
+			false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+		__atomic_store_n(&oldest->state, fresh, __ATOMIC_RELEASE);
+		__atomic_fetch_add(&rl->evicted, 1, __ATOMIC_RELAXED);
+	}
+	return oldest;
+}
+
+int picohttpRateLimitCheck(
+	struct picohttpRateLimit * const rl,
+	struct sockaddr const * const addr,
+	socklen_t addrlen )
+{
+	uint64_t const key = picohttpRateLimitKey(addr, addrlen);
+	if( !key ) {
+		__atomic_fetch_add(&rl->allowed, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	uint64_t const now = picohttpRateLimitMsec() - rl->epoch;
+	uint64_t const fresh = (now << PICOHTTP_RATELIMIT_TOKEN_BITS) | rl->burst;
+
+	struct picohttpRateLimitSlot * const s =
+		picohttpRateLimitFind(rl, key, fresh);
+
+	uint64_t state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+	for(;;) {
+		/* a new peer's state may not be stored yet */
+		uint64_t const then = state ?
+			state >> PICOHTTP_RATELIMIT_TOKEN_BITS : now;
+		uint64_t tokens = state ?
+			state & PICOHTTP_RATELIMIT_TOKEN_MASK : rl->burst;
+		uint64_t t = then;
+		if( now > then && rl->rate ) {
+			/* time only moves on by what was credited for it, so
+			 * slow refills don't get lost to rounding */
+			uint64_t const credit = (now - then) * rl->rate / 1000;
+			tokens += credit;
+			t = then + (credit * 1000 + rl->rate - 1) / rl->rate;
+		}
+		if( tokens >= rl->burst ) {
+			tokens = rl->burst;
+			t = (now > then) ? now : then;
+		}
+		int const ok = (tokens >= PICOHTTP_RATELIMIT_TOKEN);
+		if( ok ) {
+			tokens -= PICOHTTP_RATELIMIT_TOKEN;
+		}
+		uint64_t const next = (t << PICOHTTP_RATELIMIT_TOKEN_BITS) | tokens;
+		if( __atomic_compare_exchange_n(&s->state, &state, next,
+				false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+			__atomic_fetch_add(ok ? &rl->allowed : &rl->limited,
+				1, __ATOMIC_RELAXED);
+			return ok ? 0 : -1;
+		}
+	}
+}
+
+void picohttpRateLimitReject(
+	struct picohttpRateLimit const * const rl,
+	int fd )
+{
+	ssize_t const w = send(fd, rl->reject, rl->reject_len,
+		MSG_NOSIGNAL | MSG_DONTWAIT);
+	(void)w;
+}
+
+void picohttpRateLimitStats(
+	struct picohttpRateLimit const * const rl,
+	struct picohttpRateLimitStats * const stats )
+{
+	stats->allowed = __atomic_load_n(&rl->allowed, __ATOMIC_RELAXED);
+	stats->limited = __atomic_load_n(&rl->limited, __ATOMIC_RELAXED);
+	stats->evicted = __atomic_load_n(&rl->evicted, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,81 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_RATELIMIT_H
+#define PICOHTTP_RATELIMIT_H
+
+/* Per client rate limiting for POSIX hosts.
+ *
+ * Every peer address (IPv6 by its /64) gets a token bucket, refilled
+ * at rate tokens a second up to burst; a connection takes a token or
+ * is rejected with a canned 429 before anything of it is parsed.
+ * IPv4-mapped IPv6 peers share the bucket of their IPv4 address; peers
+ * of other families than AF_INET and AF_INET6 are not limited.
+ *
+ * The buckets live in a fixed size open addressing table, looked up
+ * and updated with compare-and-swap only, so the drivers' threads
+ * don't serialize on it. A peer not found within a few probes takes
+ * the slot of the one seen longest ago. Races between threads evicting
+ * and updating the same slot may credit a token to the wrong peer;
+ * for a limiter that is good enough. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/socket.h>
+
+struct picohttpRateLimit;
+
+struct picohttpRateLimitStats {
+	uint64_t allowed;
+	uint64_t limited;
+	uint64_t evicted;   /* buckets dropped for new peers */
+};
+
+/* slots is rounded up to a power of 2; rate and burst are in
+ * connections, up to 65535 of each. */
+struct picohttpRateLimit *picohttpRateLimitCreate(
+	size_t slots,
+	unsigned rate,
+	unsigned burst );
+
+void picohttpRateLimitDestroy(
+	struct picohttpRateLimit * const rl );
+
+/* Takes a token for the peer; returns 0 if there was one, -1 if the
+ * connection is to be rejected. Safe to call from any thread. */
+int picohttpRateLimitCheck(
+	struct picohttpRateLimit * const rl,
+	struct sockaddr const * const addr,
+	socklen_t addrlen );
+
+/* Sends the canned 429 without blocking, best effort; see
+ * picohttpSockLinger for closing the connection after it. */
+void picohttpRateLimitReject(
+	struct picohttpRateLimit const * const rl,
+	int fd );
+
+void picohttpRateLimitStats(
+	struct picohttpRateLimit const * const rl,
+	struct picohttpRateLimitStats * const stats );
+
+#endif/*PICOHTTP_RATELIMIT_H*/
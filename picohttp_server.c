@@ -0,0 +1,551 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#define _GNU_SOURCE
+
+#include "picohttp_server.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/* per worker connection queues */
+
+struct picohttpServerQueued {
+	int fd;
+	uint64_t accepted; /* usec */
+};
+
+struct picohttpServerQueue {
+	pthread_mutex_t lock;
+	struct picohttpServerQueued *conns;
+	size_t mask;
+	size_t head; /* owner takes the oldest connection from here */
+	size_t tail; /* acceptor adds and thieves take from here */
+};
+
+struct picohttpServerWorker {
+	struct picohttpServer *server;
+	pthread_t thread;
+	unsigned index;
+	uint32_t rng;
+	struct picohttpServerQueue queue;
+	struct picohttpServerWorkerStats stats;
+	struct picohttpSockConn conn;
+};
+
+/* CoDel state (RFC 8289), over the connections taken from all queues */
+struct picohttpServerCoDel {
+	uint64_t first_above; /* when the delay will have been high an interval */
+	uint64_t drop_next;   /* next connection to shed while dropping */
+	uint32_t count;       /* shed since entering the dropping state */
+	uint32_t lastcount;
+	bool dropping;
+};
+
+struct picohttpServer {
+	struct picohttpServerConfig config;
+	unsigned nworkers;
+	unsigned ninit;   /* workers set up, for picohttpServerDestroy */
+	struct picohttpServerWorker *workers;
+
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+	size_t pending;  /* queued connections over all workers */
+	struct picohttpServerCoDel codel; /* under idle_lock as well */
+	volatile int stop;
+	unsigned next;
+	bool deadlines;
+	size_t unavailable_len;
+	char unavailable[128]; /* the 503 response, serialized */
+};
+
+static int picohttpServerQueuePush(
+	struct picohttpServerWorker * const w,
+	struct picohttpServerQueued const * const c )
+{
+	struct picohttpServerQueue * const q = &w->queue;
+	int ret = -1;
+	pthread_mutex_lock(&q->lock);
+	if( q->tail - q->head <= q->mask ) {
+		q->conns[q->tail++ & q->mask] = *c;
+		w->stats.queued++;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return ret;
+}
+
+static int picohttpServerQueueTake(
+	struct picohttpServerWorker * const w,
+	bool steal,
+	struct picohttpServerQueued * const c )
+{
+	struct picohttpServerQueue * const q = &w->queue;
+	int fd = -1;
+	pthread_mutex_lock(&q->lock);
+	if( q->tail != q->head ) {
+		*c = steal ? q->conns[--q->tail & q->mask]
+		           : q->conns[q->head++ & q->mask];
+		fd = c->fd;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return fd;
+}
+
+static uint64_t picohttpServerUsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t picohttpServerIsqrt(uint32_t x)
+{
+	uint32_t r = 0;
+	for(uint32_t bit = 1u << 30; bit; bit >>= 2) {
+		if( x >= r + bit ) {
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+	}
+	return r;
+}
+
+/* Shedding gets more frequent with the square root of the connections
+ * shed, until the queueing delay drops below target. */
+static uint64_t picohttpServerCoDelNext(
+	struct picohttpServer const * const server,
+	uint64_t t )
+{
+	return t + server->config.shed_interval_usec
+		/ picohttpServerIsqrt(server->codel.count);
+}
+
+/* Decides on a connection taken from a queue after sojourn usec;
+ * called with idle_lock held. */
+static bool picohttpServerCoDelShed(
+	struct picohttpServer * const server,
+	uint64_t now,
+	uint64_t sojourn )
+{
+	struct picohttpServerCoDel * const cd = &server->codel;
+	bool above = false;
+
+	if( sojourn < server->config.shed_target_usec || !server->pending ) {
+		/* fine, or the queues drained anyway */
+		cd->first_above = 0;
+	} else if( !cd->first_above ) {
+		cd->first_above = now + server->config.shed_interval_usec;
+	} else {
+		above = (now >= cd->first_above);
+	}
+
+	if( cd->dropping ) {
+		if( !above ) {
+			cd->dropping = false;
+			return false;
+		}
+		if( now >= cd->drop_next ) {
+			cd->count++;
+			cd->drop_next = picohttpServerCoDelNext(server, cd->drop_next);
+			return true;
+		}
+		return false;
+	}
+	if( above ) {
+		/* back to dropping soon after leaving it: pick up the rate
+		 * from where it was */
+		uint32_t const delta = cd->count - cd->lastcount;
+		cd->count = (1 < delta
+			&& now - cd->drop_next < 16ull * server->config.shed_interval_usec)
+			? delta : 1;
+		cd->lastcount = cd->count;
+		cd->drop_next = picohttpServerCoDelNext(server, now);
+		cd->dropping = true;
+		return true;
+	}
+	return false;
+}
+
+static int picohttpServerNextConnection(
+	struct picohttpServerWorker * const w,
+	struct picohttpServerQueued * const c,
+	bool *stolen,
+	bool *shed )
+{
+	struct picohttpServer * const server = w->server;
+
+	for(;;) {
+		int fd = picohttpServerQueueTake(w, false, c);
+		*stolen = false;
+
+		if( 0 > fd && 1 < server->nworkers ) {
+			/* xorshift32; start the victim scan at a random worker
+			 * so that thieves don't all converge on the same queue */
+			w->rng ^= w->rng << 13;
+			w->rng ^= w->rng >> 17;
+			w->rng ^= w->rng << 5;
+			unsigned const start = w->rng % server->nworkers;
+			for(unsigned i = 0; 0 > fd && i < server->nworkers; i++) {
+				unsigned const victim = (start + i) % server->nworkers;
+				if( victim == w->index )
+					continue;
+				fd = picohttpServerQueueTake(server->workers + victim,
+					true, c);
+			}
+			*stolen = (0 <= fd);
+		}
+
+		uint64_t const now = (0 <= fd && server->config.shed_target_usec) ?
+			picohttpServerUsec() : 0;
+		pthread_mutex_lock(&server->idle_lock);
+		if( 0 <= fd ) {
+			server->pending--;
+			*shed = now && picohttpServerCoDelShed(server,
+				now, now - c->accepted);
+			pthread_mutex_unlock(&server->idle_lock);
+			return fd;
+		}
+		while( !server->pending && !server->stop ) {
+			pthread_cond_wait(&server->idle_cond, &server->idle_lock);
+		}
+		int const stop = server->stop;
+		pthread_mutex_unlock(&server->idle_lock);
+		if( stop ) {
+			return -1;
+		}
+	}
+}
+
+static void picohttpServerServe(
+	struct picohttpServerWorker * const w,
+	struct picohttpServerQueued const * const c )
+{
+	int const fd = c->fd;
+	struct picohttpServer * const server = w->server;
+	struct picohttpSockConn * const conn = &w->conn;
+	struct picohttpIoOps ioops;
+	struct picohttpIoOps const *io = &ioops;
+	struct picohttpURLRoute const *routes = server->config.routes;
+	struct picohttpIoStats ios;
+	struct picohttpMetricsConn mc;
+
+	picohttpSockConnInit(conn, fd, &ioops);
+	if( server->deadlines ) {
+		picohttpSockConnDeadlines(conn,
+			&server->config.deadlines, c->accepted / 1000, 0);
+	}
+	if( server->config.iostats ) {
+		picohttpIoStatsBegin(&ios, server->config.iostats, io);
+		io = &ios.ioops;
+	}
+	if( server->config.metrics ) {
+		picohttpMetricsConnBegin(&mc, server->config.metrics, w->index, io);
+		io = &mc.ioops;
+		routes = picohttpMetricsRoutes(server->config.metrics);
+	}
+
+	if( server->config.handler ) {
+		server->config.handler(io, w->index, server->config.userdata);
+	} else {
+		picohttpProcessRequest(io, routes, NULL, server->config.userdata);
+	}
+	picohttpIoFlush(io);
+	if( server->config.metrics ) {
+		picohttpMetricsConnEnd(&mc);
+	}
+	if( server->config.iostats ) {
+		picohttpIoStatsEnd(&ios);
+	}
+	picohttpSockConnTimeout(conn);
+
+	/* after a 408 the client may still be sending its request */
+	picohttpSockLinger(fd, conn->expired ? PICOHTTP_SOCKIO_LINGER_MS : 0);
+	close(fd);
+}
+
+/* Answers 503 without looking at the request, and closes; waiting
+ * wait_ms at most for the client to take it */
+static void picohttpServerUnavailable(
+	struct picohttpServer const * const server,
+	int fd,
+	unsigned wait_ms )
+{
+	ssize_t const w = send(fd, server->unavailable, server->unavailable_len,
+		MSG_NOSIGNAL | MSG_DONTWAIT);
+	(void)w;
+	picohttpSockLinger(fd, wait_ms);
+	close(fd);
+}
+
+static void *picohttpServerWorkerMain(void *arg)
+{
+	struct picohttpServerWorker * const w = arg;
+
+	for(;;) {
+		struct picohttpServerQueued c;
+		bool stolen;
+		bool shed;
+		if( 0 > picohttpServerNextConnection(w, &c, &stolen, &shed) ) {
+			break;
+		}
+
+		uint64_t const t0 = picohttpServerUsec();
+		if( shed ) {
+			picohttpServerUnavailable(w->server, c.fd,
+				PICOHTTP_SOCKIO_LINGER_MS);
+		} else {
+			picohttpServerServe(w, &c);
+		}
+		uint64_t const t1 = picohttpServerUsec();
+
+		pthread_mutex_lock(&w->queue.lock);
+		w->stats.served += !shed;
+		w->stats.stolen += stolen;
+		w->stats.shed += shed;
+		w->stats.busy_usec += t1 - t0;
+		pthread_mutex_unlock(&w->queue.lock);
+	}
+	return NULL;
+}
+
+struct picohttpServer *picohttpServerCreate(
+	struct picohttpServerConfig const * const config )
+{
+	struct picohttpServer * const server = calloc(1, sizeof(*server));
+	if( !server ) {
+		return NULL;
+	}
+	server->config = *config;
+	if( !server->config.shed_interval_usec ) {
+		server->config.shed_interval_usec = 100000;
+	}
+	server->unavailable_len = snprintf(
+		server->unavailable, sizeof(server->unavailable),
+		"HTTP/1.1 503 Service Unavailable\r\n"
+		"Retry-After: %u\r\n"
+		"Connection: close\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n",
+		config->shed_retry_after ? config->shed_retry_after : 1 );
+	server->deadlines = config->deadlines.header_ms
+		|| config->deadlines.body_ms
+		|| config->deadlines.idle_ms;
+
+	server->nworkers = config->workers;
+	if( !server->nworkers ) {
+		long const ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		server->nworkers = (0 < ncpu) ? ncpu : 1;
+	}
+
+	size_t queue_len = 1;
+	while( queue_len < config->queue_len ) {
+		queue_len <<= 1;
+	}
+	if( 2 > queue_len ) {
+		queue_len = 64;
+	}
+
+	server->workers = calloc(server->nworkers, sizeof(*server->workers));
+	if( !server->workers ) {
+		free(server);
+		return NULL;
+	}
+	pthread_mutex_init(&server->idle_lock, NULL);
+	pthread_cond_init(&server->idle_cond, NULL);
+
+	for(unsigned i = 0; i < server->nworkers; i++) {
+		struct picohttpServerWorker * const w = server->workers + i;
+		w->server = server;
+		w->index = i;
+		w->rng = 2463534242u + i * 0x9e3779b9u;
+		pthread_mutex_init(&w->queue.lock, NULL);
+		server->ninit = i + 1;
+		w->queue.mask = queue_len - 1;
+		w->queue.conns = calloc(queue_len, sizeof(*w->queue.conns));
+		if( !w->queue.conns ) {
+			picohttpServerDestroy(server);
+			return NULL;
+		}
+	}
+
+	return server;
+}
+
+void picohttpServerDestroy(
+	struct picohttpServer * const server )
+{
+	if( !server ) {
+		return;
+	}
+	for(unsigned i = 0; i < server->ninit; i++) {
+		struct picohttpServerWorker * const w = server->workers + i;
+		for(size_t j = w->queue.head; j != w->queue.tail; j++) {
+			close(w->queue.conns[j & w->queue.mask].fd);
+		}
+		free(w->queue.conns);
+		pthread_mutex_destroy(&w->queue.lock);
+	}
+	pthread_cond_destroy(&server->idle_cond);
+	pthread_mutex_destroy(&server->idle_lock);
+	free(server->workers);
+	free(server);
+}
+
+void picohttpServerStop(
+	struct picohttpServer * const server )
+{
+	server->stop = 1;
+}
+
+unsigned picohttpServerWorkers(
+	struct picohttpServer const * const server )
+{
+	return server->nworkers;
+}
+
+void picohttpServerWorkerStats(
+	struct picohttpServer * const server,
+	unsigned worker,
+	struct picohttpServerWorkerStats * const stats )
+{
+	struct picohttpServerWorker * const w = server->workers + worker;
+	pthread_mutex_lock(&w->queue.lock);
+	*stats = w->stats;
+	stats->depth = w->queue.tail - w->queue.head;
+	pthread_mutex_unlock(&w->queue.lock);
+}
+
+static int picohttpServerDispatch(
+	struct picohttpServer * const server,
+	int fd )
+{
+	struct picohttpServerQueued const c = {
+		.fd = fd,
+		.accepted = picohttpServerUsec()
+	};
+	for(unsigned i = 0; i < server->nworkers; i++) {
+		unsigned const target = server->next++ % server->nworkers;
+		if( !picohttpServerQueuePush(server->workers + target, &c) ) {
+			pthread_mutex_lock(&server->idle_lock);
+			server->pending++;
+			pthread_cond_signal(&server->idle_cond);
+			pthread_mutex_unlock(&server->idle_lock);
+			return 0;
+		}
+	}
+	/* all queues full */
+	return -1;
+}
+
+int picohttpServerRun(
+	struct picohttpServer * const server )
+{
+	int ret = 0;
+	unsigned started;
+
+	for(started = 0; started < server->nworkers; started++) {
+		struct picohttpServerWorker * const w = server->workers + started;
+		if( pthread_create(&w->thread, NULL, picohttpServerWorkerMain, w) ) {
+			server->stop = 1;
+			ret = -1;
+			break;
+		}
+	}
+
+	while( !server->stop ) {
+		struct pollfd pfd = {
+			.fd = server->config.listenfd,
+			.events = POLLIN,
+			.revents = 0
+		};
+		/* the timeout bounds how long a stop request goes unnoticed */
+		int const pret = poll(&pfd, 1, 250);
+		if( 0 > pret && EINTR != errno ) {
+			ret = -1;
+			break;
+		}
+		if( 0 >= pret ) {
+			continue;
+		}
+
+		/* under deadlines, waits on clients go through poll */
+		struct sockaddr_storage peer;
+		socklen_t peerlen = sizeof(peer);
+		int const fd = accept4(server->config.listenfd,
+			(struct sockaddr*)&peer, &peerlen,
+			server->deadlines ? SOCK_NONBLOCK : 0);
+		if( 0 > fd ) {
+			if( EINTR == errno
+			 || EAGAIN == errno
+			 || EWOULDBLOCK == errno
+			 || ECONNABORTED == errno ) {
+				continue;
+			}
+			if( EMFILE == errno
+			 || ENFILE == errno
+			 || ENOBUFS == errno
+			 || ENOMEM == errno ) {
+				/* out of descriptors or memory; the pending
+				 * connections wait in the backlog until the
+				 * workers have closed some */
+				poll(NULL, 0, 50);
+				continue;
+			}
+			ret = -1;
+			break;
+		}
+		if( server->config.ratelimit
+		 && picohttpRateLimitCheck(server->config.ratelimit,
+				(struct sockaddr*)&peer, peerlen) ) {
+			/* the acceptor doesn't wait on clients */
+			picohttpRateLimitReject(server->config.ratelimit, fd);
+			picohttpSockLinger(fd, 0);
+			close(fd);
+			continue;
+		}
+		if( picohttpServerDispatch(server, fd) ) {
+			picohttpServerUnavailable(server, fd, 0);
+		}
+	}
+
+	pthread_mutex_lock(&server->idle_lock);
+	server->stop = 1;
+	pthread_cond_broadcast(&server->idle_cond);
+	pthread_mutex_unlock(&server->idle_lock);
+
+	for(unsigned i = 0; i < started; i++) {
+		pthread_join(server->workers[i].thread, NULL);
+	}
+	return ret;
+}
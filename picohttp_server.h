@@ -0,0 +1,118 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_SERVER_H
+#define PICOHTTP_SERVER_H
+
+/* Multi-threaded connection driver for POSIX hosts.
+ *
+ * An acceptor thread (the one calling picohttpServerRun) distributes
+ * accepted connections round robin over per-worker queues. Workers
+ * serve connections from their own queue and steal from the queues of
+ * others once theirs runs dry, so a worker stuck with a slow client
+ * doesn't hold up the connections queued behind it.
+ *
+ * Under overload connections can be shed, CoDel style: once the time
+ * connections spent queued stayed above a target for a whole interval,
+ * connections taken from the queues are answered 503 right away, at a
+ * rate rising for as long as the delay doesn't come down. Connections
+ * finding all queues full are answered 503 as well.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "picohttp.h"
+#include "picohttp_metrics.h"
+#include "picohttp_iostats.h"
+#include "picohttp_sockio.h"
+#include "picohttp_ratelimit.h"
+
+/* Called on a worker thread for every connection; the default
+ * (handler == NULL) is picohttpProcessRequest with the configured
+ * routes and no authentication data. */
+typedef void (*picohttpServerConnHandler)(
+	struct picohttpIoOps const * const ioops,
+	unsigned worker,
+	void *userdata );
+
+struct picohttpServerConfig {
+	int listenfd;
+	unsigned workers;     /* 0: one per online CPU */
+	size_t queue_len;     /* per worker, rounded up to a power of 2 */
+	struct picohttpURLRoute const *routes;
+	picohttpServerConnHandler handler;
+	void *userdata;
+	/* optional; connections are measured in the worker's slot and the
+	 * default handler processes them with the metrics' routes. A custom
+	 * handler has to use picohttpMetricsRoutes itself. */
+	struct picohttpMetrics *metrics;
+	/* optional; the socket I/O of every connection is counted into
+	 * these, beneath the metrics if both are set */
+	struct picohttpIoStatsTotals *iostats;
+	/* all 0 for none; the header deadline runs from the connection
+	 * being accepted, so it includes the time spent queued */
+	struct picohttpDeadlines deadlines;
+	/* queueing delay to shed at; 0 to never shed */
+	unsigned shed_target_usec;
+	unsigned shed_interval_usec; /* 0: 100 ms */
+	unsigned shed_retry_after;   /* seconds, for the 503; 0: 1 */
+	/* optional; checked on accepting, connections over the limit are
+	 * answered 429 by the acceptor and never queued */
+	struct picohttpRateLimit *ratelimit;
+};
+
+struct picohttpServerWorkerStats {
+	uint64_t queued;      /* connections the acceptor queued here */
+	uint64_t served;      /* connections served by this worker */
+	uint64_t stolen;      /* taken from other queues, served or shed */
+	uint64_t shed;        /* answered 503 right away, not served */
+	uint64_t busy_usec;   /* time spent serving */
+	size_t depth;         /* connections currently queued */
+};
+
+struct picohttpServer;
+
+struct picohttpServer *picohttpServerCreate(
+	struct picohttpServerConfig const * const config );
+
+/* Starts the workers and accepts connections until picohttpServerStop
+ * is called. Returns 0 on orderly shutdown, -1 on error. */
+int picohttpServerRun(
+	struct picohttpServer * const server );
+
+/* May be called from any thread or a signal handler. */
+void picohttpServerStop(
+	struct picohttpServer * const server );
+
+void picohttpServerDestroy(
+	struct picohttpServer * const server );
+
+unsigned picohttpServerWorkers(
+	struct picohttpServer const * const server );
+
+void picohttpServerWorkerStats(
+	struct picohttpServer * const server,
+	unsigned worker,
+	struct picohttpServerWorkerStats * const stats );
+
+#endif/*PICOHTTP_SERVER_H*/
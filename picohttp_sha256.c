@@ -0,0 +1,153 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* SHA-256 as specified in FIPS 180-4 */
+
+#include "picohttp_sha256.h"
+
+#include <string.h>
+
+#define ROR32(x,n) (((x) >> (n)) | ((x) << (32-(n))))
+
+static uint32_t const phsha256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void phsha256block(
+	struct phsha256ctx *ctx,
+	uint8_t const *block )
+{
+	uint32_t w[64];
+	for(int i = 0; i < 16; i++) {
+		w[i] = ((uint32_t)block[i*4] << 24)
+		     | ((uint32_t)block[i*4+1] << 16)
+		     | ((uint32_t)block[i*4+2] << 8)
+		     |  (uint32_t)block[i*4+3];
+	}
+	for(int i = 16; i < 64; i++) {
+		uint32_t const s0 =
+			ROR32(w[i-15], 7) ^ ROR32(w[i-15], 18) ^ (w[i-15] >> 3);
+		uint32_t const s1 =
+			ROR32(w[i-2], 17) ^ ROR32(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	uint32_t v[8];
+	memcpy(v, ctx->h, sizeof(v));
+
+	for(int i = 0; i < 64; i++) {
+		uint32_t const S1 = ROR32(v[4], 6) ^ ROR32(v[4], 11) ^ ROR32(v[4], 25);
+		uint32_t const ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+		uint32_t const t1 = v[7] + S1 + ch + phsha256_K[i] + w[i];
+		uint32_t const S0 = ROR32(v[0], 2) ^ ROR32(v[0], 13) ^ ROR32(v[0], 22);
+		uint32_t const maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+		uint32_t const t2 = S0 + maj;
+
+		v[7] = v[6];
+		v[6] = v[5];
+		v[5] = v[4];
+		v[4] = v[3] + t1;
+		v[3] = v[2];
+		v[2] = v[1];
+		v[1] = v[0];
+		v[0] = t1 + t2;
+	}
+
+	for(int i = 0; i < 8; i++) {
+		ctx->h[i] += v[i];
+	}
+}
+
+void phsha256init(
+	struct phsha256ctx *ctx )
+{
+	ctx->h[0] = 0x6a09e667;
+	ctx->h[1] = 0xbb67ae85;
+	ctx->h[2] = 0x3c6ef372;
+	ctx->h[3] = 0xa54ff53a;
+	ctx->h[4] = 0x510e527f;
+	ctx->h[5] = 0x9b05688c;
+	ctx->h[6] = 0x1f83d9ab;
+	ctx->h[7] = 0x5be0cd19;
+	ctx->length = 0;
+}
+
+void phsha256update(
+	struct phsha256ctx *ctx,
+	size_t len,
+	void const *data )
+{
+	uint8_t const *d = data;
+	size_t fill = ctx->length & 63;
+	ctx->length += len;
+
+	while( len ) {
+		size_t n = 64 - fill;
+		if( n > len ) {
+			n = len;
+		}
+		memcpy(ctx->block + fill, d, n);
+		fill += n;
+		d += n;
+		len -= n;
+		if( 64 == fill ) {
+			phsha256block(ctx, ctx->block);
+			fill = 0;
+		}
+	}
+}
+
+void phsha256final(
+	struct phsha256ctx *ctx,
+	uint8_t digest[PHSHA256_DIGEST_LEN] )
+{
+	uint64_t const bits = ctx->length << 3;
+	uint8_t pad[72] = { 0x80, };
+	size_t const fill = ctx->length & 63;
+	size_t const padlen = (fill < 56) ? 56 - fill : 120 - fill;
+
+	for(int i = 0; i < 8; i++) {
+		pad[padlen + i] = (uint8_t)(bits >> (56 - 8*i));
+	}
+	phsha256update(ctx, padlen + 8, pad);
+
+	for(int i = 0; i < 8; i++) {
+		digest[i*4]   = (uint8_t)(ctx->h[i] >> 24);
+		digest[i*4+1] = (uint8_t)(ctx->h[i] >> 16);
+		digest[i*4+2] = (uint8_t)(ctx->h[i] >> 8);
+		digest[i*4+3] = (uint8_t)(ctx->h[i]);
+	}
+}
@@ -0,0 +1,49 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_SHA256_H
+#define PICOHTTP_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PHSHA256_DIGEST_LEN 32
+
+struct phsha256ctx {
+	uint32_t h[8];
+	uint64_t length;
+	uint8_t block[64];
+};
+
+void phsha256init(
+	struct phsha256ctx *ctx );
+
+void phsha256update(
+	struct phsha256ctx *ctx,
+	size_t len,
+	void const *data );
+
+void phsha256final(
+	struct phsha256ctx *ctx,
+	uint8_t digest[PHSHA256_DIGEST_LEN] );
+
+#endif/*PICOHTTP_SHA256_H*/
@@ -0,0 +1,444 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#define _GNU_SOURCE
+
+#include "picohttp_sockio.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+uint64_t picohttpSockConnMsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Waits for the socket until the earlier of the phase deadline and the
+ * idle deadline of this wait. */
+static bool picohttpSockConnPoll(
+	struct picohttpSockConn * const conn,
+	int writable )
+{
+	if( conn->expired ) {
+		return false;
+	}
+	uint64_t now = picohttpSockConnMsec();
+	uint64_t until = conn->deadline;
+	if( conn->deadlines->idle_ms
+	 && (!until || now + conn->deadlines->idle_ms < until) ) {
+		until = now + conn->deadlines->idle_ms;
+	}
+	for(;;) {
+		if( until && until <= now ) {
+			conn->expired = 1;
+			return false;
+		}
+		struct pollfd pfd = {
+			.fd = conn->fd,
+			.events = writable ? POLLOUT : POLLIN,
+			.revents = 0
+		};
+		int const r = poll(&pfd, 1, until ? (int)(until - now) : -1);
+		if( 0 < r ) {
+			return true;
+		}
+		if( 0 > r && EINTR != errno ) {
+			return false;
+		}
+		now = picohttpSockConnMsec();
+	}
+}
+
+/* Decides whether a failed recv/send is to be retried. Without a wait
+ * hook a non-blocking socket running dry is an error. */
+static bool picohttpSockConnRetry(
+	struct picohttpSockConn * const conn,
+	int writable )
+{
+	if( EINTR == errno ) {
+		return true;
+	}
+	if( EAGAIN == errno || EWOULDBLOCK == errno ) {
+		if( conn->wait ) {
+			return 0 <= conn->wait(conn, writable);
+		}
+		if( conn->deadlines ) {
+			return picohttpSockConnPoll(conn, writable);
+		}
+	}
+	return false;
+}
+
+/* Watches the octets received for the empty line ending the request
+ * head; from there on the body deadline applies. */
+static void picohttpSockConnReceived(
+	struct picohttpSockConn * const conn,
+	uint8_t const *buf,
+	size_t len )
+{
+	if( !conn->deadlines || 4 == conn->headend ) {
+		return;
+	}
+	uint8_t m = conn->headend;
+	for(size_t i = 0; i < len && 4 > m; i++) {
+		switch( buf[i] ) {
+		case '\r': m = (0 == m || 2 == m) ? m + 1 : 1; break;
+		case '\n': m = (1 == m || 3 == m) ? m + 1 : 0; break;
+		default: m = 0;
+		}
+	}
+	conn->headend = m;
+	if( 4 == m ) {
+		conn->deadline = conn->deadlines->body_ms ?
+			picohttpSockConnMsec() + conn->deadlines->body_ms : 0;
+	}
+}
+
+static int picohttpSockConnSend(
+	struct picohttpSockConn * const conn,
+	size_t count,
+	void const *buf )
+{
+	if( conn->expired ) {
+		/* whatever the request processing has to say, the client
+		 * gets a 408 */
+		return -1;
+	}
+	size_t wb = 0;
+	while( wb < count ) {
+		ssize_t const w = send(conn->fd,
+			(uint8_t const*)buf + wb, count - wb, MSG_NOSIGNAL);
+		if( 0 > w ) {
+			if( picohttpSockConnRetry(conn, 1) )
+				continue;
+			return -1;
+		}
+		wb += w;
+		conn->sent += w;
+	}
+	return wb;
+}
+
+static int picohttpSockConnFill(
+	struct picohttpSockConn * const conn )
+{
+	ssize_t r;
+	do {
+		r = recv(conn->fd, conn->recvbuf, sizeof(conn->recvbuf), 0);
+	} while( 0 > r && picohttpSockConnRetry(conn, 0) );
+	if( 0 >= r ) {
+		return -1;
+	}
+	picohttpSockConnReceived(conn, conn->recvbuf, r);
+	conn->recvbuf_pos = 0;
+	conn->recvbuf_len = r;
+	return r;
+}
+
+static int picohttpSockConnRead(size_t count, void *buf, void *data)
+{
+	struct picohttpSockConn * const conn = data;
+	size_t rb = 0;
+	while( rb < count ) {
+		if( conn->recvbuf_pos >= conn->recvbuf_len ) {
+			if( count - rb >= sizeof(conn->recvbuf) ) {
+				/* large reads bypass the buffer */
+				ssize_t const r = recv(conn->fd,
+					(uint8_t*)buf + rb, count - rb, 0);
+				if( 0 > r && picohttpSockConnRetry(conn, 0) )
+					continue;
+				if( 0 >= r )
+					break;
+				picohttpSockConnReceived(conn, (uint8_t*)buf + rb, r);
+				rb += r;
+				continue;
+			}
+			if( 0 > picohttpSockConnFill(conn) )
+				break;
+		}
+		size_t n = conn->recvbuf_len - conn->recvbuf_pos;
+		if( n > count - rb )
+			n = count - rb;
+		memcpy((uint8_t*)buf + rb, conn->recvbuf + conn->recvbuf_pos, n);
+		conn->recvbuf_pos += n;
+		rb += n;
+	}
+	return (rb || !count) ? (int)rb : -1;
+}
+
+int picohttpSockConnFlush(void *data)
+{
+	struct picohttpSockConn * const conn = data;
+	if( conn->sendbuf_len ) {
+		int const e = picohttpSockConnSend(conn,
+			conn->sendbuf_len, conn->sendbuf);
+		conn->sendbuf_len = 0;
+		if( 0 > e )
+			return e;
+	}
+	return 0;
+}
+
+static int picohttpSockConnWrite(size_t count, void const *buf, void *data)
+{
+	struct picohttpSockConn * const conn = data;
+	if( conn->sendbuf_len + count > sizeof(conn->sendbuf) ) {
+		int const e = picohttpSockConnFlush(conn);
+		if( 0 > e )
+			return e;
+		if( count >= sizeof(conn->sendbuf) ) {
+			return picohttpSockConnSend(conn, count, buf);
+		}
+	}
+	memcpy(conn->sendbuf + conn->sendbuf_len, buf, count);
+	conn->sendbuf_len += count;
+	return count;
+}
+
+static int picohttpSockConnGetch(void *data)
+{
+	struct picohttpSockConn * const conn = data;
+	if( conn->recvbuf_pos >= conn->recvbuf_len ) {
+		if( 0 > picohttpSockConnFill(conn) )
+			return -1;
+	}
+	return conn->recvbuf[conn->recvbuf_pos++];
+}
+
+static int picohttpSockConnPutch(int ch, void *data)
+{
+	uint8_t const c = ch;
+	return picohttpSockConnWrite(1, &c, data);
+}
+
+#if defined(__linux__)
+/* at most what fits a pipe with the default capacity */
+#define PICOHTTP_SOCKIO_SPLICE_LEN 65536
+
+static int picohttpSockConnWriteFd(
+	int fd,
+	size_t len,
+	uint8_t const *buf )
+{
+	while( len ) {
+		ssize_t const w = write(fd, buf, len);
+		if( 0 > w ) {
+			if( EINTR == errno )
+				continue;
+			return -1;
+		}
+		buf += w;
+		len -= w;
+	}
+	return 0;
+}
+
+/* Empties len octets out of the pipe into fd; copied if fd is nothing
+ * splice writes to (e.g. opened O_APPEND) */
+static int picohttpSockConnPipeOut(
+	int pipefd,
+	int fd,
+	size_t len )
+{
+	while( len ) {
+		ssize_t w = splice(pipefd, NULL, fd, NULL, len, SPLICE_F_MOVE);
+		if( 0 > w && EINVAL == errno ) {
+			uint8_t buf[512];
+			w = read(pipefd, buf, (len < sizeof(buf)) ? len : sizeof(buf));
+			if( 0 < w && 0 > picohttpSockConnWriteFd(fd, w, buf) )
+				return -1;
+		}
+		if( 0 > w && EINTR == errno )
+			continue;
+		if( 0 >= w )
+			return -1;
+		len -= w;
+	}
+	return 0;
+}
+
+static int picohttpSockConnSplice(size_t count, int fd, void *data)
+{
+	struct picohttpSockConn * const conn = data;
+	if( conn->expired ) {
+		return -1;
+	}
+	if( conn->recvbuf_pos >= conn->recvbuf_len
+	 && count < sizeof(conn->recvbuf) ) {
+		/* not worth a pipe */
+		if( 0 > picohttpSockConnFill(conn) )
+			return -1;
+	}
+	if( conn->recvbuf_pos < conn->recvbuf_len ) {
+		/* what was buffered goes first */
+		size_t n = conn->recvbuf_len - conn->recvbuf_pos;
+		if( n > count )
+			n = count;
+		if( 0 > picohttpSockConnWriteFd(fd,
+				n, conn->recvbuf + conn->recvbuf_pos) )
+			return -1;
+		conn->recvbuf_pos += n;
+		return n;
+	}
+
+	int pipefd[2];
+	if( pipe2(pipefd, O_CLOEXEC) ) {
+		return -1;
+	}
+	size_t moved = 0;
+	bool failed = false;
+	while( moved < count ) {
+		size_t const n = (count - moved < PICOHTTP_SOCKIO_SPLICE_LEN) ?
+			count - moved : PICOHTTP_SOCKIO_SPLICE_LEN;
+		ssize_t const r = splice(conn->fd, NULL, pipefd[1], NULL,
+			n, SPLICE_F_MOVE);
+		if( 0 > r && picohttpSockConnRetry(conn, 0) )
+			continue;
+		if( 0 >= r )
+			break;
+		if( 0 > picohttpSockConnPipeOut(pipefd[0], fd, r) ) {
+			failed = true;
+			break;
+		}
+		moved += r;
+	}
+	close(pipefd[0]);
+	close(pipefd[1]);
+	return (moved && !failed) ? (int)moved : -1;
+}
+#endif
+
+void picohttpSockConnInit(
+	struct picohttpSockConn * const conn,
+	int fd,
+	struct picohttpIoOps * const ioops )
+{
+	conn->fd = fd;
+	conn->recvbuf_pos = 0;
+	conn->recvbuf_len = 0;
+	conn->sendbuf_len = 0;
+	conn->sent = 0;
+	conn->wait = NULL;
+	conn->waitdata = NULL;
+	conn->deadlines = NULL;
+	conn->deadline = 0;
+	conn->headend = 0;
+	conn->expired = 0;
+
+	ioops->read  = picohttpSockConnRead;
+	ioops->write = picohttpSockConnWrite;
+	ioops->getch = picohttpSockConnGetch;
+	ioops->putch = picohttpSockConnPutch;
+	ioops->flush = picohttpSockConnFlush;
+	ioops->data  = conn;
+#if defined(__linux__)
+	ioops->splice = picohttpSockConnSplice;
+#else
+	ioops->splice = NULL;
+#endif
+	ioops->inner = NULL;
+}
+
+void picohttpSockConnDeadlines(
+	struct picohttpSockConn * const conn,
+	struct picohttpDeadlines const * const deadlines,
+	uint64_t start,
+	int head_done )
+{
+	conn->deadlines = deadlines;
+	conn->headend = 0;
+	conn->deadline = 0;
+	if( head_done ) {
+		conn->headend = 4;
+		if( deadlines->body_ms ) {
+			conn->deadline = picohttpSockConnMsec() + deadlines->body_ms;
+		}
+	} else if( deadlines->header_ms ) {
+		conn->deadline = start + deadlines->header_ms;
+	}
+}
+
+void picohttpSockSendTimeout(int fd)
+{
+	static char const response[] =
+		"HTTP/1.1 408 Request Timeout\r\n"
+		"Connection: close\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n";
+	ssize_t const w = send(fd, response, sizeof(response)-1,
+		MSG_NOSIGNAL | MSG_DONTWAIT);
+	(void)w;
+}
+
+void picohttpSockLinger(
+	int fd,
+	unsigned wait_ms )
+{
+	shutdown(fd, SHUT_WR);
+
+	uint64_t const until = picohttpSockConnMsec() + wait_ms;
+	char scratch[512];
+	for(size_t left = PICOHTTP_SOCKIO_LINGER_MAX; left; ) {
+		ssize_t const r = recv(fd, scratch,
+			(left < sizeof(scratch)) ? left : sizeof(scratch),
+			MSG_DONTWAIT);
+		if( 0 < r ) {
+			left -= r;
+			continue;
+		}
+		if( !r ) {
+			/* the client is done */
+			return;
+		}
+		if( EINTR == errno ) {
+			continue;
+		}
+		if( EAGAIN != errno && EWOULDBLOCK != errno ) {
+			return;
+		}
+		uint64_t const now = picohttpSockConnMsec();
+		if( now >= until ) {
+			return;
+		}
+		struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+		if( 0 >= poll(&pfd, 1, until - now) ) {
+			return;
+		}
+	}
+}
+
+void picohttpSockConnTimeout(
+	struct picohttpSockConn * const conn )
+{
+	if( conn->expired && !conn->sent ) {
+		picohttpSockSendTimeout(conn->fd);
+	}
+}
@@ -0,0 +1,127 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_SOCKIO_H
+#define PICOHTTP_SOCKIO_H
+
+/* Buffered picohttpIoOps on top of a POSIX stream socket, shared by
+ * the connection drivers. The socket is expected to block unless a
+ * wait hook is installed or the connection is put under deadlines. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "picohttp.h"
+
+#ifndef PICOHTTP_SOCKIO_RECVBUF_LEN
+#define PICOHTTP_SOCKIO_RECVBUF_LEN 2048
+#endif
+#ifndef PICOHTTP_SOCKIO_SENDBUF_LEN
+#define PICOHTTP_SOCKIO_SENDBUF_LEN 2048
+#endif
+/* how long a thread that may block waits for the client to take a
+ * canned response, and how much of its request gets read off then */
+#ifndef PICOHTTP_SOCKIO_LINGER_MS
+#define PICOHTTP_SOCKIO_LINGER_MS 50
+#endif
+#ifndef PICOHTTP_SOCKIO_LINGER_MAX
+#define PICOHTTP_SOCKIO_LINGER_MAX 65536
+#endif
+
+/* Connection deadlines in milliseconds, 0 for none: header from the
+ * start of the connection until the request head is complete, body
+ * from then on until the connection is done, idle for each wait on the
+ * client. */
+struct picohttpDeadlines {
+	unsigned header_ms;
+	unsigned body_ms;
+	unsigned idle_ms;
+};
+
+struct picohttpSockConn;
+
+/* Called when the non-blocking socket would block; returns once it is
+ * (likely) readable, or writable if so requested, or < 0 to give up. */
+typedef int (*picohttpSockConnWait)(
+	struct picohttpSockConn * const conn,
+	int writable );
+
+struct picohttpSockConn {
+	int fd;
+	picohttpSockConnWait wait;
+	void *waitdata;
+	size_t recvbuf_pos;
+	size_t recvbuf_len;
+	size_t sendbuf_len;
+	size_t sent;           /* octets that went out so far */
+	struct picohttpDeadlines const *deadlines;
+	uint64_t deadline;     /* of the current phase; 0 for none */
+	uint8_t headend;       /* of CR LF CR LF, matched so far */
+	uint8_t expired;       /* a deadline passed; all I/O fails */
+	uint8_t recvbuf[PICOHTTP_SOCKIO_RECVBUF_LEN];
+	uint8_t sendbuf[PICOHTTP_SOCKIO_SENDBUF_LEN];
+};
+
+/* Empties the buffers, removes the wait hook and sets up ioops to do
+ * I/O on fd; on Linux these splice off the socket as well. Octets that
+ * were received already may be placed in recvbuf afterwards. */
+void picohttpSockConnInit(
+	struct picohttpSockConn * const conn,
+	int fd,
+	struct picohttpIoOps * const ioops );
+
+int picohttpSockConnFlush(void *data);
+
+/* CLOCK_MONOTONIC in milliseconds, the time base of deadlines */
+uint64_t picohttpSockConnMsec(void);
+
+/* Puts the connection under deadlines, with the header deadline
+ * running from start, or the body deadline from now if the request
+ * head has been received already. The socket has to be non-blocking;
+ * waits for it happen in poll, with no wait hook installed. */
+void picohttpSockConnDeadlines(
+	struct picohttpSockConn * const conn,
+	struct picohttpDeadlines const * const deadlines,
+	uint64_t start,
+	int head_done );
+
+/* For when done with a connection: if a deadline passed before a
+ * response went out, the client is told 408. */
+void picohttpSockConnTimeout(
+	struct picohttpSockConn * const conn );
+
+/* Sends the canned 408 response without blocking, best effort. */
+void picohttpSockSendTimeout(int fd);
+
+/* To be called before closing fd after a response the client may not
+ * have read its request up to, like the canned ones. A close with
+ * input left unread resets the connection, and the reset can overtake
+ * the response. So the write side is shut down, and the input is read
+ * off until the client closes, for up to wait_ms. With wait_ms 0, for
+ * threads that must not block, only what has arrived already is read
+ * off; a request still on its way may then reset the connection. At
+ * most PICOHTTP_SOCKIO_LINGER_MAX octets are read either way. */
+void picohttpSockLinger(
+	int fd,
+	unsigned wait_ms );
+
+#endif/*PICOHTTP_SOCKIO_H*/
@@ -0,0 +1,96 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "picohttp_stackmeter.h"
+
+/* The stack is assumed to grow downwards. */
+
+#define PICOHTTP_STACKMETER_PATTERN 0xa5
+
+struct picohttpStackReport picohttpStackLast;
+
+static uintptr_t picohttpStackBase;
+static uintptr_t picohttpStackPainted; /* lowest painted address */
+static unsigned picohttpStackCurrent;
+
+/* Paints below the caller's frame; the array occupies what the callee
+ * of our caller will use next. */
+static __attribute__((noinline)) void picohttpStackPaint(void)
+{
+	volatile uint8_t area[PICOHTTP_STACKMETER_PAINT];
+	for(size_t i = 0; i < sizeof(area); i++) {
+		area[i] = PICOHTTP_STACKMETER_PATTERN;
+	}
+	picohttpStackPainted = (uintptr_t)area;
+}
+
+/* Scans up from the bottom of the painted area for the first octet
+ * that was overwritten. Our own frame sits near the top of the area,
+ * above anything the phase reached if it went deeper than this. */
+static __attribute__((noinline)) size_t picohttpStackDepth(
+	uint8_t * const overflow )
+{
+	uint8_t const volatile *p = (uint8_t const volatile*)picohttpStackPainted;
+	uint8_t const volatile * const end = p + PICOHTTP_STACKMETER_PAINT;
+	*overflow = (PICOHTTP_STACKMETER_PATTERN != *p);
+	while( p < end && PICOHTTP_STACKMETER_PATTERN == *p ) {
+		p++;
+	}
+	return picohttpStackBase - (uintptr_t)p;
+}
+
+static void picohttpStackRecord(void)
+{
+	uint8_t overflow;
+	size_t const depth = picohttpStackDepth(&overflow);
+	if( depth > picohttpStackLast.peak[picohttpStackCurrent] ) {
+		picohttpStackLast.peak[picohttpStackCurrent] = depth;
+	}
+	picohttpStackLast.overflow |= overflow;
+}
+
+void picohttpStackMeterBegin(
+	void const * const base )
+{
+	for(unsigned i = 0; i < PICOHTTP_STACK_PHASES; i++) {
+		picohttpStackLast.peak[i] = 0;
+	}
+	picohttpStackLast.route = NULL;
+	picohttpStackLast.overflow = 0;
+	picohttpStackBase = (uintptr_t)base;
+	picohttpStackCurrent = PICOHTTP_STACK_HEAD;
+	picohttpStackPaint();
+}
+
+void picohttpStackMeterPhase(
+	unsigned phase )
+{
+	picohttpStackRecord();
+	picohttpStackCurrent = phase;
+	picohttpStackPaint();
+}
+
+void picohttpStackMeterEnd(
+	struct picohttpURLRoute const * const route )
+{
+	picohttpStackRecord();
+	picohttpStackLast.route = route;
+}
@@ -0,0 +1,91 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_STACKMETER_H
+#define PICOHTTP_STACKMETER_H
+
+/* Stack high-water measurement, for sizing task stacks.
+ *
+ * Built with PICOHTTP_STACKMETER=1 the request processing paints the
+ * stack below itself with a pattern at the start of each phase and
+ * looks for the deepest octet overwritten at its end. Depths are
+ * counted from the frame of picohttpProcessRequest (or
+ * picohttpParserDispatch), so they include the request state, the URL
+ * buffer and everything the parser and handler put on the stack, but
+ * not what the caller has.
+ *
+ * Phases are the request head (request line and header fields) and the
+ * handler, including the body it reads and the response it writes; an
+ * error response counts as handler phase of the route, if any.
+ *
+ * This is a measuring aid: it costs painting the stack twice per
+ * request, and the report is global, so process one request at a
+ * time. picohttp_stackmeter.c has to be linked. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef PICOHTTP_STACKMETER
+#define PICOHTTP_STACKMETER 0
+#endif
+
+/* octets painted below the start of a phase */
+#ifndef PICOHTTP_STACKMETER_PAINT
+#define PICOHTTP_STACKMETER_PAINT 16384
+#endif
+
+#define PICOHTTP_STACK_HEAD    0
+#define PICOHTTP_STACK_HANDLER 1
+#define PICOHTTP_STACK_PHASES  2
+
+struct picohttpURLRoute;
+
+struct picohttpStackReport {
+	struct picohttpURLRoute const *route; /* NULL if not routed */
+	size_t peak[PICOHTTP_STACK_PHASES];   /* octets deep */
+	uint8_t overflow; /* a phase went deeper than was painted */
+};
+
+/* Of the request processed last */
+extern struct picohttpStackReport picohttpStackLast;
+
+void picohttpStackMeterBegin(
+	void const * const base );
+
+void picohttpStackMeterPhase(
+	unsigned phase );
+
+void picohttpStackMeterEnd(
+	struct picohttpURLRoute const * const route );
+
+#if PICOHTTP_STACKMETER
+#define picohttpStackBegin() \
+	picohttpStackMeterBegin(__builtin_frame_address(0))
+#define picohttpStackPhase(phase) picohttpStackMeterPhase(phase)
+#define picohttpStackEnd(route)   picohttpStackMeterEnd(route)
+#else
+#define picohttpStackBegin()      do{}while(0)
+#define picohttpStackPhase(phase) do{}while(0)
+#define picohttpStackEnd(route)   do{}while(0)
+#endif
+
+#endif/*PICOHTTP_STACKMETER_H*/
@@ -0,0 +1,203 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "picohttp_timer.h"
+
+#include <string.h>
+
+#define PICOHTTP_TIMER_MASK (PICOHTTP_TIMER_SLOTS - 1)
+
+void picohttpTimerWheelInit(
+	struct picohttpTimerWheel * const wheel,
+	uint64_t now )
+{
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->now = now;
+}
+
+/* Queues timer in the slot its expiry falls into, seen from now. A
+ * timer goes to the lowest level whose turn still covers it. Cascading
+ * happens before the current level 0 slot is run, so a timer due now
+ * still makes it. */
+static void picohttpTimerInsert(
+	struct picohttpTimerWheel * const wheel,
+	struct picohttpTimer * const timer )
+{
+	uint64_t expires = timer->expires;
+	if( expires < wheel->now ) {
+		expires = wheel->now;
+	}
+	if( expires - wheel->now > PICOHTTP_TIMER_RANGE ) {
+		expires = wheel->now + PICOHTTP_TIMER_RANGE;
+	}
+
+	unsigned level = 0;
+	while( level < PICOHTTP_TIMER_LEVELS - 1
+	    && (expires >> ((level+1) * PICOHTTP_TIMER_SLOT_BITS))
+	       != (wheel->now >> ((level+1) * PICOHTTP_TIMER_SLOT_BITS)) ) {
+		level++;
+	}
+	unsigned const slot = (expires >> (level * PICOHTTP_TIMER_SLOT_BITS))
+		& PICOHTTP_TIMER_MASK;
+
+	struct picohttpTimer ** const head = &wheel->slots[level][slot];
+	timer->level = level;
+	timer->slot = slot;
+	timer->next = *head;
+	if( timer->next ) {
+		timer->next->pprev = &timer->next;
+	}
+	timer->pprev = head;
+	*head = timer;
+	wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+static void picohttpTimerUnlink(
+	struct picohttpTimerWheel * const wheel,
+	struct picohttpTimer * const timer )
+{
+	*timer->pprev = timer->next;
+	if( timer->next ) {
+		timer->next->pprev = timer->pprev;
+	}
+	if( !wheel->slots[timer->level][timer->slot] ) {
+		wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+void picohttpTimerArm(
+	struct picohttpTimerWheel * const wheel,
+	struct picohttpTimer * const timer,
+	uint64_t expires )
+{
+	if( timer->pprev ) {
+		picohttpTimerUnlink(wheel, timer);
+	} else {
+		wheel->armed++;
+	}
+	/* the current slot has been run already */
+	if( expires <= wheel->now ) {
+		expires = wheel->now + 1;
+	}
+	timer->expires = expires;
+	picohttpTimerInsert(wheel, timer);
+}
+
+void picohttpTimerCancel(
+	struct picohttpTimerWheel * const wheel,
+	struct picohttpTimer * const timer )
+{
+	if( timer->pprev ) {
+		picohttpTimerUnlink(wheel, timer);
+		wheel->armed--;
+	}
+}
+
+/* Takes all timers out of a slot */
+static struct picohttpTimer *picohttpTimerTake(
+	struct picohttpTimerWheel * const wheel,
+	unsigned level,
+	unsigned slot )
+{
+	struct picohttpTimer * const list = wheel->slots[level][slot];
+	wheel->slots[level][slot] = NULL;
+	wheel->occupied[level] &= ~((uint64_t)1 << slot);
+	return list;
+}
+
+void picohttpTimerAdvance(
+	struct picohttpTimerWheel * const wheel,
+	uint64_t now )
+{
+	while( wheel->now < now ) {
+		if( !wheel->armed ) {
+			wheel->now = now;
+			return;
+		}
+		/* nothing due on level 0 for the rest of its turn: skip ahead
+		 * to the turn's end, where higher levels may cascade */
+		unsigned const idx = wheel->now & PICOHTTP_TIMER_MASK;
+		uint64_t const ahead = (PICOHTTP_TIMER_MASK == idx) ? 0 :
+			wheel->occupied[0] >> (idx + 1);
+		if( !ahead ) {
+			uint64_t const end = wheel->now | PICOHTTP_TIMER_MASK;
+			if( end >= now ) {
+				wheel->now = now;
+				return;
+			}
+			wheel->now = end;
+		}
+
+		wheel->now++;
+
+		/* cascade the higher levels whose slot came up */
+		for(unsigned level = 1; level < PICOHTTP_TIMER_LEVELS; level++) {
+			unsigned const shift = level * PICOHTTP_TIMER_SLOT_BITS;
+			if( wheel->now & (((uint64_t)1 << shift) - 1) ) {
+				break;
+			}
+			struct picohttpTimer *t = picohttpTimerTake(wheel, level,
+				(wheel->now >> shift) & PICOHTTP_TIMER_MASK);
+			while( t ) {
+				struct picohttpTimer * const next = t->next;
+				picohttpTimerInsert(wheel, t);
+				t = next;
+			}
+		}
+
+		/* the functions may cancel timers still pending here, so
+		 * those stay linked to the list until run */
+		struct picohttpTimer *pending = picohttpTimerTake(wheel, 0,
+			wheel->now & PICOHTTP_TIMER_MASK);
+		if( pending ) {
+			pending->pprev = &pending;
+		}
+		while( pending ) {
+			struct picohttpTimer * const t = pending;
+			pending = t->next;
+			if( pending ) {
+				pending->pprev = &pending;
+			}
+			t->next = NULL;
+			t->pprev = NULL;
+			wheel->armed--;
+			t->fn(t);
+		}
+	}
+}
+
+uint64_t picohttpTimerIdle(
+	struct picohttpTimerWheel const * const wheel,
+	uint64_t limit )
+{
+	if( !wheel->armed ) {
+		return limit;
+	}
+	unsigned const idx = wheel->now & PICOHTTP_TIMER_MASK;
+	uint64_t const ahead = (PICOHTTP_TIMER_MASK == idx) ? 0 :
+		wheel->occupied[0] >> (idx + 1);
+	uint64_t const idle = ahead ?
+		(uint64_t)__builtin_ctzll(ahead) + 1 :
+		PICOHTTP_TIMER_SLOTS - idx;
+	return (idle < limit) ? idle : limit;
+}
@@ -0,0 +1,109 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_TIMER_H
+#define PICOHTTP_TIMER_H
+
+/* Hierarchical timer wheel, for connection deadlines.
+ *
+ * Time is counted in ticks (the drivers use milliseconds). Level 0
+ * has a slot per tick, each higher level a slot per full turn of the
+ * one below; timers on higher levels cascade down as their slot comes
+ * up. Arming and cancelling are O(1), timers are intrusive and the
+ * wheel allocates nothing. Not thread safe. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PICOHTTP_TIMER_LEVELS    4
+#define PICOHTTP_TIMER_SLOT_BITS 6
+#define PICOHTTP_TIMER_SLOTS     (1u << PICOHTTP_TIMER_SLOT_BITS)
+/* farther out timers expire at the end of the range */
+#define PICOHTTP_TIMER_RANGE \
+	(((uint64_t)1 << (PICOHTTP_TIMER_LEVELS * PICOHTTP_TIMER_SLOT_BITS)) - 1)
+
+struct picohttpTimer;
+
+typedef void (*picohttpTimerFn)(struct picohttpTimer *timer);
+
+struct picohttpTimer {
+	struct picohttpTimer *next;
+	struct picohttpTimer **pprev; /* NULL while not armed */
+	uint64_t expires;
+	picohttpTimerFn fn;
+	void *data;
+	uint8_t level;
+	uint8_t slot;
+};
+
+struct picohttpTimerWheel {
+	uint64_t now;
+	size_t armed;
+	uint64_t occupied[PICOHTTP_TIMER_LEVELS]; /* bit per slot */
+	struct picohttpTimer *slots[PICOHTTP_TIMER_LEVELS][PICOHTTP_TIMER_SLOTS];
+};
+
+void picohttpTimerWheelInit(
+	struct picohttpTimerWheel * const wheel,
+	uint64_t now );
+
+static inline void picohttpTimerInit(
+	struct picohttpTimer * const timer,
+	picohttpTimerFn fn,
+	void *data )
+{
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->fn = fn;
+	timer->data = data;
+}
+
+static inline int picohttpTimerArmed(
+	struct picohttpTimer const * const timer )
+{
+	return NULL != timer->pprev;
+}
+
+/* (Re)arms timer to fire once the wheel reaches expires; a time that
+ * passed already fires on the next tick. */
+void picohttpTimerArm(
+	struct picohttpTimerWheel * const wheel,
+	struct picohttpTimer * const timer,
+	uint64_t expires );
+
+void picohttpTimerCancel(
+	struct picohttpTimerWheel * const wheel,
+	struct picohttpTimer * const timer );
+
+/* Moves the wheel on to now, calling the function of every timer
+ * expiring on the way; those may arm and cancel timers. */
+void picohttpTimerAdvance(
+	struct picohttpTimerWheel * const wheel,
+	uint64_t now );
+
+/* Ticks the wheel may be left alone without missing an expiry, at most
+ * limit; for poll timeouts. */
+uint64_t picohttpTimerIdle(
+	struct picohttpTimerWheel const * const wheel,
+	uint64_t limit );
+
+#endif/*PICOHTTP_TIMER_H*/
@@ -0,0 +1,254 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#undef PICOHTTP_TRACE
+#define PICOHTTP_TRACE 1
+#include "picohttp_trace.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#if PICOHTTP_TRACE_RING_EVENTS & (PICOHTTP_TRACE_RING_EVENTS - 1)
+#error "PICOHTTP_TRACE_RING_EVENTS must be a power of 2"
+#endif
+
+/* Single producer ring: only the owning thread writes events and head,
+ * only the reader (under picohttpTraceReadLock) moves tail. The reader
+ * checks head again after copying an event; if the writer may have
+ * lapped it meanwhile, the copy is dropped as lost. */
+struct picohttpTraceRing {
+	struct picohttpTraceRing *next;
+	uint32_t thread;
+	uint64_t tail;
+	uint64_t head __attribute__((aligned(64)));
+	struct picohttpTraceEvent ev[PICOHTTP_TRACE_RING_EVENTS]
+		__attribute__((aligned(64)));
+};
+
+unsigned picohttpTraceMask;
+
+static struct picohttpTraceRing *picohttpTraceRings;
+static uint32_t picohttpTraceThreads;
+static __thread struct picohttpTraceRing *picohttpTraceThreadRing;
+static pthread_mutex_t picohttpTraceReadLock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct picohttpTraceRing *picohttpTraceRingNew(void)
+{
+	void *mem;
+	if( posix_memalign(&mem, 64, sizeof(struct picohttpTraceRing)) ) {
+		return NULL;
+	}
+	struct picohttpTraceRing * const ring = mem;
+	memset(ring, 0, sizeof(*ring));
+	ring->thread = __atomic_fetch_add(&picohttpTraceThreads, 1,
+		__ATOMIC_RELAXED);
+
+	/* rings stay around after their thread exits, so that its last
+	 * events can still be read */
+	ring->next = __atomic_load_n(&picohttpTraceRings, __ATOMIC_RELAXED);
+	while( !__atomic_compare_exchange_n(&picohttpTraceRings,
+			&ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+	return ring;
+}
+
+void picohttpTraceEmit(
+	unsigned id,
+	uint64_t a,
+	uint64_t b )
+{
+	struct picohttpTraceRing *ring = picohttpTraceThreadRing;
+	if( !ring ) {
+		if( !(ring = picohttpTraceRingNew()) ) {
+			return;
+		}
+		picohttpTraceThreadRing = ring;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	uint64_t const h = ring->head;
+	struct picohttpTraceEvent * const ev =
+		ring->ev + (h & (PICOHTTP_TRACE_RING_EVENTS - 1));
+	/* head == h, stored by the previous event, must be seen by any
+	 * reader seeing one of the stores below; its check of head after
+	 * the copy relies on that to drop a slot overwritten meanwhile */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&ev->ns,
+		(uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->id, id, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->thread, ring->thread, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->a, a, __ATOMIC_RELAXED);
+	__atomic_store_n(&ev->b, b, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->head, h + 1, __ATOMIC_RELEASE);
+}
+
+void picohttpTraceSetMask(
+	unsigned mask )
+{
+	__atomic_store_n(&picohttpTraceMask, mask, __ATOMIC_RELAXED);
+}
+
+size_t picohttpTraceCollect(
+	picohttpTraceCallback cb,
+	void *data )
+{
+	size_t n = 0;
+	pthread_mutex_lock(&picohttpTraceReadLock);
+	for(struct picohttpTraceRing *ring =
+		__atomic_load_n(&picohttpTraceRings, __ATOMIC_ACQUIRE);
+	    ring;
+	    ring = ring->next ) {
+		uint64_t const head =
+			__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint64_t lost = 0;
+		/* the slot of event head - RING_EVENTS is the one being
+		 * written next, that one can't be read safely either */
+		if( head - ring->tail >= PICOHTTP_TRACE_RING_EVENTS ) {
+			lost = head - PICOHTTP_TRACE_RING_EVENTS + 1 - ring->tail;
+			ring->tail = head - PICOHTTP_TRACE_RING_EVENTS + 1;
+		}
+
+		for(; ring->tail != head; ring->tail++) {
+			struct picohttpTraceEvent const * const src =
+				ring->ev + (ring->tail & (PICOHTTP_TRACE_RING_EVENTS - 1));
+			struct picohttpTraceEvent ev;
+			ev.ns = __atomic_load_n(&src->ns, __ATOMIC_RELAXED);
+			ev.id = __atomic_load_n(&src->id, __ATOMIC_RELAXED);
+			ev.thread = __atomic_load_n(&src->thread, __ATOMIC_RELAXED);
+			ev.a = __atomic_load_n(&src->a, __ATOMIC_RELAXED);
+			ev.b = __atomic_load_n(&src->b, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+			uint64_t const now =
+				__atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+			if( now - ring->tail >= PICOHTTP_TRACE_RING_EVENTS ) {
+				lost++;
+				continue;
+			}
+			if( lost ) {
+				struct picohttpTraceEvent const lev = {
+					ev.ns, PICOHTTP_TRACE_LOST, ring->thread, lost, 0
+				};
+				cb(data, &lev);
+				lost = 0;
+				n++;
+			}
+			cb(data, &ev);
+			n++;
+		}
+		if( lost ) {
+			struct picohttpTraceEvent const lev = {
+				0, PICOHTTP_TRACE_LOST, ring->thread, lost, 0
+			};
+			cb(data, &lev);
+			n++;
+		}
+	}
+	pthread_mutex_unlock(&picohttpTraceReadLock);
+	return n;
+}
+
+static char const * const picohttpTraceNames[PICOHTTP_TRACE_EVENTS] = {
+	"lost", "route", "response", "header", "query_var",
+	"auth_basic", "auth_digest", "auth_reject", "auth_uri_mismatch"
+};
+
+static void picohttpTraceUnpack(uint64_t v, char name[9])
+{
+	unsigned i;
+	for(i = 0; i < 8 && (v & 0xff); i++, v >>= 8) {
+		unsigned char const c = v & 0xff;
+		name[i] = (' ' <= c && '~' >= c) ? c : '?';
+	}
+	name[i] = 0;
+}
+
+int picohttpTraceFormat(
+	struct picohttpTraceEvent const * const ev,
+	char *buf,
+	size_t len )
+{
+	char const * const name = (ev->id < PICOHTTP_TRACE_EVENTS) ?
+		picohttpTraceNames[ev->id] : "unknown";
+	char packed[9];
+	int const n = snprintf(buf, len, "%llu.%09llu %u %s",
+		(unsigned long long)(ev->ns / 1000000000),
+		(unsigned long long)(ev->ns % 1000000000),
+		(unsigned)ev->thread, name);
+	if( 0 > n || (size_t)n >= len ) {
+		return n;
+	}
+
+	switch( ev->id ) {
+	case PICOHTTP_TRACE_HEADER:
+	case PICOHTTP_TRACE_QUERY_VAR:
+	case PICOHTTP_TRACE_AUTH_BASIC:
+	case PICOHTTP_TRACE_AUTH_DIGEST:
+	case PICOHTTP_TRACE_AUTH_REJECT:
+		picohttpTraceUnpack(ev->a, packed);
+		return n + snprintf(buf + n, len - n, " '%s' %llu",
+			packed, (unsigned long long)ev->b);
+	default:
+		return n + snprintf(buf + n, len - n, " %llu %llu",
+			(unsigned long long)ev->a, (unsigned long long)ev->b);
+	}
+}
+
+static void picohttpTraceDumpEvent(
+	void *data,
+	struct picohttpTraceEvent const *ev )
+{
+	int const fd = *(int const*)data;
+	char line[128];
+	int n = picohttpTraceFormat(ev, line, sizeof(line) - 1);
+	if( 0 > n ) {
+		return;
+	}
+	if( (size_t)n > sizeof(line) - 2 ) {
+		n = sizeof(line) - 2;
+	}
+	line[n++] = '\n';
+	for(char const *p = line; n; ) {
+		ssize_t const w = write(fd, p, n);
+		if( 0 > w ) {
+			if( EINTR == errno )
+				continue;
+			return;
+		}
+		p += w;
+		n -= w;
+	}
+}
+
+size_t picohttpTraceDump(
+	int fd )
+{
+	return picohttpTraceCollect(picohttpTraceDumpEvent, &fd);
+}
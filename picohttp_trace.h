@@ -0,0 +1,132 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#pragma once
+#ifndef PICOHTTP_TRACE_H
+#define PICOHTTP_TRACE_H
+
+/* Binary event tracing.
+ *
+ * Built with PICOHTTP_TRACE=1 the library records events of the
+ * classes enabled in the runtime mask (none by default) into per thread
+ * rings of fixed size records; picohttp_trace.c, which needs POSIX
+ * threads, has to be linked then. Recording an event is a handful of
+ * stores and never blocks; a disabled class costs a load and a branch.
+ * When a ring is full the oldest events are overwritten.
+ *
+ * Without PICOHTTP_TRACE the trace points compile to nothing. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef PICOHTTP_TRACE
+#define PICOHTTP_TRACE 0
+#endif
+
+/* events per thread; a power of 2 */
+#ifndef PICOHTTP_TRACE_RING_EVENTS
+#define PICOHTTP_TRACE_RING_EVENTS 4096
+#endif
+
+/* classes, for the mask */
+#define PICOHTTP_TRACE_CLASS_REQUEST 0x01
+#define PICOHTTP_TRACE_CLASS_HEADER  0x02
+#define PICOHTTP_TRACE_CLASS_QUERY   0x04
+#define PICOHTTP_TRACE_CLASS_AUTH    0x08
+#define PICOHTTP_TRACE_CLASS_ALL     0x0f
+
+/* events                         a                b */
+#define PICOHTTP_TRACE_LOST      0 /* events lost  -                  */
+#define PICOHTTP_TRACE_ROUTE     1 /* method       route index        */
+#define PICOHTTP_TRACE_RESPONSE  2 /* status       content length     */
+#define PICOHTTP_TRACE_HEADER    3 /* name         value length       */
+#define PICOHTTP_TRACE_QUERY_VAR 4 /* name         -                  */
+#define PICOHTTP_TRACE_AUTH_BASIC  5 /* username   verified           */
+#define PICOHTTP_TRACE_AUTH_DIGEST 6 /* username   nonce count        */
+#define PICOHTTP_TRACE_AUTH_REJECT 7 /* parameter  -                  */
+#define PICOHTTP_TRACE_AUTH_URI_MISMATCH 8
+#define PICOHTTP_TRACE_EVENTS    9
+/* verified is 0 without the auth cache; names are packed: their first 8 chars, the first in the low octet */
+
+struct picohttpTraceEvent {
+	uint64_t ns;     /* CLOCK_MONOTONIC */
+	uint32_t id;
+	uint32_t thread; /* ring the event was recorded in */
+	uint64_t a;
+	uint64_t b;
+};
+
+#if PICOHTTP_TRACE
+extern unsigned picohttpTraceMask;
+
+void picohttpTraceEmit(
+	unsigned id,
+	uint64_t a,
+	uint64_t b );
+
+static inline uint64_t picohttpTracePack(char const *s)
+{
+	uint64_t v = 0;
+	for(unsigned i = 0; i < 8 && s[i]; i++) {
+		v |= (uint64_t)(unsigned char)s[i] << (8*i);
+	}
+	return v;
+}
+
+#define picohttpTrace(cls, id, a, b) do{ \
+	if( __builtin_expect( \
+		__atomic_load_n(&picohttpTraceMask, __ATOMIC_RELAXED) & (cls), 0) ) \
+		picohttpTraceEmit((id), (a), (b)); \
+	}while(0)
+#else
+#define picohttpTracePack(s) 0
+#define picohttpTrace(cls, id, a, b) do{ (void)(a); (void)(b); }while(0)
+#endif
+
+/* The rest is for the host reading the traces */
+
+void picohttpTraceSetMask(
+	unsigned mask );
+
+typedef void (*picohttpTraceCallback)(
+	void *data,
+	struct picohttpTraceEvent const *ev );
+
+/* Hands the events recorded since the previous call to cb, ring by
+ * ring and oldest first. Events overwritten before they could be read
+ * show up as one PICOHTTP_TRACE_LOST event. Returns the number of
+ * events passed on. */
+size_t picohttpTraceCollect(
+	picohttpTraceCallback cb,
+	void *data );
+
+/* Decodes ev into a line of text (without line end); returns the
+ * length as snprintf does. */
+int picohttpTraceFormat(
+	struct picohttpTraceEvent const * const ev,
+	char *buf,
+	size_t len );
+
+/* picohttpTraceCollect writing decoded lines to fd */
+size_t picohttpTraceDump(
+	int fd );
+
+#endif/*PICOHTTP_TRACE_H*/
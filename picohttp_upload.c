@@ -0,0 +1,359 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#define _GNU_SOURCE
+
+#include "picohttp_upload.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct picohttpUpload {
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t filled;   /* the writer waits for buffers */
+	pthread_cond_t drained;  /* the handler waits for free ones */
+	unsigned nbufs;
+	size_t buflen;
+	uint8_t *bufs;
+	size_t *lens;
+
+	/* under lock */
+	unsigned tail;     /* next buffer to be written */
+	unsigned queued;   /* buffers handed to the writer, including the
+	                    * one being written */
+	int fd;            /* -1 between uploads */
+	bool failed;
+	bool stop;
+	uint64_t written;
+
+	/* the handler's */
+	unsigned head;     /* buffer being filled */
+	size_t fill;
+	bool error;        /* failed, as of the last hand over */
+};
+
+static int picohttpUploadWriteFd(
+	int fd,
+	size_t len,
+	uint8_t const *buf )
+{
+	while( len ) {
+		ssize_t const w = write(fd, buf, len);
+		if( 0 > w ) {
+			if( EINTR == errno )
+				continue;
+			return -1;
+		}
+		buf += w;
+		len -= w;
+	}
+	return 0;
+}
+
+static void *picohttpUploadWriter(void *arg)
+{
+	struct picohttpUpload * const up = arg;
+	pthread_mutex_lock(&up->lock);
+	for(;;) {
+		while( !up->queued && !up->stop ) {
+			pthread_cond_wait(&up->filled, &up->lock);
+		}
+		if( !up->queued ) {
+			break;
+		}
+		unsigned const i = up->tail;
+		size_t const len = up->lens[i];
+		int const fd = up->fd;
+		bool ok = !up->failed;
+		pthread_mutex_unlock(&up->lock);
+
+		/* after a failure buffers are just passed through, so that
+		 * the handler doesn't wait on them */
+		if( ok ) {
+			ok = !picohttpUploadWriteFd(fd,
+				len, up->bufs + (size_t)i * up->buflen);
+		}
+
+		pthread_mutex_lock(&up->lock);
+		if( ok ) {
+			up->written += len;
+		} else {
+			up->failed = true;
+		}
+		up->tail = (i + 1) % up->nbufs;
+		up->queued--;
+		pthread_cond_signal(&up->drained);
+	}
+	pthread_mutex_unlock(&up->lock);
+	return NULL;
+}
+
+struct picohttpUpload *picohttpUploadCreate(
+	unsigned nbufs,
+	size_t buflen )
+{
+	struct picohttpUpload * const up = calloc(1, sizeof(*up));
+	if( !up ) {
+		return NULL;
+	}
+	up->nbufs = (2 < nbufs) ? nbufs : 2;
+	up->buflen = (buflen + PICOHTTP_UPLOAD_ALIGN - 1)
+		/ PICOHTTP_UPLOAD_ALIGN * PICOHTTP_UPLOAD_ALIGN;
+	if( !up->buflen ) {
+		up->buflen = PICOHTTP_UPLOAD_ALIGN;
+	}
+	up->fd = -1;
+
+	void *bufs;
+	if( posix_memalign(&bufs, PICOHTTP_UPLOAD_ALIGN,
+			(size_t)up->nbufs * up->buflen) ) {
+		free(up);
+		return NULL;
+	}
+	up->bufs = bufs;
+	up->lens = calloc(up->nbufs, sizeof(*up->lens));
+	if( !up->lens ) {
+		goto fail_lens;
+	}
+
+	if( pthread_mutex_init(&up->lock, NULL) ) {
+		goto fail_lock;
+	}
+	if( pthread_cond_init(&up->filled, NULL) ) {
+		goto fail_filled;
+	}
+	if( pthread_cond_init(&up->drained, NULL) ) {
+		goto fail_drained;
+	}
+	if( pthread_create(&up->writer, NULL, picohttpUploadWriter, up) ) {
+		goto fail_writer;
+	}
+	return up;
+
+fail_writer:
+	pthread_cond_destroy(&up->drained);
+fail_drained:
+	pthread_cond_destroy(&up->filled);
+fail_filled:
+	pthread_mutex_destroy(&up->lock);
+fail_lock:
+	free(up->lens);
+fail_lens:
+	free(up->bufs);
+	free(up);
+	return NULL;
+}
+
+void picohttpUploadDestroy(
+	struct picohttpUpload * const up )
+{
+	if( !up ) {
+		return;
+	}
+	pthread_mutex_lock(&up->lock);
+	up->stop = true;
+	pthread_cond_signal(&up->filled);
+	pthread_mutex_unlock(&up->lock);
+	pthread_join(up->writer, NULL);
+
+	pthread_cond_destroy(&up->drained);
+	pthread_cond_destroy(&up->filled);
+	pthread_mutex_destroy(&up->lock);
+	free(up->lens);
+	free(up->bufs);
+	free(up);
+}
+
+int picohttpUploadBegin(
+	struct picohttpUpload * const up,
+	int fd,
+	uint64_t size )
+{
+	if( 0 <= up->fd ) {
+		return -1;
+	}
+#if defined(__linux__)
+	if( size ) {
+		/* best effort; whatever isn't written stays past the end of
+		 * the file, instead of extending it */
+		off_t const offset = lseek(fd, 0, SEEK_CUR);
+		if( 0 <= offset ) {
+			int const e = fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, size);
+			(void)e;
+		}
+	}
+#else
+	(void)size;
+#endif
+	pthread_mutex_lock(&up->lock);
+	up->fd = fd;
+	up->failed = false;
+	up->written = 0;
+	pthread_mutex_unlock(&up->lock);
+	up->fill = 0;
+	up->error = false;
+	return 0;
+}
+
+/* Hands the buffer being filled to the writer and waits for a free
+ * one to fill next. */
+static void picohttpUploadQueue(
+	struct picohttpUpload * const up )
+{
+	pthread_mutex_lock(&up->lock);
+	up->lens[up->head] = up->fill;
+	up->queued++;
+	pthread_cond_signal(&up->filled);
+	while( up->queued == up->nbufs ) {
+		pthread_cond_wait(&up->drained, &up->lock);
+	}
+	up->error = up->failed;
+	pthread_mutex_unlock(&up->lock);
+	up->head = (up->head + 1) % up->nbufs;
+	up->fill = 0;
+}
+
+void *picohttpUploadBuffer(
+	struct picohttpUpload * const up,
+	size_t * const len )
+{
+	if( up->fill == up->buflen ) {
+		picohttpUploadQueue(up);
+	}
+	if( up->error ) {
+		return NULL;
+	}
+	*len = up->buflen - up->fill;
+	return up->bufs + (size_t)up->head * up->buflen + up->fill;
+}
+
+void picohttpUploadCommit(
+	struct picohttpUpload * const up,
+	size_t len )
+{
+	up->fill += len;
+}
+
+int64_t picohttpUploadEnd(
+	struct picohttpUpload * const up )
+{
+	if( 0 > up->fd ) {
+		return -1;
+	}
+	if( up->fill ) {
+		picohttpUploadQueue(up);
+	}
+	pthread_mutex_lock(&up->lock);
+	while( up->queued ) {
+		pthread_cond_wait(&up->drained, &up->lock);
+	}
+	int64_t const written = up->failed ? -1 : (int64_t)up->written;
+	up->fd = -1;
+	pthread_mutex_unlock(&up->lock);
+	return written;
+}
+
+int64_t picohttpUploadBody(
+	struct picohttpUpload * const up,
+	struct picohttpRequest * const req,
+	int fd,
+	uint64_t maxlen )
+{
+	bool const chunked =
+		PICOHTTP_CODING_CHUNKED == req->query.transferencoding;
+	uint64_t const size = chunked ? 0 :
+		req->query.contentlength - req->received_octets;
+	if( maxlen && size > maxlen ) {
+		/* not even starting on it */
+		return -1;
+	}
+	if( 0 > picohttpUploadBegin(up, fd, size) ) {
+		return -1;
+	}
+
+	uint64_t received = 0;
+	bool failed = false;
+	for(;;) {
+		size_t len;
+		char * const buf = picohttpUploadBuffer(up, &len);
+		if( !buf ) {
+			failed = true;
+			break;
+		}
+		bool const full = maxlen && received == maxlen;
+		if( full ) {
+			/* only to see whether the body ends here */
+			len = 1;
+		} else
+		if( maxlen && len > maxlen - received ) {
+			len = maxlen - received;
+		}
+		int const r = picohttpRead(req, len, buf);
+		if( !r ) {
+			break;
+		}
+		if( 0 > r || full ) {
+			failed = true;
+			break;
+		}
+		picohttpUploadCommit(up, r);
+		received += r;
+	}
+
+	int64_t const written = picohttpUploadEnd(up);
+	return failed ? -1 : written;
+}
+
+int64_t picohttpUploadPart(
+	struct picohttpUpload * const up,
+	struct picohttpMultipart * const mp,
+	int fd )
+{
+	if( 0 > picohttpUploadBegin(up, fd, 0) ) {
+		return -1;
+	}
+
+	bool failed = false;
+	while( !mp->finished ) {
+		size_t len;
+		char * const buf = picohttpUploadBuffer(up, &len);
+		if( !buf ) {
+			failed = true;
+			break;
+		}
+		int const r = picohttpMultipartRead(mp, len, buf);
+		if( 0 > r ) {
+			failed = true;
+			break;
+		}
+		picohttpUploadCommit(up, r);
+	}
+
+	int64_t const written = picohttpUploadEnd(up);
+	return failed ? -1 : written;
+}
@@ -0,0 +1,98 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+#pragma once
+#ifndef PICOHTTP_UPLOAD_H
+#define PICOHTTP_UPLOAD_H
+
+/* Upload pipeline for POSIX hosts.
+ *
+ * Received data is gathered in a ring of fixed size buffers; full ones
+ * are written out by a dedicated writer thread while the handler goes
+ * on reading the next, so that the connection and the disk are kept
+ * busy at the same time. The buffers are page aligned and written
+ * whole, so files get large aligned writes; where the length is known
+ * beforehand the file space is allocated up front.
+ *
+ * A pipeline serves one upload at a time; a server may keep one for
+ * each of its handler threads. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "picohttp.h"
+
+#ifndef PICOHTTP_UPLOAD_ALIGN
+#define PICOHTTP_UPLOAD_ALIGN 4096
+#endif
+
+struct picohttpUpload;
+
+/* nbufs buffers, at least 2, of buflen octets each, rounded up to
+ * PICOHTTP_UPLOAD_ALIGN; starts the writer thread. */
+struct picohttpUpload *picohttpUploadCreate(
+	unsigned nbufs,
+	size_t buflen );
+
+void picohttpUploadDestroy(
+	struct picohttpUpload * const up );
+
+/* Starts an upload to fd, at its current offset. size is the length
+ * expected, 0 if not known. Returns -1 if an upload is in progress. */
+int picohttpUploadBegin(
+	struct picohttpUpload * const up,
+	int fd,
+	uint64_t size );
+
+/* The free part of the buffer being filled, *len octets of it; hands
+ * the buffer to the writer first if it is full. Returns NULL if
+ * writing failed, there is no point in receiving more then. */
+void *picohttpUploadBuffer(
+	struct picohttpUpload * const up,
+	size_t * const len );
+
+/* Marks len octets of what picohttpUploadBuffer returned as filled. */
+void picohttpUploadCommit(
+	struct picohttpUpload * const up,
+	size_t len );
+
+/* Waits for the writer to be done with the upload; returns the number
+ * of octets written, -1 if writing failed. */
+int64_t picohttpUploadEnd(
+	struct picohttpUpload * const up );
+
+/* The request body, as received, to fd; see picohttpRequestBodyToFd
+ * for maxlen and the return value. */
+int64_t picohttpUploadBody(
+	struct picohttpUpload * const up,
+	struct picohttpRequest * const req,
+	int fd,
+	uint64_t maxlen );
+
+/* The current part of a multipart body to fd, until its end. Returns
+ * the number of octets written, -1 on error. */
+int64_t picohttpUploadPart(
+	struct picohttpUpload * const up,
+	struct picohttpMultipart * const mp,
+	int fd );
+
+#endif/*PICOHTTP_UPLOAD_H*/
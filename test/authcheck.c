@@ -0,0 +1,404 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+/* Authentication check.
+ *
+ * Runs a sequence of requests carrying Digest and Basic credentials
+ * against nonce and credential caches on a simulated clock, and checks
+ * what picohttpAuthDigestVerify and the Basic credential cache make of
+ * them: valid responses for each algorithm, wrong passwords, URIs,
+ * realms and algorithms, replayed and out of order nonce-counts,
+ * unknown and expired nonces, cached, expired and revoked Basic
+ * credentials. One JSON line per step goes to stdout; the exit status
+ * is 1 if a check failed. */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../picohttp.h"
+#include "../picohttp_authcache.h"
+#include "../picohttp_base64.h"
+#include "../picohttp_digest.h"
+#include "../picohttp_md5.h"
+#include "../picohttp_sha256.h"
+
+/* in memory connection */
+
+struct checkIo {
+	char const *req;
+	size_t len;
+	size_t pos;
+};
+
+static int check_io_getch(void *data)
+{
+	struct checkIo * const io = data;
+	if( io->pos >= io->len ) {
+		return -1;
+	}
+	return (unsigned char)io->req[io->pos++];
+}
+
+static int check_io_read(size_t count, void *buf, void *data)
+{
+	struct checkIo * const io = data;
+	if( io->pos >= io->len ) {
+		return -1;
+	}
+	if( count > io->len - io->pos ) {
+		count = io->len - io->pos;
+	}
+	memcpy(buf, io->req + io->pos, count);
+	io->pos += count;
+	return count;
+}
+
+static int check_io_write(size_t count, void const *buf, void *data)
+{
+	(void)buf;
+	(void)data;
+	return count;
+}
+
+static int check_io_putch(int ch, void *data)
+{
+	(void)data;
+	return ch;
+}
+
+static int check_io_flush(void *data)
+{
+	(void)data;
+	return 0;
+}
+
+/* simulated clock and a not at all random source */
+
+static uint32_t check_now = 1000;
+
+static uint32_t check_clock(void *data)
+{
+	(void)data;
+	return check_now;
+}
+
+static void check_random(size_t len, uint8_t *buf, void *data)
+{
+	static uint32_t x = 2463534242u;
+	(void)data;
+	for(size_t i = 0; i < len; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = x;
+	}
+}
+
+/* handlers; what they saw of the credentials */
+
+#define CHECK_REALM "picoweb"
+#define CHECK_PASSWORD "Circle Of Life"
+#define CHECK_BASIC_USER "Aladdin"
+#define CHECK_BASIC_PASSWORD "open sesame"
+
+static int check_result;
+static int check_stale;
+
+static void rhCheckDigest(struct picohttpRequest *req)
+{
+	check_result = picohttpAuthDigestVerify(req, CHECK_REALM, CHECK_PASSWORD);
+	check_stale = req->query.auth->stale;
+	picohttpResponseWrite(req, 2, "ok");
+}
+
+static void rhCheckBasic(struct picohttpRequest *req)
+{
+	struct picohttpAuthData * const auth = req->query.auth;
+	check_result = auth->verified;
+	if( PICOHTTP_AUTH_BASIC == auth->scheme
+	 && !auth->verified
+	 && !strcmp(auth->username, CHECK_BASIC_USER)
+	 && !strcmp(auth->pwresponse, CHECK_BASIC_PASSWORD) ) {
+		/* where an application would run its expensive check */
+		picohttpAuthVerified(req);
+	}
+	picohttpResponseWrite(req, 2, "ok");
+}
+
+static struct picohttpURLRoute const check_routes[] = {
+	{ "/private", 0, rhCheckDigest, 32, PICOHTTP_METHOD_GET },
+	{ "/basic|", 0, rhCheckBasic, 0, PICOHTTP_METHOD_GET },
+	{ NULL, 0, 0, 0, 0 }
+};
+
+/* the steps, run in order on shared caches */
+
+#define CHECK_NONCE_ISSUED 0
+#define CHECK_NONCE_UNKNOWN 1
+
+struct checkStep {
+	char const *name;
+	char const *path;
+	/* Digest algorithm as sent; NULL for Basic credentials */
+	char const *algorithm;
+	char const *uri;       /* digest-uri; path if NULL */
+	char const *password;
+	uint32_t nc;
+	uint8_t nonce;
+	uint32_t advance;      /* seconds the clock moves on first */
+	uint8_t revoke;        /* Basic credential cache reset first */
+	int result;            /* verify result, or Basic verified */
+	int stale;
+	char const *realm;     /* as sent; CHECK_REALM if NULL */
+};
+
+#define CHECK_NONCE_LIFETIME 300
+#define CHECK_BASIC_TTL 60
+
+static struct checkStep const check_steps[] = {
+	{ "digest_md5", "/private/status", "MD5", NULL, CHECK_PASSWORD,
+	  1, CHECK_NONCE_ISSUED, 0, 0, 1, 0 },
+	{ "digest_replay", "/private/status", "MD5", NULL, CHECK_PASSWORD,
+	  1, CHECK_NONCE_ISSUED, 0, 0, 0, 0 },
+	{ "digest_nc_next", "/private/status", "MD5", NULL, CHECK_PASSWORD,
+	  2, CHECK_NONCE_ISSUED, 0, 0, 1, 0 },
+	{ "digest_nc_ahead", "/private/status", "MD5", NULL, CHECK_PASSWORD,
+	  5, CHECK_NONCE_ISSUED, 0, 0, 1, 0 },
+	{ "digest_nc_late", "/private/status", "MD5", NULL, CHECK_PASSWORD,
+	  4, CHECK_NONCE_ISSUED, 0, 0, 1, 0 },
+	{ "digest_nc_late_replay", "/private/status", "MD5", NULL, CHECK_PASSWORD,
+	  4, CHECK_NONCE_ISSUED, 0, 0, 0, 0 },
+	{ "digest_wrong_password", "/private/status", "MD5", NULL, "Circle of Life",
+	  6, CHECK_NONCE_ISSUED, 0, 0, 0, 0 },
+	{ "digest_md5_sess", "/private/status", "MD5-sess", NULL, CHECK_PASSWORD,
+	  7, CHECK_NONCE_ISSUED, 0, 0, 1, 0 },
+	{ "digest_sha256", "/private/status", "SHA-256", NULL, CHECK_PASSWORD,
+	  8, CHECK_NONCE_ISSUED, 0, 0, 1, 0 },
+	{ "digest_sha256_sess", "/private/status", "SHA-256-sess", NULL, CHECK_PASSWORD,
+	  9, CHECK_NONCE_ISSUED, 0, 0, 1, 0 },
+	{ "digest_sess_replay", "/private/status", "SHA-256-sess", NULL, CHECK_PASSWORD,
+	  9, CHECK_NONCE_ISSUED, 0, 0, 0, 0 },
+	{ "digest_uri_other", "/private/status", "MD5", "/private/other", CHECK_PASSWORD,
+	  10, CHECK_NONCE_ISSUED, 0, 0, 0, 0 },
+	{ "digest_uri_absolute", "/private/status", "MD5",
+	  "http://example.com/private/status", CHECK_PASSWORD,
+	  11, CHECK_NONCE_ISSUED, 0, 0, 1, 0 },
+	{ "digest_uri_dot_segments", "/private/./a/../status", "MD5", NULL, CHECK_PASSWORD,
+	  12, CHECK_NONCE_ISSUED, 0, 0, 1, 0 },
+	{ "digest_uri_escaped", "/private/st%61tus", "MD5", NULL, CHECK_PASSWORD,
+	  13, CHECK_NONCE_ISSUED, 0, 0, 1, 0 },
+	{ "digest_realm_other", "/private/status", "MD5", NULL, CHECK_PASSWORD,
+	  14, CHECK_NONCE_ISSUED, 0, 0, 0, 0, "elsewhere" },
+	{ "digest_algorithm_short", "/private/status", "MD", NULL, CHECK_PASSWORD,
+	  15, CHECK_NONCE_ISSUED, 0, 0, 0, 0 },
+	{ "digest_nonce_unknown", "/private/status", "MD5", NULL, CHECK_PASSWORD,
+	  1, CHECK_NONCE_UNKNOWN, 0, 0, 0, 1 },
+	{ "digest_nonce_expired", "/private/status", "MD5", NULL, CHECK_PASSWORD,
+	  16, CHECK_NONCE_ISSUED, CHECK_NONCE_LIFETIME + 1, 0, 0, 1 },
+
+	{ "basic_first", "/basic", NULL, NULL, CHECK_BASIC_PASSWORD,
+	  0, 0, 0, 0, 0, 0 },
+	{ "basic_cached", "/basic", NULL, NULL, CHECK_BASIC_PASSWORD,
+	  0, 0, 1, 0, 1, 0 },
+	{ "basic_other_password", "/basic", NULL, NULL, "open sesam",
+	  0, 0, 0, 0, 0, 0 },
+	{ "basic_other_password_again", "/basic", NULL, NULL, "open sesam",
+	  0, 0, 0, 0, 0, 0 },
+	{ "basic_expired", "/basic", NULL, NULL, CHECK_BASIC_PASSWORD,
+	  0, 0, CHECK_BASIC_TTL, 0, 0, 0 },
+	{ "basic_cached_again", "/basic", NULL, NULL, CHECK_BASIC_PASSWORD,
+	  0, 0, 1, 0, 1, 0 },
+	{ "basic_revoked", "/basic", NULL, NULL, CHECK_BASIC_PASSWORD,
+	  0, 0, 0, 1, 0, 0 },
+};
+
+/* H() of the formatted string, in hex */
+static void check_h(
+	uint8_t algorithm,
+	char *hex,
+	char const *fmt, ... )
+{
+	char text[512];
+	va_list ap;
+	va_start(ap, fmt);
+	int const len = vsnprintf(text, sizeof(text), fmt, ap);
+	va_end(ap);
+
+	uint8_t digest[PHSHA256_DIGEST_LEN];
+	size_t n;
+	if( PICOHTTP_DIGEST_SHA256 & algorithm ) {
+		struct phsha256ctx ctx;
+		phsha256init(&ctx);
+		phsha256update(&ctx, len, text);
+		phsha256final(&ctx, digest);
+		n = PHSHA256_DIGEST_LEN;
+	} else {
+		struct phmd5ctx ctx;
+		phmd5init(&ctx);
+		phmd5update(&ctx, len, text);
+		phmd5final(&ctx, digest);
+		n = PHMD5_DIGEST_LEN;
+	}
+	for(size_t i = 0; i < n; i++) {
+		sprintf(hex + 2*i, "%02x", digest[i]);
+	}
+}
+
+/* what a client would send */
+static void check_digest_request(
+	struct checkStep const * const s,
+	char const *nonce,
+	char *req,
+	size_t size )
+{
+	char const * const realm = s->realm ? s->realm : CHECK_REALM;
+	static char const user[] = "Mufasa";
+	static char const cnonce[] = "0a4f113b";
+	char const * const uri = s->uri ? s->uri : s->path;
+
+	uint8_t a = strncmp(s->algorithm, "SHA-256", 7) ?
+		PICOHTTP_DIGEST_MD5 : PICOHTTP_DIGEST_SHA256;
+	if( strstr(s->algorithm, "-sess") ) {
+		a |= PICOHTTP_DIGEST_SESS;
+	}
+
+	char ha1[2*PHSHA256_DIGEST_LEN+1];
+	char ha2[2*PHSHA256_DIGEST_LEN+1];
+	char response[2*PHSHA256_DIGEST_LEN+1];
+	check_h(a, ha1, "%s:%s:%s", user, realm, s->password);
+	if( PICOHTTP_DIGEST_SESS & a ) {
+		char ha1_sess[2*PHSHA256_DIGEST_LEN+1];
+		check_h(a, ha1_sess, "%s:%s:%s", ha1, nonce, cnonce);
+		memcpy(ha1, ha1_sess, sizeof(ha1));
+	}
+	check_h(a, ha2, "GET:%s", uri);
+	check_h(a, response, "%s:%s:%08x:%s:auth:%s",
+		ha1, nonce, (unsigned)s->nc, cnonce, ha2);
+
+	snprintf(req, size,
+		"GET %s HTTP/1.1\r\n"
+		"Authorization: Digest username=\"%s\", realm=\"%s\", "
+		"nonce=\"%s\", uri=\"%s\", algorithm=%s, qop=auth, "
+		"nc=%08x, cnonce=\"%s\", response=\"%s\"\r\n"
+		"\r\n",
+		s->path, user, realm, nonce, uri, s->algorithm,
+		(unsigned)s->nc, cnonce, response);
+}
+
+static void check_basic_request(
+	struct checkStep const * const s,
+	char *req,
+	size_t size )
+{
+	char credentials[64];
+	char encoded[PHB64_ENCODED_LEN(sizeof(credentials)) + 1];
+	int const len = snprintf(credentials, sizeof(credentials), "%s:%s",
+		CHECK_BASIC_USER, s->password);
+	encoded[phb64_encode_buf(NULL, len, credentials, encoded)] = 0;
+
+	snprintf(req, size,
+		"GET %s HTTP/1.1\r\n"
+		"Authorization: Basic %s\r\n"
+		"\r\n",
+		s->path, encoded);
+}
+
+int main(void)
+{
+	struct picohttpDigestNonceCache nonces = {
+		.lifetime = CHECK_NONCE_LIFETIME,
+		.now = check_clock,
+		.random = check_random,
+	};
+	struct picohttpAuthCache cache = {
+		.ttl = CHECK_BASIC_TTL,
+		.now = check_clock,
+		.random = check_random,
+	};
+	picohttpAuthCacheInit(&cache);
+
+	char username[32], realm[32], pwresponse[80];
+	struct picohttpAuthData auth = {
+		.username_maxlen = sizeof(username)-1,
+		.username = username,
+		.realm_maxlen = sizeof(realm)-1,
+		.realm = realm,
+		.pwresponse_maxlen = sizeof(pwresponse)-1,
+		.pwresponse = pwresponse,
+		.cache = &cache,
+		.nonces = &nonces,
+	};
+
+	char issued[PICOHTTP_DIGEST_NONCE_LEN+1];
+	picohttpDigestNonceIssue(&nonces, issued);
+	static char const unknown[PICOHTTP_DIGEST_NONCE_LEN+1] =
+		"00112233445566778899aabbccddeeff";
+
+	int ret = 0;
+	for(size_t i = 0; i < sizeof(check_steps)/sizeof(*check_steps); i++) {
+		struct checkStep const * const s = check_steps + i;
+		check_now += s->advance;
+		if( s->revoke ) {
+			picohttpAuthCacheInit(&cache);
+		}
+
+		char text[1024];
+		if( s->algorithm ) {
+			check_digest_request(s,
+				(CHECK_NONCE_UNKNOWN == s->nonce) ? unknown : issued,
+				text, sizeof(text));
+		} else {
+			check_basic_request(s, text, sizeof(text));
+		}
+		struct checkIo io = { .req = text, .len = strlen(text) };
+		struct picohttpIoOps const ioops = {
+			.read  = check_io_read,
+			.write = check_io_write,
+			.getch = check_io_getch,
+			.putch = check_io_putch,
+			.flush = check_io_flush,
+			.data  = &io,
+		};
+
+		check_result = check_stale = -1;
+		picohttpProcessRequest(&ioops, check_routes, &auth, NULL);
+
+		char const *check = "ok";
+		if( check_result != s->result ) {
+			check = "result";
+		} else
+		if( s->algorithm && check_stale != s->stale ) {
+			check = "stale";
+		}
+		printf("{\"step\":\"%s\",\"result\":%d,\"stale\":%d,"
+			"\"check\":\"%s\"}\n",
+			s->name, check_result, check_stale, check);
+		if( strcmp(check, "ok") ) {
+			ret = 1;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,241 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+/* Base64 buffer codec check.
+ *
+ * Runs the buffer codec over pseudo random input of random lengths:
+ * encoding in one go and streamed in random pieces, decoding of the
+ * result, with whitespace added, without padding, and corrupted. The
+ * same seed gives the same cases, so builds with different SIMD
+ * extensions enabled can be compared by the digest of all results
+ * they print. Exits 1 if a round trip fails or the streamed codec
+ * disagrees with the one-shot one, 77 if the CPU lacks an extension
+ * the build uses. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../picohttp_base64.h"
+
+#define CHECK_CASES 20000
+
+static uint64_t check_rng = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t check_rand(void)
+{
+	check_rng ^= check_rng << 13;
+	check_rng ^= check_rng >> 7;
+	check_rng ^= check_rng << 17;
+	return (uint32_t)(check_rng >> 32);
+}
+
+/* FNV-1a over everything a codec call returned */
+static uint64_t check_digest = 0xcbf29ce484222325ULL;
+
+static void check_hash(
+	size_t len,
+	void const *buf )
+{
+	uint8_t const *b = buf;
+	for(size_t i = 0; i < len; i++) {
+		check_digest = (check_digest ^ b[i]) * 0x100000001b3ULL;
+	}
+}
+
+static void check_hash_result(
+	size_t n,
+	void const *buf )
+{
+	check_hash(sizeof(n), &n);
+	if( PHB64_ERROR != n ) {
+		check_hash(n, buf);
+	}
+}
+
+static void check_fail(
+	unsigned c,
+	char const *what )
+{
+	fprintf(stderr, "b64check: case %u: %s\n", c, what);
+	exit(1);
+}
+
+/* mostly short, the bulk paths need 16 to 48 characters at least;
+ * now and then a long one */
+static size_t check_length(void)
+{
+	uint32_t const r = check_rand();
+	if( !(r & 0x1f) ) {
+		return r >> 20;
+	}
+	return (r >> 8) % 200;
+}
+
+static size_t check_encode_streamed(
+	size_t len,
+	uint8_t const *raw,
+	char *enc )
+{
+	phb64state_t state = PHB64_STATE_INIT;
+	size_t n = 0;
+	for(size_t i = 0; i < len; ) {
+		size_t piece = check_rand() % 64;
+		if( piece > len - i ) {
+			piece = len - i;
+		}
+		n += phb64_encode_buf(&state, piece, raw + i, enc + n);
+		i += piece;
+	}
+	return n + phb64_encode_final(&state, enc + n);
+}
+
+static size_t check_decode_streamed(
+	size_t len,
+	char const *enc,
+	uint8_t *raw )
+{
+	phb64state_t state = PHB64_STATE_INIT;
+	size_t n = 0;
+	for(size_t i = 0; i < len; ) {
+		size_t piece = check_rand() % 64;
+		if( piece > len - i ) {
+			piece = len - i;
+		}
+		size_t const r = phb64_decode_buf(&state, piece, enc + i, raw + n);
+		if( PHB64_ERROR == r ) {
+			return r;
+		}
+		n += r;
+		i += piece;
+	}
+	size_t const r = phb64_decode_final(&state, raw + n);
+	return (PHB64_ERROR == r) ? r : n + r;
+}
+
+int main(void)
+{
+#if defined(__AVX2__)
+	if( !__builtin_cpu_supports("avx2") ) {
+		return 77;
+	}
+#endif
+#if defined(__SSSE3__)
+	if( !__builtin_cpu_supports("ssse3") ) {
+		return 77;
+	}
+#endif
+
+	for(unsigned c = 0; c < CHECK_CASES; c++) {
+		size_t const len = check_length();
+		size_t const enc_max = PHB64_ENCODED_LEN(len + 2);
+		/* room for a space every other character */
+		size_t const text_max = 2 * enc_max + 1;
+		uint8_t * const raw = malloc(len + 1);
+		char * const enc = malloc(enc_max + 1);
+		char * const enc2 = malloc(enc_max + 1);
+		char * const text = malloc(text_max);
+		uint8_t * const dec = malloc(PHB64_DECODED_MAX(text_max + 3));
+		uint8_t * const dec2 = malloc(PHB64_DECODED_MAX(text_max + 3));
+		if( !raw || !enc || !enc2 || !text || !dec || !dec2 ) {
+			check_fail(c, "out of memory");
+		}
+		for(size_t i = 0; i < len; i++) {
+			raw[i] = check_rand();
+		}
+
+		size_t const n = phb64_encode_buf(NULL, len, raw, enc);
+		check_hash_result(n, enc);
+		if( n != PHB64_ENCODED_LEN(len) ) {
+			check_fail(c, "encoded length");
+		}
+		if( n != check_encode_streamed(len, raw, enc2)
+		 || memcmp(enc, enc2, n) ) {
+			check_fail(c, "streamed encoding differs");
+		}
+
+		size_t d = phb64_decode_buf(NULL, n, enc, dec);
+		check_hash_result(d, dec);
+		if( d != len || memcmp(dec, raw, len) ) {
+			check_fail(c, "round trip");
+		}
+
+		/* unpadded */
+		size_t m = n;
+		while( m && '=' == enc[m-1] ) {
+			m--;
+		}
+		d = phb64_decode_buf(NULL, m, enc, dec);
+		check_hash_result(d, dec);
+		if( d != len || memcmp(dec, raw, len) ) {
+			check_fail(c, "round trip without padding");
+		}
+
+		/* with whitespace, which the bulk decoders leave to the
+		 * scalar one */
+		size_t t = 0;
+		for(size_t i = 0; i < n; i++) {
+			if( !(check_rand() & 0x0f) ) {
+				text[t++] = " \t\r\n"[check_rand() & 3];
+			}
+			text[t++] = enc[i];
+		}
+		d = phb64_decode_buf(NULL, t, text, dec);
+		check_hash_result(d, dec);
+		if( d != len || memcmp(dec, raw, len) ) {
+			check_fail(c, "round trip with whitespace");
+		}
+		if( d != check_decode_streamed(t, text, dec)
+		 || memcmp(dec, raw, len) ) {
+			check_fail(c, "streamed decoding differs");
+		}
+
+		/* corrupted: any octet, including padding and whitespace,
+		 * somewhere in the text */
+		if( t ) {
+			unsigned const hits = 1 + (check_rand() & 1);
+			for(unsigned h = 0; h < hits; h++) {
+				uint32_t const r = check_rand();
+				text[r % t] = (r & 1) ? "=A/+\n"[(r >> 1) % 5] : (char)(r >> 8);
+			}
+		}
+		d = phb64_decode_buf(NULL, t, text, dec);
+		check_hash_result(d, dec);
+		size_t const ds = check_decode_streamed(t, text, dec2);
+		if( ds != d || (PHB64_ERROR != d && memcmp(dec, dec2, d)) ) {
+			check_fail(c, "streamed decoding of corrupted text differs");
+		}
+
+		free(dec2);
+		free(dec);
+		free(text);
+		free(enc2);
+		free(enc);
+		free(raw);
+	}
+
+	printf("{\"cases\":%u,\"digest\":\"%016llx\"}\n",
+		CHECK_CASES, (unsigned long long)check_digest);
+	return 0;
+}
@@ -0,0 +1,323 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+/* Request body framing check.
+ *
+ * Processes requests followed by the start of a pipelined next one and
+ * checks that the handler reads exactly the body, and that the
+ * connection is left at the start of the next request. Each request
+ * goes through both the pull parser (picohttpProcessRequest) and the
+ * push parser (picohttpParserFeed). One JSON line per request and
+ * parser goes to stdout; the exit status is 1 if a check failed. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../picohttp.h"
+
+/* in memory connection */
+
+struct checkIo {
+	char const *req;
+	size_t len;
+	size_t pos;
+	char head[16];
+	size_t sent;
+};
+
+static int check_io_getch(void *data)
+{
+	struct checkIo * const io = data;
+	if( io->pos >= io->len ) {
+		return -1;
+	}
+	return (unsigned char)io->req[io->pos++];
+}
+
+static int check_io_read(size_t count, void *buf, void *data)
+{
+	struct checkIo * const io = data;
+	if( io->pos >= io->len ) {
+		return -1;
+	}
+	if( count > io->len - io->pos ) {
+		count = io->len - io->pos;
+	}
+	memcpy(buf, io->req + io->pos, count);
+	io->pos += count;
+	return count;
+}
+
+static int check_io_write(size_t count, void const *buf, void *data)
+{
+	struct checkIo * const io = data;
+	if( io->sent < sizeof(io->head) - 1 ) {
+		size_t n = sizeof(io->head) - 1 - io->sent;
+		if( n > count )
+			n = count;
+		memcpy(io->head + io->sent, buf, n);
+	}
+	io->sent += count;
+	return count;
+}
+
+static int check_io_putch(int ch, void *data)
+{
+	char const c = ch;
+	return check_io_write(1, &c, data);
+}
+
+static int check_io_flush(void *data)
+{
+	(void)data;
+	return 0;
+}
+
+/* handlers */
+
+static char check_body[64];
+static int check_body_len;
+
+static void rhCheckBody(struct picohttpRequest *req)
+{
+	int r;
+	check_body_len = 0;
+	while( 0 < (r = picohttpRead(req,
+			sizeof(check_body) - check_body_len,
+			check_body + check_body_len)) ) {
+		check_body_len += r;
+		if( sizeof(check_body) == (size_t)check_body_len ) {
+			break;
+		}
+	}
+	/* the end of the body stays the end */
+	if( 0 > r || picohttpRead(req, sizeof(check_body), check_body) ) {
+		check_body_len = -1;
+	}
+	picohttpResponseWrite(req, 2, "ok");
+}
+
+/* "ok" as an entity with a strong and with a weak validator */
+static void rhCheckRange(struct picohttpRequest *req)
+{
+	picohttpResponseRanges(req, 2, "\"ok\"");
+	rhCheckBody(req);
+}
+
+static void rhCheckRangeWeak(struct picohttpRequest *req)
+{
+	picohttpResponseRanges(req, 2, "W/\"ok\"");
+	rhCheckBody(req);
+}
+
+static struct picohttpVarSpec const check_vars[] = {
+	{ "a", PICOHTTP_TYPE_TEXT, 8 },
+	{ NULL, 0, 0 }
+};
+
+static struct picohttpURLRoute const check_routes[] = {
+	{ "/|", 0, rhCheckBody, 0, PICOHTTP_METHOD_GET },
+	{ "/vars|", check_vars, rhCheckBody, 0, PICOHTTP_METHOD_GET },
+	{ "/body|", 0, rhCheckBody, 0, PICOHTTP_METHOD_POST },
+	{ "/small|", 0, rhCheckBody, 0, PICOHTTP_METHOD_POST,
+	  .max_body = 4 },
+	{ "/range|", 0, rhCheckRange, 0, PICOHTTP_METHOD_GET },
+	{ "/weak|", 0, rhCheckRangeWeak, 0, PICOHTTP_METHOD_GET },
+	{ NULL, 0, 0, 0, 0 }
+};
+
+/* every request is followed by this, which must be left unread */
+#define CHECK_NEXT "GET /next HTTP/1.1\r\n\r\n"
+
+/* body NULL: reading it fails, the connection is left where it failed */
+struct checkRequest {
+	char const *name;
+	char const *req;
+	int status;
+	char const *body;
+};
+
+static struct checkRequest const check_requests[] = {
+	{ "get",
+	  "GET / HTTP/1.1\r\n\r\n",
+	  200, "" },
+	{ "query",
+	  "GET /vars?a=1&b&abc=%20 HTTP/1.1\r\n\r\n",
+	  200, "" },
+	{ "length_0",
+	  "POST /body HTTP/1.1\r\n"
+	  "Content-Length: 0\r\n"
+	  "\r\n",
+	  200, "" },
+	{ "length",
+	  "POST /body HTTP/1.1\r\n"
+	  "Content-Length: 5\r\n"
+	  "\r\n"
+	  "hello",
+	  200, "hello" },
+	{ "unframed",
+	  "POST /body HTTP/1.1\r\n"
+	  "\r\n",
+	  200, "" },
+	{ "unframed_max_body",
+	  "POST /small HTTP/1.1\r\n"
+	  "\r\n",
+	  200, "" },
+	{ "max_body_length",
+	  "POST /small HTTP/1.1\r\n"
+	  "Content-Length: 8\r\n"
+	  "\r\n"
+	  "12345678",
+	  413, "" },
+	{ "query_bad_escape",
+	  "GET /vars?a=%zz HTTP/1.1\r\n\r\n",
+	  400, NULL },
+	{ "query_bad_escape_name",
+	  "GET /vars?abc%g1=1 HTTP/1.1\r\n\r\n",
+	  400, NULL },
+	{ "query_bad_escape_skipped",
+	  "GET /?a=%1 HTTP/1.1\r\n\r\n",
+	  400, NULL },
+	{ "query_nul",
+	  "GET /vars?a=%00 HTTP/1.1\r\n\r\n",
+	  400, NULL },
+	{ "max_body_chunked",
+	  "POST /small HTTP/1.1\r\n"
+	  "Transfer-Encoding: chunked\r\n"
+	  "\r\n"
+	  "3\r\n123\r\n3\r\n456\r\n0\r\n\r\n",
+	  413, NULL },
+	{ "max_body_chunked_fits",
+	  "POST /small HTTP/1.1\r\n"
+	  "Transfer-Encoding: chunked\r\n"
+	  "\r\n"
+	  "1\r\n1\r\n3\r\n234\r\n0\r\n\r\n",
+	  200, "1234" },
+	{ "chunked_empty",
+	  "POST /body HTTP/1.1\r\n"
+	  "Transfer-Encoding: chunked\r\n"
+	  "\r\n"
+	  "0\r\n\r\n",
+	  200, "" },
+	{ "chunked",
+	  "POST /body HTTP/1.1\r\n"
+	  "Transfer-Encoding: chunked\r\n"
+	  "\r\n"
+	  "5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\nX-Trailer: 1\r\n\r\n",
+	  200, "hello world" },
+	{ "chunked_hex",
+	  "POST /body HTTP/1.1\r\n"
+	  "Transfer-Encoding: chunked\r\n"
+	  "\r\n"
+	  "a\r\n0123456789\r\n10\r\n0123456789ABCDEF\r\n0\r\n\r\n",
+	  200, "01234567890123456789ABCDEF" },
+	{ "if_range",
+	  "GET /range HTTP/1.1\r\n"
+	  "Range: bytes=0-0\r\n"
+	  "If-Range: \"ok\"\r\n"
+	  "\r\n",
+	  206, "" },
+	{ "if_range_weak",
+	  "GET /range HTTP/1.1\r\n"
+	  "Range: bytes=0-0\r\n"
+	  "If-Range: W/\"ok\"\r\n"
+	  "\r\n",
+	  200, "" },
+	{ "if_range_weak_validator",
+	  "GET /weak HTTP/1.1\r\n"
+	  "Range: bytes=0-0\r\n"
+	  "If-Range: W/\"ok\"\r\n"
+	  "\r\n",
+	  200, "" },
+};
+
+static struct picohttpParser check_parser;
+static char check_url[64];
+
+/* the request in io through either parser */
+static void check_process(
+	struct picohttpIoOps const * const ioops,
+	struct checkIo * const io,
+	int push )
+{
+	if( !push ) {
+		picohttpProcessRequest(ioops, check_routes, NULL, NULL);
+		return;
+	}
+	picohttpParserInit(&check_parser, check_routes, check_url, NULL, NULL);
+	io->pos = picohttpParserFeed(&check_parser, io->req, io->len);
+	picohttpParserDispatch(&check_parser, ioops);
+}
+
+int main(void)
+{
+	if( picohttpRoutesMaxUrlLength(check_routes) >= sizeof(check_url) ) {
+		return 1;
+	}
+	int ret = 0;
+	for(size_t i = 0; i < 2 * sizeof(check_requests)/sizeof(*check_requests); i++) {
+		struct checkRequest const * const c = check_requests + i/2;
+		int const push = i & 1;
+		char text[512];
+		snprintf(text, sizeof(text), "%s" CHECK_NEXT, c->req);
+		struct checkIo io = { .req = text, .len = strlen(text) };
+		struct picohttpIoOps const ioops = {
+			.read  = check_io_read,
+			.write = check_io_write,
+			.getch = check_io_getch,
+			.putch = check_io_putch,
+			.flush = check_io_flush,
+			.data  = &io,
+		};
+
+		check_body_len = -1;
+		check_process(&ioops, &io, push);
+
+		char const *sp = strchr(io.head, ' ');
+		int const status = sp ? atoi(sp + 1) : -1;
+		size_t const left = io.len - io.pos;
+
+		char const *check = "ok";
+		if( status != c->status ) {
+			check = "status";
+		} else
+		if( !c->body ? 0 <= check_body_len :
+		    (200 == status && ((int)strlen(c->body) != check_body_len
+		     || memcmp(c->body, check_body, check_body_len))) ) {
+			check = "body";
+		} else
+		if( c->body && sizeof(CHECK_NEXT)-1 != left ) {
+			check = "next";
+		}
+		printf("{\"request\":\"%s\",\"parser\":\"%s\",\"status\":%d,"
+			"\"body\":%d,\"left\":%zu,\"check\":\"%s\"}\n",
+			c->name, push ? "push" : "pull", status, check_body_len,
+			left, check);
+		if( strcmp(check, "ok") ) {
+			ret = 1;
+		}
+	}
+	return ret;
+}
@@ -29,12 +29,32 @@
 #include <string.h>
 
 #include <unistd.h>
+#include <fcntl.h>
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <netinet/ip.h>
 
 #include "../picohttp.h"
+#include "../picohttp_upload.h"
+#if HOST_DEBUG
+#include "../picohttp_trace.h"
+#endif
+#ifdef BSDSOCKET_GREEN
+#include "../picohttp_green.h"
+#endif
+
+/* a client has this long for each read or write to make progress;
+ * the timeouts are set on the connection sockets */
+#ifndef BSDSOCK_IDLE_SEC
+#define BSDSOCK_IDLE_SEC 10
+#endif
+
+/* per connection; requests are served one at a time */
+static int bsdsock_expired;
+static size_t bsdsock_written;
 
 int bsdsock_read(size_t count, void *buf, void *data)
 {
@@ -54,8 +74,7 @@ int bsdsock_read(size_t count, void *buf, void *data)
 
 		if( EAGAIN == errno ||
 		    EWOULDBLOCK == errno ) {
-			usleep(100);
-			continue;
+			bsdsock_expired = 1;
 		}
 		return -3 + errno;
 	} while( rb < count );
@@ -68,10 +87,15 @@ int bsdsock_write(size_t count, void const *buf, void *data)
 	
 	ssize_t wb = 0;
 	ssize_t w = 0;
+	if( bsdsock_expired ) {
+		/* the client gets a 408 instead */
+		return -1;
+	}
 	do {
 		w = write(fd, (unsigned char*)buf + wb, count-wb);
 		if( 0 < w ) {
 			wb += w;
+			bsdsock_written += w;
 			continue;
 		}
 		if( !w ) {
@@ -80,8 +104,7 @@ int bsdsock_write(size_t count, void const *buf, void *data)
 
 		if( EAGAIN == errno ||
 		    EWOULDBLOCK == errno ) {
-			usleep(100);
-			continue;
+			bsdsock_expired = 1;
 		}
 		return -3 + errno;
 	} while( wb < count );
@@ -146,6 +169,10 @@ void rhRoot(struct picohttpRequest *req)
 void rhTest(struct picohttpRequest *req)
 {
 	fprintf(stderr, "handling request /test%s\n", req->urltail);
+	char const * const useragent = picohttpRequestHeader(req, "User-Agent");
+	if( useragent ) {
+		fprintf(stderr, "from %s\n", useragent);
+	}
 	char http_header[] = "HTTP/x.x 200 OK\r\nServer: picoweb\r\nContent-Type: text/text\r\n\r\n";
 	http_header[5] = '0'+req->httpversion.major;
 	http_header[7] = '0'+req->httpversion.minor;
@@ -166,41 +193,35 @@ void rhUpload(struct picohttpRequest *req)
 
 	char http_test[] = "handling request /upload";
 
+	/* file parts are written out while more is received; one
+	 * pipeline for each request, as green threads may be amid uploads
+	 * at the same time */
+	struct picohttpUpload * const upload = picohttpUploadCreate(4, 64 << 10);
+	if( !upload ) {
+		picohttpStatusResponse(req,
+			PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR);
+		return;
+	}
+
 	struct picohttpMultipart mp = picohttpMultipartStart(req);
 	
 	chdir("/tmp/uploadtest");
 	while( !picohttpMultipartNext(&mp) ) {
 		fprintf(stderr, "\nprocessing form field \"%s\"\n", mp.disposition.name);
-		FILE *fil = fopen(mp.disposition.name, "wb");
-		if(!fil) {
+		int const fd = open(mp.disposition.name,
+			O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if( 0 > fd ) {
 			continue;
 		}
 
-		for(int ch = picohttpMultipartGetch(&mp);
-		    0 <= ch;
-		    ch = picohttpMultipartGetch(&mp) ) {
-			fputc(ch, fil);
-
-		#if HOST_DEBUG
-			fputs("\e[32m", stderr);
-			switch(ch) {
-			case '\r':
-				fputs("[CR]", stderr); break;
-			case '\n':
-				fputs("[LF]", stderr); break;
-
-			default:
-				fputc(ch, stderr);
-			}
-			fputs("\e[0m", stderr);
-		#endif/*HOST_DEBUG*/
-		}
-
-		fclose(fil);
-		if( !mp.finished ) {
+		int64_t const stored = picohttpUploadPart(upload, &mp, fd);
+		close(fd);
+		fprintf(stderr, "stored %lld octets\n", (long long)stored);
+		if( 0 > stored ) {
 			break;
 		}
 	}
+	picohttpUploadDestroy(upload);
 	if( !mp.finished ) {
 	}
 
@@ -210,6 +231,90 @@ void rhUpload(struct picohttpRequest *req)
 	}
 }
 
+/* raw bodies, e.g. firmware images, go to the file in one piece */
+void rhStore(struct picohttpRequest *req)
+{
+	fprintf(stderr, "handling request /store%s\n", req->urltail);
+
+	if( !req->urltail || strchr(req->urltail+1, '/') ) {
+		picohttpStatusResponse(req, PICOHTTP_STATUS_404_NOT_FOUND);
+		return;
+	}
+
+	chdir("/tmp/uploadtest");
+	int const fd = open(req->urltail+1, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if( 0 > fd ) {
+		picohttpStatusResponse(req,
+			PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR);
+		return;
+	}
+	int64_t const stored = picohttpRequestBodyToFd(req, fd, 256 << 20);
+	close(fd);
+	if( 0 > stored ) {
+		unlink(req->urltail+1);
+		picohttpStatusResponse(req,
+			PICOHTTP_STATUS_500_INTERNAL_SERVER_ERROR);
+		return;
+	}
+
+	char http_test[32];
+	int const len = snprintf(http_test, sizeof(http_test),
+		"stored %lld\n", (long long)stored);
+	picohttpResponseWrite(req, len, http_test);
+}
+
+void rhDownload(struct picohttpRequest *req)
+{
+	fprintf(stderr, "handling request /download%s\n", req->urltail);
+
+	if( !req->urltail || strchr(req->urltail+1, '/') ) {
+		picohttpStatusResponse(req, PICOHTTP_STATUS_404_NOT_FOUND);
+		return;
+	}
+
+	chdir("/tmp/uploadtest");
+	FILE *fil = fopen(req->urltail+1, "rb");
+	struct stat st;
+	if( !fil || fstat(fileno(fil), &st) ) {
+		if( fil )
+			fclose(fil);
+		picohttpStatusResponse(req, PICOHTTP_STATUS_404_NOT_FOUND);
+		return;
+	}
+
+	char etag[32];
+	snprintf(etag, sizeof(etag), "\"%lx-%lx\"",
+		(unsigned long)st.st_mtime, (unsigned long)st.st_size);
+	req->response.contenttype = "application/octet-stream";
+	req->response.contentlength = st.st_size;
+	req->response.etag = etag;
+
+	if( 0 > picohttpResponseRanges(req, st.st_size, etag) ) {
+		fclose(fil);
+		return;
+	}
+
+	char buf[512];
+	size_t offset;
+	while( (offset = picohttpResponseNextOffset(req)) < (size_t)st.st_size ) {
+#ifdef BSDSOCKET_GREEN
+		/* doesn't hold up the other connections */
+		int const rb = picohttpGreenFileRead(req->ioops,
+			fileno(fil), sizeof(buf), buf, offset);
+		if( 0 >= rb || 0 > picohttpResponseWrite(req, rb, buf) ) {
+#else
+		if( fseek(fil, offset, SEEK_SET) ) {
+			break;
+		}
+		size_t const rb = fread(buf, 1, sizeof(buf), fil);
+		if( !rb || 0 > picohttpResponseWrite(req, rb, buf) ) {
+#endif
+			break;
+		}
+	}
+	fclose(fil);
+}
+
 int main(int argc, char *argv[])
 {
 	sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -223,9 +328,10 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	unsigned short const port = (1 < argc) ? atoi(argv[1]) : 8000;
 	struct sockaddr_in addr = {
 		.sin_family = AF_INET,
-		.sin_port   = htons(8000),
+		.sin_port   = htons(port),
 		.sin_addr   = 0
 	};
 
@@ -236,11 +342,55 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	if( -1 == listen(sockfd, 2) ) {
+#ifdef BSDSOCKET_GREEN
+	int const backlog = SOMAXCONN;
+#else
+	int const backlog = 2;
+#endif
+	if( -1 == listen(sockfd, backlog) ) {
 		perror("listen");
 		return -1;
 	}
 
+	static int const upload_types[] = {
+		PICOHTTP_CONTENTTYPE_MULTIPART_FORMDATA, 0
+	};
+	static int const store_types[] = {
+		PICOHTTP_CONTENTTYPE_APPLICATION_OCTETSTREAM, 0
+	};
+	static char const * const test_headers[] = { "User-Agent", NULL };
+	static struct picohttpURLRoute const routes[] = {
+		{ "/test", 0, rhTest, 16, PICOHTTP_METHOD_GET,
+		  0, NULL, test_headers },
+		{ "/upload", 0, rhUpload, 16, PICOHTTP_METHOD_POST,
+		  4 << 20, upload_types },
+		{ "/store", 0, rhStore, 32, PICOHTTP_METHOD_POST,
+		  256 << 20, store_types },
+		{ "/download", 0, rhDownload, 32, PICOHTTP_METHOD_GET },
+		{ "/|", 0, rhRoot, 0, PICOHTTP_METHOD_GET },
+		{ NULL, 0, 0, 0, 0 }
+	};
+
+#ifdef BSDSOCKET_GREEN
+	/* same handlers, each connection on a green thread */
+	struct picohttpGreenConfig const config = {
+		.listenfd = sockfd,
+		.routes = routes,
+	};
+	struct picohttpGreen * const green = picohttpGreenCreate(&config);
+	if( !green ) {
+		fputs("picohttpGreenCreate failed\n", stderr);
+		return -1;
+	}
+	int const ret = picohttpGreenRun(green);
+	picohttpGreenDestroy(green);
+	return ret;
+#endif
+
+#if HOST_DEBUG
+	picohttpTraceSetMask(PICOHTTP_TRACE_CLASS_ALL);
+#endif
+
 	for(;;) {
 		socklen_t addrlen = 0;
 		int confd = accept(sockfd, (struct sockaddr*)&addr, &addrlen);
@@ -255,6 +405,12 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		struct timeval const idle = { .tv_sec = BSDSOCK_IDLE_SEC };
+		setsockopt(confd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+		setsockopt(confd, SOL_SOCKET, SO_SNDTIMEO, &idle, sizeof(idle));
+		bsdsock_expired = 0;
+		bsdsock_written = 0;
+
 		struct picohttpIoOps ioops = {
 			.read  = bsdsock_read,
 			.write = bsdsock_write,
@@ -264,14 +420,19 @@ int main(int argc, char *argv[])
 			.data = &confd
 		};
 
-		struct picohttpURLRoute routes[] = {
-			{ "/test", 0, rhTest, 16, PICOHTTP_METHOD_GET },
-			{ "/upload", 0, rhUpload, 16, PICOHTTP_METHOD_POST },
-			{ "/|", 0, rhRoot, 0, PICOHTTP_METHOD_GET },
-			{ NULL, 0, 0, 0, 0 }
-		};
-
-		picohttpProcessRequest(&ioops, routes);
+		picohttpProcessRequest(&ioops, routes, NULL, NULL);
+		if( bsdsock_expired && !bsdsock_written ) {
+			static char const timeout[] =
+				"HTTP/1.1 408 Request Timeout\r\n"
+				"Connection: close\r\n"
+				"Content-Length: 0\r\n"
+				"\r\n";
+			send(confd, timeout, sizeof(timeout)-1,
+				MSG_NOSIGNAL | MSG_DONTWAIT);
+		}
+#if HOST_DEBUG
+		picohttpTraceDump(STDERR_FILENO);
+#endif
 
 		shutdown(confd, SHUT_RDWR);
 		close(confd);
@@ -225,6 +225,8 @@ void rhFavicon(struct picohttpRequest *req)
 
 	req->response.contenttype = "image/x-icon";
 	req->response.contentlength = sizeof(favicon_ico);
+	if( 0 > picohttpResponseRanges(req, sizeof(favicon_ico), NULL) )
+		return;
 	picohttpResponseWrite(req, sizeof(favicon_ico), favicon_ico);
 }
 
@@ -290,7 +292,7 @@ int main(int argc, char *argv[])
 			{ NULL, 0, 0, 0, 0 }
 		};
 
-		picohttpProcessRequest(&ioops, routes);
+		picohttpProcessRequest(&ioops, routes, NULL, NULL);
 
 		shutdown(confd, SHUT_RDWR);
 		close(confd);
@@ -0,0 +1,136 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../picohttp.h"
+#include "../picohttp_evloop.h"
+
+static struct picohttpEvLoop *loop;
+
+static void onsignal(int sig)
+{
+	(void)sig;
+	picohttpEvLoopStop(loop);
+}
+
+void rhRoot(struct picohttpRequest *req)
+{
+	char const http_test[] =
+"<html><head><title>picoweb</title></head><body>\n"
+"<a href=\"/test\">/test</a>\n"
+"</body></html>\n";
+
+	req->response.contenttype = "text/html";
+	req->response.contentlength = sizeof(http_test)-1;
+	picohttpResponseWrite(req, sizeof(http_test)-1, http_test);
+}
+
+void rhTest(struct picohttpRequest *req)
+{
+	char const http_test[] = "handling request /test";
+	picohttpResponseWrite(req, sizeof(http_test)-1, http_test);
+	if(req->urltail) {
+		picohttpResponseWrite(req, strlen(req->urltail), req->urltail);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned short const port = (1 < argc) ? atoi(argv[1]) : 8000;
+	unsigned const workers = (2 < argc) ? atoi(argv[2]) : 0;
+
+	int const sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if( -1 == sockfd ) {
+		perror("socket");
+		return -1;
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	int const one = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if( -1 == bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) ) {
+		perror("bind");
+		return -1;
+	}
+	if( -1 == listen(sockfd, SOMAXCONN) ) {
+		perror("listen");
+		return -1;
+	}
+
+	static struct picohttpURLRoute const routes[] = {
+		{ "/test", 0, rhTest, 16, PICOHTTP_METHOD_GET },
+		{ "/|", 0, rhRoot, 0, PICOHTTP_METHOD_GET },
+		{ NULL, 0, 0, 0, 0 }
+	};
+
+	struct picohttpEvLoopConfig const config = {
+		.listenfd = sockfd,
+		.routes = routes,
+		.workers = workers,
+		.deadlines = {
+			.header_ms = 10000,
+			.body_ms = 60000,
+			.idle_ms = 5000,
+		},
+	};
+	loop = picohttpEvLoopCreate(&config);
+	if( !loop ) {
+		fputs("picohttpEvLoopCreate failed\n", stderr);
+		return -1;
+	}
+
+	signal(SIGINT, onsignal);
+	signal(SIGTERM, onsignal);
+
+	int const ret = picohttpEvLoopRun(loop);
+
+	struct picohttpEvLoopStats stats;
+	picohttpEvLoopStats(loop, &stats);
+	fprintf(stderr,
+		"served %llu, %llu expired, %zu connections open (%zu mid request)\n",
+		(unsigned long long)stats.served,
+		(unsigned long long)stats.expired,
+		stats.connections,
+		stats.parsing);
+
+	picohttpEvLoopDestroy(loop);
+	close(sockfd);
+	return ret;
+}
@@ -0,0 +1,110 @@
+#!/bin/sh
+#
+# Footprint matrix: compiles the library under each feature
+# configuration and reports the size of its sections and the largest
+# stack frames (-fstack-usage). With a budget file, fails if a
+# configuration exceeds its budget.
+#
+# usage: footprint.sh [budgetfile]
+#
+# CC and FOOTPRINT_CFLAGS select the compiler and flags, e.g. for a
+# cross compiler. Budgets only hold for the compiler and flags they were
+# taken with; keep a budget file per target. Per function stack usage
+# ends up in footprint/<configuration>.su.
+
+CC=${CC:-cc}
+FOOTPRINT_CFLAGS=${FOOTPRINT_CFLAGS:--Os}
+BUDGET=$1
+OUT=footprint
+SRC=..
+
+# name and flags of each configuration
+CONFIGS='
+default
+no_digest       -DPICOHTTP_NO_DIGEST_AUTH=1
+no_authcache    -DPICOHTTP_NO_AUTHCACHE=1
+minimal         -DPICOHTTP_NO_DIGEST_AUTH=1 -DPICOHTTP_NO_AUTHCACHE=1 -DPICOHTTP_NO_BODYTOFD=1
+c99vararray     -DPICOWEB_CONFIG_USE_C99VARARRAY
+snprintf        -DPICOHTTP_CONFIG_USE_SNPRINTF
+libdjb          -DPICOHTTP_CONFIG_HAVE_LIBDJB
+'
+
+# sources a configuration needs; hashes are only there for the
+# authentication features
+sources()
+{
+	s="picohttp.c picohttp_base64.c"
+	case "$1" in *NO_DIGEST_AUTH*) ;; *)
+		s="$s picohttp_digest.c picohttp_md5.c picohttp_sha256.c" ;;
+	esac
+	case "$1" in *NO_AUTHCACHE*) ;; *)
+		s="$s picohttp_authcache.c"
+		case "$s" in *sha256*) ;; *) s="$s picohttp_sha256.c" ;; esac ;;
+	esac
+	echo "$s"
+}
+
+mkdir -p $OUT || exit 1
+rm -f $OUT/over
+printf '%-14s %8s %8s %8s %8s %10s  %s\n' \
+	configuration text rodata data bss max_stack function
+status=0
+
+echo "$CONFIGS" | while read -r name flags; do
+	[ -n "$name" ] || continue
+	dir=$OUT/$name
+	rm -rf $dir && mkdir -p $dir || exit 1
+
+	failed=
+	for s in $(sources "$flags"); do
+		if ! $CC -std=c99 $FOOTPRINT_CFLAGS -I$SRC $flags -fstack-usage \
+			-c $SRC/$s -o $dir/${s%.c}.o 2>$dir/${s%.c}.log; then
+			failed=$s
+			break
+		fi
+	done
+	if [ -n "$failed" ]; then
+		printf '%-14s skipped, %s does not build (see %s)\n' \
+			$name $failed $dir/${failed%.c}.log
+		continue
+	fi
+
+	# sizes summed by section kind over all objects
+	sizes=$(size -A $dir/*.o | awk '
+		$1 ~ /^\.text/   { t += $2 }
+		$1 ~ /^\.rodata/ { r += $2 }
+		$1 ~ /^\.data/   { d += $2 }
+		$1 ~ /^\.bss/    { b += $2 }
+		END { print t+0, r+0, d+0, b+0 }')
+	cat $dir/*.su | sort -t'	' -k2 -n -r > $OUT/$name.su
+	top=$(head -n 1 $OUT/$name.su)
+	stack=$(echo "$top" | cut -f2)
+	func=$(echo "$top" | cut -f1 | sed 's/.*://')
+
+	set -- $sizes
+	printf '%-14s %8s %8s %8s %8s %10s  %s\n' \
+		$name $1 $2 $3 $4 $stack "$func"
+
+	[ -n "$BUDGET" ] || continue
+	budget=$(awk -v n=$name '$1 == n { print $2, $3, $4, $5, $6 }' $BUDGET)
+	if [ -z "$budget" ]; then
+		echo "$name: no budget" >&2
+		continue
+	fi
+	echo "$budget" | {
+		read bt br bd bb bs
+		over=
+		[ $1 -le $bt ] || over="$over text $1>$bt"
+		[ $2 -le $br ] || over="$over rodata $2>$br"
+		[ $3 -le $bd ] || over="$over data $3>$bd"
+		[ $4 -le $bb ] || over="$over bss $4>$bb"
+		[ $stack -le $bs ] || over="$over stack $stack>$bs"
+		if [ -n "$over" ]; then
+			echo "$name: over budget:$over" >&2
+			echo $name >> $OUT/over
+		fi
+	}
+done || status=1
+[ ! -s $OUT/over ] || status=1
+
+exit $status
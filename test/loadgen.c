@@ -0,0 +1,931 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* HTTP load generator for the server harnesses in this directory.
+ *
+ * Closed loop (default): every connection keeps its pipeline full,
+ * issuing the next request as soon as a response is in.
+ * Open loop (-r): requests are due at a fixed rate no matter how the
+ * server keeps up; requests that find no free connection queue up.
+ *
+ * Latency is taken from the time a request was due, so in open loop
+ * mode time spent queued counts. Closed loop runs can't know when a
+ * request would have been due had the server not stalled; there the
+ * histogram is corrected for coordinated omission after the run, the
+ * way HdrHistogram does, taking the median as the expected interval
+ * between requests.
+ *
+ * The result is printed as one JSON line. With -B it is compared to a
+ * baseline recorded earlier (-o); a throughput or p99 latency worse by
+ * more than the threshold makes the exit status 2. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define LOADGEN_PIPELINE_MAX 64
+#define LOADGEN_RETRIES_MAX  3
+#define LOADGEN_HEAD_MAX     4096
+#define LOADGEN_DRAIN_NS     2000000000ull
+
+/* log-linear histogram: values below 2^LOADGEN_HIST_SUB_BITS ns are
+ * exact, above that each power of two is split into as many linear
+ * buckets, for a relative error below 1/64 */
+#define LOADGEN_HIST_SUB_BITS 6
+#define LOADGEN_HIST_SUB      (1u << LOADGEN_HIST_SUB_BITS)
+#define LOADGEN_HIST_EXP_MAX  42 /* about 73 minutes */
+#define LOADGEN_HIST_BUCKETS \
+	((LOADGEN_HIST_EXP_MAX - LOADGEN_HIST_SUB_BITS + 1) * LOADGEN_HIST_SUB)
+
+struct loadgenHist {
+	uint64_t n;
+	uint64_t max;
+	uint64_t count[LOADGEN_HIST_BUCKETS];
+};
+
+static unsigned loadgen_hist_index(uint64_t v)
+{
+	if( v < LOADGEN_HIST_SUB ) {
+		return v;
+	}
+	unsigned const e = 63 - __builtin_clzll(v);
+	if( e > LOADGEN_HIST_EXP_MAX ) {
+		return LOADGEN_HIST_BUCKETS - 1;
+	}
+	unsigned const sub = (v >> (e - LOADGEN_HIST_SUB_BITS))
+		& (LOADGEN_HIST_SUB - 1);
+	return (e - LOADGEN_HIST_SUB_BITS + 1) * LOADGEN_HIST_SUB + sub;
+}
+
+/* lowest value falling into bucket i */
+static uint64_t loadgen_hist_value(unsigned i)
+{
+	if( i < LOADGEN_HIST_SUB ) {
+		return i;
+	}
+	unsigned const e = i / LOADGEN_HIST_SUB + LOADGEN_HIST_SUB_BITS - 1;
+	uint64_t const sub = i % LOADGEN_HIST_SUB;
+	return (LOADGEN_HIST_SUB | sub) << (e - LOADGEN_HIST_SUB_BITS);
+}
+
+static void loadgen_hist_add(
+	struct loadgenHist * const h,
+	uint64_t v,
+	uint64_t count )
+{
+	h->count[loadgen_hist_index(v)] += count;
+	h->n += count;
+	if( v > h->max ) {
+		h->max = v;
+	}
+}
+
+static uint64_t loadgen_hist_percentile(
+	struct loadgenHist const * const h,
+	double pct )
+{
+	if( !h->n ) {
+		return 0;
+	}
+	uint64_t const rank = (uint64_t)(pct / 100. * (h->n - 1)) + 1;
+	uint64_t seen = 0;
+	for(unsigned i = 0; i < LOADGEN_HIST_BUCKETS; i++) {
+		seen += h->count[i];
+		if( seen >= rank ) {
+			/* report the upper end of the bucket */
+			uint64_t const v = (i + 1 < LOADGEN_HIST_BUCKETS) ?
+				loadgen_hist_value(i + 1) - 1 : h->max;
+			return (v < h->max) ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+/* Fills in the samples a stalled closed loop never took: a response
+ * that took k expected intervals held back k-1 requests, which would
+ * have seen latencies one, two, ... intervals shorter. */
+static void loadgen_hist_correct(
+	struct loadgenHist * const dst,
+	struct loadgenHist const * const src,
+	uint64_t interval )
+{
+	*dst = *src;
+	if( !interval ) {
+		return;
+	}
+	for(unsigned i = 0; i < LOADGEN_HIST_BUCKETS; i++) {
+		if( !src->count[i] ) {
+			continue;
+		}
+		uint64_t const v = loadgen_hist_value(i);
+		for(uint64_t missing = v; missing > interval; ) {
+			missing -= interval;
+			loadgen_hist_add(dst, missing, src->count[i]);
+		}
+	}
+}
+
+static uint64_t loadgen_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* configuration */
+
+struct loadgenRequest {
+	char *text;
+	size_t len;
+	unsigned weight;
+};
+
+struct loadgenConfig {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	unsigned connections;
+	unsigned threads;
+	double duration;
+	double warmup;
+	double rate;          /* requests per second; 0: closed loop */
+	bool keepalive;
+	unsigned pipeline;
+	struct loadgenRequest *requests;
+	size_t nrequests;
+	unsigned total_weight;
+	uint64_t t_start;     /* requests due from here on count */
+	uint64_t t_end;       /* no requests are issued after this */
+};
+
+/* connections */
+
+struct loadgenConn {
+	int fd;
+	bool connecting;
+	unsigned retries;
+
+	/* requests sent or to be sent, oldest first */
+	unsigned head;
+	unsigned count;
+	uint64_t due[LOADGEN_PIPELINE_MAX];
+	unsigned req[LOADGEN_PIPELINE_MAX];
+
+	char *out;
+	size_t out_len;
+	size_t out_pos;
+	size_t out_cap;
+
+	/* response being received */
+	char head_buf[LOADGEN_HEAD_MAX];
+	size_t head_len;
+	bool in_body;
+	bool body_to_eof;
+	uint64_t body_left;
+	int status;
+};
+
+struct loadgenThread {
+	struct loadgenConfig const *cfg;
+	pthread_t thread;
+	unsigned nconns;
+	struct loadgenConn *conns;
+	int epfd;
+	uint32_t rng;
+	double rate;
+	unsigned next_conn;
+
+	/* open loop: due times of requests waiting for a connection */
+	uint64_t *backlog;
+	size_t backlog_mask;
+	size_t backlog_head;
+	size_t backlog_tail;
+	uint64_t next_due;
+
+	struct loadgenHist hist;
+	uint64_t completed;
+	uint64_t incomplete;
+	uint64_t errors;
+	uint64_t reconnects;
+	uint64_t status[6]; /* by class; [0] unparseable */
+};
+
+static void loadgen_out_append(
+	struct loadgenConn * const c,
+	char const *s,
+	size_t n )
+{
+	if( c->out_len + n > c->out_cap ) {
+		c->out_cap = 2 * (c->out_len + n);
+		c->out = realloc(c->out, c->out_cap);
+		if( !c->out ) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(c->out + c->out_len, s, n);
+	c->out_len += n;
+}
+
+static void loadgen_epoll(
+	struct loadgenThread * const th,
+	struct loadgenConn * const c,
+	int op )
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN
+			| ((c->connecting || c->out_pos < c->out_len) ? EPOLLOUT : 0),
+		.data.ptr = c
+	};
+	epoll_ctl(th->epfd, op, c->fd, &ev);
+}
+
+static void loadgen_conn_close(
+	struct loadgenThread * const th,
+	struct loadgenConn * const c )
+{
+	if( 0 <= c->fd ) {
+		epoll_ctl(th->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+		close(c->fd);
+		c->fd = -1;
+	}
+	c->connecting = false;
+	c->out_len = c->out_pos = 0;
+	c->head_len = 0;
+	c->in_body = false;
+}
+
+/* (Re)connects and queues all outstanding requests for sending */
+static void loadgen_conn_open(
+	struct loadgenThread * const th,
+	struct loadgenConn * const c )
+{
+	struct loadgenConfig const * const cfg = th->cfg;
+
+	c->fd = socket(cfg->addr.ss_family,
+		SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if( 0 > c->fd ) {
+		perror("socket");
+		exit(1);
+	}
+	int const one = 1;
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	c->connecting = true;
+	if( connect(c->fd, (struct sockaddr const*)&cfg->addr, cfg->addrlen)
+	 && EINPROGRESS != errno ) {
+		c->connecting = false;
+	}
+	for(unsigned i = 0; i < c->count; i++) {
+		struct loadgenRequest const * const r = cfg->requests
+			+ c->req[(c->head + i) % LOADGEN_PIPELINE_MAX];
+		loadgen_out_append(c, r->text, r->len);
+	}
+	loadgen_epoll(th, c, EPOLL_CTL_ADD);
+}
+
+static void loadgen_conn_issue(
+	struct loadgenThread * const th,
+	struct loadgenConn * const c,
+	uint64_t due )
+{
+	struct loadgenConfig const * const cfg = th->cfg;
+
+	/* xorshift32 for the request mix */
+	th->rng ^= th->rng << 13;
+	th->rng ^= th->rng >> 17;
+	th->rng ^= th->rng << 5;
+	unsigned pick = th->rng % cfg->total_weight;
+	unsigned r = 0;
+	while( pick >= cfg->requests[r].weight ) {
+		pick -= cfg->requests[r].weight;
+		r++;
+	}
+
+	unsigned const slot = (c->head + c->count) % LOADGEN_PIPELINE_MAX;
+	c->due[slot] = due;
+	c->req[slot] = r;
+	c->count++;
+
+	if( 0 > c->fd ) {
+		loadgen_conn_open(th, c);
+		return;
+	}
+	bool const idle = c->out_pos >= c->out_len;
+	loadgen_out_append(c, cfg->requests[r].text, cfg->requests[r].len);
+	if( idle && !c->connecting ) {
+		loadgen_epoll(th, c, EPOLL_CTL_MOD);
+	}
+}
+
+static unsigned loadgen_conn_capacity(
+	struct loadgenThread const * const th,
+	struct loadgenConn const * const c )
+{
+	/* without keep-alive every request gets a connection of its own */
+	unsigned const depth = th->cfg->keepalive ? th->cfg->pipeline : 1;
+	return depth - c->count;
+}
+
+static void loadgen_response_done(
+	struct loadgenThread * const th,
+	struct loadgenConn * const c,
+	uint64_t now )
+{
+	if( !c->count ) {
+		/* unsolicited response */
+		th->errors++;
+		return;
+	}
+	uint64_t const due = c->due[c->head];
+	if( due >= th->cfg->t_start ) {
+		int const cls = (100 <= c->status && 600 > c->status) ?
+			c->status / 100 : 0;
+		th->status[cls]++;
+		if( 2 == cls || 3 == cls ) {
+			loadgen_hist_add(&th->hist, now - due, 1);
+			th->completed++;
+		} else {
+			th->errors++;
+		}
+	}
+	c->head = (c->head + 1) % LOADGEN_PIPELINE_MAX;
+	c->count--;
+	c->retries = 0;
+	c->head_len = 0;
+	c->in_body = false;
+}
+
+/* Parses the response head collected so far; false if incomplete */
+static bool loadgen_response_head(
+	struct loadgenConn * const c,
+	size_t * const body_start )
+{
+	for(size_t i = 3; i < c->head_len; i++) {
+		if( '\n' == c->head_buf[i] && '\r' == c->head_buf[i-1]
+		 && '\n' == c->head_buf[i-2] && '\r' == c->head_buf[i-3] ) {
+			*body_start = i + 1;
+			c->head_buf[i] = 0;
+
+			c->status = 0;
+			char const *sp = memchr(c->head_buf, ' ', 12);
+			if( !strncmp(c->head_buf, "HTTP/", 5) && sp ) {
+				c->status = atoi(sp + 1);
+			}
+			c->body_to_eof = true;
+			c->body_left = 0;
+			for(char const *l = strchr(c->head_buf, '\n');
+			    l; l = strchr(l + 1, '\n')) {
+				if( !strncasecmp(l + 1, "Content-Length:", 15) ) {
+					c->body_left = strtoull(l + 16, NULL, 10);
+					c->body_to_eof = false;
+				}
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+static void loadgen_conn_data(
+	struct loadgenThread * const th,
+	struct loadgenConn * const c,
+	char const *buf,
+	size_t n,
+	uint64_t now )
+{
+	while( n ) {
+		if( !c->in_body ) {
+			size_t const old = c->head_len;
+			size_t take = sizeof(c->head_buf) - 1 - c->head_len;
+			if( take > n )
+				take = n;
+			memcpy(c->head_buf + c->head_len, buf, take);
+			c->head_len += take;
+
+			size_t body_start;
+			if( !loadgen_response_head(c, &body_start) ) {
+				if( c->head_len >= sizeof(c->head_buf) - 1 ) {
+					/* head too large; treat as broken */
+					c->status = 0;
+					c->in_body = true;
+					c->body_to_eof = true;
+				}
+				return;
+			}
+			c->in_body = true;
+			buf += body_start - old;
+			n -= body_start - old;
+		}
+		if( c->body_to_eof ) {
+			return;
+		}
+		size_t const take = (n < c->body_left) ? n : c->body_left;
+		c->body_left -= take;
+		buf += take;
+		n -= take;
+		if( !c->body_left ) {
+			loadgen_response_done(th, c, now);
+		}
+	}
+}
+
+static void loadgen_conn_eof(
+	struct loadgenThread * const th,
+	struct loadgenConn * const c,
+	bool failed,
+	uint64_t now )
+{
+	if( !failed && c->in_body && c->body_to_eof ) {
+		loadgen_response_done(th, c, now);
+	}
+	loadgen_conn_close(th, c);
+	if( !c->count ) {
+		return;
+	}
+	/* the server went away with requests still pending; they're sent
+	 * again on a fresh connection */
+	if( ++c->retries > LOADGEN_RETRIES_MAX ) {
+		th->errors += c->count;
+		c->count = 0;
+		c->retries = 0;
+		return;
+	}
+	th->reconnects++;
+	loadgen_conn_open(th, c);
+}
+
+static void loadgen_conn_event(
+	struct loadgenThread * const th,
+	struct loadgenConn * const c,
+	uint32_t events,
+	uint64_t now )
+{
+	if( c->connecting ) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		if( err ) {
+			loadgen_conn_eof(th, c, true, now);
+			return;
+		}
+		if( !(events & (EPOLLOUT | EPOLLIN)) ) {
+			return;
+		}
+		c->connecting = false;
+	}
+
+	while( c->out_pos < c->out_len ) {
+		ssize_t const w = send(c->fd, c->out + c->out_pos,
+			c->out_len - c->out_pos, MSG_NOSIGNAL);
+		if( 0 > w ) {
+			if( EAGAIN == errno || EWOULDBLOCK == errno ) {
+				break;
+			}
+			loadgen_conn_eof(th, c, true, now);
+			return;
+		}
+		c->out_pos += w;
+	}
+	if( c->out_pos >= c->out_len ) {
+		c->out_pos = c->out_len = 0;
+	}
+	loadgen_epoll(th, c, EPOLL_CTL_MOD);
+
+	if( !(events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ) {
+		return;
+	}
+	for(;;) {
+		char buf[16384];
+		ssize_t const r = recv(c->fd, buf, sizeof(buf), 0);
+		if( 0 > r ) {
+			if( EAGAIN == errno || EWOULDBLOCK == errno ) {
+				break;
+			}
+			loadgen_conn_eof(th, c, true, now);
+			return;
+		}
+		if( !r ) {
+			loadgen_conn_eof(th, c, false, now);
+			return;
+		}
+		loadgen_conn_data(th, c, buf, r, now);
+	}
+
+	if( !th->cfg->keepalive && !c->count ) {
+		/* done with this connection even if the server isn't yet */
+		loadgen_conn_close(th, c);
+	}
+}
+
+/* open loop scheduling */
+
+static void loadgen_backlog_push(
+	struct loadgenThread * const th,
+	uint64_t due )
+{
+	if( th->backlog_tail - th->backlog_head > th->backlog_mask ) {
+		size_t const len = 2 * (th->backlog_mask + 1);
+		uint64_t * const b = malloc(len * sizeof(*b));
+		if( !b ) {
+			perror("malloc");
+			exit(1);
+		}
+		size_t n = 0;
+		for(size_t i = th->backlog_head; i != th->backlog_tail; i++) {
+			b[n++] = th->backlog[i & th->backlog_mask];
+		}
+		free(th->backlog);
+		th->backlog = b;
+		th->backlog_mask = len - 1;
+		th->backlog_head = 0;
+		th->backlog_tail = n;
+	}
+	th->backlog[th->backlog_tail++ & th->backlog_mask] = due;
+}
+
+static void loadgen_dispatch(
+	struct loadgenThread * const th,
+	uint64_t now )
+{
+	struct loadgenConfig const * const cfg = th->cfg;
+
+	if( th->rate ) {
+		uint64_t const period = 1e9 / th->rate;
+		while( th->next_due <= now && th->next_due < cfg->t_end ) {
+			loadgen_backlog_push(th, th->next_due);
+			th->next_due += period;
+		}
+		for(unsigned i = 0;
+		    i < th->nconns && th->backlog_head != th->backlog_tail; i++) {
+			struct loadgenConn * const c =
+				th->conns + (th->next_conn + i) % th->nconns;
+			for(unsigned n = loadgen_conn_capacity(th, c);
+			    n && th->backlog_head != th->backlog_tail; n--) {
+				loadgen_conn_issue(th, c,
+					th->backlog[th->backlog_head++ & th->backlog_mask]);
+			}
+		}
+		th->next_conn = (th->next_conn + 1) % th->nconns;
+		return;
+	}
+
+	if( now >= cfg->t_end ) {
+		return;
+	}
+	for(unsigned i = 0; i < th->nconns; i++) {
+		struct loadgenConn * const c = th->conns + i;
+		for(unsigned n = loadgen_conn_capacity(th, c); n; n--) {
+			loadgen_conn_issue(th, c, now);
+		}
+	}
+}
+
+static void *loadgen_thread_main(void *arg)
+{
+	struct loadgenThread * const th = arg;
+	struct loadgenConfig const * const cfg = th->cfg;
+
+	th->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if( 0 > th->epfd ) {
+		perror("epoll_create1");
+		exit(1);
+	}
+	th->conns = calloc(th->nconns, sizeof(*th->conns));
+	th->backlog_mask = 1023;
+	th->backlog = malloc((th->backlog_mask + 1) * sizeof(*th->backlog));
+	if( !th->conns || !th->backlog ) {
+		perror("malloc");
+		exit(1);
+	}
+	for(unsigned i = 0; i < th->nconns; i++) {
+		th->conns[i].fd = -1;
+	}
+
+	uint64_t const t_begin = loadgen_ns();
+	th->next_due = t_begin;
+	uint64_t const t_stop = cfg->t_end + LOADGEN_DRAIN_NS;
+
+	for(;;) {
+		uint64_t now = loadgen_ns();
+		loadgen_dispatch(th, now);
+
+		unsigned pending = th->backlog_tail - th->backlog_head;
+		for(unsigned i = 0; i < th->nconns; i++) {
+			pending += th->conns[i].count;
+		}
+		if( now >= t_stop || (now >= cfg->t_end && !pending) ) {
+			break;
+		}
+
+		int timeout = 10;
+		if( th->rate && th->next_due < cfg->t_end ) {
+			uint64_t const wait = (th->next_due > now) ?
+				th->next_due - now : 0;
+			timeout = (wait + 999999) / 1000000;
+		}
+		struct epoll_event ev[64];
+		int const n = epoll_wait(th->epfd, ev, 64, timeout);
+		now = loadgen_ns();
+		for(int i = 0; i < n; i++) {
+			loadgen_conn_event(th, ev[i].data.ptr, ev[i].events, now);
+		}
+	}
+
+	/* whatever didn't complete took at least until now */
+	uint64_t const now = loadgen_ns();
+	for(unsigned i = 0; i < th->nconns; i++) {
+		struct loadgenConn * const c = th->conns + i;
+		for(unsigned j = 0; j < c->count; j++) {
+			uint64_t const due = c->due[(c->head + j) % LOADGEN_PIPELINE_MAX];
+			if( due >= cfg->t_start ) {
+				loadgen_hist_add(&th->hist, now - due, 1);
+				th->incomplete++;
+			}
+		}
+		loadgen_conn_close(th, c);
+		free(c->out);
+	}
+	for(size_t i = th->backlog_head; i != th->backlog_tail; i++) {
+		uint64_t const due = th->backlog[i & th->backlog_mask];
+		if( due >= cfg->t_start ) {
+			loadgen_hist_add(&th->hist, now - due, 1);
+			th->incomplete++;
+		}
+	}
+	free(th->backlog);
+	free(th->conns);
+	close(th->epfd);
+	return NULL;
+}
+
+/* command line */
+
+static void loadgen_usage(char const *argv0)
+{
+	fprintf(stderr,
+"usage: %s [options]\n"
+"  -h host       server address (127.0.0.1)\n"
+"  -p port       server port (8000)\n"
+"  -c n          connections (16)\n"
+"  -t n          threads (1)\n"
+"  -d seconds    measuring time (5)\n"
+"  -w seconds    warmup not measured (1)\n"
+"  -r rate       open loop at rate requests/s; default closed loop\n"
+"  -k            keep connections alive\n"
+"  -P depth      pipeline depth with -k (1)\n"
+"  -u path[#w]   request path with weight w (1); repeat for a mix (/)\n"
+"  -o file       also write the result to file, e.g. as a baseline\n"
+"  -B file       compare to baseline file\n"
+"  -T percent    regression threshold for -B (10)\n",
+		argv0);
+}
+
+static double loadgen_json_number(char const *json, char const *key)
+{
+	char pat[64];
+	snprintf(pat, sizeof(pat), "\"%s\":", key);
+	char const * const p = strstr(json, pat);
+	return p ? strtod(p + strlen(pat), NULL) : -1.;
+}
+
+int main(int argc, char *argv[])
+{
+	struct loadgenConfig cfg = {
+		.connections = 16,
+		.threads = 1,
+		.duration = 5.,
+		.warmup = 1.,
+		.pipeline = 1,
+	};
+	char const *host = "127.0.0.1";
+	char const *port = "8000";
+	char const *outfile = NULL;
+	char const *basefile = NULL;
+	double threshold = 10.;
+	char const *paths[64];
+	size_t npaths = 0;
+
+	int opt;
+	while( -1 != (opt = getopt(argc, argv, "h:p:c:t:d:w:r:kP:u:o:B:T:")) ) {
+		switch( opt ) {
+		case 'h': host = optarg; break;
+		case 'p': port = optarg; break;
+		case 'c': cfg.connections = atoi(optarg); break;
+		case 't': cfg.threads = atoi(optarg); break;
+		case 'd': cfg.duration = atof(optarg); break;
+		case 'w': cfg.warmup = atof(optarg); break;
+		case 'r': cfg.rate = atof(optarg); break;
+		case 'k': cfg.keepalive = true; break;
+		case 'P': cfg.pipeline = atoi(optarg); break;
+		case 'u':
+			if( npaths < sizeof(paths)/sizeof(*paths) )
+				paths[npaths++] = optarg;
+			break;
+		case 'o': outfile = optarg; break;
+		case 'B': basefile = optarg; break;
+		case 'T': threshold = atof(optarg); break;
+		default:
+			loadgen_usage(argv[0]);
+			return 1;
+		}
+	}
+	if( !npaths ) {
+		paths[npaths++] = "/";
+	}
+	if( !cfg.connections || !cfg.threads || 0. >= cfg.duration
+	 || !cfg.pipeline || LOADGEN_PIPELINE_MAX < cfg.pipeline ) {
+		loadgen_usage(argv[0]);
+		return 1;
+	}
+	if( cfg.threads > cfg.connections ) {
+		cfg.threads = cfg.connections;
+	}
+
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+	};
+	struct addrinfo *ai;
+	int const gai = getaddrinfo(host, port, &hints, &ai);
+	if( gai ) {
+		fprintf(stderr, "%s: %s\n", host, gai_strerror(gai));
+		return 1;
+	}
+	memcpy(&cfg.addr, ai->ai_addr, ai->ai_addrlen);
+	cfg.addrlen = ai->ai_addrlen;
+	freeaddrinfo(ai);
+
+	cfg.requests = calloc(npaths, sizeof(*cfg.requests));
+	for(size_t i = 0; i < npaths; i++) {
+		char path[1024];
+		snprintf(path, sizeof(path), "%s", paths[i]);
+		unsigned weight = 1;
+		char * const w = strrchr(path, '#');
+		if( w ) {
+			*w = 0;
+			weight = atoi(w + 1);
+		}
+		char text[1400];
+		int const len = snprintf(text, sizeof(text),
+			"GET %s HTTP/1.1\r\n"
+			"Host: %s:%s\r\n"
+			"Connection: %s\r\n"
+			"\r\n",
+			path, host, port, cfg.keepalive ? "keep-alive" : "close");
+		cfg.requests[i].text = strdup(text);
+		cfg.requests[i].len = len;
+		cfg.requests[i].weight = weight;
+		cfg.total_weight += weight;
+	}
+	cfg.nrequests = npaths;
+	if( !cfg.total_weight ) {
+		loadgen_usage(argv[0]);
+		return 1;
+	}
+
+	uint64_t const t0 = loadgen_ns();
+	cfg.t_start = t0 + cfg.warmup * 1e9;
+	cfg.t_end = cfg.t_start + cfg.duration * 1e9;
+
+	struct loadgenThread * const threads =
+		calloc(cfg.threads, sizeof(*threads));
+	for(unsigned i = 0; i < cfg.threads; i++) {
+		struct loadgenThread * const th = threads + i;
+		th->cfg = &cfg;
+		th->nconns = cfg.connections / cfg.threads
+			+ (i < cfg.connections % cfg.threads);
+		th->rate = cfg.rate / cfg.threads;
+		th->rng = 2463534242u + i * 0x9e3779b9u;
+		if( pthread_create(&th->thread, NULL, loadgen_thread_main, th) ) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	static struct loadgenHist raw, corrected;
+	uint64_t completed = 0, incomplete = 0, errors = 0, reconnects = 0;
+	uint64_t status[6] = {0,};
+	for(unsigned i = 0; i < cfg.threads; i++) {
+		struct loadgenThread * const th = threads + i;
+		pthread_join(th->thread, NULL);
+		for(unsigned b = 0; b < LOADGEN_HIST_BUCKETS; b++) {
+			raw.count[b] += th->hist.count[b];
+		}
+		raw.n += th->hist.n;
+		if( th->hist.max > raw.max )
+			raw.max = th->hist.max;
+		completed += th->completed;
+		incomplete += th->incomplete;
+		errors += th->errors;
+		reconnects += th->reconnects;
+		for(unsigned s = 0; s < 6; s++)
+			status[s] += th->status[s];
+	}
+
+	/* open loop latencies already run from the due times */
+	loadgen_hist_correct(&corrected, &raw,
+		cfg.rate ? 0 : loadgen_hist_percentile(&raw, 50.));
+
+	char result[1024];
+	snprintf(result, sizeof(result),
+		"{\"loadgen\":\"picohttp\",\"mode\":\"%s\",\"connections\":%u,"
+		"\"threads\":%u,\"keepalive\":%d,\"pipeline\":%u,\"rate\":%.0f,"
+		"\"duration\":%.2f,\"requests\":%llu,\"incomplete\":%llu,"
+		"\"errors\":%llu,\"reconnects\":%llu,"
+		"\"status_2xx\":%llu,\"status_4xx\":%llu,\"status_5xx\":%llu,"
+		"\"rps\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,"
+		"\"max_us\":%.1f,\"p50_us_raw\":%.1f,\"p99_us_raw\":%.1f,"
+		"\"p999_us_raw\":%.1f}",
+		cfg.rate ? "open" : "closed", cfg.connections, cfg.threads,
+		cfg.keepalive, cfg.keepalive ? cfg.pipeline : 1, cfg.rate,
+		cfg.duration,
+		(unsigned long long)completed, (unsigned long long)incomplete,
+		(unsigned long long)errors, (unsigned long long)reconnects,
+		(unsigned long long)status[2], (unsigned long long)status[4],
+		(unsigned long long)status[5],
+		completed / cfg.duration,
+		loadgen_hist_percentile(&corrected, 50.) / 1e3,
+		loadgen_hist_percentile(&corrected, 99.) / 1e3,
+		loadgen_hist_percentile(&corrected, 99.9) / 1e3,
+		corrected.max / 1e3,
+		loadgen_hist_percentile(&raw, 50.) / 1e3,
+		loadgen_hist_percentile(&raw, 99.) / 1e3,
+		loadgen_hist_percentile(&raw, 99.9) / 1e3);
+	puts(result);
+
+	if( outfile ) {
+		FILE * const f = fopen(outfile, "w");
+		if( !f ) {
+			perror(outfile);
+			return 1;
+		}
+		fprintf(f, "%s\n", result);
+		fclose(f);
+	}
+
+	int ret = 0;
+	if( !completed || errors > completed / 100 ) {
+		fprintf(stderr, "loadgen: %llu requests, %llu errors\n",
+			(unsigned long long)completed, (unsigned long long)errors);
+		ret = 1;
+	}
+	if( basefile ) {
+		char base[1024] = {0,};
+		FILE * const f = fopen(basefile, "r");
+		if( !f || !fgets(base, sizeof(base), f) ) {
+			perror(basefile);
+			return 1;
+		}
+		fclose(f);
+
+		double const base_rps = loadgen_json_number(base, "rps");
+		double const base_p99 = loadgen_json_number(base, "p99_us");
+		double const rps = loadgen_json_number(result, "rps");
+		double const p99 = loadgen_json_number(result, "p99_us");
+		double const drps = 100. * (rps - base_rps) / base_rps;
+		double const dp99 = 100. * (p99 - base_p99) / base_p99;
+		fprintf(stderr, "loadgen: rps %.1f (%+.1f%%), p99 %.1f us (%+.1f%%)"
+			" against %s\n", rps, drps, p99, dp99, basefile);
+		if( -threshold > drps || threshold < dp99 ) {
+			fprintf(stderr, "loadgen: regression beyond %.1f%%\n", threshold);
+			ret = 2;
+		}
+	}
+	return ret;
+}
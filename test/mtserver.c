@@ -0,0 +1,223 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../picohttp.h"
+#include "../picohttp_server.h"
+#include "../picohttp_metrics.h"
+#include "../picohttp_trace.h"
+
+static struct picohttpServer *server;
+
+static void onsignal(int sig)
+{
+	(void)sig;
+	picohttpServerStop(server);
+}
+
+/* SIGUSR1 toggles tracing; the events are dumped on exit */
+static volatile sig_atomic_t tracing;
+
+static void ontracesignal(int sig)
+{
+	(void)sig;
+	tracing = !tracing;
+	picohttpTraceSetMask(tracing ? PICOHTTP_TRACE_CLASS_ALL : 0);
+}
+
+void rhRoot(struct picohttpRequest *req)
+{
+	char const http_test[] =
+"<html><head><title>picoweb</title></head><body>\n"
+"<a href=\"/test\">/test</a>\n"
+"</body></html>\n";
+
+	req->response.contenttype = "text/html";
+	req->response.contentlength = sizeof(http_test)-1;
+	picohttpResponseWrite(req, sizeof(http_test)-1, http_test);
+}
+
+void rhTest(struct picohttpRequest *req)
+{
+	char const http_test[] = "handling request /test";
+	picohttpResponseWrite(req, sizeof(http_test)-1, http_test);
+	if(req->urltail) {
+		picohttpResponseWrite(req, strlen(req->urltail), req->urltail);
+	}
+	/* declared in the route, which the metrics wrap */
+	char const * const useragent = picohttpRequestHeader(req, "User-Agent");
+	if( useragent ) {
+		char const from[] = " from ";
+		picohttpResponseWrite(req, sizeof(from)-1, from);
+		picohttpResponseWrite(req, strlen(useragent), useragent);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned short const port = (1 < argc) ? atoi(argv[1]) : 8000;
+	unsigned const workers = (2 < argc) ? atoi(argv[2]) : 0;
+	/* connections a second per client, 0 for no limit */
+	unsigned const rate = (3 < argc) ? atoi(argv[3]) : 0;
+
+	int const sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if( -1 == sockfd ) {
+		perror("socket");
+		return -1;
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	int const one = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if( -1 == bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) ) {
+		perror("bind");
+		return -1;
+	}
+	if( -1 == listen(sockfd, SOMAXCONN) ) {
+		perror("listen");
+		return -1;
+	}
+
+	static char const * const test_headers[] = { "User-Agent", NULL };
+	static struct picohttpURLRoute const routes[] = {
+		{ "/test", 0, rhTest, 16, PICOHTTP_METHOD_GET,
+		  0, NULL, test_headers },
+		{ "/metrics|", 0, picohttpMetricsHandler, 0, PICOHTTP_METHOD_GET },
+		{ "/|", 0, rhRoot, 0, PICOHTTP_METHOD_GET },
+		{ NULL, 0, 0, 0, 0 }
+	};
+
+	static struct picohttpIoStatsTotals iostats;
+
+	long const ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	struct picohttpMetrics * const metrics = picohttpMetricsCreate(routes,
+		workers ? workers : (0 < ncpu) ? (unsigned)ncpu : 1);
+	if( !metrics ) {
+		fputs("picohttpMetricsCreate failed\n", stderr);
+		return -1;
+	}
+
+	struct picohttpRateLimit * const ratelimit = rate ?
+		picohttpRateLimitCreate(4096, rate, rate) : NULL;
+	if( rate && !ratelimit ) {
+		fputs("picohttpRateLimitCreate failed\n", stderr);
+		return -1;
+	}
+
+	struct picohttpServerConfig const config = {
+		.listenfd = sockfd,
+		.workers = workers,
+		.queue_len = 256,
+		.routes = routes,
+		.metrics = metrics,
+		.iostats = &iostats,
+		.deadlines = {
+			.header_ms = 10000,
+			.body_ms = 60000,
+			.idle_ms = 5000,
+		},
+		.shed_target_usec = 5000,
+		.shed_interval_usec = 100000,
+		.shed_retry_after = 1,
+		.ratelimit = ratelimit,
+	};
+	server = picohttpServerCreate(&config);
+	if( !server ) {
+		fputs("picohttpServerCreate failed\n", stderr);
+		return -1;
+	}
+
+	signal(SIGINT, onsignal);
+	signal(SIGTERM, onsignal);
+	signal(SIGUSR1, ontracesignal);
+
+	int const ret = picohttpServerRun(server);
+
+	for(unsigned i = 0; i < picohttpServerWorkers(server); i++) {
+		struct picohttpServerWorkerStats stats;
+		picohttpServerWorkerStats(server, i, &stats);
+		fprintf(stderr,
+			"worker %2u: queued %8llu served %8llu stolen %8llu "
+			"shed %8llu busy %10llu us\n", i,
+			(unsigned long long)stats.queued,
+			(unsigned long long)stats.served,
+			(unsigned long long)stats.stolen,
+			(unsigned long long)stats.shed,
+			(unsigned long long)stats.busy_usec);
+	}
+
+	if( ratelimit ) {
+		struct picohttpRateLimitStats rls;
+		picohttpRateLimitStats(ratelimit, &rls);
+		fprintf(stderr, "rate limit: allowed %llu limited %llu evicted %llu\n",
+			(unsigned long long)rls.allowed,
+			(unsigned long long)rls.limited,
+			(unsigned long long)rls.evicted);
+	}
+
+	static char const * const phases[PICOHTTP_IO_PHASES] = {
+		"request head", "request body", "response head", "response body"
+	};
+	static char const * const ops[PICOHTTP_IO_OPS] = {
+		"read", "write", "getch", "putch", "flush"
+	};
+	fprintf(stderr, "%llu requests, at most %llu I/O calls each\n",
+		(unsigned long long)iostats.requests,
+		(unsigned long long)iostats.max_calls);
+	for(unsigned p = 0; iostats.requests && p < PICOHTTP_IO_PHASES; p++) {
+		for(unsigned op = 0; op < PICOHTTP_IO_OPS; op++) {
+			uint64_t const calls = iostats.phase[p].calls[op];
+			if( !calls )
+				continue;
+			fprintf(stderr, "%-13s %-5s %8.2f calls/req %8.1f bytes/call\n",
+				phases[p], ops[op],
+				(double)calls / iostats.requests,
+				(double)iostats.phase[p].bytes[op] / calls);
+		}
+	}
+
+	picohttpTraceDump(STDERR_FILENO);
+
+	picohttpServerDestroy(server);
+	picohttpMetricsDestroy(metrics);
+	picohttpRateLimitDestroy(ratelimit);
+	close(sockfd);
+	return ret;
+}
@@ -0,0 +1,119 @@
+/*
+    picoweb / litheweb -- a web server and application framework
+                          for resource constraint systems.
+
+    Copyright (C) 2012 - 2014 Wolfgang Draxinger
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+
+
+
+/* Rate limit check.
+ *
+ * Runs peers of each address family through picohttpRateLimitCheck
+ * with a burst of 2 and no refill, and checks which of them share a
+ * bucket: an IPv4 peer with the same one seen through a dual stack
+ * socket (IPv4-mapped and -compatible), IPv6 peers with others in
+ * their /64, and that AF_UNIX peers are not limited at all. One JSON
+ * line per step goes to stdout; the exit status is 1 if a check
+ * failed. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../picohttp_ratelimit.h"
+
+struct checkStep {
+	char const *name;
+	int family;
+	char const *addr; /* as inet_pton takes it; a path for AF_UNIX */
+	int result;       /* of picohttpRateLimitCheck */
+};
+
+static struct checkStep const check_steps[] = {
+	{ "v4_first",           AF_INET,  "192.0.2.1", 0 },
+	{ "v4_second",          AF_INET,  "192.0.2.1", 0 },
+	{ "v4_limited",         AF_INET,  "192.0.2.1", -1 },
+	{ "v4_mapped",          AF_INET6, "::ffff:192.0.2.1", -1 },
+	{ "v4_compat",          AF_INET6, "::192.0.2.1", -1 },
+	{ "v4_mapped_other",    AF_INET6, "::ffff:192.0.2.2", 0 },
+	{ "v4_other_mapped",    AF_INET,  "192.0.2.2", 0 },
+	{ "v4_other_limited",   AF_INET6, "::ffff:192.0.2.2", -1 },
+	{ "v6_first",           AF_INET6, "2001:db8::1", 0 },
+	{ "v6_same_64",         AF_INET6, "2001:db8::2", 0 },
+	{ "v6_same_64_limited", AF_INET6, "2001:db8::ffff:1", -1 },
+	{ "v6_other_64",        AF_INET6, "2001:db8:0:1::1", 0 },
+	{ "unix_first",         AF_UNIX,  "/tmp/peer", 0 },
+	{ "unix_second",        AF_UNIX,  "/tmp/peer", 0 },
+	{ "unix_third",         AF_UNIX,  "", 0 },
+	{ "unix_fourth",        AF_UNIX,  "", 0 },
+};
+
+int main(void)
+{
+	struct picohttpRateLimit * const rl =
+		picohttpRateLimitCreate(64, 0, 2);
+	if( !rl ) {
+		return 1;
+	}
+
+	int ret = 0;
+	for(size_t i = 0; i < sizeof(check_steps)/sizeof(*check_steps); i++) {
+		struct checkStep const * const s = check_steps + i;
+		struct sockaddr_storage ss;
+		socklen_t len;
+		memset(&ss, 0, sizeof(ss));
+		ss.ss_family = s->family;
+		if( AF_INET == s->family ) {
+			struct sockaddr_in * const in = (void*)&ss;
+			inet_pton(AF_INET, s->addr, &in->sin_addr);
+			len = sizeof(*in);
+		} else
+		if( AF_INET6 == s->family ) {
+			struct sockaddr_in6 * const in6 = (void*)&ss;
+			inet_pton(AF_INET6, s->addr, &in6->sin6_addr);
+			len = sizeof(*in6);
+		} else {
+			struct sockaddr_un * const un = (void*)&ss;
+			strncpy(un->sun_path, s->addr, sizeof(un->sun_path)-1);
+			len = offsetof(struct sockaddr_un, sun_path)
+				+ strlen(un->sun_path);
+		}
+
+		int const result = picohttpRateLimitCheck(rl,
+			(struct sockaddr const*)&ss, len);
+
+		char const * const check = (result == s->result) ? "ok" : "result";
+		printf("{\"step\":\"%s\",\"result\":%d,\"check\":\"%s\"}\n",
+			s->name, result, check);
+		if( strcmp(check, "ok") ) {
+			ret = 1;
+		}
+	}
+	picohttpRateLimitDestroy(rl);
+	return ret;
+}